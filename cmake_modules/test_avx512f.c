@@ -0,0 +1,8 @@
+
+#include <immintrin.h>
+
+int main(int argc, const char* argv[])
+{
+    __m512d arst = _mm512_setzero_pd();
+    return 0;
+}
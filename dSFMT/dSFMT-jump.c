@@ -0,0 +1,179 @@
+/**
+ * @file dSFMT-jump.c
+ *
+ * @brief jump ahead function for dSFMT
+ *
+ * The state is treated as a ring of DSFMT_N 128-bit elements and the
+ * lung. Each step replaces the oldest element by the recursion of it,
+ * the element DSFMT_POS1 later and the lung, which is what
+ * gen_rand_all() does for the whole array at once. The jumped state is
+ * the sum of the states after the steps whose coefficients are set.
+ *
+ * The recursion isn't quite linear: the constant exponent bits of the
+ * elements go into the lung. The minimal polynomial has the factor
+ * (x + 1) this adds, so every jump polynomial adds an odd number of
+ * states and the exponent bits come out right.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#include <string.h>
+#include "dSFMT-params.h"
+#include "dSFMT-jump.h"
+
+/**
+ * One step of the recursion on the ring, in standard C so it matches
+ * every build of dSFMT.c.
+ * @param ring internal state array with the lung at DSFMT_N
+ * @param head position of the oldest element
+ */
+inline static void next_state(w128_t ring[DSFMT_N + 1], int head) {
+    w128_t *a = &ring[head];
+    w128_t *b = &ring[(head + DSFMT_POS1) % DSFMT_N];
+    w128_t *lung = &ring[DSFMT_N];
+    uint64_t t0, t1, L0, L1;
+
+    t0 = a->u[0];
+    t1 = a->u[1];
+    L0 = lung->u[0];
+    L1 = lung->u[1];
+    lung->u[0] = (t0 << DSFMT_SL1) ^ (L1 >> 32) ^ (L1 << 32) ^ b->u[0];
+    lung->u[1] = (t1 << DSFMT_SL1) ^ (L0 >> 32) ^ (L0 << 32) ^ b->u[1];
+    a->u[0] = (lung->u[0] >> DSFMT_SR) ^ (lung->u[0] & DSFMT_MSK1) ^ t0;
+    a->u[1] = (lung->u[1] >> DSFMT_SR) ^ (lung->u[1] & DSFMT_MSK2) ^ t1;
+}
+
+/**
+ * Adds the ring starting at head to work, with the oldest element first.
+ */
+inline static void add(w128_t work[DSFMT_N + 1],
+		       const w128_t ring[DSFMT_N + 1], int head) {
+    int i;
+    int j;
+
+    for (i = 0, j = head; i < DSFMT_N; i++) {
+	work[i].u[0] ^= ring[j].u[0];
+	work[i].u[1] ^= ring[j].u[1];
+	if (++j == DSFMT_N) {
+	    j = 0;
+	}
+    }
+    work[DSFMT_N].u[0] ^= ring[DSFMT_N].u[0];
+    work[DSFMT_N].u[1] ^= ring[DSFMT_N].u[1];
+}
+
+void dSFMT_jump(dsfmt_t *dsfmt, const char *jump_string) {
+    w128_t work[DSFMT_N + 1];
+    int head = 0;
+    int bits;
+    int i;
+    int j;
+
+    /* The array holds the elements being read, so it is the ring at the
+       start of the block whatever idx is, and idx stays the same. */
+    memset(work, 0, sizeof(work));
+    for (i = 0; jump_string[i] != '\0'; i++) {
+	bits = jump_string[i];
+	if (bits >= 'a' && bits <= 'f') {
+	    bits = bits - 'a' + 10;
+	} else if (bits >= 'A' && bits <= 'F') {
+	    bits = bits - 'A' + 10;
+	} else {
+	    bits = bits - '0';
+	}
+	for (j = 0; j < 4; j++) {
+	    if (bits & 1) {
+		add(work, dsfmt->status, head);
+	    }
+	    next_state(dsfmt->status, head);
+	    if (++head == DSFMT_N) {
+		head = 0;
+	    }
+	    bits >>= 1;
+	}
+    }
+    memcpy(dsfmt->status, work, sizeof(work));
+}
+
+#if DSFMT_MEXP == 19937
+/* x^(2^64) mod the minimal polynomial, which has degree 19993 */
+const char dsfmt_jump_2_64[] =
+    "ea0d9d40b4853cc5fa61b988bb7261fe2b7ea752e3192d09baca91574f82c6a9"
+    "097acabc7e0aa6bf03e1b5378a463d861e2b6667556a8f851499208c5363de93"
+    "6106632580efd5fb710d01fe9094c1e79f59f73615859df276dae0ac63e4635d"
+    "edf5f62e847162f5be6b7e3cd99825ac063781402a74d28009d8a86c75c5f6e6"
+    "a9dea36ee14ede368fc865f3594f4aa4f59db6c8ff677b8e0c27435ba7404f81"
+    "93aa76e48b8d4f1ab5a088dd30506b26d5f4233b2a0f78ae93f5332ca55793a6"
+    "cec0c6d01f0657a692ffe417ca49dbdc83926a83eedc2c9270376d2d53828f45"
+    "4ca6a34ba6d5f84c7d7cb77e5a6e42204b13f609fec1ee55a0e9c5d34091713b"
+    "d671f701fb19903be0a7ef2d002474edd3a3ee5694950a97dd12ec0ed36391ef"
+    "8cef755da3ca332144c4cc5b58c1c988eb80e44deaea67ce7a3e7489f26ea27a"
+    "f271e7af1aaa811c26a761f0c9f94a564f4359d81b49b4139127e97f290a58bd"
+    "d33b95c28499b2d3b66b8a5e70ac6522b0fb59221b490d571789e3fb741cfb86"
+    "89e4b53aac3ac7a8cd2b235e2730af257fd6093047ef9b836a7da75634d88d60"
+    "bdab547ce20dd310380a3d89bd5001135fc58008e1b44bb058690ee242e6dc24"
+    "ede66a31751706c3136eed48388c750233c7ff694a5ac2be0f307c9dadbb7b76"
+    "d7c07841bcb9ce9d9443066e1ea5e18f097bd088cd537e35939c10b2a9aced5d"
+    "018fe1baeb02cff27f5d04450f15c02ab036ba8a42e2c86501e5db0a2808745e"
+    "9eecb0276634302d710a862f69553006c114f8ab09fc6fda62ead86620c1c7e3"
+    "1c053d617c5b28904428d8262e6ab659b79401149d3bd7cfe15b4c6f309ba5a0"
+    "b1bd1f41b26fd7c82f8713ff980e159d82dcd21758395f79db6fc9c7b9cf2fc7"
+    "7e0deb3997560e48ad5ddb36b1b4ff950bfb09ee72fa4cf688891618fd823878"
+    "9410ccfd412005b9e166ec4be660beeb072d6cd056d7cf6f3bf02d0c2c495fc1"
+    "0f35f6c55108e96967ecf6a5c06f2136e98eb7cce1ec9897cc8616d99e97f356"
+    "103841ad3cc469985a56f4554566f7fbce0ddcc3ad8098dc1d33ccc2c057a784"
+    "7b7bb34386feb07cbda5b6e825928f2e24391caeb3e346deb7395ab5755cea42"
+    "227c30382c7da9229989535c79875951f413b5dcdb258d6ff678ceb1f3abc97a"
+    "801ebeafd4ba75de5d093944620679addf082f49c77eb5b307d7b2f7a05830e4"
+    "7201c3f0125179891929ca935e3cac538976266271e042a1e20b4fab34c09001"
+    "9365fa964887bf62309c9f1f3a419ed15ea3cf9fb7e4fd8618a330396f5f4276"
+    "7445fb26099feb2941e31f6213161dcf69c63d807e2d57ab53710b8420e2c8c0"
+    "61c56dd91dd166d85aae4f1edf183260e303126cd6074617a04d5bc91138cbb5"
+    "f0bbbb15f0e08c857aaaae102b5d533757b3b0df488ebcc7d20eb3654890d0dd"
+    "6cd3cc2ac490dd32656e8a7cb7f2856f717da3d87a9b3f2aeb309ad715d8a22c"
+    "25437126d06bba9ac388683d75b1fb11fdf9971b3fb723e413327c84e7bb4ad3"
+    "8414a3009e6ac480d29bfed73775f2fcf02761be8941bb97398f38a0edc0d6aa"
+    "6422432b874cef97c960f32dedfc074a137b1b40e10f914158c8a2d68f1524fb"
+    "05148900620d8a8408589edbfe20c13b8bd23d6bb40d7e2cb45af167d959c836"
+    "95e9e36cd891cf0c4656b26315ec0b5d271890db21542809fecfc73b18db8fd4"
+    "1c1709b6ef765485c314cd49181ff3c70302f52914643d6881ca88ff15d777fd"
+    "9ac65f4322e02b53a0fe06f91a701065e170041d188d333542f1a7841468a781"
+    "b8491d1f1c49bbd97ee894d1c202d92620269560a77dcad95c614b23fd02bcee"
+    "273797c541aedb8644f1c77cd13d1324c09272b6c756a94cc75f94710ec466d3"
+    "fdef0eb84ce5b8ae9072cd76303f677dff0628619ef7ea0d67d4a709a1b1bcef"
+    "6b1b389222a824ce937d423b073735284561e6fde420bf0c81e5fea095e0df42"
+    "bb5213a008cdc3813b498de8039250ef37fccea6b89f4b8b5d0627ee211b9ef2"
+    "a7589f905b845e8b092408809b773cf99bc8475d1f9b4ef81a9d67c941d6d814"
+    "325f069d4fcebed843c99801ee795db846b2abb891d39326ccf50fbac58664f1"
+    "a72b77577239e4a5954a95cf3a905210d417f17fb98c71d8ad10a76b8920056e"
+    "c0612898a353bfdac4df2787cda540736ffc34ba0fc2d6d0c742e82c705074e6"
+    "07379d143a8c48f0bad9f3e804e9ffe3d6c35ac31cd004d7b63fed7b20011c5b"
+    "042c85f55445896fabedc38813734483bad7e915736f860ca7a7895c37d9c310"
+    "3a3f2d572712716917365c038a9bf5d9fa6e4ac6124159d062cdc9309cb54fa2"
+    "cc648eecdb24f14f05391ff97d27f13a2a63328037d100618829ba9b541903d9"
+    "14e2f430b74a8907903a8e11ca7d3786fd043fefb5e099346adc2ae9fa0fe69c"
+    "ad956e319f0cd11be7ba97ea06b6546d077cbf484396d33a7e5f99631d92f225"
+    "366b33ec581649b1056571446597b709d99d07c1f1c32885d7aeed7613dacb3c"
+    "072358dd1f5048eef29f46af4341a38aff637e61da4504f681eb6831fa468964"
+    "6a5399d9212949dbafb279896bb7d0f04fbb22a62850f8d0fb4cfbe1f2fda0a7"
+    "4eeca2729ae0508946a4d22a151ecef5d15579cbdce74dbd0ab6efd0873b159a"
+    "7536198a1a619eecc3090d64be98dd51dcb3cb6ac1b97fe326bdea21a2eab3de"
+    "00ca810b3fcf6225b1a84a3e99e1838f42a21b2ed27ac14191d1845fa327efd0"
+    "0bec9b94a2110fd4d1e73e4e4465e91ef572b7c4402db4cb9e217d9514abd0fb"
+    "c938176b9ddd59d1bbbf5586f0d8f7fc325be23c718838a3320aa88c09af50d8"
+    "14a8c14bad023ecd7d5c1e562b855f08bf332d46deac5939358336e8a2b1fd27"
+    "ede0bb0b0f28f150314cfa7a7fb2f0c780b96e0827160c9a2dee7b6b49d56e6f"
+    "a61e63dfd3fd58847f45ae609ac0ea106c02e653ccf59d6f75d8b9661d95fffe"
+    "f857ee0be98dd0fdebb77bd837a7d4c2fe0fdde9f47db17ba3b087f1d417ffd0"
+    "b22cd637590290481c3b6c8e4380cefa9a92c9d5b057f8217ad0a94e715519ce"
+    "f58c16590b2667b7d5420834051061ec17180743c8365d597b5603da8c2868f0"
+    "b2865582c4eefd2598082e26b519554fd51c8421598dd79d3fc709c86ad9a03b"
+    "11903749c242b572e19c802793ff382a47398619b46c9f927f4c1b18cc4298fb"
+    "ca081cbdccfe277b8c3ef48f13257aa35cdb93f727fecb3e7c3d6096bf4f129e"
+    "a32c94d66f0828d041046b6c4c7ab76a6378272d277de71b536e172e9b70b986"
+    "6ea1cf688a8840d7d777ff46e48b0b6ef3e652227c88b6972c28028a08419176"
+    "feebeb6bf7073a56a17a984bd7d453fa0823775b6be6483756740ef847318b53"
+    "eb10133f8a6d747f24f1f0a67d394b2ae02c0d69de855092fb7fc3fae917102c"
+    "4b48793d9759206fc5bc2cbf7fc7281585970a27e3e7011f1c2c3c6450822f63"
+    "b90040575f0c47672bf1c4ed0139958b42b24a3b0507def712e94f24dc3c5c67"
+    "fe9ad00";
+#endif
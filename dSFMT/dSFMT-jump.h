@@ -0,0 +1,41 @@
+/**
+ * @file dSFMT-jump.h
+ *
+ * @brief jump ahead function for dSFMT
+ *
+ * The jump polynomial is x^J mod the minimal polynomial of the
+ * generator's output. Applying it to the state gives the state J steps
+ * later, where each step generates one 128-bit element (two double
+ * precision numbers), without generating the numbers in between.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#ifndef DSFMT_JUMP_H
+#define DSFMT_JUMP_H
+
+#include "dSFMT.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * Jumps the state ahead by the polynomial in jump_string.
+ * @param dsfmt dSFMT internal state, which may be at any position
+ * @param jump_string hexadecimal coefficients of the jump polynomial,
+ * lowest degree first. The lowest bit of each character is the lowest
+ * of its four coefficients.
+ */
+void dSFMT_jump(dsfmt_t *dsfmt, const char *jump_string);
+
+#if DSFMT_MEXP == 19937
+/** jump polynomial for 2^64 steps (2^65 double precision numbers) */
+extern const char dsfmt_jump_2_64[];
+#define DSFMT_HAVE_JUMP_2_64 1
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* DSFMT_JUMP_H */
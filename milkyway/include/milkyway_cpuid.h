@@ -33,8 +33,14 @@ int mwHasSSE41(const int abcd[4]);
 int mwHasSSE3(const int abcd[4]);
 int mwHasSSE2(const int abcd[4]);
 int mwHasAVX(const int abcd[4]);
+int mwHasFMA(const int abcd[4]);
+
+/* Take the result of mw_cpuid() for leaf 7 */
+int mwHasAVX2(const int abcd[4]);
+int mwHasAVX512F(const int abcd[4]);
 
 int mwOSHasAVXSupport(void);
+int mwOSHasAVX512Support(void);
 
 #ifdef __cplusplus
 }
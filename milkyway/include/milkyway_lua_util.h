@@ -49,6 +49,9 @@ void mw_lua_openlibs(lua_State *L, mwbool debug);
 
 int dostringWithArgs(lua_State* luaSt, const char* str, const char** args, unsigned int nArgs);
 int dofileWithArgs(lua_State* luaSt, const char* filename, const char** args, unsigned int nArgs);
+char* compileString(lua_State* luaSt, const char* str, size_t* sizeOut);
+int dochunkWithArgs(lua_State* luaSt, const char* chunk, size_t size, const char* name,
+                    const char** args, unsigned int nArgs);
 
 int mwBindBOINCStatus(lua_State* luaSt);
 
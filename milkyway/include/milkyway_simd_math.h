@@ -0,0 +1,508 @@
+/*
+ *  Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Packed double math functions for kernels that are built once per
+ * instruction set. Everything is inline here, so the width is whatever
+ * the file including this is compiled for: 8 with AVX-512F, 4 with
+ * AVX2 and FMA, otherwise 2 with SSE2. mwvd is the vector type and
+ * MW_VEC_WIDTH its length.
+ *
+ * Errors are the largest seen against the C library (itself within
+ * 1 ulp) by simd_math_test over its sampled ranges, and are the
+ * same for every width:
+ *
+ *   mwv_sqrt     correctly rounded
+ *   mwv_rsqrt    1 ulp
+ *   mwv_exp      1 ulp. 0 below -708 (no denormals), infinity above 709.78
+ *   mwv_log      1 ulp. Denormals, 0, negatives, infinity and NaN handled
+ *   mwv_log10    2 ulp
+ *   mwv_pow      b > 0 only. 2 ulp while |y log(b)| < 1, growing to
+ *                2 |y log(b)| ulp beyond that
+ *   mwv_sincos   1 ulp. Arguments past 2^20 pi/2 go to the C library
+ *                one lane at a time
+ *
+ * Without FMA, the SSE2 width does separate multiplies and adds, so the
+ * results differ in the last bit from the wider ones.
+ */
+
+#ifndef _MILKYWAY_SIMD_MATH_H_
+#define _MILKYWAY_SIMD_MATH_H_
+
+#include "milkyway_extra.h"
+
+#include <math.h>
+
+#if defined(__AVX512F__)
+  #include <immintrin.h>
+
+  typedef __m512d mwvd;
+  typedef __mmask8 mwvmask;
+  #define MW_VEC_WIDTH 8
+
+  #define mwv_set1     _mm512_set1_pd
+  #define mwv_zero     _mm512_setzero_pd
+  #define mwv_loadu    _mm512_loadu_pd
+  #define mwv_load     _mm512_load_pd
+  #define mwv_storeu   _mm512_storeu_pd
+  #define mwv_store    _mm512_store_pd
+  #define mwv_add      _mm512_add_pd
+  #define mwv_sub      _mm512_sub_pd
+  #define mwv_mul      _mm512_mul_pd
+  #define mwv_div      _mm512_div_pd
+  #define mwv_sqrt     _mm512_sqrt_pd
+  #define mwv_fmadd    _mm512_fmadd_pd   /* a * b + c */
+  #define mwv_fmsub    _mm512_fmsub_pd   /* a * b - c */
+  #define mwv_fnmadd   _mm512_fnmadd_pd  /* c - a * b */
+  #define mwv_min      _mm512_min_pd
+  #define mwv_max      _mm512_max_pd
+  #define mwv_hsum     _mm512_reduce_add_pd
+  #define mwv_cmplt(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_LT_OQ)
+  #define mwv_cmpge(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_GE_OQ)
+  #define mwv_cmpgt(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_GT_OQ)
+  #define mwv_cmpeq(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_EQ_OQ)
+  #define mwv_select(m, a, b) _mm512_mask_blend_pd((m), (b), (a))  /* m ? a : b */
+  #define mwv_any(m)   ((m) != 0)
+  #define mwv_round(x) _mm512_roundscale_pd((x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+
+  static inline mwvd mwv_xor(mwvd a, mwvd b)
+  {
+      return _mm512_castsi512_pd(_mm512_xor_epi64(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+  }
+
+  static inline mwvd mwv_abs(mwvd x)
+  {
+      return _mm512_castsi512_pd(_mm512_and_epi64(_mm512_castpd_si512(x),
+                                                  _mm512_set1_epi64(0x7fffffffffffffffLL)));
+  }
+
+  /* The first n, with zeros after */
+  static inline mwvd mwv_load_n(const double* p, int n)
+  {
+      return _mm512_maskz_loadu_pd((__mmask8) ((1 << n) - 1), p);
+  }
+
+  /* x * 2^n for integral n */
+  static inline mwvd mwv_ldexp(mwvd x, mwvd n)
+  {
+      return _mm512_scalef_pd(x, n);
+  }
+
+  /* Mantissa in [1, 2) and the unbiased exponent of positive, normal x */
+  static inline mwvd mwv_frexp(mwvd x, mwvd* e)
+  {
+      *e = _mm512_getexp_pd(x);
+      return _mm512_getmant_pd(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+  }
+
+  /* From the quadrant n of an argument reduced by pi/2, whether sin and
+     cos swap and the sign bits to flip them by */
+  static inline void mwv_quadrant(mwvd n, mwvmask* swap, mwvd* sinSign, mwvd* cosSign)
+  {
+      const mwvd magic = _mm512_set1_pd(6755399441055744.0);
+      const __m512i one = _mm512_set1_epi64(1);
+      const __m512i two = _mm512_set1_epi64(2);
+      __m512i k = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(n, magic)), _mm512_castpd_si512(magic));
+
+      *swap = _mm512_test_epi64_mask(k, one);
+      *sinSign = _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_and_epi64(k, two), 62));
+      *cosSign = _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_and_epi64(_mm512_add_epi64(k, one), two), 62));
+  }
+
+#elif defined(__AVX2__) && defined(__FMA__)
+  #include <immintrin.h>
+
+  typedef __m256d mwvd;
+  typedef __m256d mwvmask;
+  #define MW_VEC_WIDTH 4
+
+  #define mwv_set1     _mm256_set1_pd
+  #define mwv_zero     _mm256_setzero_pd
+  #define mwv_loadu    _mm256_loadu_pd
+  #define mwv_load     _mm256_load_pd
+  #define mwv_storeu   _mm256_storeu_pd
+  #define mwv_store    _mm256_store_pd
+  #define mwv_add      _mm256_add_pd
+  #define mwv_sub      _mm256_sub_pd
+  #define mwv_mul      _mm256_mul_pd
+  #define mwv_div      _mm256_div_pd
+  #define mwv_sqrt     _mm256_sqrt_pd
+  #define mwv_fmadd    _mm256_fmadd_pd
+  #define mwv_fmsub    _mm256_fmsub_pd
+  #define mwv_fnmadd   _mm256_fnmadd_pd
+  #define mwv_min      _mm256_min_pd
+  #define mwv_max      _mm256_max_pd
+  #define mwv_cmplt(a, b) _mm256_cmp_pd((a), (b), _CMP_LT_OQ)
+  #define mwv_cmpge(a, b) _mm256_cmp_pd((a), (b), _CMP_GE_OQ)
+  #define mwv_cmpgt(a, b) _mm256_cmp_pd((a), (b), _CMP_GT_OQ)
+  #define mwv_cmpeq(a, b) _mm256_cmp_pd((a), (b), _CMP_EQ_OQ)
+  #define mwv_select(m, a, b) _mm256_blendv_pd((b), (a), (m))
+  #define mwv_any(m)   (_mm256_movemask_pd(m) != 0)
+  #define mwv_xor      _mm256_xor_pd
+  #define mwv_round(x) _mm256_round_pd((x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+
+  static inline mwvd mwv_abs(mwvd x)
+  {
+      return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+  }
+
+  static inline double mwv_hsum(mwvd x)
+  {
+      __m128d lo = _mm256_castpd256_pd128(x);
+      __m128d hi = _mm256_extractf128_pd(x, 1);
+
+      lo = _mm_add_pd(lo, hi);
+      return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+  }
+
+  static inline mwvd mwv_load_n(const double* p, int n)
+  {
+      const __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+      return _mm256_maskload_pd(p, _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lanes));
+  }
+
+  /* x * 2^n for integral n in the normal exponent range. Adding 1.5 *
+   * 2^52 leaves n as an integer in the low bits. */
+  static inline mwvd mwv_ldexp(mwvd x, mwvd n)
+  {
+      const mwvd magic = _mm256_set1_pd(6755399441055744.0);
+      __m256i k;
+
+      k = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+      k = _mm256_slli_epi64(_mm256_add_epi64(k, _mm256_set1_epi64x(1023)), 52);
+
+      return _mm256_mul_pd(x, _mm256_castsi256_pd(k));
+  }
+
+  static inline mwvd mwv_frexp(mwvd x, mwvd* e)
+  {
+      const __m256i bits = _mm256_castpd_si256(x);
+      const __m256i mantMask = _mm256_set1_epi64x(0x000fffffffffffffLL);
+      const __m256i one = _mm256_set1_epi64x(0x3ff0000000000000LL);
+      const __m256i two52 = _mm256_set1_epi64x(0x4330000000000000LL);
+
+      /* The biased exponent put in the mantissa of 2^52 */
+      *e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), two52)),
+                         _mm256_set1_pd(4503599627370496.0 + 1023.0));
+
+      return _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantMask), one));
+  }
+
+  static inline void mwv_quadrant(mwvd n, mwvmask* swap, mwvd* sinSign, mwvd* cosSign)
+  {
+      const mwvd magic = _mm256_set1_pd(6755399441055744.0);
+      const __m256i one = _mm256_set1_epi64x(1);
+      const __m256i two = _mm256_set1_epi64x(2);
+      __m256i k = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+
+      *swap = _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(k, one)));
+      *sinSign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(k, two), 62));
+      *cosSign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(k, one), two), 62));
+  }
+
+#elif defined(__SSE2__)
+  #if defined(__FMA__) || defined(__SSE4_1__)
+    #include <immintrin.h>
+  #else
+    #include <emmintrin.h>
+  #endif
+
+  typedef __m128d mwvd;
+  typedef __m128d mwvmask;
+  #define MW_VEC_WIDTH 2
+
+  #define mwv_set1     _mm_set1_pd
+  #define mwv_zero     _mm_setzero_pd
+  #define mwv_loadu    _mm_loadu_pd
+  #define mwv_load     _mm_load_pd
+  #define mwv_storeu   _mm_storeu_pd
+  #define mwv_store    _mm_store_pd
+  #define mwv_add      _mm_add_pd
+  #define mwv_sub      _mm_sub_pd
+  #define mwv_mul      _mm_mul_pd
+  #define mwv_div      _mm_div_pd
+  #define mwv_sqrt     _mm_sqrt_pd
+  #define mwv_min      _mm_min_pd
+  #define mwv_max      _mm_max_pd
+  #define mwv_cmplt    _mm_cmplt_pd
+  #define mwv_cmpge    _mm_cmpge_pd
+  #define mwv_cmpgt    _mm_cmpgt_pd
+  #define mwv_cmpeq    _mm_cmpeq_pd
+  #define mwv_any(m)   (_mm_movemask_pd(m) != 0)
+  #define mwv_xor      _mm_xor_pd
+
+  #if defined(__FMA__)
+    #define mwv_fmadd  _mm_fmadd_pd
+    #define mwv_fmsub  _mm_fmsub_pd
+    #define mwv_fnmadd _mm_fnmadd_pd
+  #else
+    #define mwv_fmadd(a, b, c)  _mm_add_pd(_mm_mul_pd((a), (b)), (c))
+    #define mwv_fmsub(a, b, c)  _mm_sub_pd(_mm_mul_pd((a), (b)), (c))
+    #define mwv_fnmadd(a, b, c) _mm_sub_pd((c), _mm_mul_pd((a), (b)))
+  #endif
+
+  static inline mwvd mwv_select(mwvmask m, mwvd a, mwvd b)
+  {
+      return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+  }
+
+  /* Rounds to even like the others for |x| < 2^51 */
+  static inline mwvd mwv_round(mwvd x)
+  {
+  #if defined(__SSE4_1__)
+      return _mm_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  #else
+      const mwvd magic = _mm_set1_pd(6755399441055744.0);
+      return _mm_sub_pd(_mm_add_pd(x, magic), magic);
+  #endif
+  }
+
+  static inline mwvd mwv_abs(mwvd x)
+  {
+      return _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+  }
+
+  static inline double mwv_hsum(mwvd x)
+  {
+      return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
+  }
+
+  static inline mwvd mwv_load_n(const double* p, int n)
+  {
+      return n >= 2 ? _mm_loadu_pd(p) : _mm_load_sd(p);
+  }
+
+  static inline mwvd mwv_ldexp(mwvd x, mwvd n)
+  {
+      const mwvd magic = _mm_set1_pd(6755399441055744.0);
+      __m128i k;
+
+      k = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(n, magic)), _mm_castpd_si128(magic));
+      k = _mm_slli_epi64(_mm_add_epi64(k, _mm_set1_epi64x(1023)), 52);
+
+      return _mm_mul_pd(x, _mm_castsi128_pd(k));
+  }
+
+  static inline mwvd mwv_frexp(mwvd x, mwvd* e)
+  {
+      const __m128i bits = _mm_castpd_si128(x);
+      const __m128i mantMask = _mm_set1_epi64x(0x000fffffffffffffLL);
+      const __m128i one = _mm_set1_epi64x(0x3ff0000000000000LL);
+      const __m128i two52 = _mm_set1_epi64x(0x4330000000000000LL);
+
+      *e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits, 52), two52)),
+                      _mm_set1_pd(4503599627370496.0 + 1023.0));
+
+      return _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, mantMask), one));
+  }
+
+  static inline void mwv_quadrant(mwvd n, mwvmask* swap, mwvd* sinSign, mwvd* cosSign)
+  {
+      const mwvd magic = _mm_set1_pd(6755399441055744.0);
+      const __m128i one = _mm_set1_epi64x(1);
+      const __m128i two = _mm_set1_epi64x(2);
+      __m128i k = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(n, magic)), _mm_castpd_si128(magic));
+
+      *swap = _mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(k, one)));
+      *sinSign = _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(k, two), 62));
+      *cosSign = _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(_mm_add_epi64(k, one), two), 62));
+  }
+
+#else
+  #error "milkyway_simd_math.h needs at least SSE2"
+#endif
+
+
+static inline mwvd mwv_rsqrt(mwvd x)
+{
+    return mwv_div(mwv_set1(1.0), mwv_sqrt(x));
+}
+
+/* Cody-Waite reduction by ln(2) and a degree 13 Taylor series, which
+ * is good to 1 ulp on [-ln(2)/2, ln(2)/2]. */
+ALWAYS_INLINE
+static inline mwvd mwv_exp(mwvd x)
+{
+    mwvd n, r, p, y;
+    mwvmask tiny, huge;
+
+    tiny = mwv_cmplt(x, mwv_set1(-708.0));
+    huge = mwv_cmpgt(x, mwv_set1(709.782712893384));
+
+    /* In this order NaN comes through */
+    y = mwv_min(mwv_set1(709.78), mwv_max(mwv_set1(-708.0), x));
+
+    n = mwv_round(mwv_mul(y, mwv_set1(1.4426950408889634074)));
+    r = mwv_fnmadd(n, mwv_set1(6.93145751953125e-1), y);
+    r = mwv_fnmadd(n, mwv_set1(1.42860682030941723212e-6), r);
+
+    p = mwv_set1(1.0 / 6227020800.0);
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 479001600.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 39916800.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 3628800.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 362880.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 40320.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 5040.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 720.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 120.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 24.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0 / 6.0));
+    p = mwv_fmadd(p, r, mwv_set1(0.5));
+    p = mwv_fmadd(p, r, mwv_set1(1.0));
+    p = mwv_fmadd(p, r, mwv_set1(1.0));
+
+    /* n goes up to 1024, one past what fits in the exponent */
+    p = mwv_mul(mwv_ldexp(p, mwv_sub(n, mwv_set1(1.0))), mwv_set1(2.0));
+
+    p = mwv_select(huge, mwv_set1(INFINITY), p);
+    return mwv_select(tiny, mwv_zero(), p);
+}
+
+/* The fdlibm log. With the mantissa m in [sqrt(1/2), sqrt(2)) and
+ * f = m - 1, log(m) = f - f^2 / 2 + s (f^2 / 2 + R(s^2)) for
+ * s = f / (2 + f) */
+ALWAYS_INLINE
+static inline mwvd mwv_log(mwvd x)
+{
+    mwvd e, m, f, s, z, hfsq, r, p, xs;
+    mwvmask big, denorm;
+
+    /* Bring denormals up by 2^54 first */
+    denorm = mwv_cmplt(x, mwv_set1(2.2250738585072014e-308));
+    xs = mwv_select(denorm, mwv_mul(x, mwv_set1(18014398509481984.0)), x);
+
+    m = mwv_frexp(xs, &e);
+    e = mwv_select(denorm, mwv_sub(e, mwv_set1(54.0)), e);
+
+    big = mwv_cmpgt(m, mwv_set1(1.41421356237309504880));
+    m = mwv_select(big, mwv_mul(m, mwv_set1(0.5)), m);
+    e = mwv_select(big, mwv_add(e, mwv_set1(1.0)), e);
+
+    f = mwv_sub(m, mwv_set1(1.0));
+    hfsq = mwv_mul(mwv_mul(mwv_set1(0.5), f), f);
+    s = mwv_div(f, mwv_add(mwv_set1(2.0), f));
+    z = mwv_mul(s, s);
+
+    r = mwv_set1(1.479819860511658591e-01);
+    r = mwv_fmadd(r, z, mwv_set1(1.531383769920937332e-01));
+    r = mwv_fmadd(r, z, mwv_set1(1.818357216161805012e-01));
+    r = mwv_fmadd(r, z, mwv_set1(2.222219843214978396e-01));
+    r = mwv_fmadd(r, z, mwv_set1(2.857142874366239149e-01));
+    r = mwv_fmadd(r, z, mwv_set1(3.999999999940941908e-01));
+    r = mwv_fmadd(r, z, mwv_set1(6.666666666666735130e-01));
+    r = mwv_mul(r, z);
+
+    /* e * ln(2) split in two, the high part exact */
+    p = mwv_fmadd(s, mwv_add(hfsq, r), mwv_mul(e, mwv_set1(1.90821492927058770002e-10)));
+    p = mwv_sub(mwv_sub(hfsq, p), f);
+    p = mwv_fmsub(e, mwv_set1(6.93147180369123816490e-01), p);
+
+    /* Infinity and NaN give themselves, which is what x + x is */
+    p = mwv_select(mwv_cmpge(x, mwv_set1(INFINITY)), x, p);
+    p = mwv_select(mwv_cmpeq(x, x), p, mwv_add(x, x));
+    p = mwv_select(mwv_cmplt(x, mwv_zero()), mwv_set1(NAN), p);
+    return mwv_select(mwv_cmpeq(x, mwv_zero()), mwv_set1(-INFINITY), p);
+}
+
+static inline mwvd mwv_log10(mwvd x)
+{
+    return mwv_mul(mwv_log(x), mwv_set1(0.43429448190325182765));
+}
+
+/* b^y for positive b */
+static inline mwvd mwv_pow(mwvd b, mwvd y)
+{
+    return mwv_exp(mwv_mul(y, mwv_log(b)));
+}
+
+/* Reduced by pi/2 as in fdlibm, to r + rr with the first two parts
+ * having few enough bits that n times them is exact for n < 2^20. The
+ * polynomials are the fdlibm ones for [-pi/4, pi/4], which take the
+ * tail rr. */
+ALWAYS_INLINE
+static inline void mwv_sincos(mwvd x, mwvd* sinOut, mwvd* cosOut)
+{
+    mwvd n, t, w, r, rr, z, v, s, c, hz, sinSign, cosSign;
+    mwvmask swap;
+
+    n = mwv_round(mwv_mul(x, mwv_set1(6.36619772367581382433e-01)));
+    t = mwv_fnmadd(n, mwv_set1(1.57079632673412561417e+00), x);
+    w = mwv_mul(n, mwv_set1(6.07710050630396597660e-11));
+    r = mwv_sub(t, w);
+    w = mwv_fmsub(n, mwv_set1(2.02226624879595063154e-21), mwv_sub(mwv_sub(t, r), w));
+    t = r;
+    r = mwv_sub(t, w);
+    rr = mwv_sub(mwv_sub(t, r), w);
+
+    z = mwv_mul(r, r);
+    v = mwv_mul(z, r);
+
+    /* r - ((z (rr / 2 - v S) - rr) - v S1) */
+    s = mwv_set1(1.58969099521155010221e-10);
+    s = mwv_fmadd(s, z, mwv_set1(-2.50507602534068634195e-08));
+    s = mwv_fmadd(s, z, mwv_set1(2.75573137070700676789e-06));
+    s = mwv_fmadd(s, z, mwv_set1(-1.98412698298579493134e-04));
+    s = mwv_fmadd(s, z, mwv_set1(8.33333333332248946124e-03));
+    s = mwv_fnmadd(v, s, mwv_mul(mwv_set1(0.5), rr));
+    s = mwv_fmsub(z, s, rr);
+    s = mwv_fnmadd(v, mwv_set1(-1.66666666666666324348e-01), s);
+    s = mwv_sub(r, s);
+
+    /* w + (((1 - w) - z / 2) + (z C - r rr)) for w = 1 - z / 2 */
+    c = mwv_set1(-1.13596475577881948265e-11);
+    c = mwv_fmadd(c, z, mwv_set1(2.08757232129817482790e-09));
+    c = mwv_fmadd(c, z, mwv_set1(-2.75573143513906633035e-07));
+    c = mwv_fmadd(c, z, mwv_set1(2.48015872894767294178e-05));
+    c = mwv_fmadd(c, z, mwv_set1(-1.38888888888741095749e-03));
+    c = mwv_fmadd(c, z, mwv_set1(4.16666666666666019037e-02));
+    c = mwv_mul(mwv_mul(c, z), z);
+    hz = mwv_mul(mwv_set1(0.5), z);
+    w = mwv_sub(mwv_set1(1.0), hz);
+    c = mwv_add(w, mwv_add(mwv_sub(mwv_sub(mwv_set1(1.0), w), hz), mwv_fnmadd(r, rr, c)));
+
+    mwv_quadrant(n, &swap, &sinSign, &cosSign);
+
+    *sinOut = mwv_xor(mwv_select(swap, c, s), sinSign);
+    *cosOut = mwv_xor(mwv_select(swap, s, c), cosSign);
+
+    if (mwv_any(mwv_cmpge(mwv_abs(x), mwv_set1(1647099.0))))
+    {
+        MW_ALIGN_V(64) double xs[MW_VEC_WIDTH];
+        MW_ALIGN_V(64) double ss[MW_VEC_WIDTH];
+        MW_ALIGN_V(64) double cs[MW_VEC_WIDTH];
+        int i;
+
+        mwv_store(xs, x);
+        mwv_store(ss, *sinOut);
+        mwv_store(cs, *cosOut);
+        for (i = 0; i < MW_VEC_WIDTH; ++i)
+        {
+            if (fabs(xs[i]) >= 1647099.0)
+            {
+                ss[i] = sin(xs[i]);
+                cs[i] = cos(xs[i]);
+            }
+        }
+
+        *sinOut = mwv_load(ss);
+        *cosOut = mwv_load(cs);
+    }
+}
+
+#endif /* _MILKYWAY_SIMD_MATH_H_ */
+
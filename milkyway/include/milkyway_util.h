@@ -84,8 +84,12 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512F;
     int verbose;
     int enableProfiling;
+
+    double adaptiveTolerance; /* Relative error for adaptive CPU integration. 0 for the full grid */
 } CLRequest;
 
 #if MW_ENABLE_DEBUG
@@ -34,6 +34,10 @@
 #define bit_SSE3 (1 << 0)
 #define bit_SSE41 (1 << 19)
 #define bit_AVX (1 << 28)
+#define bit_OSXSAVE (1 << 27)
+#define bit_FMA (1 << 12)
+#define bit_AVX2 (1 << 5) /* In ebx of leaf 7 */
+#define bit_AVX512F (1 << 16) /* In ebx of leaf 7 */
 #define bit_CMPXCHG16B (1 << 13)
 #define bit_3DNOW (1 << 31)
 #define bit_3DNOWP (1 << 30)
@@ -72,9 +76,9 @@ void mw_cpuid(int abcd[4], int a, int c)
 {
     abcd[0] = abcd[1] = abcd[2] = abcd[3] = 0;
     __cpuid(abcd, 0);
-    if (abcd[0] >= 1) /* Is this really necessary? */
+    if (abcd[0] >= a) /* Is this really necessary? */
     {
-        __cpuid(abcd, a);
+        __cpuidex(abcd, a, c);
     }
     else
     {
@@ -99,6 +103,22 @@ int mwHasAVX(const int abcd[4])
     return !!(abcd[2] & bit_AVX);
 }
 
+int mwHasFMA(const int abcd[4])
+{
+    return !!(abcd[2] & bit_FMA);
+}
+
+/* Unlike the others, these take the result of leaf 7 */
+int mwHasAVX2(const int abcd[4])
+{
+    return !!(abcd[1] & bit_AVX2);
+}
+
+int mwHasAVX512F(const int abcd[4])
+{
+    return !!(abcd[1] & bit_AVX512F);
+}
+
 int mwHasSSE41(const int abcd[4])
 {
     return !!(abcd[2] & bit_SSE41);
@@ -222,4 +242,47 @@ int mwOSHasAVXSupport()
 #endif /* _WIN32 */
 
 
+#if MW_IS_X86
+
+static unsigned long long mw_xgetbv(unsigned int index)
+{
+  #ifdef _MSC_VER
+    return _xgetbv(index);
+  #else
+    unsigned int eax, edx;
+
+    __asm__ volatile(
+        "xgetbv          \n\t" /* input ecx. output edx:eax */
+        : "=a" (eax), "=d" (edx)
+        : "c" (index)
+        );
+
+    return ((unsigned long long) edx << 32) | eax;
+  #endif
+}
+
+/* The OS needs to save the opmask and upper ZMM state as well as the
+ * usual SSE and AVX state */
+int mwOSHasAVX512Support(void)
+{
+    int abcd[4];
+    const unsigned long long xcrMask = 0xe6;  /* SSE, AVX, opmask, ZMM_Hi256 and Hi16_ZMM */
+
+    mw_cpuid(abcd, 1, 0);
+    if (!(abcd[2] & bit_OSXSAVE))
+    {
+        return FALSE;
+    }
+
+    return (mw_xgetbv(0) & xcrMask) == xcrMask;
+}
+
+#else
+
+int mwOSHasAVX512Support(void)
+{
+    return FALSE;
+}
+
+#endif /* MW_IS_X86 */
 
@@ -236,6 +236,59 @@ int dofileWithArgs(lua_State* luaSt,
     return luaL_loadfile(luaSt, filename) || doWithArgs(luaSt, args, nArgs);
 }
 
+typedef struct
+{
+    char* buf;
+    size_t size;
+    size_t capacity;
+} LuaChunkBuffer;
+
+static int writeChunkBuffer(lua_State* luaSt, const void* p, size_t sz, void* ud)
+{
+    LuaChunkBuffer* cb = (LuaChunkBuffer*) ud;
+    (void) luaSt;
+
+    if (cb->size + sz > cb->capacity)
+    {
+        cb->capacity = 2 * (cb->size + sz);
+        cb->buf = (char*) mwRealloc(cb->buf, cb->capacity);
+    }
+
+    memcpy(cb->buf + cb->size, p, sz);
+    cb->size += sz;
+
+    return 0;
+}
+
+/* Compile str to a precompiled chunk which can be loaded into other
+ * states with dochunkWithArgs() without parsing the source again.
+ * Returns NULL on error, with the error on the stack. */
+char* compileString(lua_State* luaSt, const char* str, size_t* sizeOut)
+{
+    LuaChunkBuffer cb = { NULL, 0, 0 };
+
+    if (luaL_loadstring(luaSt, str))
+    {
+        return NULL;
+    }
+
+    lua_dump(luaSt, writeChunkBuffer, &cb);
+    lua_pop(luaSt, 1);
+
+    *sizeOut = cb.size;
+    return cb.buf;
+}
+
+int dochunkWithArgs(lua_State* luaSt,
+                    const char* chunk,
+                    size_t size,
+                    const char* name,
+                    const char** args,
+                    unsigned int nArgs)
+{
+    return luaL_loadbuffer(luaSt, chunk, size, name) || doWithArgs(luaSt, args, nArgs);
+}
+
 int mwBindBOINCStatus(lua_State* luaSt)
 {
     lua_pushboolean(luaSt, BOINC_APPLICATION);
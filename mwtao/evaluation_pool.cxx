@@ -0,0 +1,205 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "evaluation_pool.hxx"
+
+using namespace std;
+
+static bool read_all(int fd, void *buffer, size_t size)
+{
+    char *p = (char*)buffer;
+
+    while (size > 0)
+    {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool write_all(int fd, const void *buffer, size_t size)
+{
+    const char *p = (const char*)buffer;
+
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+// Requests are a parameter count followed by the parameters. A count of
+// 0 tells the worker to exit.
+void EvaluationPool::worker_loop(int from_parent, int to_parent, double (*objective_function)(const vector<double> &))
+{
+    uint32_t n;
+    vector<double> parameters;
+
+    while (read_all(from_parent, &n, sizeof(n)) && n > 0)
+    {
+        parameters.resize(n);
+        if (!read_all(from_parent, &parameters[0], n * sizeof(double))) break;
+
+        double fitness = objective_function(parameters);
+        if (!write_all(to_parent, &fitness, sizeof(fitness))) break;
+    }
+
+    _exit(0);
+}
+
+EvaluationPool::EvaluationPool(uint32_t number_workers, double (*objective_function)(const vector<double> &)) : number_busy(0)
+{
+    for (uint32_t i = 0; i < number_workers; i++)
+    {
+        int request[2], result[2];
+
+        if (pipe(request) || pipe(result))
+        {
+            cerr << "Failed to create pipes for worker: " << strerror(errno) << endl;
+            exit(1);
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(request[1]);
+            close(result[0]);
+
+            // Don't hold on to the other workers' pipes
+            for (uint32_t j = 0; j < workers.size(); j++)
+            {
+                close(workers[j].to_worker);
+                close(workers[j].from_worker);
+            }
+
+            worker_loop(request[0], result[1], objective_function);
+        }
+        else if (pid < 0)
+        {
+            cerr << "Failed to fork" << endl;
+            exit(1);
+        }
+
+        close(request[0]);
+        close(result[1]);
+
+        Worker w;
+        w.pid = pid;
+        w.to_worker = request[1];
+        w.from_worker = result[0];
+        w.busy = false;
+        w.id = 0;
+        workers.push_back(w);
+    }
+}
+
+EvaluationPool::~EvaluationPool()
+{
+    uint32_t stop = 0;
+
+    for (uint32_t i = 0; i < workers.size(); i++)
+    {
+        write_all(workers[i].to_worker, &stop, sizeof(stop));
+        close(workers[i].to_worker);
+        close(workers[i].from_worker);
+    }
+
+    for (uint32_t i = 0; i < workers.size(); i++)
+    {
+        int status;
+        waitpid(workers[i].pid, &status, 0);
+    }
+}
+
+void EvaluationPool::submit(uint32_t id, const vector<double> &parameters)
+{
+    uint32_t n = parameters.size();
+
+    for (uint32_t i = 0; i < workers.size(); i++)
+    {
+        Worker &w = workers[i];
+        if (w.busy) continue;
+
+        if (!write_all(w.to_worker, &n, sizeof(n)) || !write_all(w.to_worker, &parameters[0], n * sizeof(double)))
+        {
+            cerr << "Failed to send parameters to worker " << i << endl;
+            exit(1);
+        }
+
+        w.busy = true;
+        w.id = id;
+        w.parameters = parameters;
+        number_busy++;
+        return;
+    }
+
+    cerr << "No idle worker to submit to" << endl;
+    exit(1);
+}
+
+void EvaluationPool::wait(uint32_t &id, vector<double> &parameters, double &fitness)
+{
+    vector<struct pollfd> fds;
+    vector<uint32_t> index;
+
+    for (uint32_t i = 0; i < workers.size(); i++)
+    {
+        if (!workers[i].busy) continue;
+
+        struct pollfd p;
+        p.fd = workers[i].from_worker;
+        p.events = POLLIN;
+        p.revents = 0;
+        fds.push_back(p);
+        index.push_back(i);
+    }
+
+    if (fds.empty())
+    {
+        cerr << "Waiting on an idle pool" << endl;
+        exit(1);
+    }
+
+    while (poll(&fds[0], fds.size(), -1) < 0)
+    {
+        if (errno != EINTR)
+        {
+            cerr << "poll() failed: " << strerror(errno) << endl;
+            exit(1);
+        }
+    }
+
+    for (uint32_t i = 0; i < fds.size(); i++)
+    {
+        if (fds[i].revents == 0) continue;
+
+        Worker &w = workers[index[i]];
+        if (!read_all(w.from_worker, &fitness, sizeof(fitness)))
+        {
+            cerr << "Worker " << index[i] << " exited unexpectedly" << endl;
+            exit(1);
+        }
+
+        w.busy = false;
+        number_busy--;
+        id = w.id;
+        parameters = w.parameters;
+        return;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef MWTAO_EVALUATION_POOL_H
+#define MWTAO_EVALUATION_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+/*
+ * A set of forked worker processes that each evaluate the objective
+ * function. Parameters and fitnesses are passed over pipes, so there are
+ * no files shared between evaluations. The workers are forked after the
+ * evaluator has been set up, so they share its stars and parameters.
+ */
+class EvaluationPool
+{
+    private:
+        struct Worker
+        {
+            pid_t pid;
+            int to_worker;
+            int from_worker;
+            bool busy;
+            uint32_t id;
+            std::vector<double> parameters;
+        };
+
+        std::vector<Worker> workers;
+        uint32_t number_busy;
+
+        static void worker_loop(int from_parent, int to_parent, double (*objective_function)(const std::vector<double> &));
+
+    public:
+        EvaluationPool(uint32_t number_workers, double (*objective_function)(const std::vector<double> &));
+        ~EvaluationPool();
+
+        uint32_t size() const { return workers.size(); }
+        bool has_idle_worker() const { return number_busy < workers.size(); }
+        uint32_t pending() const { return number_busy; }
+
+        /* Start evaluating parameters on an idle worker */
+        void submit(uint32_t id, const std::vector<double> &parameters);
+
+        /* Wait for the next evaluation to finish */
+        void wait(uint32_t &id, std::vector<double> &parameters, double &fitness);
+};
+
+/*
+ * Drive an asynchronous search (particle swarm, differential evolution)
+ * with the pool, handing out a new individual as soon as each result
+ * comes back.
+ */
+template <class Search>
+void iterate_with_pool(Search &search, EvaluationPool &pool, uint32_t number_parameters, uint32_t maximum_evaluations)
+{
+    uint32_t id;
+    uint32_t created = 0, reported = 0;
+    double fitness;
+    std::vector<double> parameters(number_parameters, 0.0);
+
+    while (reported < maximum_evaluations)
+    {
+        while (pool.has_idle_worker() && created < maximum_evaluations)
+        {
+            search.new_individual(id, parameters);
+            pool.submit(id, parameters);
+            created++;
+        }
+
+        pool.wait(id, parameters, fitness);
+        search.insert_individual(id, parameters, fitness);
+        reported++;
+    }
+}
+
+#endif
@@ -1,17 +1,23 @@
 #include <cfloat>
+#include <algorithm>
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
 
-#include <unistd.h>
-#include <sys/wait.h> 
-
 extern "C" {
 #include "lauxlib.h"
 }
 
+#include "separation_api.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "evaluation_pool.hxx"
+
 #include "tao/asynchronous_algorithms/particle_swarm.hxx"
 #include "tao/asynchronous_algorithms/differential_evolution.hxx"
 
@@ -26,8 +32,9 @@ extern "C" {
 using namespace std;
 
 //Run Independent Constants
-char* PATH_TO_SEPARATION;
-char* PATH_TO_STARS;  //Needs -s in front of path name without any spaces
+SeparationEvaluator* evaluator;
+vector<real> separation_parameters;
+double background_epsilon = 1.0;
 int number_streams;
 int number_cuts;
 int wedge;
@@ -210,7 +217,10 @@ int lua_get_stream(lua_State* L, vector<double> & v)
     return 1;
 }
 
-double objective_function(const vector<double> &A) 
+// Written once to set up the evaluator. Only the wedge, area and the
+// number of streams matter; the fit parameters are replaced for each
+// evaluation.
+void write_parameter_file(const vector<double> &A)
 {
     ofstream input ( "input.lua" );
 
@@ -218,7 +228,7 @@ double objective_function(const vector<double> &A)
 
     input << setprecision(16);
 
-    input << "\n\nbackground = {\n\tq = " << A[0] << ",\n\tr0 = " << A[1] << "\n}\n\nstreams = {\n";
+    input << "\n\nbackground = {\n\tq = " << A[0] << ",\n\tr0 = " << A[1] << ",\n\tepsilon = " << background_epsilon << "\n}\n\nstreams = {\n";
 
     for(int s=0; s<number_streams; s++)
         input << "\t{\n\t\tepsilon = " << A[2+s*6] << ",\n\t\tmu = " << A[3+s*6] << ",\n\t\tr = " << A[4+s*6] 
@@ -233,40 +243,25 @@ double objective_function(const vector<double> &A)
                << ",\n\t\tnu_steps = " << area[8+c*9] << "\n\t},\n";
 
     input << "}" << endl;
+}
 
-    pid_t pID = fork();
-    if (pID == 0)
-    {
-        // Code only executed by child process
-        execl ( PATH_TO_SEPARATION, "milkyway_separation", "-c", "-i", "-t","-ainput.lua", PATH_TO_STARS, "-f", NULL);
-        _exit(0);
-    }
-    else if (pID < 0)
-    {
-        cerr << "Failed to fork" << endl;
-        exit(1);
-    }
+double objective_function(const vector<double> &A) 
+{
+    real likelihood;
 
-    int childExitStatus;
-    waitpid( pID, &childExitStatus, 0);
+    // The search has q and r0 for the background, where separation has
+    // epsilon and q. r0 is fixed in separation, and the background
+    // epsilon stays as it was in the parameter file.
+    separation_parameters[1] = A[0];
+    for (size_t i = 2; i < A.size(); i++)
+        separation_parameters[i] = A[i];
 
-    if( !WIFEXITED(childExitStatus) )
+    if (separationEvaluate(evaluator, &separation_parameters[0], separation_parameters.size(), &likelihood))
     {
-        cerr << "waitpid() exited with an error: Status= " << WEXITSTATUS(childExitStatus) << endl;
-        return 0;
-    }
-    else if( WIFSIGNALED(childExitStatus) )
-    {
-        cerr << "waitpid() exited due to a signal: " << WTERMSIG(childExitStatus) << endl;
-        return 0;
+        cerr << "Failed to evaluate likelihood" << endl;
+        return -999.0;
     }
 
-    ifstream results ( "results.txt" );
-
-    double likelihood;
-
-    results >> likelihood;
-
     return likelihood;
 }
 
@@ -276,9 +271,6 @@ int main(int number_arguments, char **argv)
     vector<string> arguments(argv, argv + number_arguments);
 
     string stemp;
-    get_argument(arguments, "--separation", true, stemp);
-    PATH_TO_SEPARATION = (char*)stemp.c_str();
-
     get_argument(arguments, "--params", true, stemp);
     char *search_params = (char*)stemp.c_str();
 
@@ -311,21 +303,60 @@ int main(int number_arguments, char **argv)
     lua_get_stream(L, max_bound);
     lua_pop(L, 1);
 
-    // Not sure why this has to be down here, but opening the Lua file somehow makes the variable unreadable if it is done first
-    get_argument(arguments, "--stars", true, stemp);
-    stemp = "-s" + stemp;
-    PATH_TO_STARS = (char*)stemp.c_str();
+    get_argument(arguments, "--background_epsilon", false, background_epsilon);
+
+    string stars;
+    get_argument(arguments, "--stars", true, stars);
+
+    write_parameter_file(min_bound);
+    evaluator = separationEvaluatorCreate("input.lua", stars.c_str(), TRUE, FALSE);
+    if (!evaluator)
+    {
+        cerr << "Failed to set up separation" << endl;
+        return 1;
+    }
+
+    separation_parameters.resize(separationEvaluatorNumberParameters(evaluator));
+    separationEvaluatorGetParameters(evaluator, &separation_parameters[0], separation_parameters.size());
 
     string search_type;
     get_argument(arguments, "--search_type", true, search_type);
 
+    // With more than one worker, particle swarm and differential evolution
+    // evaluate individuals in separate processes as fast as they come back.
+    // The synchronous methods evaluate one point at a time, with the
+    // separation integrals already spread over every core.
+    uint32_t number_workers = 1;
+    get_argument(arguments, "--workers", false, number_workers);
+
+    uint32_t maximum_evaluations = 0;
+    if (number_workers > 1 && (search_type.compare("ps") == 0 || search_type.compare("de") == 0))
+    {
+        get_argument(arguments, "--max_evaluations", true, maximum_evaluations);
+
+#ifdef _OPENMP
+        // Share the cores between the workers
+        omp_set_num_threads(max(1, omp_get_num_procs() / (int)number_workers));
+#endif
+    }
+
     if (search_type.compare("ps") == 0) {
         ParticleSwarm ps(min_bound, max_bound, arguments);
-        ps.iterate(objective_function);
+        if (number_workers > 1) {
+            EvaluationPool pool(number_workers, objective_function);
+            iterate_with_pool(ps, pool, min_bound.size(), maximum_evaluations);
+        } else {
+            ps.iterate(objective_function);
+        }
 
     } else if (search_type.compare("de") == 0) {
         DifferentialEvolution de(min_bound, max_bound, arguments);
-        de.iterate(objective_function);
+        if (number_workers > 1) {
+            EvaluationPool pool(number_workers, objective_function);
+            iterate_with_pool(de, pool, min_bound.size(), maximum_evaluations);
+        } else {
+            de.iterate(objective_function);
+        }
 
     } else if (search_type.compare("sweep") == 0) {
         vector<double> step_size;
@@ -381,9 +412,8 @@ int main(int number_arguments, char **argv)
 
     //lua_close(L);
 
-    remove ( "results.txt" );
+    separationEvaluatorDestroy(evaluator);
     remove ( "input.lua" );
-    remove ( "separation_checkpoint");
 
     return 0;
 }
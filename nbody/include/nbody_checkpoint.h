@@ -35,6 +35,18 @@ int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, cons
 NBodyStatus nbWriteFinalCheckpoint(const NBodyCtx* ctx, NBodyState* st);
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st);
 
+/* Copy the state and write it from a background thread. Check on it with
+   nbPollCheckpointWriter(), which returns nonzero if a write failed. Don't
+   ask nbTimeToCheckpoint() again while nbCheckpointWriterBusy(). */
+int nbWriteCheckpointAsync(const NBodyCtx* ctx, NBodyState* st);
+int nbCheckpointWriterBusy(NBodyState* st);
+int nbPollCheckpointWriter(NBodyState* st);
+int nbFinishCheckpointWriter(NBodyState* st);
+void nbDestroyCheckpointWriter(NBodyState* st);
+
+/* For testing */
+void nbSetCheckpointWriteDelay(unsigned int milliseconds);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,8 @@ extern "C" {
 #define DEFAULT_USE_QUADRUPOLE_MOMENTS TRUE
 #define DEFAULT_ALLOW_INCEST FALSE
 #define DEFAULT_QUIET_ERRORS FALSE
+#define DEFAULT_USE_GROUP_WALK FALSE
+#define DEFAULT_POTENTIAL_TABLE_ERROR 0.0
 
 #define DEFAULT_USE_BEST_LIKELIHOOD FALSE
 #define DEFAULT_USE_VEL_DISP FALSE
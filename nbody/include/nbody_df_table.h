@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_DF_TABLE_H_
+#define _NBODY_DF_TABLE_H_
+
+#include "nbody_types.h"
+#include "nbody_potential_types.h"
+#include "dSFMT.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tabulated isotropic distribution function of a two component dwarf,
+ * and the enclosed mass of each component, for sampling bodies. The
+ * nodes go outwards in radius, so psi and E go down. */
+typedef struct
+{
+    Dwarf comps[2];
+    real bounds[2];    /* Bodies of each component are sampled inside this */
+    real truncation;   /* f(E) is only integrated out to this times the radius where psi = E, or all the way if 0 */
+
+    unsigned int n;
+    real* r;
+    real* psi;         /* Relative potential of both components */
+    real* f;           /* Eddington distribution function at E = psi */
+    real* mass[2];     /* Mass of each component inside r */
+    unsigned int boundNode[2];
+
+    /* Cumulative distribution of v / v_esc on a grid in log r, from
+       r[0] out to the larger bound, each normalized to 1 */
+    real speedLogR0, speedDLogR;
+    real* speedCdf;    /* NBODY_DF_SPEED_RADII rows of NBODY_DF_SPEED_BINS + 1 */
+} NBodyDFTable;
+
+/* Velocity bins the speed is drawn from at each radius */
+#define NBODY_DF_SPEED_BINS 256
+
+/* Radii the speed distribution is tabulated at */
+#define NBODY_DF_SPEED_RADII 256
+
+/* Speeds are drawn below this fraction of the escape speed, as the
+   rejection sampling does */
+#define NBODY_DF_MAX_SPEED 0.99
+
+/* The rejection sampling of each generator only does the Eddington
+   integral for f(E) out to this many times the radius where psi = E */
+#define NBODY_DF_MIXED_DWARF_TRUNCATION 10.0
+#define NBODY_DF_ISOTROPIC_TRUNCATION 5.0
+
+/* Build the tables for the two components. Everything is in the total
+ * potential and the distribution function is that of the total density,
+ * like the rejection sampling. Returns NULL if the components can't be
+ * tabulated. */
+NBodyDFTable* nbMakeDFTable(const Dwarf* comp1, const Dwarf* comp2, real bound1, real bound2, real truncation);
+void nbDestroyDFTable(NBodyDFTable* t);
+
+real nbDFTableDistFun(const NBodyDFTable* t, real energy);
+
+/* Radius of a body of component comp (0 or 1) */
+real nbDFTableSampleRadius(const NBodyDFTable* t, int comp, dsfmt_t* dsfmtState);
+
+/* Speed of a body at radius r */
+real nbDFTableSampleSpeed(const NBodyDFTable* t, real r, dsfmt_t* dsfmtState);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_DF_TABLE_H_ */
+
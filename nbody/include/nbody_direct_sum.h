@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_DIRECT_SUM_H_
+#define _NBODY_DIRECT_SUM_H_
+
+#include "nbody_config.h"
+#include "milkyway_util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every source is summed into one of NBODY_DIRECT_SUM_LANES partial
+ * sums by its index, and the partial sums are added in a fixed order
+ * at the end. All of the versions do the same operations in the same
+ * order, so they give the same results whichever one is used. */
+#define NBODY_DIRECT_SUM_LANES 8
+
+/* Targets done together while a tile of sources is in cache */
+#define NBODY_DIRECT_SUM_TARGET_BLOCK 32
+
+/* Sources in each tile. Must be a multiple of NBODY_DIRECT_SUM_LANES */
+#define NBODY_DIRECT_SUM_SOURCE_TILE 1024
+
+/* Softened acceleration on each of the nTarget targets at (px, py, pz)
+ * from the nSource sources with positions (x, y, z) and masses m. The
+ * results are stored in (ax, ay, az). Targets which are also sources
+ * contribute nothing to themselves as long as eps2 > 0. */
+typedef void (*NBodyDirectSumFunc)(const real* RESTRICT x,
+                                   const real* RESTRICT y,
+                                   const real* RESTRICT z,
+                                   const real* RESTRICT m,
+                                   int nSource,
+                                   const real* RESTRICT px,
+                                   const real* RESTRICT py,
+                                   const real* RESTRICT pz,
+                                   int nTarget,
+                                   real eps2,
+                                   real* RESTRICT ax,
+                                   real* RESTRICT ay,
+                                   real* RESTRICT az);
+
+typedef enum
+{
+    NBODY_DIRECT_SUM_BEST = -1,   /* Highest available level */
+    NBODY_DIRECT_SUM_GENERIC,
+    NBODY_DIRECT_SUM_SSE2,
+    NBODY_DIRECT_SUM_AVX,
+    NBODY_DIRECT_SUM_AVX512F
+} NBodyDirectSumLevel;
+
+extern NBodyDirectSumFunc nbDirectSum;
+
+/* The intrinsics versions are built separately for each instruction set */
+#if MW_IS_X86
+  #if defined(__AVX512F__)
+    #define NB_DIRECT_SUM_INTRIN nbDirectSum_AVX512F
+  #elif defined(__AVX__)
+    #define NB_DIRECT_SUM_INTRIN nbDirectSum_AVX
+  #elif defined(__SSE2__)
+    #define NB_DIRECT_SUM_INTRIN nbDirectSum_SSE2
+  #endif
+
+void nbDirectSum_AVX512F(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                         const real* RESTRICT m, int nSource,
+                         const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                         int nTarget, real eps2,
+                         real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az);
+void nbDirectSum_AVX(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                     const real* RESTRICT m, int nSource,
+                     const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                     int nTarget, real eps2,
+                     real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az);
+void nbDirectSum_SSE2(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                      const real* RESTRICT m, int nSource,
+                      const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                      int nTarget, real eps2,
+                      real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az);
+#endif /* MW_IS_X86 */
+
+void nbDirectSum_Generic(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                         const real* RESTRICT m, int nSource,
+                         const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                         int nTarget, real eps2,
+                         real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az);
+
+/* Select the version used through nbDirectSum. Returns nonzero if the
+   requested level isn't available. */
+int nbDirectSumDispatch(NBodyDirectSumLevel level, int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_DIRECT_SUM_H_ */
@@ -30,6 +30,8 @@ extern "C" {
 /* compute force on all the bodies */
 NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st);
 
+void nbFreeWalkScratch(NBodyWalkScratch* s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,8 @@ extern "C" {
 NBodyHistogram* nbReadHistogram(const char* histogramFile);
 
 NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx, const NBodyState* st, const HistogramParams* hp);
+NBodyHistogram* nbCreateHistogramInState(const NBodyCtx* ctx, NBodyState* st, const HistogramParams* hp);
+void nbFreeHistogramScratch(NBodyHistogramScratch* s);
 
 void nbPrintHistogram(FILE* f, const NBodyHistogram* histogram);
 
@@ -29,8 +29,59 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+/* Binary output (--binary-output) is a header followed by one record per
+ * body, all in the byte order of the machine that wrote it. Each record
+ * is packed with no padding:
+ *
+ *   int32 ignore, uint32 id,
+ *   double x, y, z, v_x, v_y, v_z, mass,
+ *   double l, b, r     if fields has NBODY_BINARY_HAS_LBR
+ *   double v_los       if fields has NBODY_BINARY_HAS_VLOS
+ *
+ * Readers should skip headerSize bytes to the first record and step by
+ * recordSize, so later versions can add to either.
+ */
+#define NBODY_BINARY_MAGIC "MWNBODY"
+#define NBODY_BINARY_BYTE_ORDER 0x01020304
+#define NBODY_BINARY_VERSION 1
+
+/* Optional fields in each record */
+#define NBODY_BINARY_HAS_LBR  (1 << 0)
+#define NBODY_BINARY_HAS_VLOS (1 << 1)
+
+/* Output options the bodies were written with, for conversion to text */
+#define NBODY_BINARY_CARTESIAN     (1 << 0)
+#define NBODY_BINARY_LBR_CARTESIAN (1 << 1)
+#define NBODY_BINARY_HAS_MILKYWAY  (1 << 2)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t fields;
+    uint32_t outputFlags;
+    uint64_t nbody;
+    double sunGCDist;
+    double cmPos[3];
+    double cmVel[3];
+} NBodyBinaryHeader;
+
 int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
 int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
+int nbOutputBodiesBinary(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
+
+/* Read and check the header of binary output */
+int nbReadBinaryBodiesHeader(FILE* f, NBodyBinaryHeader* h);
+
+/* Read the h->nbody bodies following the header */
+int nbReadBinaryBodies(FILE* f, const NBodyBinaryHeader* h, Body* bodies);
+
+/* Rewrite binary output as the text output would have been */
+int nbConvertBinaryBodies(const char* binFileName, const char* textFileName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,6 +30,9 @@ extern "C" {
 
 int nbOpenPotentialEvalStatePerThread(NBodyState* st, const NBodyFlags* nbf);
 void nbEvalPotentialClosure(NBodyState* st, mwvector pos, mwvector* aOut);
+void nbEvalPotentialClosureBatch(NBodyState* st, int n,
+                                 const real* x, const real* y, const real* z,
+                                 real* ax, real* ay, real* az);
 int nbEvaluateHistogramParams(lua_State* luaSt, HistogramParams* hp);
 NBodyLikelihoodMethod nbEvaluateLikelihoodMethod(lua_State* luaSt);
 int nbHistogramParamsCheck(const NBodyFlags* nbf, HistogramParams* hp);
@@ -29,6 +29,9 @@ extern "C" {
 void nbRegisterUtilityFunctions(lua_State* luaSt);
 int nbReadMinVersion(lua_State* luaSt, int* major, int* minor);
 
+void nbSetPotentialTable(lua_State* luaSt, const NBodyPotentialTable* table);
+const NBodyPotentialTable* nbGetPotentialTable(lua_State* luaSt);
+
 #ifdef __cplusplus
 }
 #endif
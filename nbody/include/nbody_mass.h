@@ -41,8 +41,8 @@ real calc_vLOS(const mwvector v, const mwvector p, real sunGCdist);
 void nbCalcVelDisp(NBodyHistogram* histogram, mwbool initial, real correction_factor);
 void nbCalcBetaDisp(NBodyHistogram* histogram, mwbool initial, real correction_factor);
 
-void nbRemoveVelOutliers(const NBodyState* st, NBodyHistogram* histogram, real * use_velbody, real * vlos, real sigma_cutoff);
-void nbRemoveBetaOutliers(const NBodyState* st, NBodyHistogram* histogram, real * use_betabody, real * betas, real sigma_cutoff);
+void nbRemoveVelOutliers(NBodyHistogram* histogram, unsigned int nBinned, int* use_velbody, const real* vlos, real sigma_cutoff);
+void nbRemoveBetaOutliers(NBodyHistogram* histogram, unsigned int nBinned, int* use_betabody, const real* betas, real sigma_cutoff);
 
 real nbVelocityDispersion(const NBodyHistogram* data, const NBodyHistogram* histogram);
 real nbBetaDispersion(const NBodyHistogram* data, const NBodyHistogram* histogram);
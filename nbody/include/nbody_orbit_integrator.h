@@ -28,6 +28,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 void nbReverseOrbit(mwvector* finalPos,
                     mwvector* finalVel,
                     const Potential* pot,
+                    const NBodyPotentialTable* table,
                     mwvector pos,
                     mwvector vel,
                     real tstop,
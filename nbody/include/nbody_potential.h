@@ -28,6 +28,20 @@ extern "C" {
 #endif
 
 mwvector nbExtAcceleration(const Potential* pot, mwvector pos);
+mwvector nbTableExtAcceleration(const NBodyPotentialTable* t, const Potential* pot, mwvector pos);
+
+/* Points nbExtAccelerationBatch() works on at a time */
+#define NBODY_EXT_BATCH 128
+
+/* Same as nbTableExtAcceleration() for n points, t may be NULL. The
+   accelerations are written to ax, ay and az. */
+void nbExtAccelerationBatch(const Potential* pot, const NBodyPotentialTable* t, int n,
+                            const real* x, const real* y, const real* z,
+                            real* ax, real* ay, real* az);
+
+/* Acceleration from a single component */
+mwvector nbDiskAcceleration(const Disk* disk, mwvector pos);
+mwvector nbHaloAcceleration(const Halo* halo, mwvector pos);
 
 #ifdef __cplusplus
 }
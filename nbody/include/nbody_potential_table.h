@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_POTENTIAL_TABLE_H_
+#define _NBODY_POTENTIAL_TABLE_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Nodes along each axis of a grid */
+#define NBODY_POTENTIAL_TABLE_NODES 256
+
+/* Largest R and |z| covered by the grids, in kpc. Anything further
+   out is evaluated directly. */
+#define NBODY_POTENTIAL_TABLE_MAX_RADIUS 250.0
+
+/* Make grids for the components of pot which are expensive to
+ * evaluate, which are the exponential disks and the caustic halo.
+ * Returns NULL if maxError isn't positive or there is nothing worth
+ * tabulating. */
+NBodyPotentialTable* nbMakePotentialTable(const Potential* pot, real maxError);
+void nbDestroyPotentialTable(NBodyPotentialTable* t);
+
+/* Interpolate one grid at pos. Returns FALSE if the grid is unused or
+   doesn't cover pos, in which case acc isn't touched. */
+mwbool nbPotentialGridAcceleration(const NBodyPotentialGrid* g, mwvector pos, mwvector* acc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_POTENTIAL_TABLE_H_ */
@@ -177,5 +177,37 @@ typedef struct MW_ALIGN_TYPE
 #define EMPTY_DWARF { InvalidDwarf, 0.0, 0.0, 0.0, 0.0, 0.0 }
 #define EMPTY_POTENTIAL { {EMPTY_SPHERICAL}, EMPTY_DISK, EMPTY_DISK2, EMPTY_HALO, NULL }
 
+
+/* Acceleration of an axisymmetric component tabulated in (R, |z|).
+ * The nodes are evenly spaced in u = asinh(R / scaleR) and
+ * v = asinh(|z| / scaleZ), and sit in the middle of each step, so
+ * neither axis has a node on it. */
+typedef struct
+{
+    real* a;                /* aR and az at node (i, j) are a[2 * (i * nZ + j)] and the next one */
+    unsigned char* exact;   /* Cells where interpolation isn't accurate enough, indexed like the nodes */
+    real scaleR;
+    real scaleZ;
+    real du;
+    real dv;
+    int nR;
+    int nZ;
+} NBodyPotentialGrid;
+
+#define EMPTY_POTENTIAL_GRID { NULL, NULL, 0.0, 0.0, 0.0, 0.0, 0, 0 }
+
+/* Interpolation grids for the expensive parts of a potential.
+   Components without a grid are evaluated directly. */
+typedef struct
+{
+    Potential pot;              /* Potential the table was made from */
+    real maxError;              /* Largest relative error allowed in an interpolated component */
+    NBodyPotentialGrid disk;
+    NBodyPotentialGrid disk2;
+    NBodyPotentialGrid halo;
+} NBodyPotentialTable;
+
+#define EMPTY_POTENTIAL_TABLE { EMPTY_POTENTIAL, 0.0, EMPTY_POTENTIAL_GRID, EMPTY_POTENTIAL_GRID, EMPTY_POTENTIAL_GRID }
+
 #endif /* _NBODY_POTENTIAL_TYPES_H_ */
 
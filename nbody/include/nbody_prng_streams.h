@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_PRNG_STREAMS_H_
+#define _NBODY_PRNG_STREAMS_H_
+
+#include "dSFMT.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The generated models draw their bodies in blocks, each from its own
+ * stream 2^64 steps of the generator further on than the one before, so
+ * the blocks can be done in parallel and the bodies only depend on the
+ * seed and the number of bodies. The first block draws from the
+ * generator passed in, so a model small enough to be one block is the
+ * same as when it was drawn serially.
+ *
+ * The jumps are done one after another and each takes about 3 ms, as
+ * long as drawing 6000 Plummer or tabulated dwarf bodies, or 3 rejection
+ * sampled dwarf bodies. Each generator asks for blocks of at least about
+ * 8 times that many bodies, so the jumps don't take more than about an
+ * eighth of the time the blocks do. */
+#define NBODY_PRNG_PLUMMER_BLOCK 65536
+#define NBODY_PRNG_DWARF_TABLE_BLOCK 65536
+#define NBODY_PRNG_DWARF_BLOCK 64
+#define NBODY_PRNG_MAX_BLOCKS 64
+
+typedef struct
+{
+    unsigned int nbody;
+    unsigned int nBlocks;
+    unsigned int blockSize;
+    dsfmt_t* states;
+} NBodyPRNGStreams;
+
+/* Blocks have at least minBlock bodies */
+void nbInitPRNGStreams(NBodyPRNGStreams* s, const dsfmt_t* prng, unsigned int nbody, unsigned int minBlock);
+
+/* Leave prng where the last block finished and free the streams. The
+   next model drawn from it then doesn't overlap any of these blocks, and
+   a model of one block leaves it as if the bodies were drawn serially */
+void nbFinishPRNGStreams(NBodyPRNGStreams* s, dsfmt_t* prng);
+
+/* Bodies [*first, *last) of block k */
+void nbPRNGStreamBlock(const NBodyPRNGStreams* s, unsigned int k, unsigned int* first, unsigned int* last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_PRNG_STREAMS_H_ */
@@ -128,6 +128,17 @@ typedef struct MW_ALIGN_TYPE
 
 #define BODY_TYPE "Body"
 
+/* Bodies from a model generator, kept together so they don't go through
+   a table of Body userdata on the way to the state */
+typedef struct
+{
+    Body* bodies;   /* Aligned, freed with mwFreeA() */
+    int nbody;
+    mwbool taken;   /* readModels() took the bodies, so it can't be used again */
+} BodyArray;
+
+#define BODY_ARRAY_TYPE "BodyArray"
+
 #define Vel(x)  (((Body*) (x))->vel)
 
 /* CELL: structure used to represent internal nodes of tree. */
@@ -179,6 +190,19 @@ typedef enum
 #define Subp(x)   (((NBodyCell*) (x))->stuff.subp)
 #define Quad(x)   (((NBodyCell*) (x))->stuff.quad)
 
+/* Node of the linearised tree walked by the force calculation. Nodes
+   are stored in the depth-first order of the threaded tree, so the
+   links are indices into the same array. */
+typedef struct MW_ALIGN_TYPE
+{
+    mwvector pos;            /* position of node */
+    real mass;               /* total mass of node */
+    real rcrit2;             /* critical c-of-m radius^2, unused for bodies */
+    int next;                /* node to continue with after this one, -1 at end */
+    int more;                /* first descendent of a cell, -1 if none */
+    int body;                /* index into bodytab, -1 for cells */
+} NBodyTreeNode;
+
 /* Variables used in tree construction. */
 
 typedef struct MW_ALIGN_TYPE
@@ -189,9 +213,19 @@ typedef struct MW_ALIGN_TYPE
     unsigned int cellUsed;   /* count of cells in tree */
     unsigned int maxDepth;   /* count of levels in tree */
     int structureError;
+
+    NBodyTreeNode* nodes;    /* linearised copy of the threaded tree */
+    NBodyQuadMatrix* quads;  /* quad moments of the cells in nodes, if used */
+    unsigned int nNode;      /* nodes used in the last build */
+    unsigned int maxNode;    /* allocated size of nodes and quads */
+
+    int* bodyIdx;            /* bodies partitioned by cell during construction */
+    int* bodyIdxTmp;
+    unsigned char* bodySubIdx;
+    int maxBodyIdx;
 } NBodyTree;
 
-#define EMPTY_TREE { NULL, 0.0, 0, 0, FALSE }
+#define EMPTY_TREE { NULL, 0.0, 0, 0, FALSE, NULL, NULL, 0, 0, NULL, NULL, NULL, 0 }
 
 
 #if NBODY_OPENCL
@@ -338,6 +372,84 @@ typedef struct
 } NBodyHistogram;
 
 
+/* Scratch space used for building a histogram from the bodies. Kept
+   between histogram evaluations so they don't allocate every step. */
+typedef struct
+{
+    HistData* partials;        /* Bin accumulators for each thread, nBin per thread */
+    unsigned int* threadInfo;  /* Per thread light and binned body counts, and last light body + 1 */
+
+    /* Bodies which land in the histogram, in the original body order */
+    int* betaBin;            /* Bin of each binned body, -1 after rejected as beta outlier */
+    int* velBin;             /* Bin of each binned body, -1 after rejected as velocity outlier */
+    real* betas;
+    real* vlos;
+
+    int nbody;               /* Number of bodies the per body arrays have room for */
+    int nThreads;            /* Number of threads the per thread arrays have room for */
+    unsigned int nBin;       /* Number of bins per thread in partials */
+} NBodyHistogramScratch;
+
+#define EMPTY_HISTOGRAM_SCRATCH { NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0 }
+
+typedef enum
+{
+    NBODY_INVALID_METHOD = -1,
+    NBODY_EMD,
+    NBODY_ORIG_CHISQ,
+    NBODY_ORIG_ALT,
+    NBODY_CHISQ_ALT,
+    NBODY_POISSON,
+    NBODY_KOLMOGOROV,
+    NBODY_KULLBACK_LEIBLER,
+    NBODY_SAHA
+} NBodyLikelihoodMethod;
+
+
+/* Structure of arrays view of the bodies used by the CPU integrator
+   and force loop. Positions are also kept current in bodytab since the
+   tree is built from it; velocities and accelerations are only written
+   back when something outside the step needs them. */
+typedef struct
+{
+    real* pos[3];
+    real* vel[3];
+    real* acc[3];
+    real* masses;
+} NBodySoA;
+
+
+/* Cells or bodies gathered by one walk of the tree in group walk
+   mode, or the bodies copied for the direct sum, stored by component
+   so the force loops over them vectorize */
+typedef struct
+{
+    real* pos[3];
+    real* mass;
+    real* quad[6];   /* xx, xy, xz, yy, yz, zz. Only for cells when using quadrupole moments */
+    int* body;       /* Index in bodytab. Only for bodies */
+    int n;
+    int max;
+} NBodyInteractionList;
+
+#define EMPTY_INTERACTION_LIST { { NULL, NULL, NULL }, NULL, { NULL, NULL, NULL, NULL, NULL, NULL }, NULL, 0, 0 }
+
+/* Scratch space for the group walk and the direct sum. Kept between
+   steps so they don't allocate every step. */
+typedef struct
+{
+    int* groups;                    /* First node and one past the last node of each group */
+    NBodyInteractionList* cells;    /* One list of each per thread */
+    NBodyInteractionList* bodies;
+    int nGroup;
+    int maxGroup;                   /* Number of groups there is room for */
+    int nThreads;                   /* Number of threads the lists have been allocated for */
+    NBodyInteractionList direct;    /* Copy of all the bodies for the direct sum without SoA */
+} NBodyWalkScratch;
+
+#define EMPTY_WALK_SCRATCH { NULL, NULL, NULL, 0, 0, 0, EMPTY_INTERACTION_LIST }
+
+
 /* Mutable state used during an evaluation */
 typedef struct MW_ALIGN_TYPE
 {
@@ -393,11 +505,44 @@ typedef struct MW_ALIGN_TYPE
     void* nbb;
   #endif /* NBODY_OPENCL */
     NBodyWorkSizes* workSizes;
+
+    /* Best likelihood tracking evaluates every step after BestLikeStart,
+       so keep what doesn't change over the run instead of reloading it */
+    NBodyHistogram* bestLikeData;       /* Data histogram, read once */
+    NBodyHistogram* bestLikeHistogram;  /* Reused buffer for the histogram of the current step */
+    NBodyHistogramScratch histogramScratch;
+    HistogramParams bestLikeParams;
+    NBodyLikelihoodMethod bestLikeMethod;
+    mwbool bestLikeLoaded;              /* Whether loading the above was attempted */
+
+    NBodySoA* soa;     /* Only allocated while running with usesSoA */
+    mwbool usesSoA;
+
+    real treeBuildTime;          /* Total wall time spent in nbMakeTree */
+    unsigned int nTreeBuild;     /* Number of trees built in this run */
+
+    NBodyWalkScratch walkScratch;
+
+    NBodyPotentialTable* potTable;  /* Tabulated external potential, if ctx.potentialTableError is set */
+
+    struct NBodyCheckpointWriter* checkpointWriter;  /* Background checkpoint writes, started with the first */
+    mwbool checkpointWriterFailed;  /* The thread couldn't be started, so checkpoints are written directly */
+    real checkpointStallTime;    /* Total wall time stepping waited on checkpoints */
+    unsigned int nCheckpoint;    /* Number of checkpoints taken in this run */
+    unsigned int nCheckpointCompleted;  /* Number of those reported with mw_checkpoint_completed() */
 } NBodyState;
 
 #define NBODYSTATE_TYPE "NBodyState"
 
-#define EMPTY_NBODYSTATE { EMPTY_TREE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, NULL, NULL, NULL, NULL }
+#define EMPTY_NBODYSTATE { EMPTY_TREE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,       \
+                           0, 0, 0, 0, 0, 0, 0, 0,                                        \
+                           0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0, FALSE, FALSE,                 \
+                           FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,        \
+                           NULL, NULL, NULL, NULL,                                        \
+                           NULL, NULL, EMPTY_HISTOGRAM_SCRATCH,                           \
+                           EMPTY_HISTOGRAM_PARAMS, NBODY_INVALID_METHOD, FALSE,       \
+                           NULL, FALSE, 0.0, 0, EMPTY_WALK_SCRATCH, NULL,             \
+                           NULL, FALSE, 0.0, 0, 0 }
 
 
 
@@ -444,6 +589,9 @@ typedef struct MW_ALIGN_TYPE
     time_t checkpointT;       /* Period to checkpoint when not using BOINC */
     unsigned int nStep;
 
+    mwbool useGroupWalk;      /* walk the tree once per group of nearby bodies */
+    real potentialTableError; /* allowed relative error of tabulated external potentials. 0 evaluates them directly */
+
     Potential pot;
 } NBodyCtx;
 
@@ -452,7 +600,7 @@ typedef struct MW_ALIGN_TYPE
                          InvalidCriterion, EXTERNAL_POTENTIAL_DEFAULT,                      \
                          FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,            \
                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                                      \
-                         EMPTY_POTENTIAL }
+                         FALSE, 0.0, EMPTY_POTENTIAL }
 
 /* Negative codes can be nonfatal but useful return statuses.
    Positive can be different hard failures.
@@ -518,21 +666,6 @@ typedef enum
 
 
 
-typedef enum
-{
-    NBODY_INVALID_METHOD = -1,
-    NBODY_EMD,
-    NBODY_ORIG_CHISQ,
-    NBODY_ORIG_ALT,
-    NBODY_CHISQ_ALT,
-    NBODY_POISSON,
-    NBODY_KOLMOGOROV,
-    NBODY_KULLBACK_LEIBLER,
-    NBODY_SAHA
-} NBodyLikelihoodMethod;
-
-
-
 NBodyStatus nbInitCL(NBodyState* st, const NBodyCtx* ctx, const CLRequest* clr);
 NBodyStatus nbInitNBodyStateCL(NBodyState* st, const NBodyCtx* ctx);
 
@@ -542,6 +675,10 @@ void setInitialNBodyState(NBodyState* st, const NBodyCtx* ctx, Body* bodies, int
 void cloneNBodyState(NBodyState* st, const NBodyState* oldSt);
 int equalNBodyState(const NBodyState* st1, const NBodyState* st2);
 
+void nbCreateSoA(NBodyState* st);
+void nbDestroySoA(NBodyState* st);
+void nbMarshalBodiesSoA(NBodyState* st, mwbool marshalIn);
+
 void sortBodies(Body* bodies, int nbody);
 
 int equalSpherical(const Spherical* s1, const Spherical* s2);
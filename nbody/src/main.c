@@ -31,6 +31,7 @@
 #include "milkyway_util.h"
 #include "nbody.h"
 #include "nbody_likelihood.h"
+#include "nbody_io.h"
 #include "nbody_defaults.h"
 #include "milkyway_git_version.h"
 
@@ -257,13 +258,17 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Output file", NULL
         },
 
-      #if 0
         {
             "binary-output", 'B',
             POPT_ARG_NONE, &nbf.outputBinary,
             0, "Write output dump as a binary", NULL
         },
-      #endif
+
+        {
+            "convert-binary-output", '\0',
+            POPT_ARG_STRING, &nbf.convertBinaryOutput,
+            0, "Only rewrite this binary output dump as text to the output file", NULL
+        },
 
         {
             "output-cartesian", 'x',
@@ -397,6 +402,12 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Do not care about display responsiveness (use with caution)", NULL
         },
 
+        {
+            "soa-bodies", '\0',
+            POPT_ARG_NONE, &nbf.useSoA,
+            0, "Use structure of arrays body storage in the CPU integrator and force loop", NULL
+        },
+
         {
             "progress", 'P',
             POPT_ARG_NONE, &nbf.reportProgress,
@@ -471,13 +482,20 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
         exit(EXIT_SUCCESS);
     }
 
-    if (!nbf.inputFile && !nbf.checkpointFileName && !nbf.matchHistogram && !nbf.matchHistBetaDisp && !nbf.matchHistVelDisp && !nbf.matchHistBetaVelDisp)
+    if (!nbf.inputFile && !nbf.checkpointFileName && !nbf.matchHistogram && !nbf.matchHistBetaDisp && !nbf.matchHistVelDisp && !nbf.matchHistBetaVelDisp && !nbf.convertBinaryOutput)
     {
         mw_printf("An input file, checkpoint, or matching histogram argument is required\n");
         poptFreeContext(context);
         return TRUE;
     }
 
+    if (nbf.convertBinaryOutput && !nbf.outFileName)
+    {
+        mw_printf("--convert-binary-output argument requires --output-file\n");
+        poptFreeContext(context);
+        return TRUE;
+    }
+
     if ((nbf.matchHistogram || nbf.matchHistVelDisp || nbf.matchHistBetaDisp || nbf.matchHistBetaVelDisp) && !nbf.histogramFileName)
     {
         mw_printf("--match-histogram argument requires --histogram-file\n");
@@ -534,6 +552,7 @@ static void freeNBodyFlags(NBodyFlags* nbf)
     free(nbf->histogramFileName);
     free(nbf->histoutFileName);
     free(nbf->matchHistogram);
+    free(nbf->convertBinaryOutput);
     free(nbf->forwardedArgs);
     free(nbf->graphicsBin);
     free(nbf->visArgs);
@@ -628,6 +647,10 @@ int main(int argc, const char* argv[])
     {
         rc = nbVerifyFile(&nbf);
     }
+    else if (nbf.convertBinaryOutput)
+    {
+        rc = nbConvertBinaryBodies(nbf.convertBinaryOutput, nbf.outFileName);
+    }
     else if (nbf.matchHistogram)
     {
         real emd;
@@ -31,6 +31,8 @@
 #include "nbody_plain.h"
 #include "nbody_likelihood.h"
 #include "nbody_histogram.h"
+#include "nbody_direct_sum.h"
+#include "nbody_potential_table.h"
 
 #if NBODY_OPENCL
   #include "nbody_cl.h"
@@ -77,6 +79,11 @@ static NBodyStatus nbResumeOrNewRun(NBodyCtx* ctx, NBodyState* st, const NBodyFl
         {
             mw_report("Resumed from checkpoint '%s'\n", nbf->checkpointFileName);
         }
+
+        if (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT)
+        {
+            st->potTable = nbMakePotentialTable(&ctx->pot, ctx->potentialTableError);
+        }
     }
 
     if (ctx->potentialType == EXTERNAL_POTENTIAL_CUSTOM_LUA)
@@ -103,6 +110,7 @@ static void nbSetStateFromFlags(NBodyState* st, const NBodyFlags* nbf)
 {
     st->reportProgress = nbf->reportProgress;
     st->ignoreResponsive = nbf->ignoreResponsive;
+    st->usesSoA = nbf->useSoA;
 }
 
 static void nbSetCLRequestFromFlags(CLRequest* clr, const NBodyFlags* nbf)
@@ -379,6 +387,8 @@ int nbMain(const NBodyFlags* nbf)
         }
     }
 
+    nbDirectSumDispatch(NBODY_DIRECT_SUM_BEST, nbf->verbose);
+
     rc = nbResumeOrNewRun(ctx, st, nbf);
     if (nbStatusIsFatal(rc))
     {
@@ -450,6 +460,19 @@ int nbMain(const NBodyFlags* nbf)
         if (nbf->printTiming)
         {
             printf("<run_time> %f </run_time>\n", te - ts);
+            if (st->nTreeBuild > 0)
+            {
+                printf("<tree_build_time> %f </tree_build_time>\n", st->treeBuildTime);
+                printf("<tree_build_time_per_step> %f </tree_build_time_per_step>\n",
+                       st->treeBuildTime / (real) st->nTreeBuild);
+            }
+
+            if (st->nCheckpoint > 0)
+            {
+                printf("<checkpoint_stall_time> %f </checkpoint_stall_time>\n", st->checkpointStallTime);
+                printf("<checkpoint_stall_time_per_checkpoint> %f </checkpoint_stall_time_per_checkpoint>\n",
+                       st->checkpointStallTime / (real) st->nCheckpoint);
+            }
         }
     }
 
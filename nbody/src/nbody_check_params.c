@@ -285,8 +285,20 @@ static int hasAcceptableSteps(const NBodyCtx* ctx)
     return rc;
 }
 
+static int hasAcceptablePotentialTableError(const NBodyCtx* ctx)
+{
+    if (!isfinite(ctx->potentialTableError) || ctx->potentialTableError < 0.0)
+    {
+        mw_printf("Potential table error must be >= 0.0 (potentialTableError = %f)\n", ctx->potentialTableError);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 mwbool checkNBodyCtxConstants(const NBodyCtx* ctx)
 {
-    return hasAcceptableTimes(ctx) || hasAcceptableSteps(ctx) || hasAcceptableEps2(ctx) || hasAcceptableTheta(ctx);
+    return hasAcceptableTimes(ctx) || hasAcceptableSteps(ctx) || hasAcceptableEps2(ctx) || hasAcceptableTheta(ctx)
+        || hasAcceptablePotentialTableError(ctx);
 }
 
@@ -43,6 +43,10 @@
   #include <sys/stat.h>
 #endif
 
+#if HAVE_PTHREAD_H
+  #include <pthread.h>
+#endif
+
 #ifndef _WIN32
 
 typedef struct
@@ -177,7 +181,7 @@ static int nbVerifyCheckpointHeader(const NBodyCheckpointHeader* cpHdr,
 
 #ifndef _WIN32
 
-static int nbOpenCheckpointHandle(const NBodyState* st,
+static int nbOpenCheckpointHandle(size_t writeSize,
                                   CheckpointHandle* cp,
                                   const char* filename,
                                   int writing)
@@ -205,7 +209,7 @@ static int nbOpenCheckpointHandle(const NBodyState* st,
 
     if (writing)
     {
-        cp->cpFileSize = hdrSize + st->nbody * sizeof(Body) + st->nOrbitTrace * sizeof(mwvector);
+        cp->cpFileSize = writeSize;
         /* Make the file the right size in case it's a new file */
         if (ftruncate(cp->fd, cp->cpFileSize) < 0)
         {
@@ -271,7 +275,7 @@ static int nbCloseCheckpointHandle(CheckpointHandle* cp)
              Flushing:
              http://msdn.microsoft.com/en-us/library/aa366563(v=VS.85).aspx
  */
-static int nbOpenCheckpointHandle(const NBodyState* st,
+static int nbOpenCheckpointHandle(size_t writeSize,
                                   CheckpointHandle* cp,
                                   const char* filename,
                                   int writing)
@@ -311,7 +315,7 @@ static int nbOpenCheckpointHandle(const NBodyState* st,
 
     if (writing)
     {
-        cp->cpFileSize = (DWORD) (hdrSize + st->nbody * sizeof(Body) + st->nOrbitTrace * sizeof(mwvector));
+        cp->cpFileSize = (DWORD) writeSize;
     }
     else
     {
@@ -437,26 +441,44 @@ static int nbThawState(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
     return FALSE;
 }
 
-static void nbFreezeState(const NBodyCtx* ctx, const NBodyState* st, CheckpointHandle* cp)
+/* What goes into a checkpoint. The bodies may be the state's own or a
+ * copy being written in the background. */
+typedef struct
 {
-    const size_t bodySize = st->nbody * sizeof(Body);
-    const size_t traceSize = st->nOrbitTrace * sizeof(mwvector);
-    char* p = cp->mptr;
     NBodyCheckpointHeader cpHdr;
+    const Body* bodytab;
+    const mwvector* orbitTrace;
+} NBodyCheckpointSnapshot;
 
-    memset(&cpHdr, 0, sizeof(cpHdr));
-    nbPrepareWriteCheckpointHeader(&cpHdr, ctx, st);
+static void nbSnapshotState(NBodyCheckpointSnapshot* snap, const NBodyCtx* ctx, const NBodyState* st)
+{
+    memset(&snap->cpHdr, 0, sizeof(snap->cpHdr));
+    nbPrepareWriteCheckpointHeader(&snap->cpHdr, ctx, st);
+    snap->bodytab = st->bodytab;
+    snap->orbitTrace = st->orbitTrace;
+}
 
-    memcpy(p, &cpHdr, sizeof(cpHdr));
-    p += sizeof(cpHdr);
+static size_t nbSnapshotSize(const NBodyCheckpointSnapshot* snap)
+{
+    return hdrSize + snap->cpHdr.nbody * sizeof(Body) + snap->cpHdr.nOrbitTrace * sizeof(mwvector);
+}
+
+static void nbFreezeSnapshot(const NBodyCheckpointSnapshot* snap, CheckpointHandle* cp)
+{
+    const size_t bodySize = snap->cpHdr.nbody * sizeof(Body);
+    const size_t traceSize = snap->cpHdr.nOrbitTrace * sizeof(mwvector);
+    char* p = cp->mptr;
+
+    memcpy(p, &snap->cpHdr, sizeof(snap->cpHdr));
+    p += sizeof(snap->cpHdr);
 
     /* The main piece of state*/
-    memcpy(p, st->bodytab, bodySize);
+    memcpy(p, snap->bodytab, bodySize);
     p += bodySize;
 
-    if (st->orbitTrace)
+    if (snap->orbitTrace)
     {
-        memcpy(p, st->orbitTrace, traceSize);
+        memcpy(p, snap->orbitTrace, traceSize);
         p += traceSize;
     }
 
@@ -492,7 +514,7 @@ int nbResolvedCheckpointExists(const NBodyState* st)
 /* Try to open a checkpoint with a few tries if the open fails.
    This is in case of weird/rare failures like interrupted system calls.
  */
-static int nbOpenCheckpointHandleWithAttempts(const NBodyState* st,
+static int nbOpenCheckpointHandleWithAttempts(size_t writeSize,
                                               CheckpointHandle* cp,
                                               const char* filename,
                                               int writing)
@@ -502,7 +524,7 @@ static int nbOpenCheckpointHandleWithAttempts(const NBodyState* st,
 
     do
     {
-        if (!nbOpenCheckpointHandle(st, cp, filename, writing))
+        if (!nbOpenCheckpointHandle(writeSize, cp, filename, writing))
             break;
 
         if (nbCloseCheckpointHandle(cp))
@@ -527,7 +549,7 @@ int nbReadCheckpoint(NBodyCtx* ctx, NBodyState* st)
 {
     CheckpointHandle cp = EMPTY_CHECKPOINT_HANDLE;
 
-    if (nbOpenCheckpointHandleWithAttempts(st, &cp, st->checkpointResolved, FALSE))
+    if (nbOpenCheckpointHandleWithAttempts(0, &cp, st->checkpointResolved, FALSE))
     {
         mw_printf("Opening checkpoint '%s' for resuming failed\n", st->checkpointResolved);
         nbCloseCheckpointHandle(&cp);
@@ -551,21 +573,17 @@ int nbReadCheckpoint(NBodyCtx* ctx, NBodyState* st)
     return FALSE;
 }
 
-/* Use specified temporary file to avoid bad things happening if
- * multiple tests running at a time */
-int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, const char* tmpFile)
+static int nbWriteSnapshot(const NBodyCheckpointSnapshot* snap, const char* tmpFile, const char* checkpointResolved)
 {
     int failed = FALSE;
     CheckpointHandle cp = EMPTY_CHECKPOINT_HANDLE;
 
-    assert(st->checkpointResolved);
-
-    if (nbOpenCheckpointHandleWithAttempts(st, &cp, tmpFile, TRUE))
+    if (nbOpenCheckpointHandleWithAttempts(nbSnapshotSize(snap), &cp, tmpFile, TRUE))
     {
         return TRUE;
     }
 
-    nbFreezeState(ctx, st, &cp);
+    nbFreezeSnapshot(snap, &cp);
 
     if (nbCloseCheckpointHandle(&cp))
     {
@@ -577,9 +595,9 @@ int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, cons
      * should avoid corruption in the event the file write is
      * interrupted. */
     /* Don't update if the file was not closed properly; it can't be trusted. */
-    if (!failed && mw_rename(tmpFile, st->checkpointResolved))
+    if (!failed && mw_rename(tmpFile, checkpointResolved))
     {
-        mwPerror("Failed to update checkpoint '%s' with temporary", st->checkpointResolved);
+        mwPerror("Failed to update checkpoint '%s' with temporary", checkpointResolved);
         failed = TRUE;
     }
 
@@ -591,15 +609,383 @@ int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, cons
     return failed;
 }
 
+/* Use specified temporary file to avoid bad things happening if
+ * multiple tests running at a time */
+int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, const char* tmpFile)
+{
+    NBodyCheckpointSnapshot snap;
+
+    assert(st->checkpointResolved);
+
+    nbSnapshotState(&snap, ctx, st);
+    return nbWriteSnapshot(&snap, tmpFile, st->checkpointResolved);
+}
+
+static void nbCheckpointTmpFile(char* path, size_t size)
+{
+    snprintf(path, size, "nbody_checkpoint_tmp_%d", (int) getpid());
+}
+
 int nbWriteCheckpoint(const NBodyCtx* ctx, const NBodyState* st)
 {
     char path[256];
 
-    snprintf(path, sizeof(path), "nbody_checkpoint_tmp_%d", (int) getpid());
+    nbCheckpointTmpFile(path, sizeof(path));
 
     return nbWriteCheckpointWithTmpFile(ctx, st, path);
 }
 
+/* BOINC keeps saying it's time to checkpoint until it's told one
+   completed, so each yes from nbTimeToCheckpoint() gets exactly one
+   mw_checkpoint_completed() */
+static void nbCheckpointCompleted(NBodyState* st, unsigned int n)
+{
+    while (n-- > 0)
+    {
+        mw_checkpoint_completed();
+        ++st->nCheckpointCompleted;
+    }
+}
+
+static void nbReportCheckpointStall(NBodyState* st, double tStart)
+{
+    real stall = (real) (mwGetTime() - tStart);
+
+    st->checkpointStallTime += stall;
+    ++st->nCheckpoint;
+    mw_report("Checkpoint %u held up stepping for %.3f ms\n", st->nCheckpoint, 1.0e3 * stall);
+}
+
+static int nbWriteCheckpointNow(const NBodyCtx* ctx, NBodyState* st)
+{
+    if (nbWriteCheckpoint(ctx, st))
+    {
+        return TRUE;
+    }
+
+    nbCheckpointCompleted(st, 1);
+    return FALSE;
+}
+
+#if HAVE_PTHREAD_H
+
+/* For tests, to make the writer slower than stepping */
+static unsigned int checkpointWriteDelay = 0;
+
+/* One copy of the state for the writer thread */
+typedef struct
+{
+    NBodyCheckpointSnapshot snap;
+    Body* bodytab;
+    mwvector* orbitTrace;
+    int maxBodies;          /* Room in the copies */
+    unsigned int maxTrace;
+} NBodyCheckpointBuffer;
+
+typedef struct NBodyCheckpointWriter NBodyCheckpointWriter;
+
+/* Stepping copies the state into one buffer while the thread writes the
+ * other, so taking a checkpoint only costs the copy. A newer checkpoint
+ * replaces one that's still waiting to be written. */
+struct NBodyCheckpointWriter
+{
+    NBodyCheckpointBuffer buffers[2];
+    int writing;            /* Buffer being written, or -1 */
+    int queued;             /* Buffer waiting to be written, or -1 */
+    unsigned int completed; /* Written or replaced since last asked */
+    int failed;
+    int quit;
+
+    char* checkpointResolved;
+    char tmpFile[256];
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void nbCopyToCheckpointBuffer(NBodyCheckpointBuffer* buf, const NBodyCtx* ctx, const NBodyState* st)
+{
+    if (buf->maxBodies < st->nbody)
+    {
+        mwFreeA(buf->bodytab);
+        buf->bodytab = (Body*) mwMallocA(st->nbody * sizeof(Body));
+        buf->maxBodies = st->nbody;
+    }
+
+    if (st->orbitTrace && buf->maxTrace < st->nOrbitTrace)
+    {
+        mwFreeA(buf->orbitTrace);
+        buf->orbitTrace = (mwvector*) mwMallocA(st->nOrbitTrace * sizeof(mwvector));
+        buf->maxTrace = st->nOrbitTrace;
+    }
+
+    memcpy(buf->bodytab, st->bodytab, st->nbody * sizeof(Body));
+    if (st->orbitTrace)
+    {
+        memcpy(buf->orbitTrace, st->orbitTrace, st->nOrbitTrace * sizeof(mwvector));
+    }
+
+    nbSnapshotState(&buf->snap, ctx, st);
+    buf->snap.bodytab = buf->bodytab;
+    buf->snap.orbitTrace = st->orbitTrace ? buf->orbitTrace : NULL;
+}
+
+static void* nbCheckpointWriterThread(void* arg)
+{
+    NBodyCheckpointWriter* w = (NBodyCheckpointWriter*) arg;
+    int k, rc;
+
+    pthread_mutex_lock(&w->lock);
+    while (TRUE)
+    {
+        while (w->queued < 0 && !w->quit)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        /* A checkpoint still queued when quitting is written first */
+        if (w->queued < 0)
+            break;
+
+        k = w->writing = w->queued;
+        w->queued = -1;
+        pthread_mutex_unlock(&w->lock);
+
+        if (checkpointWriteDelay > 0)
+        {
+            mwMilliSleep(checkpointWriteDelay);
+        }
+
+        rc = nbWriteSnapshot(&w->buffers[k].snap, w->tmpFile, w->checkpointResolved);
+
+        /* A failed write still answers its request. The failure is
+           reported separately and stops the run. */
+        pthread_mutex_lock(&w->lock);
+        w->writing = -1;
+        ++w->completed;
+        if (rc)
+            w->failed = TRUE;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static NBodyCheckpointWriter* nbCreateCheckpointWriter(const NBodyState* st)
+{
+    NBodyCheckpointWriter* w;
+
+    w = (NBodyCheckpointWriter*) mwCalloc(1, sizeof(NBodyCheckpointWriter));
+    w->writing = -1;
+    w->queued = -1;
+    w->checkpointResolved = strdup(st->checkpointResolved);
+    nbCheckpointTmpFile(w->tmpFile, sizeof(w->tmpFile));
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, nbCheckpointWriterThread, w))
+    {
+        mw_printf("Failed to start checkpoint writer thread, writing checkpoints directly\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w->checkpointResolved);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+static void nbQueueCheckpoint(NBodyCheckpointWriter* w, const NBodyCtx* ctx, const NBodyState* st)
+{
+    int k;
+
+    /* Take whichever buffer isn't being written. If it was queued and
+     * not started yet, this checkpoint replaces it, and stands in for
+     * it as completed. */
+    pthread_mutex_lock(&w->lock);
+    k = (w->writing == 0) ? 1 : 0;
+    if (w->queued == k)
+    {
+        w->queued = -1;
+        ++w->completed;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    /* The thread won't touch buffer k until it's queued again */
+    nbCopyToCheckpointBuffer(&w->buffers[k], ctx, st);
+
+    pthread_mutex_lock(&w->lock);
+    w->queued = k;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int nbWriteCheckpointAsync(const NBodyCtx* ctx, NBodyState* st)
+{
+    double tStart = mwGetTime();
+    int failed = FALSE;
+
+    assert(st->checkpointResolved);
+
+    /* Only try to start the thread once */
+    if (!st->checkpointWriter && !st->checkpointWriterFailed)
+    {
+        st->checkpointWriter = nbCreateCheckpointWriter(st);
+        st->checkpointWriterFailed = (st->checkpointWriter == NULL);
+    }
+
+    if (st->checkpointWriter)
+    {
+        nbQueueCheckpoint(st->checkpointWriter, ctx, st);
+    }
+    else
+    {
+        failed = nbWriteCheckpointNow(ctx, st);
+    }
+
+    nbReportCheckpointStall(st, tStart);
+
+    return failed;
+}
+
+int nbCheckpointWriterBusy(NBodyState* st)
+{
+    NBodyCheckpointWriter* w = st->checkpointWriter;
+    int busy;
+
+    if (!w)
+        return FALSE;
+
+    pthread_mutex_lock(&w->lock);
+    busy = (w->queued >= 0 || w->writing >= 0);
+    pthread_mutex_unlock(&w->lock);
+
+    return busy;
+}
+
+int nbPollCheckpointWriter(NBodyState* st)
+{
+    NBodyCheckpointWriter* w = st->checkpointWriter;
+    unsigned int completed;
+    int failed;
+
+    if (!w)
+        return FALSE;
+
+    pthread_mutex_lock(&w->lock);
+    completed = w->completed;
+    failed = w->failed;
+    w->completed = 0;
+    w->failed = FALSE;
+    pthread_mutex_unlock(&w->lock);
+
+    nbCheckpointCompleted(st, completed);
+
+    return failed;
+}
+
+int nbFinishCheckpointWriter(NBodyState* st)
+{
+    NBodyCheckpointWriter* w = st->checkpointWriter;
+
+    if (!w)
+        return FALSE;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->queued >= 0 || w->writing >= 0)
+    {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return nbPollCheckpointWriter(st);
+}
+
+void nbDestroyCheckpointWriter(NBodyState* st)
+{
+    NBodyCheckpointWriter* w = st->checkpointWriter;
+    int k;
+
+    if (!w)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->quit = TRUE;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    /* Anything written while quitting still needs answering */
+    nbPollCheckpointWriter(st);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+
+    for (k = 0; k < 2; ++k)
+    {
+        mwFreeA(w->buffers[k].bodytab);
+        mwFreeA(w->buffers[k].orbitTrace);
+    }
+
+    free(w->checkpointResolved);
+    free(w);
+    st->checkpointWriter = NULL;
+}
+
+void nbSetCheckpointWriteDelay(unsigned int milliseconds)
+{
+    checkpointWriteDelay = milliseconds;
+}
+
+#else
+
+/* Without threads checkpoints are written as they're taken */
+int nbWriteCheckpointAsync(const NBodyCtx* ctx, NBodyState* st)
+{
+    double tStart = mwGetTime();
+    int failed;
+
+    failed = nbWriteCheckpointNow(ctx, st);
+    nbReportCheckpointStall(st, tStart);
+
+    return failed;
+}
+
+int nbCheckpointWriterBusy(NBodyState* st)
+{
+    (void) st;
+    return FALSE;
+}
+
+int nbPollCheckpointWriter(NBodyState* st)
+{
+    (void) st;
+    return FALSE;
+}
+
+int nbFinishCheckpointWriter(NBodyState* st)
+{
+    (void) st;
+    return FALSE;
+}
+
+void nbDestroyCheckpointWriter(NBodyState* st)
+{
+    (void) st;
+}
+
+void nbSetCheckpointWriteDelay(unsigned int milliseconds)
+{
+    (void) milliseconds;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
     time_t now;
@@ -628,6 +1014,12 @@ NBodyStatus nbWriteFinalCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
     if (BOINC_APPLICATION || ctx->checkpointT >= 0)
     {
+        /* Let a background write finish so it can't replace this one */
+        if (nbFinishCheckpointWriter(st))
+        {
+            mw_printf("Failed to write last background checkpoint\n");
+        }
+
         mw_report("Making final checkpoint\n");
         if (nbWriteCheckpoint(ctx, st))
         {
@@ -59,6 +59,9 @@ const NBodyCtx defaultNBodyCtx =
     /* .checkpointT     */  NOBOINC_DEFAULT_CHECKPOINT_PERIOD,
     /* .nStep           */  0,
 
+    /* .useGroupWalk    */  DEFAULT_USE_GROUP_WALK,
+    /* .potentialTableError */ DEFAULT_POTENTIAL_TABLE_ERROR,
+
     /* .pot             */  EMPTY_POTENTIAL
 };
 
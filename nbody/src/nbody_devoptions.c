@@ -35,8 +35,17 @@ int dev_write_outputs(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlag
         char output_file_name[1024];
         sprintf(output_file_name, "%d", st->step);
         
-        f = mwOpenResolved(output_file_name, "w+");
-        rc = nbOutputBodies(f, ctx, st, nbf);
+        f = mwOpenResolved(output_file_name, nbf->outputBinary ? "wb+" : "w+");
+        if (!f)
+        {
+            mw_printf("Failed to open output file '%s'\n", output_file_name);
+            return 1;
+        }
+
+        if (nbf->outputBinary)
+            rc = nbOutputBodiesBinary(f, ctx, st, nbf);
+        else
+            rc = nbOutputBodies(f, ctx, st, nbf);
         fclose(f);
         
     }
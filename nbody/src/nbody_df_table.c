@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The isotropic and mixed dwarf generators used to rejection sample
+ * every radius from r^2 rho and every speed from v^2 f(E), with the
+ * Eddington integral for f(E) done again for each trial speed. They
+ * still do with tabulateDF = false. Otherwise f(E) and the enclosed
+ * mass of each component are tabulated once on a radial grid, as is the
+ * distribution of speeds on a coarser grid, and bodies are drawn by
+ * inverting cumulative sums.
+ *
+ * The grid starts evenly spaced in log r and intervals are halved until
+ * both the enclosed mass (Simpson against trapezoid) and drho/dpsi
+ * (linear in psi) are good to DF_TOLERANCE. f(E) is
+ *
+ *   1 / (sqrt(8) pi^2) int_psiCut^E (d^2 rho / dpsi^2) dpsi / sqrt(E - psi)
+ *
+ * where psiCut is psi at the truncation times the radius where psi = E,
+ * which is where the rejection sampling stops the integral, or 0.
+ * with d^2 rho / dpsi^2 differenced from drho/dpsi at the nodes and
+ * taken as linear in psi between them. Each piece of that integral is
+ * done exactly, including the singularity at psi = E. Going through
+ * drho/dpsi rather than the second derivatives in r avoids a
+ * cancellation in cored profiles.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_df_table.h"
+#include "nbody_dwarf_potential.h"
+#include "milkyway_util.h"
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+/* Ends of the grid as fractions of the smaller scale length and
+   multiples of the larger bound */
+#define DF_INNER_RADIUS 1.0e-3
+#define DF_OUTER_RADIUS 1.0e3
+
+#define DF_NODES_PER_DECADE 8
+#define DF_MAX_DEPTH 12
+#define DF_MAX_NODES (1 << 16)
+#define DF_TOLERANCE 1.0e-5
+
+/* Relative step of the derivatives in r */
+#define DF_DERIV_STEP 1.0e-2
+
+/* 1 / (sqrt(8) pi^2) */
+#define DF_EDDINGTON_CONST 0.03582244801567226
+
+
+typedef struct
+{
+    real r;
+    real psi;
+    real drhoDPsi;
+    real rho[2];
+    real dm[2];        /* Mass of each component between the last node and this one */
+} DFNode;
+
+typedef struct
+{
+    DFNode* nodes;
+    unsigned int n, size;
+} DFNodeList;
+
+
+static real nbDFPotential(const NBodyDFTable* t, real r)
+{
+    return get_potential(&t->comps[0], r) + get_potential(&t->comps[1], r);
+}
+
+static real nbDFDensity(const NBodyDFTable* t, real r)
+{
+    return get_density(&t->comps[0], r) + get_density(&t->comps[1], r);
+}
+
+static void nbEvalDFNode(const NBodyDFTable* t, real r, DFNode* nd)
+{
+    real h = DF_DERIV_STEP * r;
+    real dPsi, dRho;
+
+    dPsi = 8.0 * (nbDFPotential(t, r + h) - nbDFPotential(t, r - h))
+         - (nbDFPotential(t, r + 2.0 * h) - nbDFPotential(t, r - 2.0 * h));
+    dRho = 8.0 * (nbDFDensity(t, r + h) - nbDFDensity(t, r - h))
+         - (nbDFDensity(t, r + 2.0 * h) - nbDFDensity(t, r - 2.0 * h));
+
+    nd->r = r;
+    nd->psi = nbDFPotential(t, r);
+    nd->drhoDPsi = dRho / dPsi;
+    nd->rho[0] = get_density(&t->comps[0], r);
+    nd->rho[1] = get_density(&t->comps[1], r);
+    nd->dm[0] = 0.0;
+    nd->dm[1] = 0.0;
+}
+
+static void nbAppendDFNode(DFNodeList* list, const DFNode* nd)
+{
+    if (list->n == list->size)
+    {
+        list->size *= 2;
+        list->nodes = (DFNode*) mwRealloc(list->nodes, list->size * sizeof(DFNode));
+    }
+
+    list->nodes[list->n++] = *nd;
+}
+
+/* Add the nodes after a up to and including b */
+static void nbRefineDFInterval(const NBodyDFTable* t, DFNodeList* list, const DFNode* a, const DFNode* b, int depth)
+{
+    DFNode m, end;
+    real lnWidth = mw_log(b->r / a->r);
+    real simpson[2];
+    real w, linear;
+    mwbool refine = FALSE;
+    int c;
+
+    nbEvalDFNode(t, mw_sqrt(a->r * b->r), &m);
+
+    /* Mass as the integral of 4 pi r^3 rho over ln r */
+    for (c = 0; c < 2; ++c)
+    {
+        real fa = cube(a->r) * a->rho[c];
+        real fm = cube(m.r) * m.rho[c];
+        real fb = cube(b->r) * b->rho[c];
+        real trapezoid = 0.25 * lnWidth * (fa + 2.0 * fm + fb);
+
+        simpson[c] = lnWidth * (fa + 4.0 * fm + fb) / 6.0;
+        refine |= (mw_fabs(simpson[c] - trapezoid) > DF_TOLERANCE * simpson[c]);
+    }
+
+    w = (m.psi - a->psi) / (b->psi - a->psi);
+    linear = a->drhoDPsi + w * (b->drhoDPsi - a->drhoDPsi);
+    refine |= (mw_fabs(m.drhoDPsi - linear) > DF_TOLERANCE * mw_fabs(m.drhoDPsi));
+
+    if (refine && depth < DF_MAX_DEPTH && list->n < DF_MAX_NODES)
+    {
+        nbRefineDFInterval(t, list, a, &m, depth + 1);
+        nbRefineDFInterval(t, list, &m, b, depth + 1);
+        return;
+    }
+
+    end = *b;
+    end.dm[0] = 4.0 * M_PI * simpson[0];
+    end.dm[1] = 4.0 * M_PI * simpson[1];
+    nbAppendDFNode(list, &end);
+}
+
+static int compareReals(const void* a, const void* b)
+{
+    real x = *(const real*) a;
+    real y = *(const real*) b;
+
+    return (x > y) - (x < y);
+}
+
+/* The starting grid, with nodes at the bounds */
+static unsigned int nbDFStartingGrid(real rMin, real rMax, const real bounds[2], real** rOut)
+{
+    unsigned int i, n = 0;
+    unsigned int nLog = (unsigned int) mw_ceil(DF_NODES_PER_DECADE * mw_log10(rMax / rMin)) + 1;
+    real* r = (real*) mwMalloc((nLog + 2) * sizeof(real));
+
+    for (i = 0; i < nLog; ++i)
+    {
+        real ri = rMin * mw_pow(rMax / rMin, (real) i / (real) (nLog - 1));
+
+        /* Skip the ones right next to a bound */
+        if (mw_fabs(mw_log(ri / bounds[0])) < 1.0e-3 || mw_fabs(mw_log(ri / bounds[1])) < 1.0e-3)
+            continue;
+        r[n++] = ri;
+    }
+
+    r[n++] = bounds[0];
+    if (bounds[1] != bounds[0])
+        r[n++] = bounds[1];
+
+    qsort(r, n, sizeof(real), compareReals);
+
+    *rOut = r;
+    return n;
+}
+
+/* f(E) at each node. d^2 rho / dpsi^2 comes from differencing drho/dpsi
+   between the nodes, and is taken as linear in psi between them. Past
+   the last node both go to 0 with psi. With a truncation the integral
+   stops at psi of that many times the radius where psi = E. */
+static void nbDFEddington(NBodyDFTable* t, const DFNode* nodes)
+{
+    unsigned int j, k;
+    const unsigned int n = t->n;
+    real* g = (real*) mwMalloc((n + 1) * sizeof(real));
+
+    for (k = 0; k < n; ++k)
+    {
+        real psiNext = (k + 1 < n) ? nodes[k + 1].psi : 0.0;
+        real hNext = (k + 1 < n) ? nodes[k + 1].drhoDPsi : 0.0;
+        real dNext = nodes[k].psi - psiNext;
+        real sNext = (nodes[k].drhoDPsi - hNext) / dNext;
+
+        if (k == 0)
+        {
+            g[k] = sNext;
+        }
+        else
+        {
+            real dPrev = nodes[k - 1].psi - nodes[k].psi;
+            real sPrev = (nodes[k - 1].drhoDPsi - nodes[k].drhoDPsi) / dPrev;
+
+            g[k] = (dNext * sPrev + dPrev * sNext) / (dPrev + dNext);
+        }
+    }
+    g[n] = 0.0;
+
+    for (j = 0; j < n; ++j)
+    {
+        real energy = nodes[j].psi;
+        real psiCut = t->truncation > 0.0 ? nbDFPotential(t, t->truncation * nodes[j].r) : 0.0;
+        real sum = 0.0;
+
+        for (k = j; k < n && nodes[k].psi > psiCut; ++k)
+        {
+            real psiNext = (k + 1 < n) ? nodes[k + 1].psi : 0.0;
+            real delta = nodes[k].psi - psiNext;
+            real slope = (g[k] - g[k + 1]) / delta;
+            real sLo = energy - nodes[k].psi;
+            real sHi = energy - mw_fmax(psiNext, psiCut);
+            real rootLo = mw_sqrt(sLo);
+            real rootHi = mw_sqrt(sHi);
+
+            /* int g / sqrt(E - psi) over the interval, with
+               sqrt(sHi) - sqrt(sLo) = (sHi - sLo) / (rootHi + rootLo) */
+            sum += 2.0 * (sHi - sLo) / (rootHi + rootLo)
+                 * (g[k] + slope * sLo - slope * (sHi + rootHi * rootLo + sLo) / 3.0);
+        }
+
+        t->f[j] = mw_fmax(DF_EDDINGTON_CONST * sum, 0.0);
+    }
+
+    free(g);
+}
+
+static void nbDFSpeedTable(NBodyDFTable* t);
+
+NBodyDFTable* nbMakeDFTable(const Dwarf* comp1, const Dwarf* comp2, real bound1, real bound2, real truncation)
+{
+    NBodyDFTable* t;
+    DFNodeList list;
+    DFNode a, b;
+    real rMin, rMax;
+    real* rStart;
+    unsigned int i, nStart;
+    int c;
+
+    if (!(comp1->scaleLength > 0.0) || !(comp2->scaleLength > 0.0) || !(bound1 > 0.0) || !(bound2 > 0.0))
+        return NULL;
+
+    t = (NBodyDFTable*) mwCalloc(1, sizeof(NBodyDFTable));
+    t->comps[0] = *comp1;
+    t->comps[1] = *comp2;
+    t->bounds[0] = bound1;
+    t->bounds[1] = bound2;
+    t->truncation = truncation;
+
+    rMin = DF_INNER_RADIUS * mw_fmin(comp1->scaleLength, comp2->scaleLength);
+    rMax = DF_OUTER_RADIUS * mw_fmax(bound1, bound2);
+    nStart = nbDFStartingGrid(rMin, rMax, t->bounds, &rStart);
+
+    list.size = 4 * nStart;
+    list.n = 0;
+    list.nodes = (DFNode*) mwMalloc(list.size * sizeof(DFNode));
+
+    /* Everything inside the first node as if the density were flat */
+    nbEvalDFNode(t, rStart[0], &a);
+    a.dm[0] = 4.0 * M_PI * cube(a.r) * a.rho[0] / 3.0;
+    a.dm[1] = 4.0 * M_PI * cube(a.r) * a.rho[1] / 3.0;
+    nbAppendDFNode(&list, &a);
+
+    for (i = 1; i < nStart; ++i)
+    {
+        a = list.nodes[list.n - 1];
+        nbEvalDFNode(t, rStart[i], &b);
+        nbRefineDFInterval(t, &list, &a, &b, 0);
+    }
+
+    free(rStart);
+
+    t->n = list.n;
+    t->r = (real*) mwMalloc(t->n * sizeof(real));
+    t->psi = (real*) mwMalloc(t->n * sizeof(real));
+    t->f = (real*) mwMalloc(t->n * sizeof(real));
+    t->mass[0] = (real*) mwMalloc(t->n * sizeof(real));
+    t->mass[1] = (real*) mwMalloc(t->n * sizeof(real));
+
+    for (i = 0; i < t->n; ++i)
+    {
+        const DFNode* nd = &list.nodes[i];
+
+        if (!isfinite(nd->psi) || !isfinite(nd->drhoDPsi))
+        {
+            mw_printf("Failed to tabulate distribution function at r = %g\n", nd->r);
+            free(list.nodes);
+            nbDestroyDFTable(t);
+            return NULL;
+        }
+
+        t->r[i] = nd->r;
+        t->psi[i] = nd->psi;
+        for (c = 0; c < 2; ++c)
+            t->mass[c][i] = (i == 0 ? 0.0 : t->mass[c][i - 1]) + nd->dm[c];
+    }
+
+    for (c = 0; c < 2; ++c)
+    {
+        for (i = 0; i < t->n && t->r[i] < t->bounds[c]; ++i)
+            ;
+        t->boundNode[c] = i < t->n ? i : t->n - 1;
+    }
+
+    nbDFEddington(t, list.nodes);
+    free(list.nodes);
+
+    nbDFSpeedTable(t);
+
+    return t;
+}
+
+void nbDestroyDFTable(NBodyDFTable* t)
+{
+    if (!t)
+        return;
+
+    free(t->r);
+    free(t->psi);
+    free(t->f);
+    free(t->mass[0]);
+    free(t->mass[1]);
+    free(t->speedCdf);
+    free(t);
+}
+
+/* Last node with psi >= energy, or 0 if there isn't one */
+static unsigned int nbDFFindNode(const NBodyDFTable* t, real energy)
+{
+    unsigned int lo = 0, hi = t->n - 1;
+
+    if (t->psi[hi] >= energy)
+        return hi;
+
+    while (hi - lo > 1)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (t->psi[mid] >= energy)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* f(E) with the node to start looking from, which is moved to the last
+   node with psi >= E. Energies have to go down between calls. */
+static real nbDFLookup(const NBodyDFTable* t, real energy, unsigned int* node)
+{
+    unsigned int i = *node;
+    real w;
+
+    while (i + 1 < t->n && t->psi[i + 1] >= energy)
+        ++i;
+    *node = i;
+
+    if (energy >= t->psi[0])
+        return t->f[0];
+
+    if (energy <= 0.0)
+        return 0.0;
+
+    if (i + 1 == t->n)
+        return t->f[i] * energy / t->psi[i];
+
+    w = (t->psi[i] - energy) / (t->psi[i] - t->psi[i + 1]);
+    return t->f[i] + w * (t->f[i + 1] - t->f[i]);
+}
+
+/* v = q v_esc, so E = psi (1 - q^2) and the speeds go as q^2 f(E) */
+static void nbDFSpeedTable(NBodyDFTable* t)
+{
+    const unsigned int nq = NBODY_DF_SPEED_BINS + 1;
+    real rMax = mw_fmax(t->bounds[0], t->bounds[1]);
+    unsigned int i, j;
+
+    t->speedLogR0 = mw_log(t->r[0]);
+    t->speedDLogR = (mw_log(rMax) - t->speedLogR0) / (real) (NBODY_DF_SPEED_RADII - 1);
+    t->speedCdf = (real*) mwMalloc(NBODY_DF_SPEED_RADII * nq * sizeof(real));
+
+    for (j = 0; j < NBODY_DF_SPEED_RADII; ++j)
+    {
+        real* cdf = &t->speedCdf[j * nq];
+        real psi = nbDFPotential(t, mw_exp(t->speedLogR0 + (real) j * t->speedDLogR));
+        real last = 0.0;
+        unsigned int node = nbDFFindNode(t, psi);
+
+        cdf[0] = 0.0;
+        for (i = 1; i < nq; ++i)
+        {
+            real q = NBODY_DF_MAX_SPEED * (real) i / (real) NBODY_DF_SPEED_BINS;
+            real p = sqr(q) * nbDFLookup(t, psi * (1.0 - sqr(q)), &node);
+
+            cdf[i] = cdf[i - 1] + 0.5 * (last + p);
+            last = p;
+        }
+
+        if (cdf[NBODY_DF_SPEED_BINS] > 0.0)
+        {
+            real total = cdf[NBODY_DF_SPEED_BINS];
+
+            for (i = 0; i < nq; ++i)
+                cdf[i] /= total;
+        }
+    }
+}
+
+real nbDFTableDistFun(const NBodyDFTable* t, real energy)
+{
+    unsigned int node = nbDFFindNode(t, energy);
+
+    return nbDFLookup(t, energy, &node);
+}
+
+real nbDFTableSampleRadius(const NBodyDFTable* t, int comp, dsfmt_t* dsfmtState)
+{
+    const real* m = t->mass[comp];
+    unsigned int lo = 0, hi = t->boundNode[comp];
+    real u, w, r3;
+
+    if (!(m[hi] > 0.0))
+        return 0.0;
+
+    u = (real) mwXrandom(dsfmtState, 0.0, 1.0) * m[hi];
+    if (u <= m[0])
+        return t->r[0] * mw_cbrt(u / m[0]);
+
+    while (hi - lo > 1)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (m[mid] < u)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    /* Flat density within an interval */
+    w = (u - m[lo]) / (m[hi] - m[lo]);
+    r3 = cube(t->r[lo]) + w * (cube(t->r[hi]) - cube(t->r[lo]));
+
+    return mw_cbrt(r3);
+}
+
+/* Between two radii of the grid the speeds are drawn from the linear
+   blend of their distributions */
+static real nbDFSpeedCdf(const real* a, const real* b, real w, unsigned int i)
+{
+    return (1.0 - w) * a[i] + w * b[i];
+}
+
+real nbDFTableSampleSpeed(const NBodyDFTable* t, real r, dsfmt_t* dsfmtState)
+{
+    const unsigned int nq = NBODY_DF_SPEED_BINS + 1;
+    real vEsc = mw_sqrt(2.0 * nbDFPotential(t, r));
+    real x = (mw_log(r) - t->speedLogR0) / t->speedDLogR;
+    real wr, total, u, cLo, cHi;
+    const real* a;
+    const real* b;
+    unsigned int j, lo, hi;
+
+    if (!(x > 0.0))
+    {
+        j = 0;
+        wr = 0.0;
+    }
+    else if (x >= (real) (NBODY_DF_SPEED_RADII - 1))
+    {
+        j = NBODY_DF_SPEED_RADII - 2;
+        wr = 1.0;
+    }
+    else
+    {
+        j = (unsigned int) x;
+        wr = x - (real) j;
+    }
+
+    a = &t->speedCdf[j * nq];
+    b = a + nq;
+
+    total = nbDFSpeedCdf(a, b, wr, NBODY_DF_SPEED_BINS);
+    if (!(total > 0.0))
+        return 0.0;
+
+    u = (real) mwXrandom(dsfmtState, 0.0, 1.0) * total;
+
+    lo = 0;
+    hi = NBODY_DF_SPEED_BINS;
+    while (hi - lo > 1)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (nbDFSpeedCdf(a, b, wr, mid) < u)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    cLo = nbDFSpeedCdf(a, b, wr, lo);
+    cHi = nbDFSpeedCdf(a, b, wr, hi);
+
+    return NBODY_DF_MAX_SPEED * vEsc * ((real) lo + (u - cLo) / (cHi - cLo)) / (real) NBODY_DF_SPEED_BINS;
+}
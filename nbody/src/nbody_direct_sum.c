@@ -0,0 +1,208 @@
+/*
+ *  Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_direct_sum.h"
+#include "milkyway_cpuid.h"
+
+
+NBodyDirectSumFunc nbDirectSum = NULL;
+
+
+/* MSVC can't do weak imports. Using dlsym()/GetProcAddress() etc. would be better */
+#if !HAVE_AVX512F || !DOUBLEPREC || !MW_IS_X86
+  #define nbDirectSum_AVX512F NULL
+#endif
+
+#if !HAVE_AVX || !DOUBLEPREC || !MW_IS_X86
+  #define nbDirectSum_AVX NULL
+#endif
+
+#if !HAVE_SSE2 || !DOUBLEPREC || !MW_IS_X86
+  #define nbDirectSum_SSE2 NULL
+#endif
+
+/* Can't use the functions themselves if defined to NULL */
+static NBodyDirectSumFunc directSumAVX512F = nbDirectSum_AVX512F;
+static NBodyDirectSumFunc directSumAVX = nbDirectSum_AVX;
+static NBodyDirectSumFunc directSumSSE2 = nbDirectSum_SSE2;
+
+
+/* Add up the partial sums of the lanes. The intrinsics versions use
+   the same order. */
+static inline real nbSumLanes(const real* p)
+{
+    return ((p[0] + p[1]) + (p[2] + p[3])) + ((p[4] + p[5]) + (p[6] + p[7]));
+}
+
+void nbDirectSum_Generic(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                         const real* RESTRICT m, int nSource,
+                         const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                         int nTarget, real eps2,
+                         real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az)
+{
+    int i0, i, j0, j;
+    real part[NBODY_DIRECT_SUM_TARGET_BLOCK][3][NBODY_DIRECT_SUM_LANES];
+
+    for (i0 = 0; i0 < nTarget; i0 += NBODY_DIRECT_SUM_TARGET_BLOCK)
+    {
+        const int nt = nTarget - i0 < NBODY_DIRECT_SUM_TARGET_BLOCK ? nTarget - i0 : NBODY_DIRECT_SUM_TARGET_BLOCK;
+
+        memset(part, 0, nt * sizeof(part[0]));
+
+        for (j0 = 0; j0 < nSource; j0 += NBODY_DIRECT_SUM_SOURCE_TILE)
+        {
+            const int jEnd = nSource - j0 < NBODY_DIRECT_SUM_SOURCE_TILE ? nSource : j0 + NBODY_DIRECT_SUM_SOURCE_TILE;
+
+            for (i = 0; i < nt; ++i)
+            {
+                real* RESTRICT sx = part[i][0];
+                real* RESTRICT sy = part[i][1];
+                real* RESTRICT sz = part[i][2];
+                const real xi = px[i0 + i];
+                const real yi = py[i0 + i];
+                const real zi = pz[i0 + i];
+
+                for (j = j0; j < jEnd; ++j)
+                {
+                    const int l = j & (NBODY_DIRECT_SUM_LANES - 1);
+                    real dx = x[j] - xi;
+                    real dy = y[j] - yi;
+                    real dz = z[j] - zi;
+                    real drSq = dx * dx + dy * dy + dz * dz + eps2;
+
+                    real drab = mw_sqrt(drSq);
+                    real mor3 = m[j] / (drab * drSq);
+
+                    sx[l] += dx * mor3;
+                    sy[l] += dy * mor3;
+                    sz[l] += dz * mor3;
+                }
+            }
+        }
+
+        for (i = 0; i < nt; ++i)
+        {
+            ax[i0 + i] = nbSumLanes(part[i][0]);
+            ay[i0 + i] = nbSumLanes(part[i][1]);
+            az[i0 + i] = nbSumLanes(part[i][2]);
+        }
+    }
+}
+
+static const char* showNBodyDirectSumLevel(NBodyDirectSumLevel level)
+{
+    switch (level)
+    {
+        case NBODY_DIRECT_SUM_BEST:
+            return "best";
+        case NBODY_DIRECT_SUM_GENERIC:
+            return "generic";
+        case NBODY_DIRECT_SUM_SSE2:
+            return "SSE2";
+        case NBODY_DIRECT_SUM_AVX:
+            return "AVX";
+        case NBODY_DIRECT_SUM_AVX512F:
+            return "AVX-512F";
+        default:
+            return "invalid direct sum level";
+    }
+}
+
+int nbDirectSumDispatch(NBodyDirectSumLevel level, int verbose)
+{
+    int hasSSE2 = FALSE, hasAVX = FALSE, hasAVX512F = FALSE;
+    NBodyDirectSumLevel used;
+
+  #if MW_IS_X86
+    int abcd[4];
+    int maxLeaf;
+
+    mw_cpuid(abcd, 0, 0);
+    maxLeaf = abcd[0];
+
+    mw_cpuid(abcd, 1, 0);
+    hasAVX = mwHasAVX(abcd) && mwOSHasAVXSupport();
+    hasSSE2 = mwHasSSE2(abcd);
+
+    if (maxLeaf >= 7)
+    {
+        mw_cpuid(abcd, 7, 0);
+        hasAVX512F = hasAVX && mwHasAVX512F(abcd) && mwOSHasAVX512Support();
+    }
+  #endif /* MW_IS_X86 */
+
+    hasAVX512F = hasAVX512F && directSumAVX512F;
+    hasAVX = hasAVX && directSumAVX;
+    hasSSE2 = hasSSE2 && directSumSSE2;
+
+    if (verbose)
+    {
+        mw_printf("Direct sum functions: SSE2 = %d, AVX = %d, AVX-512F = %d\n",
+                  hasSSE2, hasAVX, hasAVX512F);
+    }
+
+    if (level == NBODY_DIRECT_SUM_BEST)
+    {
+        if (hasAVX512F)
+            used = NBODY_DIRECT_SUM_AVX512F;
+        else if (hasAVX)
+            used = NBODY_DIRECT_SUM_AVX;
+        else if (hasSSE2)
+            used = NBODY_DIRECT_SUM_SSE2;
+        else
+            used = NBODY_DIRECT_SUM_GENERIC;
+    }
+    else
+    {
+        used = level;
+    }
+
+    switch (used)
+    {
+        case NBODY_DIRECT_SUM_AVX512F:
+            nbDirectSum = hasAVX512F ? directSumAVX512F : NULL;
+            break;
+        case NBODY_DIRECT_SUM_AVX:
+            nbDirectSum = hasAVX ? directSumAVX : NULL;
+            break;
+        case NBODY_DIRECT_SUM_SSE2:
+            nbDirectSum = hasSSE2 ? directSumSSE2 : NULL;
+            break;
+        case NBODY_DIRECT_SUM_GENERIC:
+            nbDirectSum = nbDirectSum_Generic;
+            break;
+        case NBODY_DIRECT_SUM_BEST:
+        default:
+            nbDirectSum = NULL;
+    }
+
+    if (!nbDirectSum)
+    {
+        mw_printf("Direct sum path '%s' is not available\n", showNBodyDirectSumLevel(level));
+        nbDirectSum = nbDirectSum_Generic;
+        return 1;
+    }
+
+    if (verbose)
+    {
+        mw_printf("Using %s direct sum path\n", showNBodyDirectSumLevel(used));
+    }
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is built once for each of SSE2, AVX and AVX-512F. It does the
+ * same operations in the same order as nbDirectSum_Generic(), with the
+ * partial sums of NBODY_DIRECT_SUM_LANES lanes split over as many
+ * vectors as it takes. */
+
+#include "nbody_direct_sum.h"
+
+#if defined(__AVX512F__)
+  #include <immintrin.h>
+
+  typedef __m512d nbvec;
+  #define NB_VEC_WIDTH 8
+  #define nb_loadu   _mm512_loadu_pd
+  #define nb_storeu  _mm512_storeu_pd
+  #define nb_set1    _mm512_set1_pd
+  #define nb_add     _mm512_add_pd
+  #define nb_sub     _mm512_sub_pd
+  #define nb_mul     _mm512_mul_pd
+  #define nb_div     _mm512_div_pd
+  #define nb_sqrt    _mm512_sqrt_pd
+#elif defined(__AVX__)
+  #include <immintrin.h>
+
+  typedef __m256d nbvec;
+  #define NB_VEC_WIDTH 4
+  #define nb_loadu   _mm256_loadu_pd
+  #define nb_storeu  _mm256_storeu_pd
+  #define nb_set1    _mm256_set1_pd
+  #define nb_add     _mm256_add_pd
+  #define nb_sub     _mm256_sub_pd
+  #define nb_mul     _mm256_mul_pd
+  #define nb_div     _mm256_div_pd
+  #define nb_sqrt    _mm256_sqrt_pd
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+
+  typedef __m128d nbvec;
+  #define NB_VEC_WIDTH 2
+  #define nb_loadu   _mm_loadu_pd
+  #define nb_storeu  _mm_storeu_pd
+  #define nb_set1    _mm_set1_pd
+  #define nb_add     _mm_add_pd
+  #define nb_sub     _mm_sub_pd
+  #define nb_mul     _mm_mul_pd
+  #define nb_div     _mm_div_pd
+  #define nb_sqrt    _mm_sqrt_pd
+#else
+  #error "Direct sum intrinsics built without SSE2, AVX or AVX-512F"
+#endif
+
+#define NB_VECS (NBODY_DIRECT_SUM_LANES / NB_VEC_WIDTH)
+
+
+static inline real nbSumLanes(const real* p)
+{
+    return ((p[0] + p[1]) + (p[2] + p[3])) + ((p[4] + p[5]) + (p[6] + p[7]));
+}
+
+void NB_DIRECT_SUM_INTRIN(const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                          const real* RESTRICT m, int nSource,
+                          const real* RESTRICT px, const real* RESTRICT py, const real* RESTRICT pz,
+                          int nTarget, real eps2,
+                          real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az)
+{
+    int i0, i, j0, j, v;
+    MW_ALIGN_V(64) real part[NBODY_DIRECT_SUM_TARGET_BLOCK][3][NBODY_DIRECT_SUM_LANES];
+    const nbvec veps2 = nb_set1(eps2);
+
+    for (i0 = 0; i0 < nTarget; i0 += NBODY_DIRECT_SUM_TARGET_BLOCK)
+    {
+        const int nt = nTarget - i0 < NBODY_DIRECT_SUM_TARGET_BLOCK ? nTarget - i0 : NBODY_DIRECT_SUM_TARGET_BLOCK;
+
+        memset(part, 0, nt * sizeof(part[0]));
+
+        for (j0 = 0; j0 < nSource; j0 += NBODY_DIRECT_SUM_SOURCE_TILE)
+        {
+            const int jEnd = nSource - j0 < NBODY_DIRECT_SUM_SOURCE_TILE ? nSource : j0 + NBODY_DIRECT_SUM_SOURCE_TILE;
+            const int jVecEnd = j0 + ((jEnd - j0) & ~(NBODY_DIRECT_SUM_LANES - 1));
+
+            for (i = 0; i < nt; ++i)
+            {
+                nbvec sx[NB_VECS], sy[NB_VECS], sz[NB_VECS];
+                const real xi = px[i0 + i];
+                const real yi = py[i0 + i];
+                const real zi = pz[i0 + i];
+                const nbvec vxi = nb_set1(xi);
+                const nbvec vyi = nb_set1(yi);
+                const nbvec vzi = nb_set1(zi);
+
+                for (v = 0; v < NB_VECS; ++v)
+                {
+                    sx[v] = nb_loadu(&part[i][0][v * NB_VEC_WIDTH]);
+                    sy[v] = nb_loadu(&part[i][1][v * NB_VEC_WIDTH]);
+                    sz[v] = nb_loadu(&part[i][2][v * NB_VEC_WIDTH]);
+                }
+
+                for (j = j0; j < jVecEnd; j += NBODY_DIRECT_SUM_LANES)
+                {
+                    for (v = 0; v < NB_VECS; ++v)
+                    {
+                        const int k = j + v * NB_VEC_WIDTH;
+                        nbvec dx = nb_sub(nb_loadu(&x[k]), vxi);
+                        nbvec dy = nb_sub(nb_loadu(&y[k]), vyi);
+                        nbvec dz = nb_sub(nb_loadu(&z[k]), vzi);
+                        nbvec drSq = nb_add(nb_add(nb_add(nb_mul(dx, dx), nb_mul(dy, dy)), nb_mul(dz, dz)), veps2);
+
+                        nbvec drab = nb_sqrt(drSq);
+                        nbvec mor3 = nb_div(nb_loadu(&m[k]), nb_mul(drab, drSq));
+
+                        sx[v] = nb_add(sx[v], nb_mul(dx, mor3));
+                        sy[v] = nb_add(sy[v], nb_mul(dy, mor3));
+                        sz[v] = nb_add(sz[v], nb_mul(dz, mor3));
+                    }
+                }
+
+                for (v = 0; v < NB_VECS; ++v)
+                {
+                    nb_storeu(&part[i][0][v * NB_VEC_WIDTH], sx[v]);
+                    nb_storeu(&part[i][1][v * NB_VEC_WIDTH], sy[v]);
+                    nb_storeu(&part[i][2][v * NB_VEC_WIDTH], sz[v]);
+                }
+
+                /* Leftover sources go to their lanes one at a time */
+                for (j = jVecEnd; j < jEnd; ++j)
+                {
+                    const int l = j & (NBODY_DIRECT_SUM_LANES - 1);
+                    real dx = x[j] - xi;
+                    real dy = y[j] - yi;
+                    real dz = z[j] - zi;
+                    real drSq = dx * dx + dy * dy + dz * dz + eps2;
+
+                    real drab = mw_sqrt(drSq);
+                    real mor3 = m[j] / (drab * drSq);
+
+                    part[i][0][l] += dx * mor3;
+                    part[i][1][l] += dy * mor3;
+                    part[i][2][l] += dz * mor3;
+                }
+            }
+        }
+
+        for (i = 0; i < nt; ++i)
+        {
+            ax[i0 + i] = nbSumLanes(part[i][0]);
+            ay[i0 + i] = nbSumLanes(part[i][1]);
+            az[i0 + i] = nbSumLanes(part[i][2]);
+        }
+    }
+}
@@ -22,17 +22,25 @@
 #include "nbody_priv.h"
 #include "nbody_util.h"
 #include "nbody_grav.h"
+#include "nbody_direct_sum.h"
 #include "milkyway_util.h"
 
 #ifdef _OPENMP
   #include <omp.h>
 #endif /* _OPENMP */
 
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
 
 /*
  * nbodyGravity: Walk the tree starting at the root to do force
  * calculations.
  *
+ * The walk goes over the linearised copy of the tree built by
+ * nbMakeTree, which keeps the nodes contiguous in the order they are
+ * visited.
  *
  * Random notes:
  *   - Not inlined without inline from multiple calls in
@@ -46,16 +54,20 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
     mwvector pos0 = Pos(p);
     mwvector acc0 = ZERO_VECTOR;
 
-    const NBodyNode* q = (const NBodyNode*) st->tree.root; /* Start at the root */
+    const NBodyTreeNode* nodes = st->tree.nodes;
+    const NBodyQuadMatrix* quads = st->tree.quads;
+    const int self = (int) (p - st->bodytab);
+    int i = 0;                      /* Start at the root */
 
-    while (q != NULL)               /* while not at end of scan */
+    while (i >= 0)                  /* while not at end of scan */
     {
-        mwvector dr = mw_subv(Pos(q), pos0);   /* Then compute distance */
+        const NBodyTreeNode* q = &nodes[i];
+        mwvector dr = mw_subv(q->pos, pos0);   /* Then compute distance */
         real drSq = mw_sqrv(dr);               /* and distance squared */
 
-        if (isBody(q) || (drSq >= Rcrit2(q)))      /* If is a body or far enough away to approximate */
+        if (q->body >= 0 || (drSq >= q->rcrit2))   /* If is a body or far enough away to approximate */
         {
-            if (mw_likely((const Body*) q != p))   /* self-interaction? */
+            if (mw_likely(q->body != self))        /* self-interaction? */
             {
                 real drab, phii, mor3;
 
@@ -63,22 +75,23 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
 
                 drSq += ctx->eps2;   /* use standard softening */
                 drab = mw_sqrt(drSq);
-                phii = Mass(q) / drab;
+                phii = q->mass / drab;
                 mor3 = phii / drSq;
 
                 acc0.x += mor3 * dr.x;
                 acc0.y += mor3 * dr.y;
                 acc0.z += mor3 * dr.z;
 
-                if (ctx->useQuad && isCell(q))          /* if cell, add quad term */
+                if (ctx->useQuad && q->body < 0)       /* if cell, add quad term */
                 {
                     real dr5inv, drQdr, phiQ;
                     mwvector Qdr;
+                    const NBodyQuadMatrix* Q = &quads[i];
 
                     /* form Q * dr */
-                    Qdr.x = Quad(q).xx * dr.x + Quad(q).xy * dr.y + Quad(q).xz * dr.z;
-                    Qdr.y = Quad(q).xy * dr.x + Quad(q).yy * dr.y + Quad(q).yz * dr.z;
-                    Qdr.z = Quad(q).xz * dr.x + Quad(q).yz * dr.y + Quad(q).zz * dr.z;
+                    Qdr.x = Q->xx * dr.x + Q->xy * dr.y + Q->xz * dr.z;
+                    Qdr.y = Q->xy * dr.x + Q->yy * dr.y + Q->yz * dr.z;
+                    Qdr.z = Q->xz * dr.x + Q->yz * dr.y + Q->zz * dr.z;
 
 
                     /* form dr * Q * dr */
@@ -104,11 +117,11 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
                 skipSelf = TRUE;   /* Encountered self */
             }
 
-            q = Next(q);  /* Follow next link */
+            i = q->next;  /* Follow next link */
         }
         else
         {
-             q = More(q); /* Follow to the next level if need to go deeper */
+             i = q->more; /* Follow to the next level if need to go deeper */
         }
     }
 
@@ -127,110 +140,632 @@ static inline void nbMapForceBody(const NBodyCtx* ctx, NBodyState* st)
 {
     int i;
     const int nbody = st->nbody;  /* Prevent reload on each loop */
-    mwvector a, externAcc;
-    const Body* b;
 
     const Body* bodies = mw_assume_aligned(st->bodytab, 16);
     mwvector* accels = mw_assume_aligned(st->acctab, 16);
 
+    /* The external potential is added afterwards by nbMapExternalAcceleration() */
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
   #endif
     for (i = 0; i < nbody; ++i)      /* get force on each body */
     {
-        /* Repeat the base hackGrav part in each case or else GCC's
-         * -funswitch-loops doesn't happen. Without that this constant
-         * gets checked on every body on every step which is dumb.  */
-        switch (ctx->potentialType)
-        {
-            case EXTERNAL_POTENTIAL_DEFAULT:
-                /* Include the external potential */
-                b = &bodies[i];
-                a = nbGravity(ctx, st, b);
-
-                externAcc = nbExtAcceleration(&ctx->pot, Pos(b));
-                mw_incaddv(a, externAcc);
-                accels[i] = a;
-                break;
-
-            case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity(ctx, st, &bodies[i]);
-                break;
-
-            case EXTERNAL_POTENTIAL_CUSTOM_LUA:
-                a = nbGravity(ctx, st, &bodies[i]);
-                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
-                mw_incaddv(a, externAcc)
-                accels[i] = a;
-                break;
-
-            default:
-                mw_fail("Bad external potential type: %d\n", ctx->potentialType);
-        }
+        accels[i] = nbGravity(ctx, st, &bodies[i]);
     }
 }
 
-static mwvector nbGravity_Exact(const NBodyCtx* ctx, NBodyState* st, const Body* p)
+/* Same as nbMapForceBody, but the accelerations go to the SoA arrays */
+static inline void nbMapForceBodySoA(const NBodyCtx* ctx, NBodyState* st)
 {
     int i;
     const int nbody = st->nbody;
-    mwvector a = ZERO_VECTOR;
-    const real eps2 = ctx->eps2;
+    mwvector a;
 
+    const Body* bodies = mw_assume_aligned(st->bodytab, 16);
+    real* RESTRICT ax = st->soa->acc[0];
+    real* RESTRICT ay = st->soa->acc[1];
+    real* RESTRICT az = st->soa->acc[2];
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, a) shared(bodies, ax, ay, az) schedule(dynamic, 4096 / sizeof(mwvector))
+  #endif
     for (i = 0; i < nbody; ++i)
     {
-        const Body* b = &st->bodytab[i];
+        a = nbGravity(ctx, st, &bodies[i]);
 
-        mwvector dr = mw_subv(Pos(b), Pos(p));
-        real drSq = mw_sqrv(dr) + eps2;
+        ax[i] = X(a);
+        ay[i] = Y(a);
+        az[i] = Z(a);
+    }
+}
 
-        real drab = mw_sqrt(drSq);
-        real phii = Mass(b) / drab;
-        real mor3 = phii / drSq;
+/* Largest subtree, counted in nodes, walked as a single group */
+#define NBODY_WALK_GROUP_NODES 128
+
+static void nbFreeInteractionList(NBodyInteractionList* l)
+{
+    int k;
+
+    for (k = 0; k < 3; ++k)
+    {
+        free(l->pos[k]);
+    }
 
-        mw_incaddv(a, mw_mulvs(dr, mor3));
+    for (k = 0; k < 6; ++k)
+    {
+        free(l->quad[k]);
     }
 
-    return a;
+    free(l->mass);
+    free(l->body);
 }
 
-static inline void nbMapForceBody_Exact(const NBodyCtx* ctx, NBodyState* st)
+void nbFreeWalkScratch(NBodyWalkScratch* s)
 {
     int i;
-    const int nbody = st->nbody;  /* Prevent reload on each loop */
-    mwvector a, externAcc;
-    const Body* b;
 
-    Body* bodies = mw_assume_aligned(st->bodytab, 16);
+    for (i = 0; i < s->nThreads; ++i)
+    {
+        nbFreeInteractionList(&s->cells[i]);
+        nbFreeInteractionList(&s->bodies[i]);
+    }
+
+    free(s->cells);
+    free(s->bodies);
+    free(s->groups);
+    nbFreeInteractionList(&s->direct);
+
+    memset(s, 0, sizeof(*s));
+}
+
+/* Cells always get room for quadrupole moments so the list doesn't
+   depend on the context it was first used with */
+static void nbGrowInteractionList(NBodyInteractionList* l, mwbool isCellList)
+{
+    int k;
+    int max = l->max > 0 ? 2 * l->max : 256;
+
+    for (k = 0; k < 3; ++k)
+    {
+        l->pos[k] = (real*) mwRealloc(l->pos[k], max * sizeof(real));
+    }
+    l->mass = (real*) mwRealloc(l->mass, max * sizeof(real));
+
+    if (isCellList)
+    {
+        for (k = 0; k < 6; ++k)
+        {
+            l->quad[k] = (real*) mwRealloc(l->quad[k], max * sizeof(real));
+        }
+    }
+    else
+    {
+        l->body = (int*) mwRealloc(l->body, max * sizeof(int));
+    }
+
+    l->max = max;
+}
+
+/* Direct sum over all pairs with nbDirectSum. The sources are the SoA
+ * arrays if they are in use, otherwise the bodies are copied into the
+ * same layout first. Each block of targets is summed against every
+ * source, including itself, which adds nothing with the softening. */
+static void nbMapForceBody_Exact(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i0, i;
+    const int nbody = st->nbody;
+    const real eps2 = ctx->eps2;
+    const real* x;
+    const real* y;
+    const real* z;
+    const real* m;
+
+    const Body* bodies = mw_assume_aligned(st->bodytab, 16);
     mwvector* accels = mw_assume_aligned(st->acctab, 16);
+    NBodySoA* soa = st->soa;
+
+    if (soa)
+    {
+        x = soa->pos[0];
+        y = soa->pos[1];
+        z = soa->pos[2];
+        m = soa->masses;
+    }
+    else
+    {
+        NBodyInteractionList* l = &st->walkScratch.direct;
+
+        while (l->max < nbody)
+        {
+            nbGrowInteractionList(l, FALSE);
+        }
+
+        for (i = 0; i < nbody; ++i)
+        {
+            l->pos[0][i] = X(Pos(&bodies[i]));
+            l->pos[1][i] = Y(Pos(&bodies[i]));
+            l->pos[2][i] = Z(Pos(&bodies[i]));
+            l->mass[i] = Mass(&bodies[i]);
+        }
+        l->n = nbody;
+
+        x = l->pos[0];
+        y = l->pos[1];
+        z = l->pos[2];
+        m = l->mass;
+    }
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i0, i) shared(x, y, z, m, accels, soa) schedule(dynamic, 1)
   #endif
-    for (i = 0; i < nbody; ++i)      /* get force on each body */
+    for (i0 = 0; i0 < nbody; i0 += NBODY_DIRECT_SUM_TARGET_BLOCK)
+    {
+        real ax[NBODY_DIRECT_SUM_TARGET_BLOCK];
+        real ay[NBODY_DIRECT_SUM_TARGET_BLOCK];
+        real az[NBODY_DIRECT_SUM_TARGET_BLOCK];
+        const int nt = nbody - i0 < NBODY_DIRECT_SUM_TARGET_BLOCK ? nbody - i0 : NBODY_DIRECT_SUM_TARGET_BLOCK;
+
+        nbDirectSum(x, y, z, m, nbody, &x[i0], &y[i0], &z[i0], nt, eps2, ax, ay, az);
+
+        for (i = 0; i < nt; ++i)
+        {
+            if (soa)
+            {
+                soa->acc[0][i0 + i] = ax[i];
+                soa->acc[1][i0 + i] = ay[i];
+                soa->acc[2][i0 + i] = az[i];
+            }
+            else
+            {
+                SET_VECTOR(accels[i0 + i], ax[i], ay[i], az[i]);
+            }
+        }
+    }
+}
+
+/* Make sure there is room for a group per node and a pair of lists
+ * per thread. The lists themselves grow as they are filled. */
+static void nbReserveWalkScratch(NBodyWalkScratch* s, int nNode, int nThreads)
+{
+    if (s->maxGroup < nNode)
+    {
+        free(s->groups);
+        s->groups = (int*) mwMalloc(2 * nNode * sizeof(int));
+        s->maxGroup = nNode;
+    }
+
+    if (s->nThreads < nThreads)
+    {
+        int i;
+
+        for (i = 0; i < s->nThreads; ++i)
+        {
+            nbFreeInteractionList(&s->cells[i]);
+            nbFreeInteractionList(&s->bodies[i]);
+        }
+        free(s->cells);
+        free(s->bodies);
+
+        s->cells = (NBodyInteractionList*) mwCalloc(nThreads, sizeof(NBodyInteractionList));
+        s->bodies = (NBodyInteractionList*) mwCalloc(nThreads, sizeof(NBodyInteractionList));
+        s->nThreads = nThreads;
+    }
+}
+
+/* Split the linearised tree into groups. A group is the largest
+ * subtree with at most NBODY_WALK_GROUP_NODES nodes, so its bodies are
+ * close together and are the contiguous range of nodes it covers. */
+static void nbFindWalkGroups(NBodyState* st)
+{
+    NBodyWalkScratch* s = &st->walkScratch;
+    const NBodyTreeNode* nodes = st->tree.nodes;
+    const int nNode = (int) st->tree.nNode;
+    int i = 0;
+
+    s->nGroup = 0;
+
+    while (i >= 0)
     {
-        switch (ctx->potentialType)
+        const NBodyTreeNode* q = &nodes[i];
+        int end = q->next >= 0 ? q->next : nNode;  /* The last subtree runs to the end */
+
+        if (q->body >= 0 || end - i <= NBODY_WALK_GROUP_NODES)
+        {
+            if (q->body >= 0 || q->more >= 0)      /* Skip empty cells */
+            {
+                s->groups[2 * s->nGroup] = i;
+                s->groups[2 * s->nGroup + 1] = end;
+                s->nGroup++;
+            }
+            i = q->next;
+        }
+        else
         {
-            case EXTERNAL_POTENTIAL_DEFAULT:
-                b = &bodies[i];
-                a = nbGravity_Exact(ctx, st, b);
-                mw_incaddv(a, nbExtAcceleration(&ctx->pot, Pos(b)));
-                accels[i] = a;
-                break;
-
-            case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity_Exact(ctx, st, &bodies[i]);
-                break;
-
-            case EXTERNAL_POTENTIAL_CUSTOM_LUA:
-                a = nbGravity_Exact(ctx, st, &bodies[i]);
-                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
-                mw_incaddv(a, externAcc);
-                accels[i] = a;
-                break;
-
-            default:
-                mw_fail("Bad external potential type: %d\n", ctx->potentialType);
+            i = q->more;
+        }
+    }
+}
+
+/* Walk the tree once for the bodies in nodes [start, end) and collect
+ * everything they interact with. A cell is only accepted if it is far
+ * enough away from every point of the group's bounding box, so it
+ * would also have been accepted by the walk of each body on its own.
+ *
+ * The group's own bodies then end up in the body list in node order,
+ * and the position of the first of them there is returned. With a
+ * large enough opening angle (BH86 with theta above about 0.577) a cell
+ * holding some of them can be accepted. That would be tree incest for
+ * those bodies on their own walks too, and -1 is returned.
+ */
+static int nbGroupInteractionList(const NBodyCtx* ctx,
+                                  const NBodyState* st,
+                                  int start,
+                                  int end,
+                                  int nSelf,
+                                  NBodyInteractionList* RESTRICT cells,
+                                  NBodyInteractionList* RESTRICT bodies)
+{
+    int i, k;
+    int selfBase = -1;
+    int nFound = 0;
+    real lo[3] = { REAL_MAX, REAL_MAX, REAL_MAX };
+    real hi[3] = { -REAL_MAX, -REAL_MAX, -REAL_MAX };
+
+    const NBodyTreeNode* nodes = st->tree.nodes;
+    const NBodyQuadMatrix* quads = st->tree.quads;
+
+    for (i = start; i < end; ++i)
+    {
+        const NBodyTreeNode* q = &nodes[i];
+
+        if (q->body >= 0)
+        {
+            lo[0] = mw_fmin(lo[0], X(q->pos));
+            lo[1] = mw_fmin(lo[1], Y(q->pos));
+            lo[2] = mw_fmin(lo[2], Z(q->pos));
+            hi[0] = mw_fmax(hi[0], X(q->pos));
+            hi[1] = mw_fmax(hi[1], Y(q->pos));
+            hi[2] = mw_fmax(hi[2], Z(q->pos));
+        }
+    }
+
+    cells->n = 0;
+    bodies->n = 0;
+
+    i = 0;                          /* Start at the root */
+    while (i >= 0)
+    {
+        const NBodyTreeNode* q = &nodes[i];
+
+        if (q->body >= 0)
+        {
+            if (bodies->n == bodies->max)
+            {
+                nbGrowInteractionList(bodies, FALSE);
+            }
+
+            if (i >= start && i < end)
+            {
+                if (selfBase < 0)
+                    selfBase = bodies->n;
+                ++nFound;
+            }
+
+            k = bodies->n++;
+            bodies->pos[0][k] = X(q->pos);
+            bodies->pos[1][k] = Y(q->pos);
+            bodies->pos[2][k] = Z(q->pos);
+            bodies->mass[k] = q->mass;
+            bodies->body[k] = q->body;
+
+            i = q->next;
+        }
+        else
+        {
+            /* Distance from the cell's center of mass to the nearest point of the box */
+            real dx = mw_fmax(0.0, mw_fmax(lo[0] - X(q->pos), X(q->pos) - hi[0]));
+            real dy = mw_fmax(0.0, mw_fmax(lo[1] - Y(q->pos), Y(q->pos) - hi[1]));
+            real dz = mw_fmax(0.0, mw_fmax(lo[2] - Z(q->pos), Z(q->pos) - hi[2]));
+
+            if (dx * dx + dy * dy + dz * dz >= q->rcrit2)
+            {
+                if (cells->n == cells->max)
+                {
+                    nbGrowInteractionList(cells, TRUE);
+                }
+
+                k = cells->n++;
+                cells->pos[0][k] = X(q->pos);
+                cells->pos[1][k] = Y(q->pos);
+                cells->pos[2][k] = Z(q->pos);
+                cells->mass[k] = q->mass;
+
+                if (ctx->useQuad)
+                {
+                    const NBodyQuadMatrix* Q = &quads[i];
+
+                    cells->quad[0][k] = Q->xx;
+                    cells->quad[1][k] = Q->xy;
+                    cells->quad[2][k] = Q->xz;
+                    cells->quad[3][k] = Q->yy;
+                    cells->quad[4][k] = Q->yz;
+                    cells->quad[5][k] = Q->zz;
+                }
+
+                i = q->next;
+            }
+            else
+            {
+                i = q->more;
+            }
+        }
+    }
+
+    return nFound == nSelf ? selfBase : -1;
+}
+
+/* Force on the body at pos0 from the cells of a group interaction
+   list. The bodies are done separately with nbDirectSum. */
+static mwvector nbGroupCellGravity(const NBodyCtx* ctx,
+                                   const NBodyInteractionList* RESTRICT cells,
+                                   mwvector pos0)
+{
+    int j;
+    const int nCell = cells->n;
+    const real eps2 = ctx->eps2;
+    const real* RESTRICT x = cells->pos[0];
+    const real* RESTRICT y = cells->pos[1];
+    const real* RESTRICT z = cells->pos[2];
+    const real* RESTRICT m = cells->mass;
+    real ax = 0.0, ay = 0.0, az = 0.0;
+    mwvector acc = ZERO_VECTOR;
+
+    if (ctx->useQuad)
+    {
+        const real* RESTRICT qxx = cells->quad[0];
+        const real* RESTRICT qxy = cells->quad[1];
+        const real* RESTRICT qxz = cells->quad[2];
+        const real* RESTRICT qyy = cells->quad[3];
+        const real* RESTRICT qyz = cells->quad[4];
+        const real* RESTRICT qzz = cells->quad[5];
+
+        for (j = 0; j < nCell; ++j)
+        {
+            real dx = x[j] - X(pos0);
+            real dy = y[j] - Y(pos0);
+            real dz = z[j] - Z(pos0);
+            real drSq = dx * dx + dy * dy + dz * dz + eps2;
+
+            real drab = mw_sqrt(drSq);
+            real mor3 = m[j] / (drab * drSq);
+
+            /* Q * dr and dr * Q * dr */
+            real qdx = qxx[j] * dx + qxy[j] * dy + qxz[j] * dz;
+            real qdy = qxy[j] * dx + qyy[j] * dy + qyz[j] * dz;
+            real qdz = qxz[j] * dx + qyz[j] * dy + qzz[j] * dz;
+            real drQdr = qdx * dx + qdy * dy + qdz * dz;
+
+            real dr5inv = 1.0 / (drSq * drSq * drab);
+            real phiQ = 2.5 * (dr5inv * drQdr) / drSq;
+
+            ax += (mor3 + phiQ) * dx - dr5inv * qdx;
+            ay += (mor3 + phiQ) * dy - dr5inv * qdy;
+            az += (mor3 + phiQ) * dz - dr5inv * qdz;
+        }
+    }
+    else
+    {
+        for (j = 0; j < nCell; ++j)
+        {
+            real dx = x[j] - X(pos0);
+            real dy = y[j] - Y(pos0);
+            real dz = z[j] - Z(pos0);
+            real drSq = dx * dx + dy * dy + dz * dz + eps2;
+
+            real drab = mw_sqrt(drSq);
+            real mor3 = m[j] / (drab * drSq);
+
+            ax += mor3 * dx;
+            ay += mor3 * dy;
+            az += mor3 * dz;
+        }
+    }
+
+    acc.x = ax;
+    acc.y = ay;
+    acc.z = az;
+
+    return acc;
+}
+
+/* Group walk version of nbMapForceBody. Each group of nearby bodies
+ * shares one walk of the tree, and the resulting interaction list is
+ * then summed for every body in the group. The group's own bodies are
+ * targets of a single nbDirectSum over the body list, where they add
+ * nothing to themselves. Writes the accelerations to the SoA arrays if
+ * they are in use. */
+static inline void nbSetGroupAccel(NBodySoA* soa, mwvector* accels, int i, mwvector a)
+{
+    if (soa)
+    {
+        soa->acc[0][i] = X(a);
+        soa->acc[1][i] = Y(a);
+        soa->acc[2][i] = Z(a);
+    }
+    else
+    {
+        accels[i] = a;
+    }
+}
+
+static void nbMapForceBodyGroups(const NBodyCtx* ctx, NBodyState* st)
+{
+    int g, i;
+    const int nbody = st->nbody;
+    NBodyWalkScratch* s = &st->walkScratch;
+    const NBodyTreeNode* nodes = st->tree.nodes;
+
+    const Body* bodies = mw_assume_aligned(st->bodytab, 16);
+    mwvector* accels = mw_assume_aligned(st->acctab, 16);
+    NBodySoA* soa = st->soa;
+
+    nbReserveWalkScratch(s, (int) st->tree.nNode, nbGetMaxThreads());
+    nbFindWalkGroups(st);
+
+  #ifdef _OPENMP
+    #pragma omp parallel private(g, i) shared(bodies, accels, soa, s, nodes)
+  #endif
+    {
+      #ifdef _OPENMP
+        const int tid = omp_get_thread_num();
+      #else
+        const int tid = 0;
+      #endif
+        NBodyInteractionList* cells = &s->cells[tid];
+        NBodyInteractionList* list = &s->bodies[tid];
+        real lax[NBODY_WALK_GROUP_NODES];
+        real lay[NBODY_WALK_GROUP_NODES];
+        real laz[NBODY_WALK_GROUP_NODES];
+        mwvector pos, a;
+
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1)
+      #endif
+        for (g = 0; g < s->nGroup; ++g)
+        {
+            const int start = s->groups[2 * g];
+            const int end = s->groups[2 * g + 1];
+            int self, nSelf = 0;
+
+            for (i = start; i < end; ++i)
+            {
+                nSelf += (nodes[i].body >= 0);
+            }
+
+            self = nbGroupInteractionList(ctx, st, start, end, nSelf, cells, list);
+            if (self < 0)
+            {
+                /* Some of the group is inside an accepted cell. Walk
+                   for each body on its own, which reports the incest. */
+                for (i = start; i < end; ++i)
+                {
+                    const NBodyTreeNode* q = &nodes[i];
+
+                    if (q->body >= 0)
+                    {
+                        a = nbGravity(ctx, st, &bodies[q->body]);
+                        nbSetGroupAccel(soa, accels, q->body, a);
+                    }
+                }
+                continue;
+            }
+
+            nbDirectSum(list->pos[0], list->pos[1], list->pos[2], list->mass, list->n,
+                        &list->pos[0][self], &list->pos[1][self], &list->pos[2][self], nSelf,
+                        ctx->eps2, lax, lay, laz);
+
+            nSelf = 0;
+            for (i = start; i < end; ++i)
+            {
+                const NBodyTreeNode* q = &nodes[i];
+
+                if (q->body < 0)
+                    continue;
+
+                pos = q->pos;
+                a = nbGroupCellGravity(ctx, cells, pos);
+                a.x += lax[nSelf];
+                a.y += lay[nSelf];
+                a.z += laz[nSelf];
+                ++nSelf;
+
+                nbSetGroupAccel(soa, accels, q->body, a);
+            }
+        }
+
+        /* Test particles aren't in the tree, so they still get their own walk */
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 4096 / sizeof(mwvector))
+      #endif
+        for (i = 0; i < nbody; ++i)
+        {
+            const Body* b = &bodies[i];
+
+            if (Mass(b) != 0.0)
+                continue;
+
+            a = nbGravity(ctx, st, b);
+            nbSetGroupAccel(soa, accels, i, a);
+        }
+    }
+}
+
+static inline void nbExternalAccelerationBatch(const NBodyCtx* ctx, NBodyState* st, int n,
+                                               const real* x, const real* y, const real* z,
+                                               real* ax, real* ay, real* az)
+{
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_CUSTOM_LUA)
+    {
+        nbEvalPotentialClosureBatch(st, n, x, y, z, ax, ay, az);
+    }
+    else
+    {
+        nbExtAccelerationBatch(&ctx->pot, st->potTable, n, x, y, z, ax, ay, az);
+    }
+}
+
+/* Add the external potential to the accelerations from the force
+ * calculation. This is a separate pass so that it is evaluated for a
+ * batch of bodies at a time, which for a Lua potential is one call
+ * into the closure's state per batch. */
+static void nbMapExternalAcceleration(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i0, i;
+    const int nbody = st->nbody;
+
+    const Body* bodies = mw_assume_aligned(st->bodytab, 16);
+    mwvector* accels = mw_assume_aligned(st->acctab, 16);
+    NBodySoA* soa = st->soa;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i0, i) shared(bodies, accels, soa) schedule(static)
+  #endif
+    for (i0 = 0; i0 < nbody; i0 += NBODY_EXT_BATCH)
+    {
+        real x[NBODY_EXT_BATCH], y[NBODY_EXT_BATCH], z[NBODY_EXT_BATCH];
+        real ax[NBODY_EXT_BATCH], ay[NBODY_EXT_BATCH], az[NBODY_EXT_BATCH];
+        const int n = nbody - i0 < NBODY_EXT_BATCH ? nbody - i0 : NBODY_EXT_BATCH;
+
+        if (soa)
+        {
+            nbExternalAccelerationBatch(ctx, st, n,
+                                        &soa->pos[0][i0], &soa->pos[1][i0], &soa->pos[2][i0],
+                                        ax, ay, az);
+
+            for (i = 0; i < n; ++i)
+            {
+                soa->acc[0][i0 + i] += ax[i];
+                soa->acc[1][i0 + i] += ay[i];
+                soa->acc[2][i0 + i] += az[i];
+            }
+        }
+        else
+        {
+            for (i = 0; i < n; ++i)
+            {
+                x[i] = X(Pos(&bodies[i0 + i]));
+                y[i] = Y(Pos(&bodies[i0 + i]));
+                z[i] = Z(Pos(&bodies[i0 + i]));
+            }
+
+            nbExternalAccelerationBatch(ctx, st, n, x, y, z, ax, ay, az);
+
+            for (i = 0; i < n; ++i)
+            {
+                X(accels[i0 + i]) += ax[i];
+                Y(accels[i0 + i]) += ay[i];
+                Z(accels[i0 + i]) += az[i];
+            }
         }
     }
 }
@@ -249,19 +784,46 @@ NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
 {
     NBodyStatus rc;
 
+    if (!nbDirectSum)
+    {
+        nbDirectSumDispatch(NBODY_DIRECT_SUM_BEST, FALSE);
+    }
+
     if (mw_likely(ctx->criterion != Exact))
     {
+        real tStart = mwGetTime();
         rc = nbMakeTree(ctx, st);
+        st->treeBuildTime += mwGetTime() - tStart;
+        st->nTreeBuild++;
         if (nbStatusIsFatal(rc))
             return rc;
 
-        nbMapForceBody(ctx, st);
+        if (ctx->useGroupWalk)
+            nbMapForceBodyGroups(ctx, st);
+        else if (st->soa)
+            nbMapForceBodySoA(ctx, st);
+        else
+            nbMapForceBody(ctx, st);
     }
     else
     {
         nbMapForceBody_Exact(ctx, st);
     }
 
+    switch (ctx->potentialType)
+    {
+        case EXTERNAL_POTENTIAL_DEFAULT:
+        case EXTERNAL_POTENTIAL_CUSTOM_LUA:
+            nbMapExternalAcceleration(ctx, st);
+            break;
+
+        case EXTERNAL_POTENTIAL_NONE:
+            break;
+
+        default:
+            mw_fail("Bad external potential type: %d\n", ctx->potentialType);
+    }
+
     if (st->potentialEvalError)
     {
         return NBODY_LUA_POTENTIAL_ERROR;
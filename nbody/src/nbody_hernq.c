@@ -146,7 +146,7 @@ static int nbGenerateHernqCore(lua_State* luaSt,
                                  real a)
 {
     unsigned int i;
-    int table;
+    Body* bodies;
     Body b;
     real r;
     real radius = 0.0;
@@ -161,8 +161,7 @@ static int nbGenerateHernqCore(lua_State* luaSt,
     b.bodynode.type = BODY(ignore);    /* Same for all in the model */
     b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    bodies = pushNewBodyArray(luaSt, nbody);
 
     for (i = 0; i < nbody; ++i)
     {
@@ -181,8 +180,7 @@ static int nbGenerateHernqCore(lua_State* luaSt,
         b.vel = hernqBodyVelocity(prng, vShift, r, radius_scale, a, mass);
         assert(nbPositionValid(b.bodynode.pos));
 
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
 
     return 1;
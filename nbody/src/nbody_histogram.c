@@ -31,6 +31,7 @@
 #include "milkyway_util.h"
 #include "nbody_coordinates.h"
 #include "nbody_show.h"
+#include "nbody_util.h"
 
 /*Calculates the center of two numbers */
 static real nbHistogramCenter(real start, real end)
@@ -579,6 +580,11 @@ static void nbNormalizeHistogram(NBodyHistogram* histogram)
 }
 
 
+static size_t nbHistogramSize(const HistogramParams* hp)
+{
+    return sizeof(NBodyHistogram) + hp->lambdaBins * hp->betaBins * sizeof(HistData);
+}
+
 /*
 Takes a treecode position, converts it to (l,b), then to (lambda,
 beta), and then constructs a histogram of the density in lambda and beta.
@@ -586,23 +592,79 @@ beta), and then constructs a histogram of the density in lambda and beta.
 Then calculates the cross correlation between the model histogram and
 the data histogram A maximum correlation means the best fit */
 
-/* Returns null on failure */
-NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation context */
-                                  const NBodyState* st,       /* Final state of the simulation */
-                                  const HistogramParams* hp)  /* Range of histogram to create */
+#define NB_HIST_THREAD_INFO 3 /* light count, binned count, last light body + 1 */
+
+/* Make sure the scratch space has room for the bodies, bins and
+ * threads. Only reallocates if something grew. */
+static void nbReserveHistogramScratch(NBodyHistogramScratch* s, int nbody, unsigned int nBin, int nThreads)
+{
+    if (s->nbody < nbody)
+    {
+        free(s->betaBin);
+        free(s->velBin);
+        free(s->betas);
+        free(s->vlos);
+
+        s->betaBin = (int*) mwMalloc(nbody * sizeof(int));
+        s->velBin = (int*) mwMalloc(nbody * sizeof(int));
+        s->betas = (real*) mwMalloc(nbody * sizeof(real));
+        s->vlos = (real*) mwMalloc(nbody * sizeof(real));
+        s->nbody = nbody;
+    }
+
+    if (s->nThreads < nThreads || s->nBin < nBin)
+    {
+        free(s->partials);
+        free(s->threadInfo);
+
+        s->partials = (HistData*) mwMalloc(nThreads * nBin * sizeof(HistData));
+        s->threadInfo = (unsigned int*) mwMalloc(NB_HIST_THREAD_INFO * nThreads * sizeof(unsigned int));
+        s->nThreads = nThreads;
+        s->nBin = nBin;
+    }
+}
+
+void nbFreeHistogramScratch(NBodyHistogramScratch* s)
+{
+    free(s->partials);
+    free(s->threadInfo);
+    free(s->betaBin);
+    free(s->velBin);
+    free(s->betas);
+    free(s->vlos);
+
+    memset(s, 0, sizeof(*s));
+}
+
+/* Fills in a histogram with room for the bins described by hp.
+ *
+ * Bodies are split into one contiguous range per thread. Each thread
+ * bins its range into its own accumulators, and records the bodies
+ * which landed in the histogram at the start of its range of the
+ * scratch arrays. The accumulators are then summed in thread order
+ * and the binned bodies packed together, so the outlier rejection
+ * only walks bodies in the histogram, in the original body order.
+ *
+ * With 1 thread this gives exactly the same result as binning
+ * serially. With more threads only the order the per bin sums are
+ * added in changes, so they differ by rounding only. The dispersions
+ * are a difference of such sums, so expect around 1e-12 relative
+ * difference there. The result only depends on the number of threads,
+ * not on timing.
+ */
+static void nbFillHistogram(const NBodyCtx* ctx,        /* Simulation context */
+                            const NBodyState* st,       /* Final state of the simulation */
+                            const HistogramParams* hp,  /* Range of histogram to create */
+                            NBodyHistogram* histogram,
+                            NBodyHistogramScratch* scratch)
 {
-    real lambda;
-    real beta;
-    mwvector lambdaBetaR;
-    unsigned int lambdaIndex;
-    unsigned int betaIndex;
     unsigned int Histindex;
     unsigned int totalNum = 0;
-    Body* p;
-    NBodyHistogram* histogram;
+    unsigned int body_count = 0;
+    unsigned int nBinned = 0;
+    unsigned int lastLight = 0;
     HistData* histData;
     NBHistTrig histTrig;
-    const Body* endp = st->bodytab + st->nbody;
     real lambdaSize = nbHistogramLambdaBinSize(hp);
     real betaSize = nbHistogramBetaBinSize(hp);
     /* Calculate the bounds of the bin range, making sure to use a
@@ -616,131 +678,211 @@ NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation cont
     unsigned int IterMax = ctx->IterMax;
     /*unsigned int IterMax = 6;*/	/*Default value for IterMax*/
     unsigned int nBin = lambdaBins * betaBins;
-    unsigned int body_count = 0;
-    unsigned int ub_counter = 0;
-    
-    real Nbodies = st->nbody;
-    mwbool islight = FALSE;//is it light matter?
-    
-    
+    const int nbody = st->nbody;
+    const Body* bodies = st->bodytab;
+    int nTeam = 1;
+    int t;
+
+    nbReserveHistogramScratch(scratch, nbody, nBin, nbGetMaxThreads());
+
     nbGetHistTrig(&histTrig, hp);
-    histogram = mwCalloc(sizeof(NBodyHistogram) + nBin * sizeof(HistData), sizeof(char));
+    memset(histogram, 0, nbHistogramSize(hp));
     histogram->lambdaBins = lambdaBins;
     histogram->betaBins = betaBins;
     histogram->hasRawCounts = TRUE;
     histogram->params = *hp;
-    
-    real v_line_of_sight;
-    
-    for (int i = 0; i < Nbodies; i++)
+    histData = histogram->data;
+
+  #ifdef _OPENMP
+    #pragma omp parallel shared(nTeam)
+  #endif
     {
-        const Body* b = &st->bodytab[i];
-        if(Type(b) == BODY(islight))
+      #ifdef _OPENMP
+        const int tid = omp_get_thread_num();
+        const int nThreads = omp_get_num_threads();
+      #else
+        const int tid = 0;
+        const int nThreads = 1;
+      #endif
+        const int lo = (int) (((long) nbody * tid) / nThreads);
+        const int hi = (int) (((long) nbody * (tid + 1)) / nThreads);
+
+        HistData* partial = &scratch->partials[tid * nBin];
+        unsigned int* info = &scratch->threadInfo[NB_HIST_THREAD_INFO * tid];
+        int* betaBin = &scratch->betaBin[lo];
+        int* velBin = &scratch->velBin[lo];
+        real* betas = &scratch->betas[lo];
+        real* vlos = &scratch->vlos[lo];
+        unsigned int nLight = 0;
+        unsigned int n = 0;
+        unsigned int last = 0;
+        unsigned int b;
+        int i, u;
+
+        if (tid == 0)
         {
-            histogram->massPerParticle = Mass(b);
-            body_count++;
+            nTeam = nThreads;
         }
-    }
-
-    real * use_velbody  = mwCalloc(body_count, sizeof(real));
-    real * use_betabody  = mwCalloc(body_count, sizeof(real));
-    real * vlos      = mwCalloc(body_count, sizeof(real));
-    real * betas     = mwCalloc(body_count, sizeof(real));
-    
-    histogram->totalSimulated = (unsigned int) body_count;
-    histData = histogram->data;
-    
-    /* It does not make sense to ignore bins in a generated histogram */
-    for (Histindex = 0; Histindex < nBin; ++Histindex)
-    {
-        histData[Histindex].rawCount = 0;
-        histData[Histindex].v_sum    = 0.0;
-        histData[Histindex].vsq_sum  = 0.0;
-        histData[Histindex].vdisp    = 0.0;
-        histData[Histindex].vdisperr = 0.0;
-        
-        histData[Histindex].beta_sum    = 0.0;
-        histData[Histindex].betasq_sum  = 0.0;
-        histData[Histindex].beta_disp    = 0.0;
-        histData[Histindex].beta_disperr = 0.0;
-        
-        histData[Histindex].outliersBetaRemoved = 0.0;
-        histData[Histindex].outliersVelRemoved = 0.0;
-        histData[Histindex].useBin = TRUE;
-    }
 
+        memset(partial, 0, nBin * sizeof(HistData));
 
-    for (p = st->bodytab; p < endp; ++p)
-    {
-        /* Only include bodies in models we aren't ignoring (like dark matter) */
-        if (!ignoreBody(p))
+        for (i = lo; i < hi; ++i)
         {
-            
+            const Body* p = &bodies[i];
+            mwvector lambdaBetaR;
+            real lambda, beta, v_line_of_sight;
+            unsigned int lambdaIndex, betaIndex;
+
+            /* Only include bodies in models we aren't ignoring (like dark matter) */
+            if (ignoreBody(p))
+                continue;
+
+            ++nLight;
+            last = (unsigned int) i + 1;
+
             /* Get the position in lbr coorinates */
             lambdaBetaR = nbXYZToLambdaBeta(&histTrig, Pos(p), ctx->sunGCDist);
             lambda = L(lambdaBetaR);
             beta = B(lambdaBetaR);
-            
-            use_betabody[ub_counter] = DEFAULT_NOT_USE;//defaulted to not use body
-            use_velbody[ub_counter] = DEFAULT_NOT_USE;//defaulted to not use body
-            
-            vlos[ub_counter]     = DEFAULT_NOT_USE;//default vlos
-            betas[ub_counter]    = DEFAULT_NOT_USE;
 
             /* Find the indices */
             lambdaIndex = (unsigned int) mw_floor((lambda - lambdaStart) / lambdaSize);
             betaIndex = (unsigned int) mw_floor((beta - betaStart) / betaSize);
 
             /* Check if the position is within the bounds of the histogram */
-            if (lambdaIndex < lambdaBins && betaIndex < betaBins)   
-            {   
-                Histindex = lambdaIndex * betaBins + betaIndex;
-                use_betabody[ub_counter] = Histindex;//if body is in hist, mark which hist bin
-                use_velbody[ub_counter] = Histindex;//if body is in hist, mark which hist bin
-                
-                histData[Histindex].rawCount++;
-                ++totalNum;
-                
-                
+            if (lambdaIndex < lambdaBins && betaIndex < betaBins)
+            {
+                b = lambdaIndex * betaBins + betaIndex;
+
                 v_line_of_sight = calc_vLOS(Vel(p), Pos(p), ctx->sunGCDist);//calc the heliocentric line of sight vel
-                vlos[ub_counter] = v_line_of_sight;//store the vlos's so as to not have to recalc
-                betas[ub_counter] = beta;
+
+                /* mark which hist bin, and store the vlos's so as to not have to recalc */
+                betaBin[n] = (int) b;
+                velBin[n] = (int) b;
+                betas[n] = beta;
+                vlos[n] = v_line_of_sight;
+                ++n;
+
+                partial[b].rawCount++;
+
                 /* each of these are components of the vel disp */
-                histData[Histindex].v_sum += v_line_of_sight;
-                histData[Histindex].vsq_sum += sqr(v_line_of_sight);
-                
+                partial[b].v_sum += v_line_of_sight;
+                partial[b].vsq_sum += sqr(v_line_of_sight);
+
                 /* each of these are components of the beta disp */
-                histData[Histindex].beta_sum += beta;
-                histData[Histindex].betasq_sum += sqr(beta);
+                partial[b].beta_sum += beta;
+                partial[b].betasq_sum += sqr(beta);
+            }
+        }
+
+        info[0] = nLight;
+        info[1] = n;
+        info[2] = last;
+
+      #ifdef _OPENMP
+        #pragma omp barrier
+        #pragma omp for schedule(static)
+      #endif
+        for (b = 0; b < nBin; ++b)
+        {
+            for (u = 0; u < nThreads; ++u)
+            {
+                const HistData* src = &scratch->partials[u * nBin + b];
+
+                histData[b].rawCount   += src->rawCount;
+                histData[b].v_sum      += src->v_sum;
+                histData[b].vsq_sum    += src->vsq_sum;
+                histData[b].beta_sum   += src->beta_sum;
+                histData[b].betasq_sum += src->betasq_sum;
             }
-            ub_counter++;
         }
     }
+
+    /* Pack the binned bodies of each thread together */
+    for (t = 0; t < nTeam; ++t)
+    {
+        const unsigned int* info = &scratch->threadInfo[NB_HIST_THREAD_INFO * t];
+        const int lo = (int) (((long) nbody * t) / nTeam);
+        unsigned int n = info[1];
+
+        if (nBinned != (unsigned int) lo && n != 0)
+        {
+            memmove(&scratch->betaBin[nBinned], &scratch->betaBin[lo], n * sizeof(int));
+            memmove(&scratch->velBin[nBinned], &scratch->velBin[lo], n * sizeof(int));
+            memmove(&scratch->betas[nBinned], &scratch->betas[lo], n * sizeof(real));
+            memmove(&scratch->vlos[nBinned], &scratch->vlos[lo], n * sizeof(real));
+        }
+
+        body_count += info[0];
+        nBinned += n;
+        if (info[2] > lastLight)
+        {
+            lastLight = info[2];
+        }
+    }
+
+    totalNum = nBinned;
+
+    if (lastLight != 0)
+    {
+        histogram->massPerParticle = Mass(&bodies[lastLight - 1]);
+    }
+
+    histogram->totalSimulated = body_count;
     histogram->totalNum = totalNum; /* Total particles in range */
 
+    /* It does not make sense to ignore bins in a generated histogram */
+    for (Histindex = 0; Histindex < nBin; ++Histindex)
+    {
+        histData[Histindex].useBin = TRUE;
+    }
+
     nbCalcVelDisp(histogram, TRUE, ctx->VelCorrect);
     nbCalcBetaDisp(histogram, TRUE, ctx->BetaCorrect);
     /* this converges somewhere between 3 and 6 iterations */
     for(int i = 0; i < IterMax; i++)
     {
-        nbRemoveBetaOutliers(st, histogram, use_betabody, betas, ctx->BetaSigma);
+        nbRemoveBetaOutliers(histogram, nBinned, scratch->betaBin, scratch->betas, ctx->BetaSigma);
         nbCalcBetaDisp(histogram, FALSE, ctx->BetaCorrect);
         
-        nbRemoveVelOutliers(st, histogram, use_velbody, vlos, ctx->VelSigma);
+        nbRemoveVelOutliers(histogram, nBinned, scratch->velBin, scratch->vlos, ctx->VelSigma);
         nbCalcVelDisp(histogram, FALSE, ctx->VelCorrect);
         
     }
     
     nbNormalizeHistogram(histogram);
-    
-    free(use_velbody);
-    free(use_betabody);
-    free(vlos);
-    free(betas);
-    
+}
+
+/* Returns null on failure */
+NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation context */
+                                  const NBodyState* st,       /* Final state of the simulation */
+                                  const HistogramParams* hp)  /* Range of histogram to create */
+{
+    NBodyHistogram* histogram;
+    NBodyHistogramScratch scratch = EMPTY_HISTOGRAM_SCRATCH;
+
+    histogram = mwMalloc(nbHistogramSize(hp));
+    nbFillHistogram(ctx, st, hp, histogram, &scratch);
+    nbFreeHistogramScratch(&scratch);
+
     return histogram;
 }
 
+/* Same as nbCreateHistogram, but reuses buffers kept in the state
+ * between calls. The returned histogram belongs to the state and is
+ * only valid until the next call. */
+NBodyHistogram* nbCreateHistogramInState(const NBodyCtx* ctx, NBodyState* st, const HistogramParams* hp)
+{
+    if (!st->bestLikeHistogram)
+    {
+        st->bestLikeHistogram = mwMalloc(nbHistogramSize(hp));
+    }
+
+    nbFillHistogram(ctx, st, hp, st->bestLikeHistogram, &st->histogramScratch);
+
+    return st->bestLikeHistogram;
+}
+
 
 /* Read in a histogram from a file for calculating a likelihood value.
  */
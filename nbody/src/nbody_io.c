@@ -27,28 +27,29 @@
 #include "nbody_coordinates.h"
 #include "nbody_mass.h"
 
-static void nbPrintSimInfoHeader(FILE* f, const NBodyFlags* nbf, const NBodyCtx* ctx, const NBodyState* st)
+static void nbStateCenters(const NBodyState* st, mwvector* cmPos, mwvector* cmVel)
 {
-    mwvector cmPos;
-    mwvector cmVel;
-    cmVel = nbCenterOfMom(st);
+    *cmVel = nbCenterOfMom(st);
     if (st->tree.root)
     {
-        cmPos = Pos(st->tree.root);
+        *cmPos = Pos(st->tree.root);
     }
     else
     {
-        cmPos = nbCenterOfMass(st);
+        *cmPos = nbCenterOfMass(st);
     }
+}
 
+static void nbPrintSimInfoHeader(FILE* f, int cartesian, int both, int hasMilkyway, mwvector cmPos, mwvector cmVel)
+{
     fprintf(f,
             "cartesian    = %d\n"
             "lbr & xyz    = %d\n"
             "hasMilkyway  = %d\n"
             "centerOfMass = %f, %f, %f,   centerOfMomentum = %f, %f, %f,\n",
-            nbf->outputCartesian,
-            nbf->outputlbrCartesian,
-            (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT),
+            cartesian,
+            both,
+            hasMilkyway,
             X(cmPos), Y(cmPos), Z(cmPos),
             X(cmVel), Y(cmVel), Z(cmVel)
         );
@@ -88,31 +89,27 @@ static void nbPrintBodyOutputHeader(FILE* f, int cartesian, int both)
     
 }
 
-/* output: Print bodies */
-int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+static void nbPrintBodies(FILE* f, const Body* bodies, int nbody, real sunGCDist, int cartesian, int both)
 {
-    Body* p;
+    const Body* p;
     mwvector lbr;
     real vLOS;
-    const Body* endp = st->bodytab + st->nbody;
+    const Body* endp = bodies + nbody;
 
-    nbPrintSimInfoHeader(f, nbf, ctx, st);
-    nbPrintBodyOutputHeader(f, nbf->outputCartesian, nbf->outputlbrCartesian);
-
-    for (p = st->bodytab; p < endp; p++)
+    for (p = bodies; p < endp; p++)
     {
         fprintf(f, "%8d, %8d,", ignoreBody(p), idBody(p));  /* Print if model it belongs to is ignored */
-        if (nbf->outputCartesian)
+        if (cartesian)
         {
             fprintf(f,
                     " %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f\n",
                     X(Pos(p)), Y(Pos(p)), Z(Pos(p)),
                     X(Vel(p)), Y(Vel(p)), Z(Vel(p)), Mass(p));
         }
-        else if (nbf->outputlbrCartesian)
+        else if (both)
         {
-            lbr = cartesianToLbr(Pos(p), ctx->sunGCDist);
-            vLOS = calc_vLOS(Vel(p), Pos(p), ctx->sunGCDist);
+            lbr = cartesianToLbr(Pos(p), sunGCDist);
+            vLOS = calc_vLOS(Vel(p), Pos(p), sunGCDist);
             fprintf(f,
                     " %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f\n",
                     X(Pos(p)), Y(Pos(p)), Z(Pos(p)),
@@ -121,13 +118,192 @@ int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBo
         }
         else
         {
-            lbr = cartesianToLbr(Pos(p), ctx->sunGCDist);
+            lbr = cartesianToLbr(Pos(p), sunGCDist);
             fprintf(f,
                     " %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f\n",
                     L(lbr), B(lbr), R(lbr),
                     X(Vel(p)), Y(Vel(p)), Z(Vel(p)), Mass(p));
         }
     }
+}
+
+/* output: Print bodies */
+int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+{
+    mwvector cmPos;
+    mwvector cmVel;
+
+    nbStateCenters(st, &cmPos, &cmVel);
+    nbPrintSimInfoHeader(f,
+                         nbf->outputCartesian,
+                         nbf->outputlbrCartesian,
+                         (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT),
+                         cmPos,
+                         cmVel);
+    nbPrintBodyOutputHeader(f, nbf->outputCartesian, nbf->outputlbrCartesian);
+    nbPrintBodies(f, st->bodytab, st->nbody, ctx->sunGCDist, nbf->outputCartesian, nbf->outputlbrCartesian);
+
+    if (fflush(f))
+    {
+        mwPerror("Body output flush");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Bodies packed into each write of binary output */
+#define NBODY_BINARY_CHUNK 4096
+
+/* Size of the fixed part of a record, the ignore flag, id, position, velocity and mass */
+#define NBODY_BINARY_RECORD_BASE (2 * sizeof(int32_t) + 7 * sizeof(double))
+
+static unsigned int nbBinaryRecordSize(uint32_t fields)
+{
+    unsigned int size = NBODY_BINARY_RECORD_BASE;
+
+    if (fields & NBODY_BINARY_HAS_LBR)
+        size += 3 * sizeof(double);
+    if (fields & NBODY_BINARY_HAS_VLOS)
+        size += sizeof(double);
+
+    return size;
+}
+
+static unsigned char* nbPackDoubles(unsigned char* out, double a, double b, double c)
+{
+    double v[3];
+
+    v[0] = a;
+    v[1] = b;
+    v[2] = c;
+    memcpy(out, v, sizeof(v));
+
+    return out + sizeof(v);
+}
+
+static unsigned char* nbPackBody(unsigned char* out, const Body* p, uint32_t fields, real sunGCDist)
+{
+    int32_t ignore = ignoreBody(p);
+    uint32_t id = idBody(p);
+    double mass = Mass(p);
+    double vLOS;
+    mwvector lbr;
+
+    memcpy(out, &ignore, sizeof(ignore));
+    out += sizeof(ignore);
+    memcpy(out, &id, sizeof(id));
+    out += sizeof(id);
+
+    out = nbPackDoubles(out, X(Pos(p)), Y(Pos(p)), Z(Pos(p)));
+    out = nbPackDoubles(out, X(Vel(p)), Y(Vel(p)), Z(Vel(p)));
+    memcpy(out, &mass, sizeof(mass));
+    out += sizeof(mass);
+
+    if (fields & NBODY_BINARY_HAS_LBR)
+    {
+        lbr = cartesianToLbr(Pos(p), sunGCDist);
+        out = nbPackDoubles(out, L(lbr), B(lbr), R(lbr));
+    }
+
+    if (fields & NBODY_BINARY_HAS_VLOS)
+    {
+        vLOS = calc_vLOS(Vel(p), Pos(p), sunGCDist);
+        memcpy(out, &vLOS, sizeof(vLOS));
+        out += sizeof(vLOS);
+    }
+
+    return out;
+}
+
+static void nbUnpackBody(const unsigned char* in, Body* p)
+{
+    int32_t ignore;
+    uint32_t id;
+    double v[7];
+
+    memcpy(&ignore, in, sizeof(ignore));
+    in += sizeof(ignore);
+    memcpy(&id, in, sizeof(id));
+    in += sizeof(id);
+    memcpy(v, in, sizeof(v));
+
+    Type(p) = BODY(ignore);
+    idBody(p) = id;
+    X(Pos(p)) = v[0];
+    Y(Pos(p)) = v[1];
+    Z(Pos(p)) = v[2];
+    X(Vel(p)) = v[3];
+    Y(Vel(p)) = v[4];
+    Z(Vel(p)) = v[5];
+    Mass(p) = v[6];
+}
+
+int nbOutputBodiesBinary(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+{
+    NBodyBinaryHeader h;
+    mwvector cmPos;
+    mwvector cmVel;
+    unsigned char* buf;
+    unsigned char* out;
+    int i, j, n;
+    int rc = FALSE;
+
+    memset(&h, 0, sizeof(h));
+    strncpy(h.magic, NBODY_BINARY_MAGIC, sizeof(h.magic));
+    h.byteOrder = NBODY_BINARY_BYTE_ORDER;
+    h.version = NBODY_BINARY_VERSION;
+    h.headerSize = sizeof(h);
+
+    /* Keep what the text output would have had */
+    if (!nbf->outputCartesian)
+    {
+        h.fields |= NBODY_BINARY_HAS_LBR;
+        if (nbf->outputlbrCartesian)
+            h.fields |= NBODY_BINARY_HAS_VLOS;
+    }
+    h.recordSize = nbBinaryRecordSize(h.fields);
+
+    h.outputFlags |= nbf->outputCartesian ? NBODY_BINARY_CARTESIAN : 0;
+    h.outputFlags |= nbf->outputlbrCartesian ? NBODY_BINARY_LBR_CARTESIAN : 0;
+    h.outputFlags |= (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT) ? NBODY_BINARY_HAS_MILKYWAY : 0;
+
+    nbStateCenters(st, &cmPos, &cmVel);
+    h.nbody = (uint64_t) st->nbody;
+    h.sunGCDist = ctx->sunGCDist;
+    h.cmPos[0] = X(cmPos);
+    h.cmPos[1] = Y(cmPos);
+    h.cmPos[2] = Z(cmPos);
+    h.cmVel[0] = X(cmVel);
+    h.cmVel[1] = Y(cmVel);
+    h.cmVel[2] = Z(cmVel);
+
+    if (fwrite(&h, sizeof(h), 1, f) != 1)
+    {
+        mwPerror("Writing binary body output header");
+        return TRUE;
+    }
+
+    buf = (unsigned char*) mwMalloc(NBODY_BINARY_CHUNK * h.recordSize);
+
+    for (i = 0; i < st->nbody && !rc; i += NBODY_BINARY_CHUNK)
+    {
+        n = mwMin(NBODY_BINARY_CHUNK, st->nbody - i);
+
+        out = buf;
+        for (j = 0; j < n; ++j)
+        {
+            out = nbPackBody(out, &st->bodytab[i + j], h.fields, ctx->sunGCDist);
+        }
+
+        if (fwrite(buf, h.recordSize, n, f) != (size_t) n)
+        {
+            mwPerror("Writing binary body output");
+            rc = TRUE;
+        }
+    }
+
+    free(buf);
 
     if (fflush(f))
     {
@@ -135,9 +311,158 @@ int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBo
         return TRUE;
     }
 
+    return rc;
+}
+
+int nbReadBinaryBodiesHeader(FILE* f, NBodyBinaryHeader* h)
+{
+    if (fread(h, sizeof(*h), 1, f) != 1)
+    {
+        mw_printf("Failed to read binary body output header\n");
+        return TRUE;
+    }
+
+    if (strncmp(h->magic, NBODY_BINARY_MAGIC, sizeof(h->magic)))
+    {
+        mw_printf("Not binary body output\n");
+        return TRUE;
+    }
+
+    if (h->byteOrder != NBODY_BINARY_BYTE_ORDER)
+    {
+        mw_printf("Binary body output was written with a different byte order\n");
+        return TRUE;
+    }
+
+    if (h->version > NBODY_BINARY_VERSION)
+    {
+        mw_printf("Binary body output version %u is newer than this reader (%u)\n",
+                  h->version,
+                  NBODY_BINARY_VERSION);
+        return TRUE;
+    }
+
+    if (h->headerSize < sizeof(*h) || h->recordSize < nbBinaryRecordSize(h->fields))
+    {
+        mw_printf("Binary body output header is corrupted\n");
+        return TRUE;
+    }
+
+    if (h->nbody > INT_MAX)
+    {
+        mw_printf("Too many bodies in binary body output (%llu)\n", (unsigned long long) h->nbody);
+        return TRUE;
+    }
+
+    /* Skip anything a later version added to the header */
+    if (fseek(f, h->headerSize, SEEK_SET))
+    {
+        mwPerror("Seeking to binary body records");
+        return TRUE;
+    }
+
     return FALSE;
 }
 
+int nbReadBinaryBodies(FILE* f, const NBodyBinaryHeader* h, Body* bodies)
+{
+    unsigned char* buf;
+    int i, j, n;
+    int nbody = (int) h->nbody;
+    int rc = FALSE;
+
+    buf = (unsigned char*) mwMalloc(NBODY_BINARY_CHUNK * h->recordSize);
+
+    for (i = 0; i < nbody && !rc; i += NBODY_BINARY_CHUNK)
+    {
+        n = mwMin(NBODY_BINARY_CHUNK, nbody - i);
+
+        if (fread(buf, h->recordSize, n, f) != (size_t) n)
+        {
+            mw_printf("Binary body output ended after %d of %d bodies\n", i, nbody);
+            rc = TRUE;
+            break;
+        }
+
+        for (j = 0; j < n; ++j)
+        {
+            nbUnpackBody(&buf[j * h->recordSize], &bodies[i + j]);
+        }
+    }
+
+    free(buf);
+
+    return rc;
+}
+
+int nbConvertBinaryBodies(const char* binFileName, const char* textFileName)
+{
+    FILE* f;
+    NBodyBinaryHeader h;
+    Body* bodies = NULL;
+    mwvector cmPos = ZERO_VECTOR;
+    mwvector cmVel = ZERO_VECTOR;
+    int cartesian, both;
+    int rc;
+
+    f = mwOpenResolved(binFileName, "rb");
+    if (!f)
+    {
+        mw_printf("Failed to open binary body output '%s'\n", binFileName);
+        return 1;
+    }
+
+    rc = nbReadBinaryBodiesHeader(f, &h);
+    if (!rc)
+    {
+        bodies = (Body*) mwCallocA(h.nbody > 0 ? (size_t) h.nbody : 1, sizeof(Body));
+        rc = nbReadBinaryBodies(f, &h, bodies);
+    }
+
+    fclose(f);
+
+    if (rc)
+    {
+        mw_printf("Error reading binary body output '%s'\n", binFileName);
+        mwFreeA(bodies);
+        return 1;
+    }
+
+    f = mwOpenResolved(textFileName, "w");
+    if (!f)
+    {
+        mw_printf("Failed to open output file '%s'\n", textFileName);
+        mwFreeA(bodies);
+        return 1;
+    }
+
+    X(cmPos) = h.cmPos[0];
+    Y(cmPos) = h.cmPos[1];
+    Z(cmPos) = h.cmPos[2];
+    X(cmVel) = h.cmVel[0];
+    Y(cmVel) = h.cmVel[1];
+    Z(cmVel) = h.cmVel[2];
+
+    cartesian = !!(h.outputFlags & NBODY_BINARY_CARTESIAN);
+    both = !!(h.outputFlags & NBODY_BINARY_LBR_CARTESIAN);
+
+    mw_boinc_print(f, "<bodies>\n");
+    nbPrintSimInfoHeader(f, cartesian, both, !!(h.outputFlags & NBODY_BINARY_HAS_MILKYWAY), cmPos, cmVel);
+    nbPrintBodyOutputHeader(f, cartesian, both);
+    nbPrintBodies(f, bodies, (int) h.nbody, h.sunGCDist, cartesian, both);
+    mw_boinc_print(f, "</bodies>\n");
+
+    mwFreeA(bodies);
+
+    if (fclose(f) < 0)
+    {
+        mwPerror("Error closing output file '%s'", textFileName);
+        return 1;
+    }
+
+    return 0;
+}
+
 int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
 {
     FILE* f;
@@ -157,8 +482,7 @@ int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* n
 
     if (nbf->outputBinary)
     {
-        mw_printf("Binary output unimplemented\n");
-        return 1;
+        rc = nbOutputBodiesBinary(f, ctx, st, nbf);
     }
     else
     {
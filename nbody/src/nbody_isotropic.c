@@ -34,6 +34,8 @@ their copyright to their programs which execute similar algorithms.
 #include "milkyway_lua.h"
 #include "nbody_lua_types.h"
 #include "nbody_isotropic.h"
+#include "nbody_df_table.h"
+#include "nbody_prng_streams.h"
 
 /*Note: minusfivehalves(x) raises to x^-5/2 power and minushalf(x) is x^-1/2*/
 
@@ -639,6 +641,7 @@ static inline real vel_mag(dsfmt_t* dsfmtState, real r, real * args)
     return v; //km/s
 }
 
+
 static inline mwvector get_components(dsfmt_t* dsfmtState, real rad)
 {
     /* assigns angles. Allows for non-circular orbits.*/
@@ -707,7 +710,7 @@ static int cm_correction(real * x, real * y, real * z, real * vx, real * vy, rea
 }
 
 /*      DWARF GENERATION        */
-static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, real mass1, real mass2, mwbool ignore, mwvector rShift, mwvector vShift, real radiusScale1, real radiusScale2)
+static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, real mass1, real mass2, mwbool ignore, mwvector rShift, mwvector vShift, real radiusScale1, real radiusScale2, mwbool tabulateDF)
 {
     /* generatePlummer: generate Plummer model initial conditions for test
     * runs, scaled to units such that M = -4E = G = 1 (Henon, Heggie,
@@ -715,7 +718,7 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
     * 183.
     */
         unsigned int i;
-        int table;
+        Body* bodies;
         Body b;
         real r, v;
  
@@ -759,74 +762,154 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
         /*finding the max of the individual components*/
         real rho_max_light = max_finder(profile_rho, parameters_light, 0, rscale_l, 2.0 * (rscale_l), 20, 1e-4, prng );
         real rho_max_dark  = max_finder(profile_rho, parameters_dark, 0, rscale_d, 2.0 * (rscale_d), 20, 1e-4, prng );
+
+        /* both components are tabulated as plummer spheres. the radii of each
+         * come from its own enclosed mass and the velocities from the distribution
+         * function of both together. with tabulateDF = false they are rejection
+         * sampled instead.
+         */
+        Dwarf comp_l = EMPTY_DWARF;
+        Dwarf comp_d = EMPTY_DWARF;
+        NBodyDFTable* df = NULL;
+        NBodyPRNGStreams streams;
+        int k;
+        int failed = FALSE;
+
+        comp_l.type = Plummer;
+        comp_l.mass = mass_l;
+        comp_l.scaleLength = rscale_l;
+        comp_d.type = Plummer;
+        comp_d.mass = mass_d;
+        comp_d.scaleLength = rscale_d;
+
+        if (tabulateDF)
+        {
+            df = nbMakeDFTable(&comp_l, &comp_d, bound, bound, NBODY_DF_ISOTROPIC_TRUNCATION);
+        }
+        if (tabulateDF && !df)
+        {
+            free(x);
+            free(y);
+            free(z);
+            free(vx);
+            free(vy);
+            free(vz);
+            free(masses);
+            return luaL_error(luaSt, "Failed to tabulate distribution function, try tabulateDF = false");
+        }
         
      
      /*initializing particles:*/
         memset(&b, 0, sizeof(b));
-        lua_createtable(luaSt, nbody, 0);
-        table = lua_gettop(luaSt);      
-        int counter = 0;
-        
+        bodies = pushNewBodyArray(luaSt, nbody);
+        /* each block of bodies draws from its own stream, so they can be
+         * done in parallel and come out the same on any number of threads
+         */
+        nbInitPRNGStreams(&streams, prng, nbody, tabulateDF ? NBODY_PRNG_DWARF_TABLE_BLOCK : NBODY_PRNG_DWARF_BLOCK);
+
         /*getting the radii and velocities for the bodies*/
-        for (i = 0; i < nbody; i++)
+    #ifdef _OPENMP
+        #pragma omp parallel for private(k, i, r, v, vec) shared(streams, df, x, y, z, vx, vy, vz, masses, failed) schedule(dynamic, 1)
+    #endif
+        for (k = 0; k < (int) streams.nBlocks; k++)
         {
-            counter = 0;
-            do
+            dsfmt_t* st = &streams.states[k];
+            unsigned int first, last;
+            int counter;
+            mwbool sampled = TRUE;
+
+            nbPRNGStreamBlock(&streams, (unsigned int) k, &first, &last);
+            for (i = first; i < last && sampled; i++)
             {
-                
-                if(i < half_bodies)
+                counter = 0;
+                do
                 {
-                    r = r_mag(prng, parameters_light, rho_max_light, bound);
-                    masses[i] = mass_light_particle;
-                }
-                else if(i >= half_bodies)
-                {
-                    r = r_mag(prng, parameters_dark, rho_max_dark, bound);
-                    masses[i] = mass_dark_particle;
-                }
-                /*to ensure that r is finite and nonzero*/
-                if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
-                
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
+                    
+                    if(i < half_bodies)
+                    {
+                        r = tabulateDF ? nbDFTableSampleRadius(df, 0, st) : r_mag(st, parameters_light, rho_max_light, bound);
+                        masses[i] = mass_light_particle;
+                    }
+                    else if(i >= half_bodies)
+                    {
+                        r = tabulateDF ? nbDFTableSampleRadius(df, 1, st) : r_mag(st, parameters_dark, rho_max_dark, bound);
+                        masses[i] = mass_dark_particle;
+                    }
+                    /*to ensure that r is finite and nonzero*/
+                    if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
+                    
+                    if(counter > 1000)
+                    {
+                        sampled = FALSE;
+                        break;
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                    
+                }while (1);
+
+                if (!sampled)
                 {
-                    counter++;
+                    break;
                 }
                 
-            }while (1);
-            
-            
-            
 //             mw_printf("\r velocity of particle %i", i+1);
-            counter = 0;
-            do
-            {
-                v = vel_mag(prng, r, args);
-                if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
-                
-                if(counter > 1000)
+                counter = 0;
+                do
                 {
-                    exit(-1);
-                }
-                else
+                    v = tabulateDF ? nbDFTableSampleSpeed(df, r, st) : vel_mag(st, r, args);
+                    if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
+                    
+                    if(counter > 1000)
+                    {
+                        sampled = FALSE;
+                        break;
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                    
+                }while (1);
+
+                if (!sampled)
                 {
-                    counter++;
+                    break;
                 }
+
+                vec = get_components(st, v);   
+                vx[i] = vec.x;
+                vy[i] = vec.y;
+                vz[i] = vec.z;
                 
-            }while (1);
+                vec = get_components(st, r);  
+                x[i] = vec.x;
+                y[i] = vec.y;
+                z[i] = vec.z;
+            }
 
-            vec = get_components(prng, v);   
-            vx[i] = vec.x;
-            vy[i] = vec.y;
-            vz[i] = vec.z;
-            
-            vec = get_components(prng, r);  
-            x[i] = vec.x;
-            y[i] = vec.y;
-            z[i] = vec.z;
+            /* can't leave the parallel region from here, so it is reported after */
+            if (!sampled)
+            {
+                failed = TRUE;
+            }
+        }
+
+        nbFinishPRNGStreams(&streams, prng);
+
+        if (failed)
+        {
+            nbDestroyDFTable(df);
+            free(x);
+            free(y);
+            free(z);
+            free(vx);
+            free(vy);
+            free(vz);
+            free(masses);
+            return luaL_error(luaSt, "Failed to sample isotropic bodies");
         }
         
         /* getting the center of mass and momentum correction */
@@ -859,11 +942,11 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
             b.vel.z = vz[i];
             
             assert(nbPositionValid(b.bodynode.pos));
-            pushBody(luaSt, &b);
-            lua_rawseti(luaSt, table, i + 1);
+            bodies[i] = b;
         }
         
         /* go now and be free!*/
+        nbDestroyDFTable(df);
         free(x);
         free(y);
         free(z);
@@ -882,6 +965,7 @@ int nbGenerateIsotropic(lua_State* luaSt)
         static const mwvector* position = NULL;
         static const mwvector* velocity = NULL;
         static mwbool ignore;
+        static mwbool tabulateDF = TRUE;
         static real mass1 = 0.0, nbodyf = 0.0, radiusScale1 = 0.0;
         static real mass2 = 0.0, radiusScale2 = 0.0;
 
@@ -896,6 +980,7 @@ int nbGenerateIsotropic(lua_State* luaSt)
             { "velocity",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &velocity          },
             { "ignore",               LUA_TBOOLEAN,    NULL,                    FALSE,   &ignore            },
             { "prng",                 LUA_TUSERDATA,   DSFMT_TYPE,              TRUE,    &prng              },
+            { "tabulateDF",           LUA_TBOOLEAN,    NULL,                    FALSE,   &tabulateDF        },
             END_MW_NAMED_ARG
             
         };
@@ -903,11 +988,12 @@ int nbGenerateIsotropic(lua_State* luaSt)
         if (lua_gettop(luaSt) != 1)
             return luaL_argerror(luaSt, 1, "Expected 1 arguments");
         
+        tabulateDF = TRUE;
         handleNamedArgumentTable(luaSt, argTable, 1);
         
         
         return nbGenerateIsotropicCore(luaSt, prng, (unsigned int) nbodyf, mass1, mass2, ignore,
-                                                                 *position, *velocity, radiusScale1, radiusScale2);
+                                                                 *position, *velocity, radiusScale1, radiusScale2, tabulateDF);
 }
 
 void registerGenerateIsotropic(lua_State* luaSt)
@@ -33,6 +33,7 @@
 #include "milkyway_lua.h"
 #include "nbody_check_params.h"
 #include "nbody_defaults.h"
+#include "nbody_potential_table.h"
 
 static int getNBodyCtxFunc(lua_State* luaSt)
 {
@@ -238,15 +239,13 @@ lua_State* nbLuaOpen(mwbool debug)
     return luaSt;
 }
 
-/* Open a lua_State, bind run information such as server arguments and
- * BOINC status, and evaluate input script.
+/* Open a lua_State and bind run information such as server arguments
+ * and BOINC status.
  * If given NULL state, no device information will be given
  */
-lua_State* nbOpenLuaStateWithScript(const NBodyFlags* nbf, NBodyState* st)
+static lua_State* nbOpenBoundLuaState(const NBodyFlags* nbf, NBodyState* st)
 {
-    char* script;
     lua_State* luaSt;
-    int execFailed;
 
     luaSt = nbLuaOpen(nbf->debugLuaLibs);
     if (!luaSt)
@@ -257,6 +256,20 @@ lua_State* nbOpenLuaStateWithScript(const NBodyFlags* nbf, NBodyState* st)
     bindDeviceInformation(luaSt, st);
     mwBindBOINCStatus(luaSt);
 
+    return luaSt;
+}
+
+/* Open a bound lua_State and evaluate input script */
+lua_State* nbOpenLuaStateWithScript(const NBodyFlags* nbf, NBodyState* st)
+{
+    char* script;
+    lua_State* luaSt;
+    int execFailed;
+
+    luaSt = nbOpenBoundLuaState(nbf, st);
+    if (!luaSt)
+        return NULL;
+
     script = mwReadFileResolved(nbf->inputFile);
     if (!script)
     {
@@ -340,115 +353,228 @@ static int nbGetPotentialClosure(lua_State* luaSt)
     return closure;
 }
 
+/* A lua_State can't be copied, so each thread still needs to run the
+ * script in its own state. The script is only read and compiled once
+ * though, and the other states load the compiled chunk.
+ */
 int nbOpenPotentialEvalStatePerThread(NBodyState* st, const NBodyFlags* nbf)
 {
     int i;
+    int rc = 1;
     int* closures;
+    char* script;
+    char* chunk = NULL;
+    size_t chunkSize = 0;
     lua_State** states;
     const int maxThreads = nbGetMaxThreads();
 
+    script = mwReadFileResolved(nbf->inputFile);
+    if (!script)
+    {
+        mwPerror("Opening Lua script '%s'", nbf->inputFile);
+        return 1;
+    }
+
     states = mwCalloc(maxThreads, sizeof(lua_State*));
     closures = mwCalloc(maxThreads, sizeof(int));
 
+    states[0] = nbOpenBoundLuaState(nbf, st);
+    if (states[0])
+    {
+        chunk = compileString(states[0], script, &chunkSize);
+        if (!chunk)
+        {
+            mw_lua_perror(states[0], "Error loading Lua script '%s'", nbf->inputFile);
+        }
+    }
+    free(script);
+
+    if (!chunk)
+    {
+        goto fail;
+    }
+
     /* CHECKME: Is it OK to open all states in the master thread first? */
     for (i = 0; i < maxThreads; ++i)
     {
-        /* FIXME: Is there a better way to copy a lua_State? */
-        states[i] = nbOpenLuaStateWithScript(nbf, st);
+        if (i > 0)
+        {
+            states[i] = nbOpenBoundLuaState(nbf, st);
+            if (!states[i])
+            {
+                goto fail;
+            }
+        }
+
+        if (dochunkWithArgs(states[i], chunk, chunkSize, nbf->inputFile, nbf->forwardedArgs, nbf->numForwardedArgs))
+        {
+            mw_lua_perror(states[i], "Error loading Lua script '%s'", nbf->inputFile);
+            goto fail;
+        }
+
+        if (i == 0 && !nbCheckMinVersionRequired(states[0]))
+        {
+            goto fail;
+        }
+
         closures[i] = nbGetPotentialClosure(states[i]);
         if (closures[i] == LUA_NOREF)
         {
-            free(states);
-            free(closures);
-            return 1;
+            goto fail;
         }
     }
 
     st->potEvalStates = states;
     st->potEvalClosures = closures;
+    rc = 0;
+    states = NULL;
+    closures = NULL;
 
-    return 0;
+fail:
+    if (states)
+    {
+        for (i = 0; i < maxThreads; ++i)
+        {
+            if (states[i])
+            {
+                lua_close(states[i]);
+            }
+        }
+    }
+
+    free(states);
+    free(closures);
+    free(chunk);
+
+    return rc;
 }
 
-/* Evaluate potential from a Lua closure. Will set the error flag on
- * the NBodyState in the event of an error.
+static void nbFailPotentialClosure(int n, real* ax, real* ay, real* az)
+{
+    int i;
+
+    /* Make sure we break everything */
+    for (i = 0; i < n; ++i)
+    {
+        ax[i] = REAL_MAX;
+        ay[i] = REAL_MAX;
+        az[i] = REAL_MAX;
+    }
+}
+
+static void nbReportPotentialClosureError(NBodyState* st, lua_State* luaSt)
+{
+    /* Avoid spewing the same error billions of times */
+    if (!st->potentialEvalError)
+    {
+        /* FIXME: This isn't really correct. We really need a lock. The worst that should happen*/
+      #ifdef _OPENMP
+        #pragma omp critical
+      #endif
+        {
+            mw_lua_perror(luaSt, "Error evaluating potential closure");
+            st->potentialEvalError = TRUE;
+        }
+    }
+}
+
+typedef struct
+{
+    int closure;
+    int n;
+    const real* x;
+    const real* y;
+    const real* z;
+    real* ax;
+    real* ay;
+    real* az;
+} NBodyPotentialClosureCall;
+
+/* Call the closure for each position. This runs under a single
+ * lua_cpcall() for the whole batch rather than setting up a protected
+ * call for every body.
  *
  * The closure used must of type number, number, number -> number,
  * number, number. (i.e. takes 3 numbers (x, y, z) and returns 3 numbers (a_x, a_y, a_z))
  */
-void nbEvalPotentialClosure(NBodyState* st, mwvector pos, mwvector* aOut)
+static int nbCallPotentialClosure(lua_State* luaSt)
 {
-  #ifdef _OPENMP
-    const int tid = omp_get_thread_num();
-  #else
-    const int tid = 0;
-  #endif
+    int i;
+    const NBodyPotentialClosureCall* c = (const NBodyPotentialClosureCall*) lua_touserdata(luaSt, 1);
 
-    int top;
-    mwvector a;
-    static const mwvector badVector = mw_vec(REAL_MAX, REAL_MAX, REAL_MAX);
-    lua_State* luaSt = st->potEvalStates[tid];
+    lua_pop(luaSt, 1);
 
-    /* Push closure */
-    getLuaClosure(luaSt, &st->potEvalClosures[tid]);
+    for (i = 0; i < c->n; ++i)
+    {
+        /* Push closure */
+        lua_rawgeti(luaSt, LUA_REGISTRYINDEX, c->closure);
 
-    /* Push position arguments */
-    lua_pushnumber(luaSt, X(pos));
-    lua_pushnumber(luaSt, Y(pos));
-    lua_pushnumber(luaSt, Z(pos));
+        /* Push position arguments */
+        lua_pushnumber(luaSt, c->x[i]);
+        lua_pushnumber(luaSt, c->y[i]);
+        lua_pushnumber(luaSt, c->z[i]);
 
-    /* Call closure */
-    if (lua_pcall(luaSt, 3, 3, 0))
-    {
-        /* Avoid spewing the same error billions of times */
-        if (!st->potentialEvalError)
+        lua_call(luaSt, 3, 3);
+
+        /* Retrieve acceleration */
+        if (!lua_isnumber(luaSt, -1) || !lua_isnumber(luaSt, -2) || !lua_isnumber(luaSt, -3))
         {
-            /* FIXME: This isn't really correct. We really need a lock. The worst that should happen*/
-          #ifdef _OPENMP
-            #pragma omp critical
-          #endif
-            {
-                mw_lua_perror(luaSt, "Error evaluating potential closure");
-                st->potentialEvalError = TRUE;
-            }
+            return luaL_error(luaSt, "Expected number, number, number. Got %s, %s, %s",
+                              luaL_typename(luaSt, -3),
+                              luaL_typename(luaSt, -2),
+                              luaL_typename(luaSt, -1));
         }
 
-        /* Make sure we break everything */
-        *aOut = badVector;
-        return;
+        c->az[i] = lua_tonumber(luaSt, -1);
+        c->ay[i] = lua_tonumber(luaSt, -2);
+        c->ax[i] = lua_tonumber(luaSt, -3);
+        lua_pop(luaSt, 3);
     }
 
+    return 0;
+}
 
-    /* Retrieve acceleration. Use to* type function to avoid excessive
-     * error message printing in general case. */
-    top = lua_gettop(luaSt);
-    if (!lua_isnumber(luaSt, top) || !lua_isnumber(luaSt, top - 1) || !lua_isnumber(luaSt, top - 2))
-    {
-        if (!st->potentialEvalError)
-        {
-          #ifdef _OPENMP
-            #pragma omp critical
-          #endif
-            {
-                mw_printf("Error in Lua potential function: "
-                          "Expected number, number, number. Got %s, %s, %s\n",
-                          luaL_typename(luaSt, top - 2),
-                          luaL_typename(luaSt, top - 1),
-                          luaL_typename(luaSt, top));
-                st->potentialEvalError = TRUE;
-            }
-        }
+/* Evaluate potential from a Lua closure at n positions, writing the
+ * accelerations to ax, ay, az. Will set the error flag on the
+ * NBodyState in the event of an error.
+ */
+void nbEvalPotentialClosureBatch(NBodyState* st, int n,
+                                 const real* x, const real* y, const real* z,
+                                 real* ax, real* ay, real* az)
+{
+  #ifdef _OPENMP
+    const int tid = omp_get_thread_num();
+  #else
+    const int tid = 0;
+  #endif
 
-        *aOut = badVector;
-        return;
+    NBodyPotentialClosureCall c;
+    lua_State* luaSt = st->potEvalStates[tid];
+    const int top = lua_gettop(luaSt);
+
+    c.closure = st->potEvalClosures[tid];
+    c.n = n;
+    c.x = x;
+    c.y = y;
+    c.z = z;
+    c.ax = ax;
+    c.ay = ay;
+    c.az = az;
+
+    if (lua_cpcall(luaSt, nbCallPotentialClosure, &c))
+    {
+        nbReportPotentialClosureError(st, luaSt);
+        lua_settop(luaSt, top);
+        nbFailPotentialClosure(n, ax, ay, az);
     }
+}
 
-    Z(a) = lua_tonumber(luaSt, top);
-    Y(a) = lua_tonumber(luaSt, top - 1);
-    X(a) = lua_tonumber(luaSt, top - 2);
+void nbEvalPotentialClosure(NBodyState* st, mwvector pos, mwvector* aOut)
+{
+    real ax, ay, az;
 
-    *aOut = a;
-    lua_pop(luaSt, 3);
+    nbEvalPotentialClosureBatch(st, 1, &X(pos), &Y(pos), &Z(pos), &ax, &ay, &az);
+    SET_VECTOR(*aOut, ax, ay, az);
 }
 
 static int nbEvaluatePotential(lua_State* luaSt, NBodyCtx* ctx)
@@ -590,6 +716,12 @@ static int nbEvaluateInitialNBodyState(lua_State* luaSt, NBodyCtx* ctx, NBodySta
     if (nbEvaluatePotential(luaSt, ctx))
         return 1;
 
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT)
+    {
+        st->potTable = nbMakePotentialTable(&ctx->pot, ctx->potentialTableError);
+        nbSetPotentialTable(luaSt, st->potTable);
+    }
+
     bodies = nbEvaluateBodies(luaSt, ctx, &nbody);
     
     if (!bodies)
@@ -39,6 +39,7 @@
 #include "nbody_defaults.h"
 #include "nbody_potential_types.h"
 #include "nbody_lua_dwarf.h"
+#include "nbody_lua_util.h"
 
 /* For using a combination of light and dark models to generate timestep */
 static real plummerTimestepIntegral(real smalla, real biga, real Md, real step)
@@ -188,6 +189,7 @@ static int luaReverseOrbit(lua_State* luaSt)
     static Potential* pot = NULL;
     static const mwvector* pos = NULL;
     static const mwvector* vel = NULL;
+    const NBodyPotentialTable* table;
 
     static const MWNamedArg argTable[] =
         {
@@ -221,7 +223,12 @@ static int luaReverseOrbit(lua_State* luaSt)
     if (checkPotentialConstants(pot))
         luaL_error(luaSt, "Error with potential");
 
-    nbReverseOrbit(&finalPos, &finalVel, pot, *pos, *vel, tstop, dt);
+    /* Use the tabulated potential of the simulation if this is the same one */
+    table = nbGetPotentialTable(luaSt);
+    if (table && !equalPotential(&table->pot, pot))
+        table = NULL;
+
+    nbReverseOrbit(&finalPos, &finalVel, pot, table, *pos, *vel, tstop, dt);
     pushVector(luaSt, finalPos);
     pushVector(luaSt, finalVel);
 
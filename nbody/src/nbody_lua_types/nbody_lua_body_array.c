@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A BodyArray is what the model generators return. Scripts can pass it
+ * straight back from makeBodies(), join several with .., or index it
+ * like a table of bodies. Indexing gives a copy of the body, so a changed
+ * body has to be assigned back. ipairs() needs a real table, which
+ * toTable() makes.
+ *
+ * When it is the only model, readModels() takes its bodies rather than
+ * copying them. Anything done with it after that is an error. */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "nbody_types.h"
+#include "nbody_lua_body.h"
+#include "nbody_lua_body_array.h"
+#include "milkyway_lua.h"
+#include "milkyway_util.h"
+
+BodyArray* toBodyArray(lua_State* luaSt, int idx)
+{
+    return (BodyArray*) mw_tonamedudata(luaSt, idx, BODY_ARRAY_TYPE);
+}
+
+BodyArray* checkBodyArray(lua_State* luaSt, int idx)
+{
+    return (BodyArray*) mw_checknamedudata(luaSt, idx, BODY_ARRAY_TYPE);
+}
+
+static void checkNotTaken(lua_State* luaSt, const BodyArray* a)
+{
+    if (a->taken)
+        luaL_error(luaSt, "BodyArray was already used for the simulation and has no bodies left");
+}
+
+/* A BodyArray that still has its bodies */
+static BodyArray* checkBodiesBodyArray(lua_State* luaSt, int idx)
+{
+    BodyArray* a = checkBodyArray(luaSt, idx);
+
+    checkNotTaken(luaSt, a);
+    return a;
+}
+
+Body* pushNewBodyArray(lua_State* luaSt, int nbody)
+{
+    BodyArray a;
+
+    /* Always allocate something so an empty array still has a buffer */
+    a.bodies = (Body*) mwCallocA(nbody > 0 ? nbody : 1, sizeof(Body));
+    a.nbody = nbody;
+    a.taken = FALSE;
+    pushType(luaSt, BODY_ARRAY_TYPE, sizeof(BodyArray), &a);
+
+    return a.bodies;
+}
+
+/* Number of bodies in either a BodyArray or a table of bodies */
+static int countBodies(lua_State* luaSt, int idx)
+{
+    BodyArray* a;
+
+    a = toBodyArray(luaSt, idx);
+    if (a)
+    {
+        checkNotTaken(luaSt, a);
+        return a->nbody;
+    }
+
+    luaL_checktype(luaSt, idx, LUA_TTABLE);
+    return luaL_getn(luaSt, idx);
+}
+
+static void copyBodies(lua_State* luaSt, int idx, Body* bodies)
+{
+    BodyArray* a;
+    int i, n;
+
+    a = toBodyArray(luaSt, idx);
+    if (a)
+    {
+        memcpy(bodies, a->bodies, a->nbody * sizeof(Body));
+        return;
+    }
+
+    n = luaL_getn(luaSt, idx);
+    for (i = 0; i < n; ++i)
+    {
+        lua_rawgeti(luaSt, idx, i + 1);
+        bodies[i] = *checkBody(luaSt, lua_gettop(luaSt));
+        lua_pop(luaSt, 1);
+    }
+}
+
+/* BodyArray.create({ Body, ... }) */
+static int createBodyArray(lua_State* luaSt)
+{
+    int n;
+    Body* bodies;
+
+    n = countBodies(luaSt, 1);
+    bodies = pushNewBodyArray(luaSt, n);
+    copyBodies(luaSt, 1, bodies);
+
+    return 1;
+}
+
+static int concatBodyArray(lua_State* luaSt)
+{
+    int n1, n2;
+    Body* bodies;
+
+    n1 = countBodies(luaSt, 1);
+    n2 = countBodies(luaSt, 2);
+
+    bodies = pushNewBodyArray(luaSt, n1 + n2);
+    copyBodies(luaSt, 1, bodies);
+    copyBodies(luaSt, 2, &bodies[n1]);
+
+    return 1;
+}
+
+/* For ipairs() and anything else that needs a table of bodies */
+static int toTableBodyArray(lua_State* luaSt)
+{
+    BodyArray* a;
+    int i, table;
+
+    a = checkBodiesBodyArray(luaSt, 1);
+
+    lua_createtable(luaSt, a->nbody, 0);
+    table = lua_gettop(luaSt);
+    for (i = 0; i < a->nbody; ++i)
+    {
+        pushBody(luaSt, &a->bodies[i]);
+        lua_rawseti(luaSt, table, i + 1);
+    }
+
+    return 1;
+}
+
+static int lenBodyArray(lua_State* luaSt)
+{
+    lua_pushinteger(luaSt, checkBodiesBodyArray(luaSt, 1)->nbody);
+    return 1;
+}
+
+static int gcBodyArray(lua_State* luaSt)
+{
+    BodyArray* a;
+
+    a = checkBodyArray(luaSt, 1);
+    mwFreeA(a->bodies);
+    a->bodies = NULL;
+    a->nbody = 0;
+
+    return 0;
+}
+
+static int toStringBodyArray(lua_State* luaSt)
+{
+    BodyArray* a = checkBodyArray(luaSt, 1);
+
+    if (a->taken)
+        lua_pushliteral(luaSt, "BodyArray(bodies taken)");
+    else
+        lua_pushfstring(luaSt, "BodyArray(%d bodies)", a->nbody);
+    return 1;
+}
+
+/* Call the member lookup registerStruct() set up, which is upvalue 1 */
+static int forwardIndexBodyArray(lua_State* luaSt)
+{
+    int nArgs = lua_gettop(luaSt);
+
+    lua_pushvalue(luaSt, lua_upvalueindex(1));
+    lua_insert(luaSt, 1);
+    lua_call(luaSt, nArgs, 1);
+
+    return 1;
+}
+
+static int indexBodyArray(lua_State* luaSt)
+{
+    BodyArray* a;
+    int i;
+
+    if (lua_type(luaSt, 2) != LUA_TNUMBER)
+        return forwardIndexBodyArray(luaSt);
+
+    a = checkBodiesBodyArray(luaSt, 1);
+    i = luaL_checkint(luaSt, 2);
+    if (i < 1 || i > a->nbody)
+    {
+        /* Same as running off the end of a table */
+        lua_pushnil(luaSt);
+        return 1;
+    }
+
+    return pushBody(luaSt, &a->bodies[i - 1]);
+}
+
+static int newIndexBodyArray(lua_State* luaSt)
+{
+    BodyArray* a;
+    int i;
+
+    if (lua_type(luaSt, 2) != LUA_TNUMBER)
+    {
+        forwardIndexBodyArray(luaSt);
+        return 0;
+    }
+
+    a = checkBodiesBodyArray(luaSt, 1);
+    i = luaL_checkint(luaSt, 2);
+    if (i < 1 || i > a->nbody)
+        return luaL_argerror(luaSt, 2, "Body index out of range");
+
+    a->bodies[i - 1] = *checkBody(luaSt, 3);
+
+    return 0;
+}
+
+static void wrapIndexHandler(lua_State* luaSt, int metaTable, const char* name, lua_CFunction f)
+{
+    lua_pushstring(luaSt, name);
+    lua_pushstring(luaSt, name);
+    lua_rawget(luaSt, metaTable);
+    lua_pushcclosure(luaSt, f, 1);
+    lua_rawset(luaSt, metaTable);
+}
+
+static const luaL_reg metaMethodsBodyArray[] =
+{
+    { "__tostring", toStringBodyArray },
+    { "__len",      lenBodyArray      },
+    { "__concat",   concatBodyArray   },
+    { "__gc",       gcBodyArray       },
+    { NULL, NULL }
+};
+
+static const luaL_reg methodsBodyArray[] =
+{
+    { "create",  createBodyArray  },
+    { "toTable", toTableBodyArray },
+    { NULL, NULL }
+};
+
+static const Xet_reg_pre gettersBodyArray[] =
+{
+    { NULL, NULL, 0 }
+};
+
+static const Xet_reg_pre settersBodyArray[] =
+{
+    { NULL, NULL, 0 }
+};
+
+int registerBodyArray(lua_State* luaSt)
+{
+    int metaTable;
+
+    registerStruct(luaSt,
+                   BODY_ARRAY_TYPE,
+                   gettersBodyArray,
+                   settersBodyArray,
+                   metaMethodsBodyArray,
+                   methodsBodyArray);
+
+    /* Numbers index the bodies, anything else goes to the usual lookup */
+    luaL_getmetatable(luaSt, BODY_ARRAY_TYPE);
+    metaTable = lua_gettop(luaSt);
+    wrapIndexHandler(luaSt, metaTable, "__index", indexBodyArray);
+    wrapIndexHandler(luaSt, metaTable, "__newindex", newIndexBodyArray);
+    lua_pop(luaSt, 1);
+
+    return 0;
+}
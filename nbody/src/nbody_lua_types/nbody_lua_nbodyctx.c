@@ -94,6 +94,8 @@ static int createNBodyCtx(lua_State* luaSt)
             { "sunGCDist",     LUA_TNUMBER,  NULL, FALSE, &ctx.sunGCDist     },
             { "criterion",     LUA_TSTRING,  NULL, FALSE, &criterionName     },
             { "useQuad",       LUA_TBOOLEAN, NULL, FALSE, &ctx.useQuad       },
+            { "useGroupWalk",  LUA_TBOOLEAN, NULL, FALSE, &ctx.useGroupWalk  },
+            { "potentialTableError", LUA_TNUMBER, NULL, FALSE, &ctx.potentialTableError },
             { "allowIncest",   LUA_TBOOLEAN, NULL, FALSE, &ctx.allowIncest   },
             { "quietErrors",   LUA_TBOOLEAN, NULL, FALSE, &ctx.quietErrors   },
             { "useBestLike",   LUA_TBOOLEAN, NULL, FALSE, &ctx.useBestLike   },
@@ -136,6 +138,7 @@ static int createNBodyCtx(lua_State* luaSt)
         /* These don't mean anything here */
         ctx.theta = 0.0;
         ctx.useQuad = FALSE;
+        ctx.useGroupWalk = FALSE;
     }
 
     nStepf = mw_ceil(ctx.timeEvolve / ctx.timestep);
@@ -231,6 +234,8 @@ static const Xet_reg_pre gettersNBodyCtx[] =
     { "sunGCDist",       getNumber,     offsetof(NBodyCtx, sunGCDist)   },
     { "criterion",       getCriterionT, offsetof(NBodyCtx, criterion)   },
     { "useQuad",         getBool,       offsetof(NBodyCtx, useQuad)     },
+    { "useGroupWalk",    getBool,       offsetof(NBodyCtx, useGroupWalk) },
+    { "potentialTableError", getNumber, offsetof(NBodyCtx, potentialTableError) },
     { "allowIncest",     getBool,       offsetof(NBodyCtx, allowIncest) },
     { "quietErrors",     getBool,       offsetof(NBodyCtx, quietErrors) },
     { "useBestLike",     getBool,       offsetof(NBodyCtx, useBestLike) },
@@ -259,6 +264,8 @@ static const Xet_reg_pre settersNBodyCtx[] =
     { "sunGCDist",       setNumber,     offsetof(NBodyCtx, sunGCDist)   },
     { "criterion",       setCriterionT, offsetof(NBodyCtx, criterion)   },
     { "useQuad",         setBool,       offsetof(NBodyCtx, useQuad)     },
+    { "useGroupWalk",    setBool,       offsetof(NBodyCtx, useGroupWalk) },
+    { "potentialTableError", setNumber, offsetof(NBodyCtx, potentialTableError) },
     { "allowIncest",     setBool,       offsetof(NBodyCtx, allowIncest) },
     { "quietErrors",     setBool,       offsetof(NBodyCtx, quietErrors) },
     { "useBestLike",     setBool,       offsetof(NBodyCtx, useBestLike) },
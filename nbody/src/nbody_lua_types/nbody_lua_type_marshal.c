@@ -29,10 +29,24 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 static int totalBodies(lua_State* luaSt, int nModels)
 {
     int top, i, n = 0;
+    BodyArray* a;
 
     top = lua_gettop(luaSt);
     for (i = top; i > top - nModels; --i)
     {
+        a = toBodyArray(luaSt, i);
+        if (a)
+        {
+            if (a->taken)
+            {
+                mw_printf("Error reading body array: its bodies were already taken\n");
+                return 0;
+            }
+
+            n += a->nbody;
+            continue;
+        }
+
         if (expectTable(luaSt, i))
         {
             mw_lua_perror(luaSt, "Error reading body table");
@@ -67,12 +81,30 @@ static int readBodyArray(lua_State* luaSt, int table, Body* bodies, int n)
     return i != n; /* Didn't read all bodies successfully */
 }
 
+/* Take the bodies of a single BodyArray model, leaving it empty. The
+   script may still hold it, so using it again is an error. */
+static Body* adoptBodyArray(lua_State* luaSt, BodyArray* a, int* nOut)
+{
+    Body* bodies = a->bodies;
+
+    if (nOut)
+        *nOut = a->nbody;
+
+    a->bodies = NULL;
+    a->nbody = 0;
+    a->taken = TRUE;
+    lua_pop(luaSt, 1);
+
+    return bodies;
+}
+
 /* Read returned table of model components. Pops the n arguments */
 Body* readModels(lua_State* luaSt, int nModels, int* nOut)
 {
     int i, n, totalN, top;
     Body* allBodies;
     Body* bodies;
+    BodyArray* a;
 
     totalN = totalBodies(luaSt, nModels);
     if (totalN == 0)
@@ -81,17 +113,33 @@ Body* readModels(lua_State* luaSt, int nModels, int* nOut)
         return NULL;
     }
 
+    /* The usual case of one generated model doesn't need copying */
+    a = toBodyArray(luaSt, lua_gettop(luaSt));
+    if (nModels == 1 && a)
+        return adoptBodyArray(luaSt, a, nOut);
+
     bodies = allBodies = (Body*) mwCallocA(totalN, sizeof(Body));
 
     for (i = 0; i < nModels; ++i)
     {
         top = lua_gettop(luaSt);
+
+        a = toBodyArray(luaSt, top);
+        if (a)
+        {
+            n = a->nbody;
+            memcpy(bodies, a->bodies, n * sizeof(Body));
+            bodies = &bodies[n];
+            lua_pop(luaSt, 1);
+            continue;
+        }
+
         n = luaL_getn(luaSt, top);
 
         if (readBodyArray(luaSt, top, bodies, n))
         {
             mw_printf("Error reading body array %d\n", i);
-            free(allBodies);
+            mwFreeA(allBodies);
             allBodies = NULL;
             totalN = 0;
             break;
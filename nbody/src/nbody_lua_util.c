@@ -33,6 +33,7 @@
 #include "nbody_check_params.h"
 #include "nbody_defaults.h"
 #include "nbody_util.h"
+#include "nbody_io.h"
 
 
 static int luaLbrToCartesian(lua_State* luaSt)
@@ -154,6 +155,66 @@ static int luaCorrectTimestep(lua_State* luaSt)
     return 1;
 }
 
+static void setInfoNumber(lua_State* luaSt, int table, const char* name, real x)
+{
+    lua_pushnumber(luaSt, x);
+    lua_setfield(luaSt, table, name);
+}
+
+static void setInfoVector(lua_State* luaSt, int table, const char* name, const double* x)
+{
+    mwvector v = mw_vec(x[0], x[1], x[2]);
+
+    pushVector(luaSt, v);
+    lua_setfield(luaSt, table, name);
+}
+
+/* readBinaryBodies(fileName) returns a BodyArray of the bodies in binary
+   output and a table with the rest of what was written */
+static int luaReadBinaryBodies(lua_State* luaSt)
+{
+    const char* fileName;
+    FILE* f;
+    NBodyBinaryHeader h;
+    Body* bodies;
+    int rc, info;
+
+    fileName = luaL_checkstring(luaSt, 1);
+
+    f = mwOpenResolved(fileName, "rb");
+    if (!f)
+        return luaL_error(luaSt, "Failed to open binary body output '%s'", fileName);
+
+    if (nbReadBinaryBodiesHeader(f, &h))
+    {
+        fclose(f);
+        return luaL_error(luaSt, "Error reading binary body output '%s'", fileName);
+    }
+
+    bodies = pushNewBodyArray(luaSt, (int) h.nbody);
+    rc = nbReadBinaryBodies(f, &h, bodies);
+    fclose(f);
+    if (rc)
+        return luaL_error(luaSt, "Error reading binary body output '%s'", fileName);
+
+    lua_createtable(luaSt, 0, 7);
+    info = lua_gettop(luaSt);
+
+    setInfoNumber(luaSt, info, "version", (real) h.version);
+    setInfoNumber(luaSt, info, "sunGCDist", h.sunGCDist);
+    setInfoVector(luaSt, info, "centerOfMass", h.cmPos);
+    setInfoVector(luaSt, info, "centerOfMomentum", h.cmVel);
+
+    lua_pushboolean(luaSt, h.outputFlags & NBODY_BINARY_CARTESIAN);
+    lua_setfield(luaSt, info, "cartesian");
+    lua_pushboolean(luaSt, h.outputFlags & NBODY_BINARY_LBR_CARTESIAN);
+    lua_setfield(luaSt, info, "lbrCartesian");
+    lua_pushboolean(luaSt, h.outputFlags & NBODY_BINARY_HAS_MILKYWAY);
+    lua_setfield(luaSt, info, "hasMilkyway");
+
+    return 2;
+}
+
 void nbRegisterUtilityFunctions(lua_State* luaSt)
 {
     lua_register(luaSt, "lbrToCartesian", luaLbrToCartesian);
@@ -164,6 +225,32 @@ void nbRegisterUtilityFunctions(lua_State* luaSt)
     lua_register(luaSt, "massUnitToSolarMass", luaMassUnitToSolarMass);
     lua_register(luaSt, "lightyearToKiloparsec", luaLightyearToKiloparsec);
     lua_register(luaSt, "kiloparsecToLightyear", luaKiloparsecToLightyear);
+
+    lua_register(luaSt, "readBinaryBodies", luaReadBinaryBodies);
+}
+
+#define NBODY_POTENTIAL_TABLE_KEY "NBodyPotentialTable"
+
+/* The table is owned by the NBodyState. It's kept where reverseOrbit()
+   can find it while makeBodies() runs. */
+void nbSetPotentialTable(lua_State* luaSt, const NBodyPotentialTable* table)
+{
+    if (table)
+        lua_pushlightuserdata(luaSt, (void*) table);
+    else
+        lua_pushnil(luaSt);
+    lua_setfield(luaSt, LUA_REGISTRYINDEX, NBODY_POTENTIAL_TABLE_KEY);
+}
+
+const NBodyPotentialTable* nbGetPotentialTable(lua_State* luaSt)
+{
+    const NBodyPotentialTable* table;
+
+    lua_getfield(luaSt, LUA_REGISTRYINDEX, NBODY_POTENTIAL_TABLE_KEY);
+    table = (const NBodyPotentialTable*) lua_touserdata(luaSt, -1);
+    lua_pop(luaSt, 1);
+
+    return table;
 }
 
 /* Return FALSE if min version set to something invalid */
@@ -39,7 +39,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
 {   
     
     /*initializing particles:*/
-    int table;
+    Body* bodies;
     Body b;
     FILE* body_inputs;
 
@@ -88,8 +88,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
     
     unsigned int nbody = fsize;
     memset(&b, 0, sizeof(b));
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);      
+    bodies = pushNewBodyArray(luaSt, nbody);
     
 
     int counter = 0;
@@ -146,8 +145,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
         
 //         mw_printf("%f %f %f %f %f %f %f\n", b.bodynode.pos.x, b.bodynode.pos.y, b.bodynode.pos.z, b.vel.x, b.vel.y, b.vel.z, b.bodynode.mass);
         assert(nbPositionValid(b.bodynode.pos));
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
     
     
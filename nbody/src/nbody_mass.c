@@ -297,109 +297,88 @@ void nbCalcBetaDisp(NBodyHistogram* histogram, mwbool initial, real correction_f
 }
 
 
-void nbRemoveVelOutliers(const NBodyState* st, NBodyHistogram* histogram, real * use_velbody, real * vlos, real sigma_cutoff)
+/* Reject the binned bodies whose line of sight velocity is too far
+ * from their bin's mean. Only looks at the bodies which landed in the
+ * histogram, in body order. */
+void nbRemoveVelOutliers(NBodyHistogram* histogram, unsigned int nBinned, int* use_velbody, const real* vlos, real sigma_cutoff)
 {
     
     unsigned int Histindex;
-    Body* p;
+    unsigned int i;
     HistData* histData;
-    const Body* endp = st->bodytab + st->nbody;
 
-    unsigned int counter = 0;
-    
     histData = histogram->data;
 
     real v_line_of_sight;
     real bin_ave, bin_sigma, new_count;
     
-    for (p = st->bodytab; p < endp; ++p)
+    for (i = 0; i < nBinned; ++i)
     {
-        /* Only include bodies in models we aren't ignoring */
-        if (!ignoreBody(p))
-        {
+        if (use_velbody[i] >= 0)//if its not -1 then it was not rejected yet and set to the Histindex   
+        {   
+            Histindex = (unsigned int) use_velbody[i];
             
-            /* Check if the position is within the bounds of the histogram */
-            if (use_velbody[counter] >= 0)//if its not -1 then it was in the hist and set to the Histindex   
-            {   
-                Histindex = (int) use_velbody[counter];
-                
-                v_line_of_sight = vlos[counter];
-                /* bin count minus what was already removed */
-                new_count = ((real) histData[Histindex].rawCount - histData[Histindex].outliersVelRemoved);
-                
-                /* average bin vel */
-                bin_ave = histData[Histindex].v_sum / new_count;
-                
-                /* the sigma for the bin is the same as the dispersion */
-                bin_sigma = histData[Histindex].vdisp;
-                
-                if(mw_fabs(bin_ave - v_line_of_sight) > sigma_cutoff * bin_sigma)//if it is outside of the sigma limit
-                {
-                    histData[Histindex].v_sum -= v_line_of_sight;//remove from vel dis sums
-                    histData[Histindex].vsq_sum -= sqr(v_line_of_sight);
-                    histData[Histindex].outliersVelRemoved++;//keep track of how many are being removed
-                    use_velbody[counter] = DEFAULT_NOT_USE;//marking the body as having been rejected as outlier
-                }
-                 
+            v_line_of_sight = vlos[i];
+            /* bin count minus what was already removed */
+            new_count = ((real) histData[Histindex].rawCount - histData[Histindex].outliersVelRemoved);
+            
+            /* average bin vel */
+            bin_ave = histData[Histindex].v_sum / new_count;
+            
+            /* the sigma for the bin is the same as the dispersion */
+            bin_sigma = histData[Histindex].vdisp;
+            
+            if(mw_fabs(bin_ave - v_line_of_sight) > sigma_cutoff * bin_sigma)//if it is outside of the sigma limit
+            {
+                histData[Histindex].v_sum -= v_line_of_sight;//remove from vel dis sums
+                histData[Histindex].vsq_sum -= sqr(v_line_of_sight);
+                histData[Histindex].outliersVelRemoved++;//keep track of how many are being removed
+                use_velbody[i] = -1;//marking the body as having been rejected as outlier
             }
-            counter++;
         }
     }
-    
-    
 }
 
 
 
-void nbRemoveBetaOutliers(const NBodyState* st, NBodyHistogram* histogram, real * use_betabody, real * betas, real sigma_cutoff)
+/* Same as nbRemoveVelOutliers, for the beta coordinate */
+void nbRemoveBetaOutliers(NBodyHistogram* histogram, unsigned int nBinned, int* use_betabody, const real* betas, real sigma_cutoff)
 {
     
     unsigned int Histindex;
-    Body* p;
+    unsigned int i;
     HistData* histData;
-    const Body* endp = st->bodytab + st->nbody;
 
-    unsigned int counter = 0;
-    
     histData = histogram->data;
 
     real beta;
     real bin_ave, bin_sigma, new_count;
 
-    for (p = st->bodytab; p < endp; ++p)
+    for (i = 0; i < nBinned; ++i)
     {
-        /* Only include bodies in models we aren't ignoring */
-        if (!ignoreBody(p))
-        {
-            /* Check if the position is within the bounds of the histogram */
-            if (use_betabody[counter] >= 0)//if its not -1 then it was in the hist and set to the Histindex   
-            {   
-                Histindex = (int) use_betabody[counter];
-                
-                beta = betas[counter];
-                /* bin count minus what was already removed */
-                new_count = ((real) histData[Histindex].rawCount - histData[Histindex].outliersBetaRemoved);
-                
-                /* average bin vel */
-                bin_ave = histData[Histindex].beta_sum / new_count;
-                
-                /* the sigma for the bin is the same as the dispersion */
-                bin_sigma = histData[Histindex].beta_disp;
-                
-                if(mw_fabs(bin_ave - beta) > sigma_cutoff * bin_sigma)//if it is outside of the sigma limit
-                {
-                    histData[Histindex].beta_sum -= beta;//remove from vel dis sums
-                    histData[Histindex].betasq_sum -= sqr(beta);
-                    histData[Histindex].outliersBetaRemoved++;//keep track of how many are being removed
-                    use_betabody[counter] = DEFAULT_NOT_USE;//marking the body as having been rejected as outlier
-                }
-                 
+        if (use_betabody[i] >= 0)//if its not -1 then it was not rejected yet and set to the Histindex   
+        {   
+            Histindex = (unsigned int) use_betabody[i];
+            
+            beta = betas[i];
+            /* bin count minus what was already removed */
+            new_count = ((real) histData[Histindex].rawCount - histData[Histindex].outliersBetaRemoved);
+            
+            /* average bin vel */
+            bin_ave = histData[Histindex].beta_sum / new_count;
+            
+            /* the sigma for the bin is the same as the dispersion */
+            bin_sigma = histData[Histindex].beta_disp;
+            
+            if(mw_fabs(bin_ave - beta) > sigma_cutoff * bin_sigma)//if it is outside of the sigma limit
+            {
+                histData[Histindex].beta_sum -= beta;//remove from vel dis sums
+                histData[Histindex].betasq_sum -= sqr(beta);
+                histData[Histindex].outliersBetaRemoved++;//keep track of how many are being removed
+                use_betabody[i] = -1;//marking the body as having been rejected as outlier
             }
-            counter++;
         }
     }
-    
-    
 }
 
 real nbCostComponent(const NBodyHistogram* data, const NBodyHistogram* histogram)
@@ -33,6 +33,8 @@ their copyright to their programs which execute similar algorithms.
 #include "nbody_mixeddwarf.h"
 #include "nbody_types.h"
 #include "nbody_potential_types.h"
+#include "nbody_df_table.h"
+#include "nbody_prng_streams.h"
 
 /*Note: minusfivehalves(x) raises to x^-5/2 power and minushalf(x) is x^-1/2*/
 
@@ -596,6 +598,7 @@ static inline real vel_mag(real r, const Dwarf* comp1, const Dwarf* comp2, dsfmt
     return v; //km/s
 }
 
+
 static inline mwvector get_components(dsfmt_t* dsfmtState, real rad)
 {
     /* assigns angles. Allows for non-circular orbits.*/
@@ -705,7 +708,7 @@ static inline void get_extra_nfw_mass(Dwarf* comp, real bound)
 /*      DWARF GENERATION        */
 static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, 
                                      Dwarf* comp1,  Dwarf* comp2, 
-                                    mwbool ignore, mwvector rShift, mwvector vShift)
+                                    mwbool ignore, mwvector rShift, mwvector vShift, mwbool tabulateDF)
 {
     /* generatePlummer: generate Plummer model initial conditions for test
     * runs, scaled to units such that M = -4E = G = 1 (Henon, Heggie,
@@ -713,7 +716,7 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
     * 183.
     */
         unsigned int i;
-        int table;
+        Body* bodies;
         Body b;
         real r, v;
  
@@ -784,75 +787,144 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
        
         
         /*finding the max of the individual components*/
-        int place_holder = 0;
         real rho_max_light = mw_sqrt(2.0 / 3.0) * rscale_l; //these are the analytic equations for the radius where r^2rho is max;
         real rho_max_dark  = mw_sqrt(2.0 / 3.0) * rscale_d;
         rho_max_light = sqr(rho_max_light) * get_density(comp1, rho_max_light);
         rho_max_dark  = sqr(rho_max_dark)  * get_density(comp2, rho_max_dark);
+
+        /* the radii of each component come from its own tabulated enclosed mass
+         * and the velocities from the tabulated distribution function of both
+         * together. with tabulateDF = false they are rejection sampled instead.
+         */
+        NBodyDFTable* df = NULL;
+        NBodyPRNGStreams streams;
+        int k;
+        int failed = FALSE;
+        if (tabulateDF)
+        {
+            df = nbMakeDFTable(comp1, comp2, bound1, bound2, NBODY_DF_MIXED_DWARF_TRUNCATION);
+        }
+        if (tabulateDF && !df)
+        {
+            free(x);
+            free(y);
+            free(z);
+            free(vx);
+            free(vy);
+            free(vz);
+            free(masses);
+            return luaL_error(luaSt, "Failed to tabulate distribution function, try tabulateDF = false");
+        }
         
      /*initializing particles:*/
         memset(&b, 0, sizeof(b));
-        lua_createtable(luaSt, nbody, 0);
-        table = lua_gettop(luaSt);      
-        int counter = 0;
-        
+        bodies = pushNewBodyArray(luaSt, nbody);
+        /* each block of bodies draws from its own stream, so they can be
+         * done in parallel and come out the same on any number of threads
+         */
+        nbInitPRNGStreams(&streams, prng, nbody, tabulateDF ? NBODY_PRNG_DWARF_TABLE_BLOCK : NBODY_PRNG_DWARF_BLOCK);
 
         /*getting the radii and velocities for the bodies*/
-        for (i = 0; i < nbody; i++)
+    #ifdef _OPENMP
+        #pragma omp parallel for private(k, i, r, v, vec) shared(streams, df, x, y, z, vx, vy, vz, masses, failed) schedule(dynamic, 1)
+    #endif
+        for (k = 0; k < (int) streams.nBlocks; k++)
         {
-            counter = 0;
-            do
+            dsfmt_t* st = &streams.states[k];
+            unsigned int first, last;
+            int counter;
+            mwbool sampled = TRUE;
+
+            nbPRNGStreamBlock(&streams, (unsigned int) k, &first, &last);
+            for (i = first; i < last && sampled; i++)
             {
-                
-                if(i < half_bodies)
+                counter = 0;
+                do
                 {
-                    r = r_mag(prng, comp1, rho_max_light, bound1);
-                    masses[i] = mass_light_particle;
-                }
-                else if(i >= half_bodies)
-                {
-                    r = r_mag(prng, comp2, rho_max_dark, bound2);
-                    masses[i] = mass_dark_particle;
-                }
-                /*to ensure that r is finite and nonzero*/
-                if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
                 
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
+                    if(i < half_bodies)
+                    {
+                        r = tabulateDF ? nbDFTableSampleRadius(df, 0, st) : r_mag(st, comp1, rho_max_light, bound1);
+                        masses[i] = mass_light_particle;
+                    }
+                    else if(i >= half_bodies)
+                    {
+                        r = tabulateDF ? nbDFTableSampleRadius(df, 1, st) : r_mag(st, comp2, rho_max_dark, bound2);
+                        masses[i] = mass_dark_particle;
+                    }
+                    /*to ensure that r is finite and nonzero*/
+                    if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
+                
+                    if(counter > 1000)
+                    {
+                        sampled = FALSE;
+                        break;
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                
+                }while (1);
+
+                if (!sampled)
                 {
-                    counter++;
+                    break;
                 }
-                
-            }while (1);
             
 //             mw_printf("\rvelocity of particle %i", i + 1);
-            counter = 0;
-            do
-            {
-                v = vel_mag(r, comp1, comp2, prng);
-                if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
-                
-                if(counter > 1000)
+                counter = 0;
+                do
                 {
-                    exit(-1);
-                }
-                else
+                    v = tabulateDF ? nbDFTableSampleSpeed(df, r, st) : vel_mag(r, comp1, comp2, st);
+                    if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
+                
+                    if(counter > 1000)
+                    {
+                        sampled = FALSE;
+                        break;
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                
+                }while (1);
+
+                if (!sampled)
                 {
-                    counter++;
+                    break;
                 }
-                
-            }while (1);
-            vec = get_components(prng, v);   
-            vx[i] = vec.x;
-            vy[i] = vec.y;
-            vz[i] = vec.z;
-            vec = get_components(prng, r);  
-            x[i] = vec.x;
-            y[i] = vec.y;
-            z[i] = vec.z;
+                vec = get_components(st, v);   
+                vx[i] = vec.x;
+                vy[i] = vec.y;
+                vz[i] = vec.z;
+                vec = get_components(st, r);  
+                x[i] = vec.x;
+                y[i] = vec.y;
+                z[i] = vec.z;
+            }
+
+            /* can't leave the parallel region from here, so it is reported after */
+            if (!sampled)
+            {
+                failed = TRUE;
+            }
+        }
+
+        nbFinishPRNGStreams(&streams, prng);
+
+        if (failed)
+        {
+            nbDestroyDFTable(df);
+            free(x);
+            free(y);
+            free(z);
+            free(vx);
+            free(vy);
+            free(vz);
+            free(masses);
+            return luaL_error(luaSt, "Failed to sample mixed dwarf bodies");
         }
         
         /* getting the center of mass and momentum correction */
@@ -885,11 +957,11 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
             b.vel.z = vz[i];
             
             assert(nbPositionValid(b.bodynode.pos));
-            pushBody(luaSt, &b);
-            lua_rawseti(luaSt, table, i + 1);
+            bodies[i] = b;
         }
         
         /* go now and be free!*/
+        nbDestroyDFTable(df);
         free(x);
         free(y);
         free(z);
@@ -908,6 +980,7 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
         static const mwvector* position = NULL;
         static const mwvector* velocity = NULL;
         static mwbool ignore;
+        static mwbool tabulateDF = TRUE;
         static real nbodyf = 0.0;
         static Dwarf* comp1 = NULL;
         static Dwarf* comp2 = NULL;
@@ -920,6 +993,7 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
             { "velocity",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &velocity          },
             { "ignore",               LUA_TBOOLEAN,    NULL,                    FALSE,   &ignore            },
             { "prng",                 LUA_TUSERDATA,   DSFMT_TYPE,              TRUE,    &prng              },
+            { "tabulateDF",           LUA_TBOOLEAN,    NULL,                    FALSE,   &tabulateDF        },
             END_MW_NAMED_ARG
             
         };
@@ -927,10 +1001,11 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
         if (lua_gettop(luaSt) != 1)
             return luaL_argerror(luaSt, 1, "Expected 1 arguments");
         
+        tabulateDF = TRUE;
         handleNamedArgumentTable(luaSt, argTable, 1);
         
         return nbGenerateMixedDwarfCore(luaSt, prng, (unsigned int) nbodyf, comp1, comp2, ignore,
-                                                                 *position, *velocity);
+                                                                 *position, *velocity, tabulateDF);
 }
 
 
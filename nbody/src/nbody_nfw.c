@@ -146,7 +146,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
                              real R_S)
 {
     unsigned int i;
-    int table;
+    Body* bodies;
     Body b;
     real r;
     real totalMass = 0.0;
@@ -160,8 +160,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
     b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    bodies = pushNewBodyArray(luaSt, nbody);
 
 
     /* Start with half an epsilon */
@@ -184,8 +183,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
         b.vel = nfwBodyVelocity(prng, vShift, r, rho_0, R_S);
         assert(nbPositionValid(b.bodynode.pos));
 
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
 
     return 1;
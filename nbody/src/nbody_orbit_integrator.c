@@ -34,6 +34,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 void nbReverseOrbit(mwvector* finalPos,
                     mwvector* finalVel,
                     const Potential* pot,
+                    const NBodyPotentialTable* table,
                     mwvector pos,
                     mwvector vel,
                     real tstop,
@@ -49,7 +50,7 @@ void nbReverseOrbit(mwvector* finalPos,
     mw_incnegv(v);
 
     // Get the initial acceleration
-    acc = nbExtAcceleration(pot, x);
+    acc = nbTableExtAcceleration(table, pot, x);
 
     for (t = 0; t <= tstop; t += dt)
     {
@@ -58,7 +59,7 @@ void nbReverseOrbit(mwvector* finalPos,
         mw_incaddv_s(x, v, dt);
         
         // Compute the new acceleration
-        acc = nbExtAcceleration(pot, x);
+        acc = nbTableExtAcceleration(table, pot, x);
         
         mw_incaddv_s(v, acc, dt_half);
     }
@@ -54,16 +54,33 @@ static void nbReportProgress(const NBodyCtx* ctx, NBodyState* st)
     }
 }
 
+/* Make bodytab and acctab current before something outside of the
+   step reads them */
+static inline void nbSyncBodiesSoA(NBodyState* st)
+{
+    if (st->soa)
+    {
+        nbMarshalBodiesSoA(st, FALSE);
+    }
+}
+
 static NBodyStatus nbCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
-    if (nbTimeToCheckpoint(ctx, st))
+    /* Only report checkpoints once they're written */
+    if (nbPollCheckpointWriter(st))
     {
-        if (nbWriteCheckpoint(ctx, st))
+        return NBODY_CHECKPOINT_ERROR;
+    }
+
+    /* Don't ask again until the last one is written, so every time
+       it's time to checkpoint is matched by one completed checkpoint */
+    if (!nbCheckpointWriterBusy(st) && nbTimeToCheckpoint(ctx, st))
+    {
+        nbSyncBodiesSoA(st);
+        if (nbWriteCheckpointAsync(ctx, st))
         {
             return NBODY_CHECKPOINT_ERROR;
         }
-
-        mw_checkpoint_completed();
     }
 
     return NBODY_SUCCESS;
@@ -121,119 +138,166 @@ static inline void advanceVelocities(NBodyState* st, const int nbody, const real
     }
 }
 
+/* SoA versions of the above. Each component is a separate unit stride
+   stream. Positions are copied back to bodytab afterwards since the
+   tree is still built from the bodies. */
+static inline void advancePosVelSoA(NBodyState* st, const int nbody, const real dt)
+{
+    int i, k;
+    real dtHalf = 0.5 * dt;
+    NBodySoA* soa = st->soa;
+    Body* bodies = mw_assume_aligned(st->bodytab, 16);
+
+    for (k = 0; k < 3; ++k)
+    {
+        real* RESTRICT pos = soa->pos[k];
+        real* RESTRICT vel = soa->vel[k];
+        const real* RESTRICT acc = soa->acc[k];
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i) schedule(static)
+      #endif
+        for (i = 0; i < nbody; ++i)
+        {
+            vel[i] += acc[i] * dtHalf;
+            pos[i] += vel[i] * dt;
+        }
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) shared(bodies, soa) schedule(static)
+  #endif
+    for (i = 0; i < nbody; ++i)
+    {
+        SET_VECTOR(Pos(&bodies[i]), soa->pos[0][i], soa->pos[1][i], soa->pos[2][i]);
+    }
+}
+
+static inline void advanceVelocitiesSoA(NBodyState* st, const int nbody, const real dt)
+{
+    int i, k;
+    real dtHalf = 0.5 * dt;
+    NBodySoA* soa = st->soa;
+
+    for (k = 0; k < 3; ++k)
+    {
+        real* RESTRICT vel = soa->vel[k];
+        const real* RESTRICT acc = soa->acc[k];
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i) schedule(static)
+      #endif
+        for (i = 0; i < nbody; ++i)
+        {
+            vel[i] += acc[i] * dtHalf;
+        }
+    }
+}
+
+
+/* Read the likelihood information and the data histogram once per
+ * run instead of every step. Failures are remembered so we don't keep
+ * retrying. */
+static void nbLoadBestLikeData(NBodyState* st, const NBodyFlags* nbf)
+{
+    st->bestLikeLoaded = TRUE;
+
+    if (nbGetLikelihoodInfo(nbf, &st->bestLikeParams, &st->bestLikeMethod)
+        || st->bestLikeMethod == NBODY_INVALID_METHOD)
+    {
+        return;
+    }
+
+    st->bestLikeData = nbReadHistogram(nbf->histogramFileName);
+}
 
 static inline int get_likelihood(const NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf)
 {
     NBodyHistogram* data = NULL;
     NBodyHistogram* histogram = NULL;
     real likelihood = NAN;
-    real likelihood_EMD = NAN;
-    real likelihood_Mass = NAN;
-    real likelihood_Beta = NAN;
-    real likelihood_Vel = NAN;
-    NBodyLikelihoodMethod method;
-    HistogramParams hp;
-    
+
     mwbool calculateLikelihood = (nbf->histogramFileName != NULL);
     
-    
-    if (calculateLikelihood || nbf->histoutFileName || nbf->printHistogram)
+    if (!calculateLikelihood)
     {
-        if (nbGetLikelihoodInfo(nbf, &hp, &method) || method == NBODY_INVALID_METHOD)
-        {
-            /* this would normally return a print statement 
-             * but I do not want to overload the output since 
-             * this would run every time step.
-             */
-            return 0;
-        }
+        return 0;
     }
-    
-    if (calculateLikelihood)
+
+    if (!st->bestLikeLoaded)
     {
-        
-        histogram = nbCreateHistogram(ctx, st, &hp);
- 
-        if (!histogram)
-        {
-            /* this would normally return a print statement 
-             * but I do not want to overload the output since 
-             * this would run every time step.
-             */
-            return 0;
-        }
-        
-        data = nbReadHistogram(nbf->histogramFileName);
-        
-        if (!data)
-        {
-            free(histogram);
-            /* if the input histogram does not exist, I do not want the 
-             * simulation to terminate as you can still get the output file
-             * from it. Therefore, this function will end here but with 0
-             */
-            return 0;
-        }
-        likelihood = nbSystemLikelihood(st, data, histogram, method);
-
-        /*
-          Used to fix Windows platform issues.  Windows' infinity is expressed as:
-          1.#INF00000, -1.#INF00000, or 0.#INF000000.  The server reads these as -1, 1, and 0
-          respectively, accounting for the sign change.  Thus, I have changed overflow
-          infinities (not errors) to be the worst case.  The worst case is now the actual
-          worst thing that can happen.
-
-        * It previous returned the worse case when the likelihood == 0. 
-        * Changed it to be best case, 1e-9 which has been added in nbody_defaults.h
-        */
-        if (likelihood > DEFAULT_WORST_CASE || likelihood < (-1 * DEFAULT_WORST_CASE) || isnan(likelihood))
+        nbLoadBestLikeData(st, nbf);
+    }
+
+    /* If the likelihood information or input histogram does not exist,
+     * this would normally return a print statement but I do not want
+     * to overload the output since this would run every time step. I
+     * also do not want the simulation to terminate as you can still
+     * get the output file from it.
+     */
+    data = st->bestLikeData;
+    if (!data)
+    {
+        return 0;
+    }
+
+    histogram = nbCreateHistogramInState(ctx, st, &st->bestLikeParams);
+    likelihood = nbSystemLikelihood(st, data, histogram, st->bestLikeMethod);
+
+    /*
+      Used to fix Windows platform issues.  Windows' infinity is expressed as:
+      1.#INF00000, -1.#INF00000, or 0.#INF000000.  The server reads these as -1, 1, and 0
+      respectively, accounting for the sign change.  Thus, I have changed overflow
+      infinities (not errors) to be the worst case.  The worst case is now the actual
+      worst thing that can happen.
+
+    * It previous returned the worse case when the likelihood == 0. 
+    * Changed it to be best case, 1e-9 which has been added in nbody_defaults.h
+    */
+    if (likelihood > DEFAULT_WORST_CASE || likelihood < (-1 * DEFAULT_WORST_CASE) || isnan(likelihood))
+    {
+        likelihood = DEFAULT_WORST_CASE;
+    }
+    else if(likelihood == 0.0)
+    {
+        likelihood = DEFAULT_BEST_CASE;
+    }
+
+    /* this checks to see if the likelihood is an improvement */
+    if(mw_fabs(likelihood) < mw_fabs(st->bestLikelihood))
+    {
+        st->bestLikelihood = likelihood;
+
+        st->bestLikelihood_Mass = nbCostComponent(data, histogram);
+
+        if (st->useBetaDisp)
         {
-            likelihood = DEFAULT_WORST_CASE;
+            st->bestLikelihood_Beta = nbBetaDispersion(data, histogram);
         }
-        else if(likelihood == 0.0)
+        else st->bestLikelihood_Beta = 0.0;
+
+        if (st->useVelDisp)
         {
-            likelihood = DEFAULT_BEST_CASE;
+            st->bestLikelihood_Vel = nbVelocityDispersion(data, histogram);
         }
+        else st->bestLikelihood_Vel = 0.0;
 
-        /* this checks to see if the likelihood is an improvement */
-        if(mw_fabs(likelihood) < mw_fabs(st->bestLikelihood))
+        st->bestLikelihood_EMD = likelihood-(st->bestLikelihood_Mass)-(st->bestLikelihood_Beta)-(st->bestLikelihood_Vel);
+        
+        /* Calculating the time that the best likelihood occurred */
+        st->bestLikelihood_time = ((real) st->step / (real) ctx->nStep) * ctx->timeEvolve;
+        
+        /* checking how many times the likelihood was improved */
+        st->bestLikelihood_count++;
+        
+        /* if it is an improvement then write out this histogram */
+        if (nbf->histoutFileName)
         {
-            st->bestLikelihood = likelihood;
-
-            st->bestLikelihood_Mass = nbCostComponent(data, histogram);
-
-            if (st->useBetaDisp)
-            {
-                st->bestLikelihood_Beta = nbBetaDispersion(data, histogram);
-            }
-            else st->bestLikelihood_Beta = 0.0;
-
-            if (st->useVelDisp)
-            {
-                st->bestLikelihood_Vel = nbVelocityDispersion(data, histogram);
-            }
-            else st->bestLikelihood_Vel = 0.0;
-
-            st->bestLikelihood_EMD = likelihood-(st->bestLikelihood_Mass)-(st->bestLikelihood_Beta)-(st->bestLikelihood_Vel);
-            
-            /* Calculating the time that the best likelihood occurred */
-            st->bestLikelihood_time = ((real) st->step / (real) ctx->nStep) * ctx->timeEvolve;
-            
-            /* checking how many times the likelihood was improved */
-            st->bestLikelihood_count++;
-            
-            /* if it is an improvement then write out this histogram */
-            if (nbf->histoutFileName)
-            {
-                nbWriteHistogram(nbf->histoutFileName, ctx, st, histogram);
-            }
+            nbWriteHistogram(nbf->histoutFileName, ctx, st, histogram);
         }
     }
-    
-    free(histogram);
-    free(data);
+
     return NBODY_SUCCESS;
-    
 }
 
 
@@ -244,10 +308,18 @@ NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
     
     const real dt = ctx->timestep;
 
-    advancePosVel(st, st->nbody, dt);
-
-    rc = nbGravMap(ctx, st);
-    advanceVelocities(st, st->nbody, dt);
+    if (st->soa)
+    {
+        advancePosVelSoA(st, st->nbody, dt);
+        rc = nbGravMap(ctx, st);
+        advanceVelocitiesSoA(st, st->nbody, dt);
+    }
+    else
+    {
+        advancePosVel(st, st->nbody, dt);
+        rc = nbGravMap(ctx, st);
+        advanceVelocities(st, st->nbody, dt);
+    }
 
     st->step++;
     #ifdef NBODY_BLENDER_OUTPUT
@@ -261,6 +333,13 @@ NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
 NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf)
 {
     NBodyStatus rc = NBODY_SUCCESS;
+
+    if (st->usesSoA)
+    {
+        nbCreateSoA(st);
+        nbMarshalBodiesSoA(st, TRUE);
+    }
+
     rc |= nbGravMap(ctx, st); /* Calculate accelerations for 1st step this episode */
     if (nbStatusIsFatal(rc))
         return rc;
@@ -297,6 +376,7 @@ NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFla
         #ifdef NBODY_DEV_OPTIONS
             if(ctx->MultiOutput)
             {
+                nbSyncBodiesSoA(st);
                 dev_write_outputs(ctx, st, nbf, ctx->OutputFreq);
             }
                 
@@ -306,6 +386,7 @@ NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFla
         
         if(curStep / Nstep >= ctx->BestLikeStart && ctx->useBestLike)
         {
+            nbSyncBodiesSoA(st);
             get_likelihood(ctx, st, nbf);
         }
     
@@ -318,8 +399,14 @@ NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFla
         /* We report the progress at step + 1. 0 is the original
            center of mass. */
         nbReportProgress(ctx, st);
+        if (st->scene)
+        {
+            nbSyncBodiesSoA(st);
+        }
         nbUpdateDisplayedBodies(ctx, st);
     }
+
+    nbSyncBodiesSoA(st);
     
     #ifdef NBODY_BLENDER_OUTPUT
         blenderPrintMisc(st, ctx, startCmPos, perpendicularCmPos);
@@ -24,6 +24,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "milkyway_lua.h"
 #include "nbody_lua_types.h"
 #include "nbody_plummer.h"
+#include "nbody_prng_streams.h"
 
 /* pickshell: pick a random point on a sphere of specified radius. */
 static inline mwvector pickShell(dsfmt_t* dsfmtState, real rad)
@@ -118,42 +119,54 @@ static int nbGeneratePlummerCore(lua_State* luaSt,
                                  mwvector vShift,
                                  real radiusScale)
 {
-    unsigned int i;
-    int table;
-    Body b;
-    real r, velScale;
-
-    memset(&b, 0, sizeof(b));
+    int k;
+    Body* bodies;
+    real velScale;
+    NBodyPRNGStreams streams;
 
     velScale = mw_sqrt(mass / radiusScale);     /* and recip. speed scale */
 
-    b.bodynode.type = BODY(ignore);    /* Same for all in the model */
-    b.bodynode.mass = mass / nbody;    /* Mass per particle */
+    bodies = pushNewBodyArray(luaSt, nbody);
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    /* Each block of bodies draws from its own stream, so the blocks can
+       be done in parallel and the model doesn't depend on the threads */
+    nbInitPRNGStreams(&streams, prng, nbody, NBODY_PRNG_PLUMMER_BLOCK);
 
-    for (i = 0; i < nbody; ++i)
+  #ifdef _OPENMP
+    #pragma omp parallel for private(k) shared(streams, bodies) schedule(dynamic, 1)
+  #endif
+    for (k = 0; k < (int) streams.nBlocks; ++k)
     {
-        do
+        dsfmt_t* st = &streams.states[k];
+        unsigned int j, first, last;
+        real r;
+
+        nbPRNGStreamBlock(&streams, (unsigned int) k, &first, &last);
+        for (j = first; j < last; ++j)
         {
-            r = plummerRandomR(prng);
-            /* FIXME: We should avoid the divide by 0.0 by multiplying
-             * the original random number by 0.9999.. but I'm too lazy
-             * to change the tests. Same with other models */
+            Body* b = &bodies[j];
+
+            do
+            {
+                r = plummerRandomR(st);
+                /* FIXME: We should avoid the divide by 0.0 by multiplying
+                 * the original random number by 0.9999.. but I'm too lazy
+                 * to change the tests. Same with other models */
+            }
+            while (isinf(r));
+
+            b->bodynode.type = BODY(ignore);    /* Same for all in the model */
+            b->bodynode.mass = mass / nbody;    /* Mass per particle */
+            b->bodynode.id = j + 1;
+            b->bodynode.pos = plummerBodyPosition(st, rShift, radiusScale, r);
+            b->vel = plummerBodyVelocity(st, vShift, velScale, r);
+
+            assert(nbPositionValid(b->bodynode.pos));
         }
-        while (isinf(r));
-        
-        b.bodynode.id = i + 1;
-        b.bodynode.pos = plummerBodyPosition(prng, rShift, radiusScale, r);
-        b.vel = plummerBodyVelocity(prng, vShift, velScale, r);
-
-        assert(nbPositionValid(b.bodynode.pos));
-
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
     }
 
+    nbFinishPRNGStreams(&streams, prng);
+
     return 1;
 }
 
@@ -25,6 +25,7 @@
 #include "milkyway_util.h"
 #include "nbody_caustic.h"
 #include "nbody_bessel.h"
+#include "nbody_potential_table.h"
 
 #ifdef __GNUC__
 #pragma GCC diagnostic ignored "-Wunused-parameter"
@@ -500,29 +501,23 @@ static inline mwvector ninkovicHaloAccel(const Halo* h, mwvector pos, real r)
     return acc;
 }
 
-mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
+static mwvector nbDiskAccel(const Disk* disk, mwvector pos, real r)
 {
-    mwvector acc, acctmp;
-    real r = mw_absv(pos);
-    const real limit = mw_pow(2.0,-8.0);
-
-    /* Change r if less than limit. Done this way to pipeline this step*/
-    r = (r <= limit)*limit + (r > limit)*r;
+    mwvector acc;
 
-    /*Calculate the Disk Accelerations*/
-    switch (pot->disk.type)
+    switch (disk->type)
     {
         case FreemanDisk:
-            acc = freemanDiskAccel(&pot->disk, pos, r);
+            acc = freemanDiskAccel(disk, pos, r);
             break;
         case MiyamotoNagaiDisk:
-            acc = miyamotoNagaiDiskAccel(&pot->disk, pos, r);
+            acc = miyamotoNagaiDiskAccel(disk, pos, r);
             break;
         case DoubleExponentialDisk:
-            acc = doubleExponentialDiskAccel(&pot->disk, pos, r);
+            acc = doubleExponentialDiskAccel(disk, pos, r);
             break;
         case Sech2ExponentialDisk:
-            acc = sech2ExponentialDiskAccel(&pot->disk, pos, r);
+            acc = sech2ExponentialDiskAccel(disk, pos, r);
             break;
         case NoDisk:
             X(acc) = 0.0;
@@ -531,112 +526,396 @@ mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
             break;
         case InvalidDisk:
         default:
-            mw_fail("Invalid primary disk type in external acceleration\n");
+            mw_fail("Invalid disk type in external acceleration\n");
+    }
+
+    return acc;
+}
+
+static mwvector nbHaloAccel(const Halo* halo, mwvector pos, real r)
+{
+    mwvector acc;
+
+    switch (halo->type)
+    {
+        case LogarithmicHalo:
+            acc = logHaloAccel(halo, pos, r);
+            break;
+        case NFWHalo:
+            acc = nfwHaloAccel(halo, pos, r);
+            break;
+        case TriaxialHalo:
+            acc = triaxialHaloAccel(halo, pos, r);
+            break;
+        case CausticHalo:
+            acc = causticHaloAccel(halo, pos, r);
+            break;
+        case AllenSantillanHalo:
+            acc = ASHaloAccel(halo, pos, r);
+            break;
+        case WilkinsonEvansHalo:
+            acc = WEHaloAccel(halo, pos, r);
+        case NFWMassHalo:
+            acc = NFWMHaloAccel(halo, pos, r);
+            break;
+        case PlummerHalo:
+            acc = plummerHaloAccel(halo, pos, r);
+            break;
+        case HernquistHalo:
+            acc = hernquistHaloAccel(halo, pos, r);
+            break;
+        case NinkovicHalo:
+            acc = ninkovicHaloAccel(halo, pos, r);
+            break;
+        case NoHalo:
+            X(acc) = 0.0;
+            Y(acc) = 0.0;
+            Z(acc) = 0.0;
+            break;
+        case InvalidHalo:
+        default:
+            mw_fail("Invalid halo type in external acceleration\n");
+    }
+
+    return acc;
+}
+
+static inline mwvector nbSphericalAccel(const Spherical* sph, mwvector pos, real r)
+{
+    mwvector acc;
+
+    switch (sph->type)
+    {
+        case HernquistSpherical:
+            acc = hernquistSphericalAccel(sph, pos, r);
+            break;
+        case PlummerSpherical:
+            acc = plummerSphericalAccel(sph, pos, r);
+            break;
+        case NoSpherical:
+            X(acc) = 0.0;
+            Y(acc) = 0.0;
+            Z(acc) = 0.0;
+            break;
+        case InvalidSpherical:
+        default:
+            mw_fail("Invalid bulge type in external acceleration\n");
     }
 
+    return acc;
+}
+
+/* Distance from the center used by the potentials */
+static inline real nbPotentialRadius(mwvector pos)
+{
+    real r = mw_absv(pos);
+    const real limit = mw_pow(2.0,-8.0);
+
+    /* Change r if less than limit. Done this way to pipeline this step*/
+    return (r <= limit)*limit + (r > limit)*r;
+}
+
+mwvector nbDiskAcceleration(const Disk* disk, mwvector pos)
+{
+    return nbDiskAccel(disk, pos, nbPotentialRadius(pos));
+}
+
+mwvector nbHaloAcceleration(const Halo* halo, mwvector pos)
+{
+    return nbHaloAccel(halo, pos, nbPotentialRadius(pos));
+}
+
+mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
+{
+    mwvector acc, acctmp;
+    const real r = nbPotentialRadius(pos);
+
+    /*Calculate the Disk Accelerations*/
+    acc = nbDiskAccel(&pot->disk, pos, r);
+
     /*Calculate Second Disk Accelerations*/
-    switch (pot->disk2.type)
+    acctmp = nbDiskAccel(&pot->disk2, pos, r);
+    mw_incaddv(acc, acctmp);
+
+    /*Calculate the Halo Accelerations*/
+    acctmp = nbHaloAccel(&pot->halo, pos, r);
+    mw_incaddv(acc, acctmp);
+
+    /*Calculate the Bulge Accelerations*/
+    acctmp = nbSphericalAccel(&pot->sphere[0], pos, r);
+    mw_incaddv(acc, acctmp);
+
+    /*For debugging acceleration values*/
+//    if (!isfinite(mw_absv(acc)))
+//    {
+//        mw_printf("ERROR: UNNATURAL ACCELERATION CALCULATED!\n");
+//        mw_printf("[X,Y,Z] = [%.15f,%.15f,%.15f]\n",X(pos),Y(pos),Z(pos));
+//        mw_printf("Acceleration = %.15f \n",mw_absv(acc));
+//    }
+
+    return acc;
+}
+
+/* Same as nbExtAcceleration, but the components with a grid in the
+ * table are interpolated where the grid can be used. The table must
+ * have been made from pot. */
+mwvector nbTableExtAcceleration(const NBodyPotentialTable* t, const Potential* pot, mwvector pos)
+{
+    mwvector acc, acctmp;
+    real r;
+
+    if (!t)
     {
-        case FreemanDisk:
-            acctmp = freemanDiskAccel(&pot->disk2, pos, r);
+        return nbExtAcceleration(pot, pos);
+    }
+
+    r = nbPotentialRadius(pos);
+
+    if (!nbPotentialGridAcceleration(&t->disk, pos, &acc))
+        acc = nbDiskAccel(&pot->disk, pos, r);
+
+    if (!nbPotentialGridAcceleration(&t->disk2, pos, &acctmp))
+        acctmp = nbDiskAccel(&pot->disk2, pos, r);
+    mw_incaddv(acc, acctmp);
+
+    if (!nbPotentialGridAcceleration(&t->halo, pos, &acctmp))
+        acctmp = nbHaloAccel(&pot->halo, pos, r);
+    mw_incaddv(acc, acctmp);
+
+    acctmp = nbSphericalAccel(&pot->sphere[0], pos, r);
+    mw_incaddv(acc, acctmp);
+
+    return acc;
+}
+
+
+/* Batched versions of the above. The component types are switched on
+ * once per batch instead of once per point, and each case is a plain
+ * loop over the points which the compiler can vectorise. They do the
+ * same operations in the same order as nbExtAcceleration(), so the
+ * results are identical.
+ */
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+  #define NB_SIMD_LOOP _Pragma("omp simd")
+#else
+  #define NB_SIMD_LOOP
+#endif
+
+#define NB_BATCH_LOOP(accelFunc, comp)                      \
+    NB_SIMD_LOOP                                            \
+    for (i = 0; i < n; ++i)                                 \
+    {                                                       \
+        mwvector pos, a;                                    \
+        SET_VECTOR(pos, x[i], y[i], z[i]);                  \
+        a = accelFunc(comp, pos, r[i]);                     \
+        ax[i] = X(a);                                       \
+        ay[i] = Y(a);                                       \
+        az[i] = Z(a);                                       \
+    }
+
+#define NB_BATCH_ZERO()                                     \
+    for (i = 0; i < n; ++i)                                 \
+    {                                                       \
+        ax[i] = 0.0;                                        \
+        ay[i] = 0.0;                                        \
+        az[i] = 0.0;                                        \
+    }
+
+/* Points with a grid which covers them are interpolated, and the rest
+   are evaluated one at a time */
+static void nbGridAccelBatch(const NBodyPotentialGrid* g,
+                             const void* comp,
+                             mwvector (*accelFunc)(const void*, mwvector, real),
+                             int n,
+                             const real* x, const real* y, const real* z, const real* r,
+                             real* ax, real* ay, real* az)
+{
+    int i;
+    mwvector pos, a;
+
+    for (i = 0; i < n; ++i)
+    {
+        SET_VECTOR(pos, x[i], y[i], z[i]);
+        if (!nbPotentialGridAcceleration(g, pos, &a))
+            a = accelFunc(comp, pos, r[i]);
+        ax[i] = X(a);
+        ay[i] = Y(a);
+        az[i] = Z(a);
+    }
+}
+
+static mwvector nbDiskAccelVoid(const void* disk, mwvector pos, real r)
+{
+    return nbDiskAccel((const Disk*) disk, pos, r);
+}
+
+static mwvector nbHaloAccelVoid(const void* halo, mwvector pos, real r)
+{
+    return nbHaloAccel((const Halo*) halo, pos, r);
+}
+
+static void nbDiskAccelBatch(const Disk* disk, const NBodyPotentialGrid* g, int n,
+                             const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                             const real* RESTRICT r,
+                             real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az)
+{
+    int i;
+
+    if (g && g->a)
+    {
+        nbGridAccelBatch(g, disk, nbDiskAccelVoid, n, x, y, z, r, ax, ay, az);
+        return;
+    }
+
+    switch (disk->type)
+    {
+        case FreemanDisk:  /* Too big to inline twice, and doesn't vectorise anyway */
+            NB_BATCH_LOOP(nbDiskAccel, disk);
             break;
         case MiyamotoNagaiDisk:
-            acctmp = miyamotoNagaiDiskAccel(&pot->disk2, pos, r);
+            NB_BATCH_LOOP(miyamotoNagaiDiskAccel, disk);
             break;
         case DoubleExponentialDisk:
-            acctmp = doubleExponentialDiskAccel(&pot->disk2, pos, r);
+            NB_BATCH_LOOP(doubleExponentialDiskAccel, disk);
             break;
         case Sech2ExponentialDisk:
-            acctmp = sech2ExponentialDiskAccel(&pot->disk2, pos, r);
+            NB_BATCH_LOOP(sech2ExponentialDiskAccel, disk);
             break;
         case NoDisk:
-            X(acctmp) = 0.0;
-            Y(acctmp) = 0.0;
-            Z(acctmp) = 0.0;
+            NB_BATCH_ZERO();
             break;
         case InvalidDisk:
         default:
-            mw_fail("Invalid secondary disk type in external acceleration\n");
+            mw_fail("Invalid disk type in external acceleration\n");
     }
-    mw_incaddv(acc, acctmp);
+}
 
-    /*Calculate the Halo Accelerations*/
-    switch (pot->halo.type)
+static void nbHaloAccelBatch(const Halo* halo, const NBodyPotentialGrid* g, int n,
+                             const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                             const real* RESTRICT r,
+                             real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az)
+{
+    int i;
+
+    if (g && g->a)
+    {
+        nbGridAccelBatch(g, halo, nbHaloAccelVoid, n, x, y, z, r, ax, ay, az);
+        return;
+    }
+
+    switch (halo->type)
     {
         case LogarithmicHalo:
-            acctmp = logHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(logHaloAccel, halo);
             break;
         case NFWHalo:
-            acctmp = nfwHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(nfwHaloAccel, halo);
             break;
         case TriaxialHalo:
-            acctmp = triaxialHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(triaxialHaloAccel, halo);
             break;
         case CausticHalo:
-            acctmp = causticHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(causticHaloAccel, halo);
             break;
         case AllenSantillanHalo:
-            acctmp = ASHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(ASHaloAccel, halo);
             break;
-        case WilkinsonEvansHalo:
-            acctmp = WEHaloAccel(&pot->halo, pos, r);
+        case WilkinsonEvansHalo:  /* Falls through to NFWMassHalo in nbHaloAccel() */
         case NFWMassHalo:
-            acctmp = NFWMHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(NFWMHaloAccel, halo);
             break;
         case PlummerHalo:
-            acctmp = plummerHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(plummerHaloAccel, halo);
             break;
         case HernquistHalo:
-            acctmp = hernquistHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(hernquistHaloAccel, halo);
             break;
         case NinkovicHalo:
-            acctmp = ninkovicHaloAccel(&pot->halo, pos, r);
+            NB_BATCH_LOOP(ninkovicHaloAccel, halo);
             break;
         case NoHalo:
-            X(acctmp) = 0.0;
-            Y(acctmp) = 0.0;
-            Z(acctmp) = 0.0;
+            NB_BATCH_ZERO();
             break;
         case InvalidHalo:
         default:
             mw_fail("Invalid halo type in external acceleration\n");
     }
-    mw_incaddv(acc, acctmp);
+}
 
-    /*Calculate the Bulge Accelerations*/
-    switch (pot->sphere[0].type)
+static void nbSphericalAccelBatch(const Spherical* sph, int n,
+                                  const real* RESTRICT x, const real* RESTRICT y, const real* RESTRICT z,
+                                  const real* RESTRICT r,
+                                  real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az)
+{
+    int i;
+
+    switch (sph->type)
     {
         case HernquistSpherical:
-            acctmp = hernquistSphericalAccel(&pot->sphere[0], pos, r);
+            NB_BATCH_LOOP(hernquistSphericalAccel, sph);
             break;
         case PlummerSpherical:
-            acctmp = plummerSphericalAccel(&pot->sphere[0], pos, r);
+            NB_BATCH_LOOP(plummerSphericalAccel, sph);
             break;
         case NoSpherical:
-            X(acctmp) = 0.0;
-            Y(acctmp) = 0.0;
-            Z(acctmp) = 0.0;
+            NB_BATCH_ZERO();
             break;
         case InvalidSpherical:
         default:
             mw_fail("Invalid bulge type in external acceleration\n");
     }
-    mw_incaddv(acc, acctmp);
+}
 
-    /*For debugging acceleration values*/
-//    if (!isfinite(mw_absv(acc)))
-//    {
-//        mw_printf("ERROR: UNNATURAL ACCELERATION CALCULATED!\n");
-//        mw_printf("[X,Y,Z] = [%.15f,%.15f,%.15f]\n",X(pos),Y(pos),Z(pos));
-//        mw_printf("Acceleration = %.15f \n",mw_absv(acc));
-//    }
+static inline void nbAddBatch(int n,
+                              real* RESTRICT ax, real* RESTRICT ay, real* RESTRICT az,
+                              const real* RESTRICT cx, const real* RESTRICT cy, const real* RESTRICT cz)
+{
+    int i;
 
-    return acc;
+    NB_SIMD_LOOP
+    for (i = 0; i < n; ++i)
+    {
+        ax[i] += cx[i];
+        ay[i] += cy[i];
+        az[i] += cz[i];
+    }
 }
 
+void nbExtAccelerationBatch(const Potential* pot, const NBodyPotentialTable* t, int n,
+                            const real* x, const real* y, const real* z,
+                            real* ax, real* ay, real* az)
+{
+    int i0, i;
+    real r[NBODY_EXT_BATCH];
+    real cx[NBODY_EXT_BATCH];
+    real cy[NBODY_EXT_BATCH];
+    real cz[NBODY_EXT_BATCH];
 
+    for (i0 = 0; i0 < n; i0 += NBODY_EXT_BATCH)
+    {
+        const int m = n - i0 < NBODY_EXT_BATCH ? n - i0 : NBODY_EXT_BATCH;
+        const real* bx = &x[i0];
+        const real* by = &y[i0];
+        const real* bz = &z[i0];
 
+        NB_SIMD_LOOP
+        for (i = 0; i < m; ++i)
+        {
+            mwvector pos;
+            SET_VECTOR(pos, bx[i], by[i], bz[i]);
+            r[i] = nbPotentialRadius(pos);
+        }
 
+        nbDiskAccelBatch(&pot->disk, t ? &t->disk : NULL, m, bx, by, bz, r, &ax[i0], &ay[i0], &az[i0]);
 
+        nbDiskAccelBatch(&pot->disk2, t ? &t->disk2 : NULL, m, bx, by, bz, r, cx, cy, cz);
+        nbAddBatch(m, &ax[i0], &ay[i0], &az[i0], cx, cy, cz);
 
+        nbHaloAccelBatch(&pot->halo, t ? &t->halo : NULL, m, bx, by, bz, r, cx, cy, cz);
+        nbAddBatch(m, &ax[i0], &ay[i0], &az[i0], cx, cy, cz);
 
+        nbSphericalAccelBatch(&pot->sphere[0], m, bx, by, bz, r, cx, cy, cz);
+        nbAddBatch(m, &ax[i0], &ay[i0], &az[i0], cx, cy, cz);
+    }
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The exponential disks integrate Bessel functions for every
+ * evaluation, and the caustic halo sums 20 flows with complex roots.
+ * These are all axisymmetric, so their accelerations are tabulated on
+ * a grid in (R, |z|) once and interpolated with bicubic Lagrange
+ * polynomials afterwards.
+ *
+ * Each cell of a grid is checked against the direct evaluation at its
+ * middle. Cells where the relative error is above the requested bound,
+ * such as the ones around the cusps of the caustics, are marked and
+ * keep using the direct evaluation.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_potential.h"
+#include "nbody_potential_table.h"
+#include "milkyway_util.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+/* The caustic radii in nbody_caustic.c are fixed, so its grid isn't
+   scaled by any halo parameter. In kpc. */
+#define CAUSTIC_TABLE_SCALE 1.0
+
+
+typedef mwvector (*NBodyComponentAccel)(const void* comp, mwvector pos);
+
+static mwvector nbTableDiskAccel(const void* comp, mwvector pos)
+{
+    return nbDiskAcceleration((const Disk*) comp, pos);
+}
+
+static mwvector nbTableHaloAccel(const void* comp, mwvector pos)
+{
+    return nbHaloAcceleration((const Halo*) comp, pos);
+}
+
+static inline void nbCubicWeights(real t, real w[4])
+{
+    w[0] = -t * (t - 1.0) * (t - 2.0) / 6.0;
+    w[1] = (t + 1.0) * (t - 1.0) * (t - 2.0) / 2.0;
+    w[2] = -(t + 1.0) * t * (t - 2.0) / 2.0;
+    w[3] = (t + 1.0) * t * (t - 1.0) / 6.0;
+}
+
+/* Nodes below the axes are mirrors of the ones above. aR is odd in R
+   and even in z, and az is the other way around. */
+static inline void nbGridNode(const NBodyPotentialGrid* g, int i, int j, real* aR, real* az)
+{
+    real sR = 1.0, sZ = 1.0;
+    const real* a;
+
+    if (i < 0)
+    {
+        i = -i - 1;
+        sR = -1.0;
+    }
+
+    if (j < 0)
+    {
+        j = -j - 1;
+        sZ = -1.0;
+    }
+
+    a = &g->a[2 * (i * g->nZ + j)];
+    *aR = sR * a[0];
+    *az = sZ * a[1];
+}
+
+/* Interpolate in the cell from node (i0, j0) to (i0 + 1, j0 + 1) at
+   fractions t and s of the way across it */
+static void nbInterpolateGrid(const NBodyPotentialGrid* g, int i0, int j0, real t, real s, real* aROut, real* azOut)
+{
+    int i, j;
+    real wu[4], wv[4];
+    real aR = 0.0, az = 0.0;
+
+    nbCubicWeights(t, wu);
+    nbCubicWeights(s, wv);
+
+    for (i = 0; i < 4; ++i)
+    {
+        real rowR = 0.0, rowZ = 0.0;
+
+        for (j = 0; j < 4; ++j)
+        {
+            real nR, nZ;
+
+            nbGridNode(g, i0 + i - 1, j0 + j - 1, &nR, &nZ);
+            rowR += wv[j] * nR;
+            rowZ += wv[j] * nZ;
+        }
+
+        aR += wu[i] * rowR;
+        az += wu[i] * rowZ;
+    }
+
+    *aROut = aR;
+    *azOut = az;
+}
+
+mwbool nbPotentialGridAcceleration(const NBodyPotentialGrid* g, mwvector pos, mwvector* acc)
+{
+    int i0, j0;
+    real R, fu, fv, aR, az;
+
+    if (!g->a)
+    {
+        return FALSE;
+    }
+
+    R = mw_sqrt(sqr(X(pos)) + sqr(Y(pos)));
+    fu = mw_asinh(R / g->scaleR) / g->du - 0.5;
+    fv = mw_asinh(mw_abs(Z(pos)) / g->scaleZ) / g->dv - 0.5;
+
+    /* The last cell with a full stencil starts at node n - 3 */
+    if (!(fu < g->nR - 2) || !(fv < g->nZ - 2))
+    {
+        return FALSE;
+    }
+
+    i0 = (int) mw_floor(fu);
+    j0 = (int) mw_floor(fv);
+
+    if (g->exact[(i0 + 1) * g->nZ + (j0 + 1)])
+    {
+        return FALSE;
+    }
+
+    nbInterpolateGrid(g, i0, j0, fu - i0, fv - j0, &aR, &az);
+
+    if (R > 0.0)
+    {
+        X(*acc) = aR * X(pos) / R;
+        Y(*acc) = aR * Y(pos) / R;
+    }
+    else
+    {
+        X(*acc) = 0.0;
+        Y(*acc) = 0.0;
+    }
+    Z(*acc) = Z(pos) < 0.0 ? -az : az;
+
+    return TRUE;
+}
+
+static void nbFreePotentialGrid(NBodyPotentialGrid* g)
+{
+    free(g->a);
+    free(g->exact);
+    g->a = NULL;
+    g->exact = NULL;
+}
+
+/* Fill the nodes and find the cells which need the direct evaluation.
+   Returns the number of those cells. */
+static int nbFillPotentialGrid(NBodyPotentialGrid* g,
+                               NBodyComponentAccel f,
+                               const void* comp,
+                               real scaleR,
+                               real scaleZ,
+                               real maxError)
+{
+    int i, j;
+    int nExact = 0;
+    const int nR = NBODY_POTENTIAL_TABLE_NODES;
+    const int nZ = NBODY_POTENTIAL_TABLE_NODES;
+
+    g->nR = nR;
+    g->nZ = nZ;
+    g->scaleR = scaleR;
+    g->scaleZ = scaleZ;
+
+    /* Leave the stencil of the last cell room past the maximum radius */
+    g->du = mw_asinh(NBODY_POTENTIAL_TABLE_MAX_RADIUS / scaleR) / (nR - 4);
+    g->dv = mw_asinh(NBODY_POTENTIAL_TABLE_MAX_RADIUS / scaleZ) / (nZ - 4);
+
+    g->a = (real*) mwMalloc(2 * nR * nZ * sizeof(real));
+    g->exact = (unsigned char*) mwCalloc(nR * nZ, sizeof(unsigned char));
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, j) schedule(dynamic)
+  #endif
+    for (i = 0; i < nR; ++i)
+    {
+        for (j = 0; j < nZ; ++j)
+        {
+            mwvector pos, a;
+
+            SET_VECTOR(pos, scaleR * mw_sinh((i + 0.5) * g->du), 0.0, scaleZ * mw_sinh((j + 0.5) * g->dv));
+            a = f(comp, pos);
+
+            g->a[2 * (i * nZ + j)] = X(a);
+            g->a[2 * (i * nZ + j) + 1] = Z(a);
+        }
+    }
+
+    /* Cells start at nodes -1 to n - 3 */
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, j) schedule(dynamic) reduction(+ : nExact)
+  #endif
+    for (i = -1; i <= nR - 3; ++i)
+    {
+        for (j = -1; j <= nZ - 3; ++j)
+        {
+            mwvector pos, a;
+            real aR, az, err, mag;
+
+            /* The middle of the first cell is on the axis, which some
+               of the potentials can't be evaluated on */
+            real t = i < 0 ? 0.75 : 0.5;
+            real s = j < 0 ? 0.75 : 0.5;
+
+            SET_VECTOR(pos,
+                       scaleR * mw_sinh((i + 0.5 + t) * g->du),
+                       0.0,
+                       scaleZ * mw_sinh((j + 0.5 + s) * g->dv));
+            a = f(comp, pos);
+            nbInterpolateGrid(g, i, j, t, s, &aR, &az);
+
+            mag = mw_sqrt(sqr(X(a)) + sqr(Z(a)));
+            err = mw_sqrt(sqr(aR - X(a)) + sqr(az - Z(a)));
+
+            if (!isfinite(err) || !(err <= maxError * mag))
+            {
+                g->exact[(i + 1) * nZ + (j + 1)] = TRUE;
+                ++nExact;
+            }
+        }
+    }
+
+    return nExact;
+}
+
+static mwbool nbDiskNeedsTable(const Disk* d)
+{
+    return d->type == DoubleExponentialDisk || d->type == Sech2ExponentialDisk;
+}
+
+NBodyPotentialTable* nbMakePotentialTable(const Potential* pot, real maxError)
+{
+    NBodyPotentialTable* t;
+    mwbool tabulateDisk = nbDiskNeedsTable(&pot->disk);
+    mwbool tabulateDisk2 = nbDiskNeedsTable(&pot->disk2);
+    mwbool tabulateHalo = (pot->halo.type == CausticHalo);
+
+    if (!(maxError > 0.0) || !(tabulateDisk || tabulateDisk2 || tabulateHalo))
+    {
+        return NULL;
+    }
+
+    t = (NBodyPotentialTable*) mwCalloc(1, sizeof(NBodyPotentialTable));
+    t->pot = *pot;
+    t->maxError = maxError;
+
+    if (tabulateDisk)
+    {
+        nbFillPotentialGrid(&t->disk, nbTableDiskAccel, &t->pot.disk,
+                            pot->disk.scaleLength, pot->disk.scaleHeight, maxError);
+    }
+
+    if (tabulateDisk2)
+    {
+        nbFillPotentialGrid(&t->disk2, nbTableDiskAccel, &t->pot.disk2,
+                            pot->disk2.scaleLength, pot->disk2.scaleHeight, maxError);
+    }
+
+    if (tabulateHalo)
+    {
+        nbFillPotentialGrid(&t->halo, nbTableHaloAccel, &t->pot.halo,
+                            CAUSTIC_TABLE_SCALE, CAUSTIC_TABLE_SCALE, maxError);
+    }
+
+    return t;
+}
+
+void nbDestroyPotentialTable(NBodyPotentialTable* t)
+{
+    if (!t)
+    {
+        return;
+    }
+
+    nbFreePotentialGrid(&t->disk);
+    nbFreePotentialGrid(&t->disk2);
+    nbFreePotentialGrid(&t->halo);
+    free(t);
+}
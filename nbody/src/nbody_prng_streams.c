@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "milkyway_util.h"
+#include "nbody_prng_streams.h"
+#include "dSFMT-jump.h"
+
+#ifndef DSFMT_HAVE_JUMP_2_64
+  #error "No dSFMT jump polynomial for this DSFMT_MEXP"
+#endif
+
+void nbInitPRNGStreams(NBodyPRNGStreams* s, const dsfmt_t* prng, unsigned int nbody, unsigned int minBlock)
+{
+    unsigned int k;
+    unsigned int blockSize = (nbody + NBODY_PRNG_MAX_BLOCKS - 1) / NBODY_PRNG_MAX_BLOCKS;
+
+    s->nbody = nbody;
+    s->blockSize = blockSize > minBlock ? blockSize : minBlock;
+    s->nBlocks = nbody > 0 ? (nbody + s->blockSize - 1) / s->blockSize : 1;
+
+    /* The states hold SSE2 vectors */
+    s->states = (dsfmt_t*) mwMallocA(s->nBlocks * sizeof(dsfmt_t));
+
+    s->states[0] = *prng;
+    for (k = 1; k < s->nBlocks; ++k)
+    {
+        s->states[k] = s->states[k - 1];
+        dSFMT_jump(&s->states[k], dsfmt_jump_2_64);
+    }
+}
+
+void nbFinishPRNGStreams(NBodyPRNGStreams* s, dsfmt_t* prng)
+{
+    *prng = s->states[s->nBlocks - 1];
+    mwFreeA(s->states);
+    s->states = NULL;
+}
+
+void nbPRNGStreamBlock(const NBodyPRNGStreams* s, unsigned int k, unsigned int* first, unsigned int* last)
+{
+    *first = k * s->blockSize;
+    *last = *first + s->blockSize < s->nbody ? *first + s->blockSize : s->nbody;
+}
@@ -495,6 +495,8 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      "  sunGCDist       = %f\n"
                      "  criterion       = %s\n"
                      "  useQuad         = %s\n"
+                     "  useGroupWalk    = %s\n"
+                     "  potentialTableError = %g\n"
                      "  allowIncest     = %s\n"
                      "  checkpointT     = %d\n"
                      "  nStep           = %u\n"
@@ -509,6 +511,8 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      ctx->sunGCDist,
                      showCriterionT(ctx->criterion),
                      showBool(ctx->useQuad),
+                     showBool(ctx->useGroupWalk),
+                     ctx->potentialTableError,
                      showBool(ctx->allowIncest),
                      (int) ctx->checkpointT,
                      ctx->nStep,
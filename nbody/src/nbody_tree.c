@@ -21,6 +21,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "nbody_priv.h"
 #include "nbody_tree.h"
+#include "nbody_util.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -33,7 +34,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 
 /* subIndex: compute subcell index for body p in cell q. */
-static inline int nbSubIndex(Body* p, NBodyCell* q)
+static inline int nbSubIndex(const Body* p, const NBodyCell* q)
 {
     int ind = 0;
 
@@ -65,9 +66,10 @@ static inline void nbIncAddNBodyQuadMatrix(NBodyQuadMatrix* RESTRICT a, NBodyQua
 
 /* hackQuad: descend tree, evaluating quadrupole moments.  Note that this
  * routine is coded so that the Subp() and Quad() components of a cell can
- * share the same memory locations.
+ * share the same memory locations. If descend is false, the moments of
+ * the subcells must already be set.
  */
-static void hackQuad(NBodyCell* p)
+static void hackQuad(NBodyCell* p, mwbool descend)
 {
     unsigned int ndesc, i;
     NBodyNode* desc[NSUB];
@@ -88,9 +90,9 @@ static void hackQuad(NBodyCell* p)
     for (i = 0; i < ndesc; ++i)                 /* loop over real subnodes  */
     {
         q = desc[i];                            /* access each one in turn  */
-        if (isCell(q))                          /* if it's also a cell      */
+        if (descend && isCell(q))               /* if it's also a cell      */
         {
-            hackQuad((NBodyCell*) q);           /* then process it first    */
+            hackQuad((NBodyCell*) q, TRUE);     /* then process it first    */
         }
 
         dr = mw_subv(Pos(q), Pos(p));           /* find displacement vect.  */
@@ -122,9 +124,10 @@ static void hackQuad(NBodyCell* p)
 
 
 /* threadTree: do a recursive treewalk starting from node p,
- * with next stop n, installing Next and More links.
+ * with next stop n, installing Next and More links. If descend is
+ * false, only the links of p and its immediate children are set.
  */
-static void threadTree(NBodyNode* p, NBodyNode* n)
+static void threadTree(NBodyNode* p, NBodyNode* n, mwbool descend)
 {
     unsigned int ndesc, i;
     NBodyNode* desc[NSUB+1];
@@ -144,7 +147,10 @@ static void threadTree(NBodyNode* p, NBodyNode* n)
         desc[ndesc] = n;                        /* end table with next */
         for (i = 0; i < ndesc; i++)             /* loop over children */
         {
-            threadTree(desc[i], desc[i + 1]);     /* thread each w/ next */
+            if (descend)
+                threadTree(desc[i], desc[i + 1], TRUE); /* thread each w/ next */
+            else
+                Next(desc[i]) = desc[i + 1];
         }
     }
 }
@@ -155,18 +161,38 @@ static void threadTree(NBodyNode* p, NBodyNode* n)
  */
 static void expandBox(NBodyTree* t, const Body* btab, int nbody)
 {
+    int i;
     real xyzmax;
-    const Body* p;
     const NBodyCell* root = t->root;
 
     assert(t->rsize > 0.0);
 
     xyzmax = 0.0;
-    for (p = btab; p < btab + nbody; ++p)
+
+  #ifdef _OPENMP
+    #pragma omp parallel private(i) shared(xyzmax)
+  #endif
     {
-        xyzmax = mw_fmax(xyzmax, mw_abs(X(Pos(p)) - X(Pos(root))));
-        xyzmax = mw_fmax(xyzmax, mw_abs(Y(Pos(p)) - Y(Pos(root))));
-        xyzmax = mw_fmax(xyzmax, mw_abs(Z(Pos(p)) - Z(Pos(root))));
+        real localMax = 0.0;
+
+      #ifdef _OPENMP
+        #pragma omp for schedule(static)
+      #endif
+        for (i = 0; i < nbody; ++i)
+        {
+            const Body* p = &btab[i];
+
+            localMax = mw_fmax(localMax, mw_abs(X(Pos(p)) - X(Pos(root))));
+            localMax = mw_fmax(localMax, mw_abs(Y(Pos(p)) - Y(Pos(root))));
+            localMax = mw_fmax(localMax, mw_abs(Z(Pos(p)) - Z(Pos(root))));
+        }
+
+      #ifdef _OPENMP
+        #pragma omp critical (nbExpandBox)
+      #endif
+        {
+            xyzmax = mw_fmax(xyzmax, localMax);
+        }
     }
 
     while (t->rsize < 2.0 * xyzmax)
@@ -196,6 +222,81 @@ static NBodyCell* nbMakeCell(NBodyState* st, NBodyTree* t)
     return c;
 }
 
+/* Cells and counts private to one thread while building the tree in
+ * parallel. Free cells are taken from st->freeCell in batches so the
+ * shared list is rarely touched. */
+typedef struct
+{
+    NBodyNode* freeCell;
+    unsigned int cellUsed;
+    unsigned int maxDepth;
+    int structureError;
+} NBodyCellCache;
+
+#define NBODY_CELL_BATCH 64
+
+static NBodyCell* nbMakeCellCached(NBodyState* st, NBodyCellCache* cache)
+{
+    NBodyCell* c;
+
+    if (cache->freeCell == NULL)
+    {
+      #ifdef _OPENMP
+        #pragma omp critical (nbFreeCellList)
+      #endif
+        {
+            unsigned int i;
+            NBodyNode* p = st->freeCell;
+
+            /* Take the front of the list in order */
+            cache->freeCell = p;
+            for (i = 1; i < NBODY_CELL_BATCH && p && Next(p); ++i)
+            {
+                p = Next(p);
+            }
+
+            if (p)
+            {
+                st->freeCell = Next(p);
+                Next(p) = NULL;
+            }
+        }
+    }
+
+    if (cache->freeCell == NULL)
+    {
+        c = (NBodyCell*) mwMallocA(sizeof(*c));
+    }
+    else
+    {
+        c = (NBodyCell*) cache->freeCell;
+        cache->freeCell = Next(c);
+    }
+    Type(c) = CELL(0);
+    More(c) = NULL;
+    memset(&c->stuff, 0, sizeof(c->stuff));
+    cache->cellUsed++;
+    return c;
+}
+
+/* Give back unused cached cells and merge the counts into the tree */
+static void nbMergeCellCache(NBodyState* st, NBodyTree* t, NBodyCellCache* cache)
+{
+    NBodyNode* p;
+
+    while (cache->freeCell)
+    {
+        p = cache->freeCell;
+        cache->freeCell = Next(p);
+        Next(p) = st->freeCell;
+        st->freeCell = p;
+    }
+
+    t->cellUsed += cache->cellUsed;
+    t->maxDepth = MAX(t->maxDepth, cache->maxDepth);
+    t->structureError |= cache->structureError;
+}
+
 /* reclaim cells in tree, prepare to build new one. */
 static void nbNewTree(NBodyState* st, NBodyTree* t)
 {
@@ -238,35 +339,124 @@ static inline void nbInitMidpoint(NBodyCell* c, const Body* p, const NBodyCell*
     Z(Pos(c)) = calcOffset(Z(Pos(p)), Z(Pos(q)), qsize);
 }
 
-/* loadBody: descend tree and insert body p in appropriate place. */
-static void nbLoadBody(NBodyState* st, NBodyTree* t, Body* p)
+/* Copy the body indices in src to dst sorted by the subcell of q they
+ * belong in, counting how many land in each.
+ */
+static void nbPartitionBodies(const Body* btab, const NBodyCell* q, const int* src, int* dst,
+                              unsigned char* sub, int n, int counts[NSUB])
+{
+    int i, k;
+    int offsets[NSUB];
+
+    for (k = 0; k < NSUB; ++k)
+    {
+        counts[k] = 0;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        sub[i] = (unsigned char) nbSubIndex(&btab[src[i]], q);
+        counts[sub[i]]++;
+    }
+
+    offsets[0] = 0;
+    for (k = 1; k < NSUB; ++k)
+    {
+        offsets[k] = offsets[k - 1] + counts[k - 1];
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        dst[offsets[sub[i]]++] = src[i];
+    }
+}
+
+/* Check if a cell of size qsize at level lev is too small to split */
+static mwbool nbCellTooSmall(const NBodyState* st, NBodyCellCache* cache, real qsize, unsigned int lev)
+{
+    if (qsize <= REAL_EPSILON)
+    {
+        if (!cache->structureError)
+        {
+            mw_printf("qsize (= %.15f) <= epsilon at level %u (initial root = %.15f)\n", qsize, lev, st->tree.rsize);
+            cache->structureError = TRUE; /* FIXME: Not quite the same as the other structure error */
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Make the subcell of q (size qsize) containing body p. Returns NULL
+ * if q is already too small to split. */
+static NBodyCell* nbMakeSubCell(NBodyState* st, NBodyCellCache* cache, const NBodyCell* q,
+                                const Body* p, real qsize, unsigned int lev)
+{
+    NBodyCell* c;
+
+    if (nbCellTooSmall(st, cache, qsize, lev))
+    {
+        return NULL;
+    }
+
+    c = nbMakeCellCached(st, cache);
+    nbInitMidpoint(c, p, q, qsize);
+    return c;
+}
+
+/* splitCell: distribute the n bodies in idx over the subcells of q at
+ * level lev. The indices end up sorted by subcell in tmp. Subcells
+ * holding a single body point to the body, the others become new cells
+ * which are returned in subCells (NULL where nothing was created). This
+ * produces the same tree as inserting the bodies one at a time.
+ */
+static void splitCell(NBodyState* st, NBodyCellCache* cache, NBodyCell* q, real qsize, unsigned int lev,
+                      const int* idx, int* tmp, unsigned char* sub, int n,
+                      int counts[NSUB], NBodyCell* subCells[NSUB])
+{
+    int k;
+    int start = 0;
+    const Body* btab = st->bodytab;
+
+    nbPartitionBodies(btab, q, idx, tmp, sub, n, counts);
+
+    for (k = 0; k < NSUB; ++k)
+    {
+        subCells[k] = NULL;
+
+        if (counts[k] == 1)
+        {
+            Subp(q)[k] = (NBodyNode*) &btab[tmp[start]];
+            cache->maxDepth = MAX(cache->maxDepth, lev);
+        }
+        else if (counts[k] > 1)
+        {
+            subCells[k] = nbMakeSubCell(st, cache, q, &btab[tmp[start]], qsize, lev);
+            Subp(q)[k] = (NBodyNode*) subCells[k];
+        }
+
+        start += counts[k];
+    }
+}
+
+/* loadBody: descend the subtree at q, which has size qsize and is at
+ * level lev, and insert body p in appropriate place. */
+static void nbLoadBody(NBodyState* st, NBodyCellCache* cache, NBodyCell* q, real qsize, unsigned int lev, Body* p)
 {
-    NBodyCell* q;
     NBodyCell* c;
     size_t qind;
-    unsigned int lev;
-    real qsize;
 
-    q = t->root;                                /* start with tree t.root */
     qind = nbSubIndex(p, q);                    /* get index of subcell */
-    qsize = t->rsize;                           /* keep track of cell size */
-    lev = 0;                                    /* count levels descended */
     while (Subp(q)[qind] != NULL)               /* loop descending tree */
     {
-        if (qsize <= REAL_EPSILON)
+        if (nbCellTooSmall(st, cache, qsize, lev))
         {
-            if (!t->structureError)
-            {
-                mw_printf("qsize (= %.15f) <= epsilon at level %u (initial root = %.15f)\n", qsize, lev, t->rsize);
-                t->structureError = TRUE; /* FIXME: Not quite the same as the other structure error */
-            }
             return;
         }
 
         if (isBody(Subp(q)[qind]))              /* reached a "leaf"? */
         {
-            c = nbMakeCell(st, t);             /* allocate new cell */
-            nbInitMidpoint(c, p, q, qsize);    /* initialize midpoint */
+            c = nbMakeSubCell(st, cache, q, p, qsize, lev); /* allocate new cell */
 
             Subp(c)[nbSubIndex((Body*) Subp(q)[qind], c)] = Subp(q)[qind];
             /* put body in cell */
@@ -278,7 +468,7 @@ static void nbLoadBody(NBodyState* st, NBodyTree* t, Body* p)
         ++lev;                            /* count another level */
     }
     Subp(q)[qind] = (NBodyNode*) p;            /* found place, store p */
-    t->maxDepth = MAX(t->maxDepth, lev);  /* remember maximum level */
+    cache->maxDepth = MAX(cache->maxDepth, lev);  /* remember maximum level */
 }
 
 ALWAYS_INLINE
@@ -381,9 +571,10 @@ static inline void nbCheckTreeStructure(NBodyTree* tree, const mwvector pPos, co
 
 
 /* hackCofM: descend tree finding center-of-mass coordinates and
- * setting critical cell radii.
+ * setting critical cell radii. If descend is false, the subcells must
+ * already be done.
  */
-static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize)
+static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize, mwbool descend)
 {
     int i;
     NBodyNode* q;
@@ -396,9 +587,9 @@ static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real ps
     {
         if ((q = Subp(p)[i]) != NULL)           /* does subnode exist? */
         {
-            if (isCell(q))                     /* and is it a cell? */
+            if (descend && isCell(q))          /* and is it a cell? */
             {
-                hackCofM(ctx, tree, (NBodyCell*) q, 0.5 * psize); /* find subcell cm */
+                hackCofM(ctx, tree, (NBodyCell*) q, 0.5 * psize, TRUE); /* find subcell cm */
             }
 
             Mass(p) += Mass(q);                       /* sum total mass */
@@ -423,38 +614,334 @@ static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real ps
     Pos(p) = cmpos;             /* and center-of-mass pos */
 }
 
+/* Make sure there is space for nNode linearised nodes. Grows with some
+ * slack since the number of cells changes a little from step to step */
+static void nbReserveTreeNodes(NBodyTree* t, unsigned int nNode, mwbool useQuad)
+{
+    if (nNode > t->maxNode)
+    {
+        mwFreeA(t->nodes);
+        mwFreeA(t->quads);
+        t->quads = NULL;
+
+        t->maxNode = nNode + nNode / 8;
+        t->nodes = (NBodyTreeNode*) mwMallocA(t->maxNode * sizeof(NBodyTreeNode));
+    }
+
+    if (useQuad && !t->quads)
+    {
+        t->quads = (NBodyQuadMatrix*) mwMallocA(t->maxNode * sizeof(NBodyQuadMatrix));
+    }
+}
+
+/* linearizeTree: copy the subtree at p into t->nodes in the order the
+ * threaded tree is walked. The node following a subtree in this order
+ * is Next() of its root, so next is just the count after the subtree.
+ */
+static void linearizeTree(NBodyTree* t, const Body* btab, const NBodyNode* p, mwbool useQuad)
+{
+    const NBodyNode* q;
+    unsigned int i = t->nNode++;
+    NBodyTreeNode* node = &t->nodes[i];
+
+    node->pos = Pos(p);
+    node->mass = Mass(p);
+    node->more = -1;
+
+    if (isCell(p))
+    {
+        node->rcrit2 = Rcrit2(p);
+        node->body = -1;
+
+        if (useQuad)
+        {
+            t->quads[i] = Quad(p);
+        }
+
+        if (More(p))
+        {
+            node->more = (int) t->nNode;
+        }
+
+        for (q = More(p); q != Next(p); q = Next(q))
+        {
+            linearizeTree(t, btab, q, useQuad);
+        }
+    }
+    else
+    {
+        node->rcrit2 = 0.0;
+        node->body = (int) ((const Body*) p - btab);
+    }
+
+    node->next = Next(p) ? (int) t->nNode : -1;
+}
+
+/* A cell whose subtree still needs to be built. Its n bodies are in
+ * idx, with the same range of the other buffers in tmp and sub. */
+typedef struct
+{
+    NBodyCell* cell;
+    real size;
+    unsigned int lev;
+    int* idx;
+    int* tmp;
+    unsigned char* sub;
+    int n;
+} NBodyTreeTask;
+
+static void nbReserveBodyIndex(NBodyTree* t, int nbody)
+{
+    if (nbody > t->maxBodyIdx)
+    {
+        free(t->bodyIdx);
+        free(t->bodyIdxTmp);
+        free(t->bodySubIdx);
+        t->bodyIdx = (int*) mwMalloc(nbody * sizeof(int));
+        t->bodyIdxTmp = (int*) mwMalloc(nbody * sizeof(int));
+        t->bodySubIdx = (unsigned char*) mwMalloc(nbody * sizeof(unsigned char));
+        t->maxBodyIdx = nbody;
+    }
+}
+
+#ifdef _OPENMP
+  #define nbThreadNum() omp_get_thread_num()
+#else
+  #define nbThreadNum() (0)
+#endif
+
+/* Split the top of the tree breadth first until there are enough
+ * subtrees to keep all threads busy. The cells split on the way are
+ * appended to top in order, so parents come before their subcells.
+ * Returns the subtrees left to build.
+ */
+static NBodyTreeTask* nbSplitTopLevels(NBodyState* st, NBodyCellCache* caches, int nBody, int targetTasks,
+                                       int* nTaskOut, NBodyTreeTask** topOut, int* nTopOut)
+{
+    int i, j, k;
+    int nTask = 1;
+    int nTop = 0;
+    int nThread = nbGetMaxThreads();
+    mwbool error = FALSE;
+    NBodyTree* t = &st->tree;
+    NBodyTreeTask* top = NULL;
+    NBodyTreeTask* tasks = (NBodyTreeTask*) mwMalloc(sizeof(NBodyTreeTask));
+    NBodyTreeTask* subTasks;
+
+    tasks[0].cell = t->root;
+    tasks[0].size = t->rsize;
+    tasks[0].lev = 0;
+    tasks[0].idx = t->bodyIdx;
+    tasks[0].tmp = t->bodyIdxTmp;
+    tasks[0].sub = t->bodySubIdx;
+    tasks[0].n = nBody;
+
+    while (nTask > 0 && nTask < targetTasks && !error)
+    {
+        subTasks = (NBodyTreeTask*) mwMalloc(nTask * NSUB * sizeof(NBodyTreeTask));
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i, k) schedule(dynamic, 1)
+      #endif
+        for (i = 0; i < nTask; ++i)
+        {
+            int counts[NSUB];
+            NBodyCell* subCells[NSUB];
+            const NBodyTreeTask* task = &tasks[i];
+            int start = 0;
+
+            splitCell(st, &caches[nbThreadNum()], task->cell, task->size, task->lev,
+                      task->idx, task->tmp, task->sub, task->n, counts, subCells);
+
+            for (k = 0; k < NSUB; ++k)
+            {
+                NBodyTreeTask* child = &subTasks[i * NSUB + k];
+
+                child->cell = subCells[k];
+                child->size = 0.5 * task->size;
+                child->lev = task->lev + 1;
+                child->idx = task->tmp + start;
+                child->tmp = task->idx + start;
+                child->sub = task->sub + start;
+                child->n = counts[k];
+                start += counts[k];
+            }
+        }
+
+        top = (NBodyTreeTask*) mwRealloc(top, (nTop + nTask) * sizeof(NBodyTreeTask));
+        memcpy(&top[nTop], tasks, nTask * sizeof(NBodyTreeTask));
+        nTop += nTask;
+
+        for (i = 0, j = 0; i < nTask * NSUB; ++i)
+        {
+            if (subTasks[i].cell)
+            {
+                subTasks[j++] = subTasks[i];
+            }
+        }
+        free(tasks);
+        tasks = subTasks;
+        nTask = j;
+
+        for (i = 0; i < nThread; ++i)
+        {
+            error |= caches[i].structureError;
+        }
+    }
+
+    t->structureError |= error;
+
+    *nTaskOut = nTask;
+    *topOut = top;
+    *nTopOut = nTop;
+    return tasks;
+}
+
+/* Find centers of mass of the subtrees in parallel, then of the top
+ * cells above them. Returns TRUE on a structure error. */
+static mwbool nbTreeCofM(const NBodyCtx* ctx, NBodyTree* t,
+                         const NBodyTreeTask* tasks, int nTask,
+                         const NBodyTreeTask* top, int nTop)
+{
+    int i;
+    int error = FALSE;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic, 1) reduction(|: error)
+  #endif
+    for (i = 0; i < nTask; ++i)
+    {
+        NBodyTree sub = *t;     /* Only rsize and structureError are used */
+
+        sub.structureError = FALSE;
+        hackCofM(ctx, &sub, tasks[i].cell, tasks[i].size, TRUE);
+        error |= sub.structureError;
+    }
+
+    t->structureError |= error;
+
+    for (i = nTop - 1; i >= 0; --i)
+    {
+        hackCofM(ctx, t, top[i].cell, top[i].size, FALSE);
+    }
+
+    return t->structureError;
+}
+
+static void nbTreeThreadAndQuad(const NBodyCtx* ctx, NBodyTree* t,
+                                const NBodyTreeTask* tasks, int nTask,
+                                const NBodyTreeTask* top, int nTop)
+{
+    int i;
+
+    /* Link the top cells from the root down. Each one sets Next of its
+     * subcells before they are reached. */
+    Next(t->root) = NULL;
+    for (i = 0; i < nTop; ++i)
+    {
+        NBodyNode* p = (NBodyNode*) top[i].cell;
+        threadTree(p, Next(p), FALSE);
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic, 1)
+  #endif
+    for (i = 0; i < nTask; ++i)
+    {
+        NBodyNode* p = (NBodyNode*) tasks[i].cell;
+        threadTree(p, Next(p), TRUE);
+    }
+
+    if (!ctx->useQuad)
+        return;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic, 1)
+  #endif
+    for (i = 0; i < nTask; ++i)
+    {
+        hackQuad(tasks[i].cell, TRUE);
+    }
+
+    for (i = nTop - 1; i >= 0; --i)
+    {
+        hackQuad(top[i].cell, FALSE);
+    }
+}
+
 /* nbMakeTree: initialize tree structure for hierarchical force calculation
  * from body array btab, which contains ctx.nbody bodies.
+ *
+ * The top levels are split until there are a few independent subtrees
+ * per thread. Those are built, have their centers of mass found and
+ * are threaded in parallel. The result is the same as building the
+ * tree serially.
  */
 NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
 {
-    Body* p;
-    const Body* endp = st->bodytab + st->nbody;
+    int i, n;
+    int nTask, nTop;
+    NBodyTreeTask* tasks;
+    NBodyTreeTask* top;
+    NBodyCellCache* caches;
     NBodyTree* t = &st->tree;
+    const int nThread = nbGetMaxThreads();
 
     nbNewTree(st, t);                                /* flush existing tree, etc */
 
     expandBox(t, st->bodytab, st->nbody);            /* and expand cell to fit */
-    for (p = st->bodytab; p < endp; p++)             /* loop over bodies... */
+
+    nbReserveBodyIndex(t, st->nbody);
+    for (i = 0, n = 0; i < st->nbody; ++i)           /* loop over bodies... */
     {
-        if (Mass(p) != 0.0)                  /* exclude test particles */
-            nbLoadBody(st, t, p);              /* and insert into tree */
+        if (Mass(&st->bodytab[i]) != 0.0)            /* exclude test particles */
+            t->bodyIdx[n++] = i;
     }
 
-    /* Check if tree structure error occured */
-    if (st->tree.structureError)
-        return NBODY_TREE_STRUCTURE_ERROR;
+    /* With one thread this is the same as inserting every body from the root */
+    caches = (NBodyCellCache*) mwCalloc(nThread, sizeof(NBodyCellCache));
+    tasks = nbSplitTopLevels(st, caches, n, nThread > 1 ? 8 * nThread : 1, &nTask, &top, &nTop);
 
+    if (!t->structureError)
+    {
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i) schedule(dynamic, 1)
+      #endif
+        for (i = 0; i < nTask; ++i)
+        {
+            int j;
+            NBodyCellCache* cache = &caches[nbThreadNum()];
+
+            for (j = 0; j < tasks[i].n; ++j)
+            {
+                nbLoadBody(st, cache, tasks[i].cell, tasks[i].size, tasks[i].lev, &st->bodytab[tasks[i].idx[j]]);
+            }
+        }
+    }
 
-    hackCofM(ctx, &st->tree, t->root, t->rsize);   /* find c-of-m coordinates */
+    for (i = 0; i < nThread; ++i)
+    {
+        nbMergeCellCache(st, t, &caches[i]);
+    }
+    free(caches);
 
     /* Check if tree structure error occured */
-    if (st->tree.structureError)
+    if (st->tree.structureError || nbTreeCofM(ctx, t, tasks, nTask, top, nTop))
+    {
+        free(tasks);
+        free(top);
         return NBODY_TREE_STRUCTURE_ERROR;
+    }
+
+    nbTreeThreadAndQuad(ctx, t, tasks, nTask, top, nTop);  /* add Next and More links, Quad moments */
+
+    free(tasks);
+    free(top);
 
-    threadTree((NBodyNode*) t->root, NULL);        /* add Next and More links */
-    if (ctx->useQuad)                           /* including quad moments? */
-        hackQuad(t->root);                      /* assign Quad moments */
+    /* At most every body plus the cells */
+    nbReserveTreeNodes(t, st->nbody + t->cellUsed, ctx->useQuad);
+    t->nNode = 0;
+    linearizeTree(t, st->bodytab, (NBodyNode*) t->root, ctx->useQuad);
 
     return NBODY_SUCCESS;
 }
@@ -25,6 +25,10 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_types.h"
 #include "nbody_show.h"
 #include "nbody_defaults.h"
+#include "nbody_histogram.h"
+#include "nbody_potential_table.h"
+#include "nbody_grav.h"
+#include "nbody_checkpoint.h"
 
 #if NBODY_OPENCL
   #include "nbody_cl.h"
@@ -57,6 +61,21 @@ static void freeNBodyTree(NBodyTree* t)
     t->root = NULL;
     t->cellUsed = 0;
     t->maxDepth = 0;
+
+    mwFreeA(t->nodes);
+    mwFreeA(t->quads);
+    t->nodes = NULL;
+    t->quads = NULL;
+    t->nNode = 0;
+    t->maxNode = 0;
+
+    free(t->bodyIdx);
+    free(t->bodyIdxTmp);
+    free(t->bodySubIdx);
+    t->bodyIdx = NULL;
+    t->bodyIdxTmp = NULL;
+    t->bodySubIdx = NULL;
+    t->maxBodyIdx = 0;
 }
 
 static void freeFreeCells(NBodyNode* freeCell)
@@ -106,6 +125,9 @@ int destroyNBodyState(NBodyState* st)
     int nThread = nbGetMaxThreads();
     int i;
 
+    /* Finish any checkpoint still being written before the state goes */
+    nbDestroyCheckpointWriter(st);
+
     freeNBodyTree(&st->tree);
     freeFreeCells(st->freeCell);
     mwFreeA(st->bodytab);
@@ -114,6 +136,14 @@ int destroyNBodyState(NBodyState* st)
 
     free(st->checkpointResolved);
 
+    free(st->bestLikeData);
+    free(st->bestLikeHistogram);
+    nbFreeHistogramScratch(&st->histogramScratch);
+    nbFreeWalkScratch(&st->walkScratch);
+    nbDestroySoA(st);
+    nbDestroyPotentialTable(st->potTable);
+    st->potTable = NULL;
+
     if (st->potEvalStates)
     {
         for (i = 0; i < nThread; ++i)
@@ -199,6 +229,92 @@ NBodyState* newNBodyState()
     return mwCallocA(1, sizeof(NBodyState));
 }
 
+void nbCreateSoA(NBodyState* st)
+{
+    int i;
+    NBodySoA* soa;
+    size_t size = st->nbody * sizeof(real);
+
+    if (st->soa)
+    {
+        return;
+    }
+
+    soa = (NBodySoA*) mwCalloc(1, sizeof(NBodySoA));
+    for (i = 0; i < 3; ++i)
+    {
+        soa->pos[i] = (real*) mwMallocA(size);
+        soa->vel[i] = (real*) mwMallocA(size);
+        soa->acc[i] = (real*) mwMallocA(size);
+    }
+    soa->masses = (real*) mwMallocA(size);
+
+    st->soa = soa;
+}
+
+void nbDestroySoA(NBodyState* st)
+{
+    int i;
+    NBodySoA* soa = st->soa;
+
+    if (!soa)
+    {
+        return;
+    }
+
+    for (i = 0; i < 3; ++i)
+    {
+        mwFreeA(soa->pos[i]);
+        mwFreeA(soa->vel[i]);
+        mwFreeA(soa->acc[i]);
+    }
+    mwFreeA(soa->masses);
+
+    free(soa);
+    st->soa = NULL;
+}
+
+/* Copy between bodytab / acctab and the SoA arrays. Marshalling out
+   leaves the bodies consistent for checkpointing, output, histograms
+   and the Lua bindings. */
+void nbMarshalBodiesSoA(NBodyState* st, mwbool marshalIn)
+{
+    int i;
+    const int nbody = st->nbody;
+    NBodySoA* soa = st->soa;
+    Body* bodies = st->bodytab;
+    mwvector* accs = st->acctab;
+
+    if (marshalIn)
+    {
+        for (i = 0; i < nbody; ++i)
+        {
+            soa->pos[0][i] = X(Pos(&bodies[i]));
+            soa->pos[1][i] = Y(Pos(&bodies[i]));
+            soa->pos[2][i] = Z(Pos(&bodies[i]));
+
+            soa->vel[0][i] = X(Vel(&bodies[i]));
+            soa->vel[1][i] = Y(Vel(&bodies[i]));
+            soa->vel[2][i] = Z(Vel(&bodies[i]));
+
+            soa->acc[0][i] = X(accs[i]);
+            soa->acc[1][i] = Y(accs[i]);
+            soa->acc[2][i] = Z(accs[i]);
+
+            soa->masses[i] = Mass(&bodies[i]);
+        }
+    }
+    else
+    {
+        for (i = 0; i < nbody; ++i)
+        {
+            SET_VECTOR(Pos(&bodies[i]), soa->pos[0][i], soa->pos[1][i], soa->pos[2][i]);
+            SET_VECTOR(Vel(&bodies[i]), soa->vel[0][i], soa->vel[1][i], soa->vel[2][i]);
+            SET_VECTOR(accs[i], soa->acc[0][i], soa->acc[1][i], soa->acc[2][i]);
+        }
+    }
+}
+
 #if NBODY_OPENCL
 
 NBodyStatus nbInitCL(NBodyState* st, const NBodyCtx* ctx, const CLRequest* clr)
@@ -424,6 +540,7 @@ void cloneNBodyState(NBodyState* st, const NBodyState* oldSt)
     st->usesQuad = oldSt->usesQuad,
     st->dirty = oldSt->dirty;
     st->usesCL = oldSt->usesCL;
+    st->usesSoA = oldSt->usesSoA;
     st->reportProgress = oldSt->reportProgress;
 
     st->treeIncest = oldSt->treeIncest;
@@ -610,6 +727,8 @@ int equalNBodyCtx(const NBodyCtx* ctx1, const NBodyCtx* ctx2)
         && feqWithNan(ctx1->criterion, ctx2->criterion)
         && (ctx1->potentialType == ctx2->potentialType)
         && feqWithNan(ctx1->useQuad, ctx2->useQuad)
+        && feqWithNan(ctx1->useGroupWalk, ctx2->useGroupWalk)
+        && feqWithNan(ctx1->potentialTableError, ctx2->potentialTableError)
         && feqWithNan(ctx1->allowIncest, ctx2->allowIncest)
         && feqWithNan(ctx1->useBestLike, ctx2->useBestLike)
         && feqWithNan(ctx1->useVelDisp, ctx2->useVelDisp)
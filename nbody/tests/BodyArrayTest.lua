@@ -0,0 +1,146 @@
+--
+-- Copyright (C) 2019 Rensselaer Polytechnic Institute
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Check a BodyArray acts like the table of bodies it replaced
+
+local function makeModel(n, seed)
+   return predefinedModels.plummer{
+      nbody       = n,
+      prng        = DSFMT.create(seed),
+      position    = Vector.create(1, 2, 3),
+      velocity    = Vector.create(-10, 20, 5),
+      mass        = 20,
+      scaleRadius = 0.5
+   }
+end
+
+local function sameBody(a, b)
+   return a.mass == b.mass
+      and a.position.x == b.position.x
+      and a.position.y == b.position.y
+      and a.position.z == b.position.z
+      and a.velocity.x == b.velocity.x
+      and a.velocity.y == b.velocity.y
+      and a.velocity.z == b.velocity.z
+      and a.ignore == b.ignore
+end
+
+local function expectError(f, what)
+   local ok = pcall(f)
+   assert(not ok, what .. " didn't raise an error")
+end
+
+local function makeContext()
+   local ctx = NBodyCtx.create{
+      timestep      = 1.0e-4,
+      timeEvolve    = 1.0,
+      theta         = 0.5,
+      eps2          = 1.0e-6,
+      criterion     = "Exact",
+      useQuad       = false,
+      BestLikeStart = 0.95,
+      BetaSigma     = 2.5,
+      VelSigma      = 2.5,
+      BetaCorrect   = 1.111,
+      VelCorrect    = 1.111,
+      IterMax       = 6,
+      allowIncest   = true,
+      quietErrors   = true
+   }
+
+   ctx:addPotential(Potential.create{
+      spherical = Spherical.hernquist{ mass = 1.52954402e5, scale = 0.7 },
+      disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+      disk2     = Disk.none{ mass = 3.0e5 },
+      halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+   })
+
+   return ctx
+end
+
+
+local m = makeModel(100, 1234)
+local t = m:toTable()
+
+-- __len, and toTable() as the way to use ipairs()
+assert(#m == 100, "Expected 100 bodies, got " .. #m)
+assert(#t == 100, "Expected toTable() to give 100 bodies, got " .. #t)
+
+local n = 0
+for i, b in ipairs(t) do
+   assert(sameBody(b, m[i]), "Body " .. i .. " from toTable() differs")
+   n = n + 1
+end
+assert(n == 100, "ipairs() over toTable() went over " .. n .. " bodies")
+
+
+-- __index gives a copy, which has to be assigned back
+local b = m[7]
+b.mass = 123.0
+assert(m[7].mass ~= 123.0, "Changing an indexed body changed the array")
+
+-- __newindex
+m[7] = b
+assert(m[7].mass == 123.0, "Assigning a body didn't change the array")
+assert(sameBody(m[8], t[8]), "Assigning a body changed its neighbour")
+
+
+-- Bounds. Reading off either end is nil like a table, writing is an error
+assert(m[0] == nil, "Expected nil for index 0")
+assert(m[101] == nil, "Expected nil past the end")
+assert(m[-1] == nil, "Expected nil for a negative index")
+expectError(function() m[0] = b end, "Assigning index 0")
+expectError(function() m[101] = b end, "Assigning past the end")
+expectError(function() m[1] = 5 end, "Assigning something other than a body")
+expectError(function() return m.noSuchMember end, "Getting an unknown member")
+
+
+-- __concat, with another BodyArray or a table of bodies on either side
+local m2 = makeModel(50, 5678)
+local joined = m .. m2
+assert(#joined == 150, "Expected 150 joined bodies, got " .. #joined)
+assert(sameBody(joined[7], m[7]), "First part of joined array differs")
+assert(sameBody(joined[101], m2[1]), "Second part of joined array differs")
+
+local withTable = m2:toTable() .. m
+assert(#withTable == 150, "Expected 150 bodies joined with a table, got " .. #withTable)
+assert(sameBody(withTable[50], m2[50]), "Table part of joined array differs")
+assert(sameBody(withTable[51], m[1]), "BodyArray part of joined array differs")
+
+local created = BodyArray.create(t)
+assert(#created == 100 and sameBody(created[100], t[100]), "BodyArray.create() differs from its table")
+
+
+-- A single model's bodies are taken by the state, after which it can't be used
+local st = NBodyState.create(makeContext(), m2)
+assert(st ~= nil, "Failed to create state")
+assert(tostring(m2) == "BodyArray(bodies taken)", "Unexpected " .. tostring(m2))
+
+expectError(function() return #m2 end, "Length of a taken BodyArray")
+expectError(function() return m2[1] end, "Indexing a taken BodyArray")
+expectError(function() m2[1] = b end, "Assigning to a taken BodyArray")
+expectError(function() return m2 .. m end, "Joining a taken BodyArray")
+expectError(function() return m2:toTable() end, "toTable() of a taken BodyArray")
+expectError(function() return NBodyState.create(makeContext(), m2) end, "Creating a second state from a taken BodyArray")
+
+-- Several models are copied, so they can still be used
+local st2 = NBodyState.create(makeContext(), m, joined)
+assert(st2 ~= nil, "Failed to create state from 2 models")
+assert(#m == 100 and #joined == 150, "Models were emptied when copied")
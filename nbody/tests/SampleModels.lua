@@ -72,7 +72,7 @@ SampleModels.sampleModels = {
 
          eps2 = calculateEps2(nbody, smallR0)
          dt   = calculateTimestep(smallMass + bigMass, smallR0)
-         return mergeTables(m1, m2), eps2, dt
+         return m1 .. m2, eps2, dt
       end
 }
 
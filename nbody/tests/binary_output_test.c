@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Write bodies as binary output, check they read back exactly, and that
+ * converting them to text gives the same file as the text output. */
+
+#include "milkyway_util.h"
+#include "nbody_io.h"
+#include "dSFMT.h"
+
+/* More than one chunk of records, and not a whole number of them */
+#define N_BODIES 10000
+
+#define TEXT_FILE "binary_output_test.txt"
+#define BINARY_FILE "binary_output_test.bin"
+#define CONVERTED_FILE "binary_output_test_converted.txt"
+
+static char* readWholeFile(const char* name, size_t* size)
+{
+    FILE* f;
+    long n;
+    char* buf;
+
+    f = fopen(name, "rb");
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = (char*) mwMalloc(n > 0 ? n : 1);
+    *size = fread(buf, 1, n, f);
+    fclose(f);
+
+    return buf;
+}
+
+static int sameFiles(const char* a, const char* b)
+{
+    char* bufA;
+    char* bufB;
+    size_t sizeA = 0, sizeB = 0;
+    int same;
+
+    bufA = readWholeFile(a, &sizeA);
+    bufB = readWholeFile(b, &sizeB);
+    same = bufA && bufB && sizeA == sizeB && memcmp(bufA, bufB, sizeA) == 0;
+
+    free(bufA);
+    free(bufB);
+
+    return same;
+}
+
+static int checkReadBack(const NBodyState* st, unsigned int expectedFields)
+{
+    FILE* f;
+    NBodyBinaryHeader h;
+    Body* bodies;
+    int i, failed = 0;
+
+    f = fopen(BINARY_FILE, "rb");
+    if (!f || nbReadBinaryBodiesHeader(f, &h))
+    {
+        mw_printf("Failed to read header\n");
+        if (f)
+            fclose(f);
+        return 1;
+    }
+
+    if (h.nbody != (uint64_t) st->nbody || h.fields != expectedFields)
+    {
+        mw_printf("Header has %llu bodies and fields %u, expected %d and %u\n",
+                  (unsigned long long) h.nbody, h.fields, st->nbody, expectedFields);
+        fclose(f);
+        return 1;
+    }
+
+    bodies = (Body*) mwCallocA(st->nbody, sizeof(Body));
+    if (nbReadBinaryBodies(f, &h, bodies))
+    {
+        mw_printf("Failed to read bodies\n");
+        failed = 1;
+    }
+    fclose(f);
+
+    for (i = 0; i < st->nbody && !failed; ++i)
+    {
+        const Body* a = &st->bodytab[i];
+        const Body* b = &bodies[i];
+
+        if (   memcmp(&Pos(a), &Pos(b), 3 * sizeof(real))
+            || memcmp(&Vel(a), &Vel(b), 3 * sizeof(real))
+            || memcmp(&Mass(a), &Mass(b), sizeof(real))
+            || idBody(a) != idBody(b)
+            || ignoreBody(a) != ignoreBody(b))
+        {
+            mw_printf("Body %d differs after reading back\n", i);
+            failed = 1;
+        }
+    }
+
+    mwFreeA(bodies);
+
+    return failed;
+}
+
+static int checkOutput(const NBodyCtx* ctx, const NBodyState* st, int cartesian, int both, unsigned int expectedFields)
+{
+    NBodyFlags nbf = EMPTY_NBODY_FLAGS;
+    char textFile[] = TEXT_FILE;
+    char binaryFile[] = BINARY_FILE;
+    int failed = 0;
+
+    nbf.outputCartesian = cartesian;
+    nbf.outputlbrCartesian = both;
+
+    nbf.outFileName = textFile;
+    nbf.outputBinary = FALSE;
+    failed |= nbWriteBodies(ctx, st, &nbf);
+
+    nbf.outFileName = binaryFile;
+    nbf.outputBinary = TRUE;
+    failed |= nbWriteBodies(ctx, st, &nbf);
+
+    if (failed)
+    {
+        mw_printf("Failed to write output\n");
+        return 1;
+    }
+
+    failed |= checkReadBack(st, expectedFields);
+
+    if (nbConvertBinaryBodies(BINARY_FILE, CONVERTED_FILE))
+    {
+        mw_printf("Failed to convert binary output\n");
+        failed = 1;
+    }
+    else if (!sameFiles(TEXT_FILE, CONVERTED_FILE))
+    {
+        mw_printf("Converted output differs from text output (cartesian = %d, both = %d)\n", cartesian, both);
+        failed = 1;
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    NBodyCtx ctx = EMPTY_NBODYCTX;
+    NBodyState st = EMPTY_NBODYSTATE;
+    dsfmt_t prng;
+    int i, failed = 0;
+
+    dsfmt_init_gen_rand(&prng, 1234);
+
+    ctx.sunGCDist = 8.0;
+    ctx.potentialType = EXTERNAL_POTENTIAL_DEFAULT;
+
+    st.nbody = N_BODIES;
+    st.bodytab = (Body*) mwCallocA(N_BODIES, sizeof(Body));
+    for (i = 0; i < N_BODIES; ++i)
+    {
+        Body* b = &st.bodytab[i];
+
+        Type(b) = BODY(i % 3 == 0);
+        idBody(b) = i + 1;
+        Mass(b) = mwXrandom(&prng, 0.0, 1.0) / N_BODIES;
+        X(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+        Y(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+        Z(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+        X(Vel(b)) = mwXrandom(&prng, -200.0, 200.0);
+        Y(Vel(b)) = mwXrandom(&prng, -200.0, 200.0);
+        Z(Vel(b)) = mwXrandom(&prng, -200.0, 200.0);
+    }
+
+    failed |= checkOutput(&ctx, &st, FALSE, FALSE, NBODY_BINARY_HAS_LBR);
+    failed |= checkOutput(&ctx, &st, TRUE, FALSE, 0);
+    failed |= checkOutput(&ctx, &st, FALSE, TRUE, NBODY_BINARY_HAS_LBR | NBODY_BINARY_HAS_VLOS);
+
+    mwFreeA(st.bodytab);
+
+    remove(TEXT_FILE);
+    remove(BINARY_FILE);
+    remove(CONVERTED_FILE);
+
+    return failed;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Write checkpoints from the background writer and check that they read
+ * back, that every checkpoint taken is reported completed exactly once
+ * even when the writer falls behind, and that failures are reported. */
+
+#include "milkyway_util.h"
+#include "nbody_types.h"
+#include "nbody_checkpoint.h"
+#include "dSFMT.h"
+
+#define N_BODIES 2000
+#define CHECKPOINT_FILE "checkpoint_writer_test.dat"
+
+static void initState(NBodyState* st, const char* checkpointFile)
+{
+    dsfmt_t prng;
+    int i;
+
+    dsfmt_init_gen_rand(&prng, 4321);
+
+    st->nbody = N_BODIES;
+    st->bodytab = (Body*) mwCallocA(N_BODIES, sizeof(Body));
+    for (i = 0; i < N_BODIES; ++i)
+    {
+        Body* b = &st->bodytab[i];
+
+        Type(b) = BODY(FALSE);
+        idBody(b) = i + 1;
+        Mass(b) = mwXrandom(&prng, 0.0, 1.0) / N_BODIES;
+        X(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+        Y(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+        Z(Pos(b)) = mwXrandom(&prng, -50.0, 50.0);
+    }
+
+    st->checkpointResolved = strdup(checkpointFile);
+}
+
+/* Stands in for a step changing the bodies */
+static void stepState(NBodyState* st)
+{
+    ++st->step;
+    X(Pos(&st->bodytab[st->step % N_BODIES])) += 1.0;
+}
+
+static int checkReadBack(const NBodyState* st)
+{
+    NBodyCtx ctx = EMPTY_NBODYCTX;
+    NBodyState rd = EMPTY_NBODYSTATE;
+    int failed = 0;
+
+    rd.checkpointResolved = strdup(CHECKPOINT_FILE);
+    if (nbReadCheckpoint(&ctx, &rd))
+    {
+        mw_printf("Failed to read checkpoint back\n");
+        destroyNBodyState(&rd);
+        return 1;
+    }
+
+    if (   rd.nbody != st->nbody
+        || rd.step != st->step
+        || memcmp(rd.bodytab, st->bodytab, st->nbody * sizeof(Body)))
+    {
+        mw_printf("Checkpoint read back is for step %u, expected %u\n", rd.step, st->step);
+        failed = 1;
+    }
+
+    destroyNBodyState(&rd);
+    return failed;
+}
+
+static int checkCounts(const NBodyState* st, unsigned int expected, const char* what)
+{
+    if (st->nCheckpointCompleted != expected)
+    {
+        mw_printf("%s: %u checkpoints completed, expected %u\n", what, st->nCheckpointCompleted, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* One checkpoint written, finished and read back */
+static int checkRoundTrip(const NBodyCtx* ctx)
+{
+    NBodyState st = EMPTY_NBODYSTATE;
+    int failed = 0;
+
+    initState(&st, CHECKPOINT_FILE);
+    stepState(&st);
+
+    failed |= nbWriteCheckpointAsync(ctx, &st);
+    failed |= nbFinishCheckpointWriter(&st);
+    failed |= nbCheckpointWriterBusy(&st);
+    failed |= checkCounts(&st, 1, "Round trip");
+    failed |= checkReadBack(&st);
+
+    destroyNBodyState(&st);
+    return failed;
+}
+
+/* Checkpoints taken faster than a slow writer keeps up replace the
+ * queued one, which still counts as completed. The last is written. */
+static int checkReplaced(const NBodyCtx* ctx)
+{
+    NBodyState st = EMPTY_NBODYSTATE;
+    unsigned int i;
+    int failed = 0;
+
+    initState(&st, CHECKPOINT_FILE);
+    nbSetCheckpointWriteDelay(20);
+
+    for (i = 0; i < 10; ++i)
+    {
+        stepState(&st);
+        failed |= nbWriteCheckpointAsync(ctx, &st);
+        failed |= nbPollCheckpointWriter(&st);
+    }
+
+    failed |= nbFinishCheckpointWriter(&st);
+    failed |= checkCounts(&st, st.nCheckpoint, "Replaced");
+    failed |= checkReadBack(&st);
+
+    nbSetCheckpointWriteDelay(0);
+    destroyNBodyState(&st);
+    return failed;
+}
+
+/* As the run loop does while BOINC keeps saying it's time: every yes is
+ * answered by exactly one completed checkpoint. */
+static int checkAlwaysTime(const NBodyCtx* ctx)
+{
+    NBodyState st = EMPTY_NBODYSTATE;
+    unsigned int i, nAsked = 0;
+    int failed = 0;
+
+    initState(&st, CHECKPOINT_FILE);
+    nbSetCheckpointWriteDelay(20);
+
+    for (i = 0; i < 100; ++i)
+    {
+        stepState(&st);
+        failed |= nbPollCheckpointWriter(&st);
+
+        if (!nbCheckpointWriterBusy(&st))
+        {
+            ++nAsked;
+            failed |= nbWriteCheckpointAsync(ctx, &st);
+        }
+
+        mwMilliSleep(1);
+
+        if (st.nCheckpointCompleted + 1 < nAsked)
+        {
+            mw_printf("Always time: %u checkpoints outstanding\n", nAsked - st.nCheckpointCompleted);
+            failed = 1;
+        }
+    }
+
+    failed |= nbFinishCheckpointWriter(&st);
+    failed |= checkCounts(&st, nAsked, "Always time");
+
+    if (nAsked == 0 || nAsked == 100)
+    {
+        mw_printf("Always time: writer didn't fall behind (%u checkpoints)\n", nAsked);
+        failed = 1;
+    }
+
+    nbSetCheckpointWriteDelay(0);
+    destroyNBodyState(&st);
+    return failed;
+}
+
+/* A write that fails in the background is reported once */
+static int checkFailedWrite(const NBodyCtx* ctx)
+{
+    NBodyState st = EMPTY_NBODYSTATE;
+    char tmpFile[256];
+    int failed = 0;
+
+    initState(&st, "no_such_directory/" CHECKPOINT_FILE);
+
+    failed |= nbWriteCheckpointAsync(ctx, &st);
+    if (!nbFinishCheckpointWriter(&st))
+    {
+        mw_printf("Failed write wasn't reported\n");
+        failed = 1;
+    }
+
+    if (nbPollCheckpointWriter(&st))
+    {
+        mw_printf("Failed write was reported twice\n");
+        failed = 1;
+    }
+
+    /* The temporary it couldn't move into place */
+    snprintf(tmpFile, sizeof(tmpFile), "nbody_checkpoint_tmp_%d", (int) getpid());
+    remove(tmpFile);
+
+    destroyNBodyState(&st);
+    return failed;
+}
+
+/* Without the thread checkpoints are written and completed directly */
+static int checkDirect(const NBodyCtx* ctx)
+{
+    NBodyState st = EMPTY_NBODYSTATE;
+    int failed = 0;
+
+    initState(&st, CHECKPOINT_FILE);
+    st.checkpointWriterFailed = TRUE;
+    stepState(&st);
+
+    failed |= nbWriteCheckpointAsync(ctx, &st);
+    if (st.checkpointWriter)
+    {
+        mw_printf("Started a writer thread after it failed\n");
+        failed = 1;
+    }
+
+    failed |= checkCounts(&st, 1, "Direct");
+    failed |= checkReadBack(&st);
+
+    destroyNBodyState(&st);
+    return failed;
+}
+
+int main(void)
+{
+    NBodyCtx ctx = EMPTY_NBODYCTX;
+    int failed = 0;
+
+    failed |= checkRoundTrip(&ctx);
+    failed |= checkReplaced(&ctx);
+    failed |= checkAlwaysTime(&ctx);
+    failed |= checkFailedWrite(&ctx);
+    failed |= checkDirect(&ctx);
+
+    remove(CHECKPOINT_FILE);
+
+    return failed;
+}
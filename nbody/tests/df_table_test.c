@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check the tabulated distribution function of a Plummer sphere
+ * against the analytic one, and the bodies drawn from two component
+ * dwarfs against the density of each component and the velocity
+ * dispersion from the Jeans equation. */
+
+#include "milkyway_util.h"
+#include "nbody_types.h"
+#include "nbody_df_table.h"
+#include "nbody_dwarf_potential.h"
+#include "dSFMT.h"
+
+#define N_SAMPLE 20000
+
+#define N_RADIUS_BINS 10
+#define N_DISPERSION_BINS 5
+#define N_SPEED_BINS 10
+
+/* Chi squared with 9 degrees of freedom at p = 0.001 */
+#define CHISQ_9_LIMIT 27.88
+
+/* Standard deviations allowed for the dispersion in a bin */
+#define DISPERSION_LIMIT 4.0
+
+#define DF_ERROR_LIMIT 1.0e-4
+
+static dsfmt_t _prng;
+
+static Dwarf makeDwarf(dwarf_t type, real mass, real scaleLength)
+{
+    Dwarf d = EMPTY_DWARF;
+
+    d.type = type;
+    d.mass = mass;
+    d.scaleLength = scaleLength;
+    return d;
+}
+
+static real enclosedMass(const Dwarf* d, real r)
+{
+    real a = d->scaleLength;
+
+    if (d->type == Plummer)
+        return d->mass * cube(r) / threehalves(sqr(r) + sqr(a));
+    if (d->type == General_Hernquist)
+        return d->mass * sqr(r) / sqr(r + a);
+
+    mw_panic("No enclosed mass for dwarf type %d\n", (int) d->type);
+    return 0.0;
+}
+
+/* Radial velocity dispersion of an isotropic model in its own potential */
+static real jeansDispersion(const Dwarf comps[2], real r)
+{
+    const int n = 400;
+    const real xMax = mw_log(1.0e4);
+    real h = xMax / (real) n;
+    real sum = 0.0;
+    int i;
+
+    for (i = 0; i <= n; ++i)
+    {
+        real s = r * mw_exp((real) i * h);
+        real rho = get_density(&comps[0], s) + get_density(&comps[1], s);
+        real m = enclosedMass(&comps[0], s) + enclosedMass(&comps[1], s);
+        real w = (i == 0 || i == n) ? 1.0 : (i % 2 ? 4.0 : 2.0);
+
+        sum += w * rho * m / s;
+    }
+
+    sum *= h / 3.0;
+
+    return sum / (get_density(&comps[0], r) + get_density(&comps[1], r));
+}
+
+/* Eddington's integral for a Plummer sphere, where d^2 rho / dpsi^2 is
+   20 rho_0 psi^3 / psi_0^5, from psi at truncation times the radius
+   where psi = E. With psi = E - s^2 it's smooth for Simpson's rule. */
+static real plummerTruncatedDistFun(const Dwarf* d, real truncation, real energy)
+{
+    const int n = 400;
+    real a = d->scaleLength;
+    real psi0 = d->mass / a;
+    real rho0 = 3.0 * d->mass / (4.0 * M_PI * cube(a));
+    real rE = mw_sqrt(sqr(d->mass / energy) - sqr(a));
+    real psiCut = d->mass / mw_sqrt(sqr(truncation * rE) + sqr(a));
+    real sMax = mw_sqrt(energy - psiCut);
+    real h = sMax / (real) n;
+    real sum = 0.0;
+    int i;
+
+    for (i = 0; i <= n; ++i)
+    {
+        real psi = energy - sqr((real) i * h);
+        real w = (i == 0 || i == n) ? 1.0 : (i % 2 ? 4.0 : 2.0);
+
+        sum += w * 20.0 * rho0 * cube(psi) / mw_pow(psi0, 5.0);
+    }
+
+    return 0.03582244801567226 * 2.0 * sum * h / 3.0;
+}
+
+static int checkPlummerDistFun(real truncation)
+{
+    Dwarf light = makeDwarf(Plummer, 12.0, 0.2);
+    Dwarf none = makeDwarf(Plummer, 0.0, 0.2);
+    NBodyDFTable* t;
+    real psi0 = light.mass / light.scaleLength;
+    real maxErr = 0.0;
+    int i;
+
+    t = nbMakeDFTable(&light, &none, 10.0, 10.0, truncation);
+    if (!t)
+    {
+        mw_printf("Failed to make Plummer table\n");
+        return 1;
+    }
+
+    for (i = 1; i < 100; ++i)
+    {
+        real energy = psi0 * (real) i / 100.0;
+        real expected = truncation > 0.0
+                      ? plummerTruncatedDistFun(&light, truncation, energy)
+                      : 24.0 * M_SQRT2 * sqr(light.scaleLength) * mw_pow(energy, 3.5)
+                        / (7.0 * cube(M_PI) * sqr(sqr(light.mass)));
+        real err = mw_fabs(nbDFTableDistFun(t, energy) - expected) / expected;
+
+        maxErr = mw_fmax(maxErr, err);
+    }
+
+    mw_printf("Plummer f(E) truncated at %g: %u nodes, max relative error %g\n", truncation, t->n, maxErr);
+    nbDestroyDFTable(t);
+
+    if (maxErr > DF_ERROR_LIMIT)
+    {
+        mw_printf("Plummer distribution function error %g is over %g\n", maxErr, DF_ERROR_LIMIT);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* The speed of a body in a Plummer sphere as a fraction of the escape
+   speed goes as q^2 (1 - q^2)^(7/2) at every radius, up to the cap */
+static int checkPlummerSpeeds(void)
+{
+    Dwarf light = makeDwarf(Plummer, 12.0, 0.2);
+    Dwarf none = makeDwarf(Plummer, 0.0, 0.2);
+    NBodyDFTable* t = nbMakeDFTable(&light, &none, 10.0, 10.0, 0.0);
+    real expected[N_SPEED_BINS];
+    int counts[N_SPEED_BINS] = { 0 };
+    int nOver = 0;
+    real total = 0.0, chisq = 0.0;
+    int i, j;
+
+    for (i = 0; i < N_SPEED_BINS; ++i)
+    {
+        const int n = 200;
+        expected[i] = 0.0;
+        for (j = 0; j < n; ++j)
+        {
+            real q = ((real) i + ((real) j + 0.5) / (real) n) / (real) N_SPEED_BINS;
+            if (q <= NBODY_DF_MAX_SPEED)
+                expected[i] += sqr(q) * mw_pow(1.0 - sqr(q), 3.5);
+        }
+        total += expected[i];
+    }
+
+    for (i = 0; i < N_SAMPLE; ++i)
+    {
+        real r = nbDFTableSampleRadius(t, 0, &_prng);
+        real vEsc = mw_sqrt(2.0 * get_potential(&light, r));
+        real q = nbDFTableSampleSpeed(t, r, &_prng) / vEsc;
+
+        if (q > NBODY_DF_MAX_SPEED)
+            ++nOver;
+
+        j = (int) (q * N_SPEED_BINS);
+        ++counts[j < N_SPEED_BINS ? j : N_SPEED_BINS - 1];
+    }
+
+    for (i = 0; i < N_SPEED_BINS; ++i)
+    {
+        real e = N_SAMPLE * expected[i] / total;
+        chisq += sqr(counts[i] - e) / e;
+    }
+
+    nbDestroyDFTable(t);
+
+    if (nOver > 0)
+    {
+        mw_printf("Plummer speeds: %d over %g v_esc\n", nOver, NBODY_DF_MAX_SPEED);
+        return 1;
+    }
+
+    if (chisq > CHISQ_9_LIMIT)
+    {
+        mw_printf("Plummer speeds: chi squared %g over %g\n", chisq, CHISQ_9_LIMIT);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int checkDwarf(const char* name, const Dwarf* comp1, const Dwarf* comp2, real bound, real truncation)
+{
+    Dwarf comps[2];
+    NBodyDFTable* t;
+    double t0, t1, t2;
+    int c, i, j;
+    int failed = 0;
+
+    comps[0] = *comp1;
+    comps[1] = *comp2;
+
+    t0 = mwGetTime();
+    t = nbMakeDFTable(comp1, comp2, bound, bound, truncation);
+    t1 = mwGetTime();
+    if (!t)
+    {
+        mw_printf("Failed to make table for %s\n", name);
+        return 1;
+    }
+
+    for (c = 0; c < 2; ++c)
+    {
+        int counts[N_RADIUS_BINS] = { 0 };
+        real dSum[N_DISPERSION_BINS] = { 0.0 };
+        real dSumSq[N_DISPERSION_BINS] = { 0.0 };
+        real mBound = enclosedMass(&comps[c], bound);
+        real chisq = 0.0;
+        real e = (real) N_SAMPLE / (real) N_RADIUS_BINS;
+
+        for (i = 0; i < N_SAMPLE; ++i)
+        {
+            real r = nbDFTableSampleRadius(t, c, &_prng);
+            real v = nbDFTableSampleSpeed(t, r, &_prng);
+            real u = enclosedMass(&comps[c], r) / mBound;
+            real d = sqr(v) - 3.0 * jeansDispersion(comps, r);
+
+            j = (int) (u * N_RADIUS_BINS);
+            ++counts[j < N_RADIUS_BINS ? j : N_RADIUS_BINS - 1];
+
+            j = (int) (u * N_DISPERSION_BINS);
+            j = j < N_DISPERSION_BINS ? j : N_DISPERSION_BINS - 1;
+            dSum[j] += d;
+            dSumSq[j] += sqr(d);
+        }
+
+        for (i = 0; i < N_RADIUS_BINS; ++i)
+            chisq += sqr(counts[i] - e) / e;
+
+        if (chisq > CHISQ_9_LIMIT)
+        {
+            mw_printf("%s component %d radii: chi squared %g over %g\n", name, c + 1, chisq, CHISQ_9_LIMIT);
+            failed = 1;
+        }
+
+        for (j = 0; j < N_DISPERSION_BINS; ++j)
+        {
+            real z = dSum[j] / mw_sqrt(dSumSq[j]);
+
+            if (mw_fabs(z) > DISPERSION_LIMIT)
+            {
+                mw_printf("%s component %d dispersion in mass bin %d off by %g sigma\n", name, c + 1, j, z);
+                failed = 1;
+            }
+        }
+    }
+
+    t2 = mwGetTime();
+    mw_printf("%s: %u nodes, table %.3f s, sampling and checking %.3f s\n", name, t->n, t1 - t0, t2 - t1);
+    nbDestroyDFTable(t);
+
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+    Dwarf light = makeDwarf(Plummer, 12.0, 0.2);
+    Dwarf darkPlummer = makeDwarf(Plummer, 120.0, 0.8);
+    Dwarf darkHernquist = makeDwarf(General_Hernquist, 120.0, 0.8);
+
+    dsfmt_init_gen_rand(&_prng, 8675309);
+
+    failed |= checkPlummerDistFun(0.0);
+    failed |= checkPlummerDistFun(NBODY_DF_MIXED_DWARF_TRUNCATION);
+    failed |= checkPlummerDistFun(NBODY_DF_ISOTROPIC_TRUNCATION);
+    failed |= checkPlummerSpeeds();
+
+    /* As the mixed dwarf and isotropic generators make them */
+    failed |= checkDwarf("Plummer + Plummer", &light, &darkPlummer, 50.0 * (0.2 + 0.8), NBODY_DF_MIXED_DWARF_TRUNCATION);
+    failed |= checkDwarf("Plummer + Hernquist", &light, &darkHernquist, 50.0 * (0.2 + 0.8), NBODY_DF_MIXED_DWARF_TRUNCATION);
+    failed |= checkDwarf("Isotropic Plummer + Plummer", &light, &darkPlummer, 50.0 * (0.2 + 0.8), NBODY_DF_ISOTROPIC_TRUNCATION);
+
+    return failed;
+}
+
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check the direct sum kernels against a plain double loop, and that
+ * every instruction set available gives exactly the same results as
+ * the generic version. */
+
+#include "milkyway_util.h"
+#include "nbody_direct_sum.h"
+#include "dSFMT.h"
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+#define EPS2 1.0e-4
+
+/* Allowed relative difference from the plain loop, which adds up in a different order */
+#define SUM_TOLERANCE 1.0e-12
+
+static dsfmt_t _prng;
+
+typedef struct
+{
+    real* x;
+    real* y;
+    real* z;
+    real* m;
+    real* ax;
+    real* ay;
+    real* az;
+} DirectSumTestData;
+
+static void allocTestData(DirectSumTestData* d, int n, mwbool sources)
+{
+    int i;
+
+    d->x = (real*) mwMalloc(n * sizeof(real));
+    d->y = (real*) mwMalloc(n * sizeof(real));
+    d->z = (real*) mwMalloc(n * sizeof(real));
+    d->m = (real*) mwMalloc(n * sizeof(real));
+    d->ax = (real*) mwMalloc(n * sizeof(real));
+    d->ay = (real*) mwMalloc(n * sizeof(real));
+    d->az = (real*) mwMalloc(n * sizeof(real));
+
+    for (i = 0; i < n; ++i)
+    {
+        d->x[i] = mwXrandom(&_prng, -1.0, 1.0);
+        d->y[i] = mwXrandom(&_prng, -1.0, 1.0);
+        d->z[i] = mwXrandom(&_prng, -1.0, 1.0);
+        d->m[i] = sources ? mwXrandom(&_prng, 0.0, 1.0) / n : 0.0;
+    }
+}
+
+static void freeTestData(DirectSumTestData* d)
+{
+    free(d->x);
+    free(d->y);
+    free(d->z);
+    free(d->m);
+    free(d->ax);
+    free(d->ay);
+    free(d->az);
+}
+
+static void plainDirectSum(const DirectSumTestData* src, int nSource,
+                           DirectSumTestData* targets, int nTarget)
+{
+    int i, j;
+
+    for (i = 0; i < nTarget; ++i)
+    {
+        real ax = 0.0, ay = 0.0, az = 0.0;
+
+        for (j = 0; j < nSource; ++j)
+        {
+            real dx = src->x[j] - targets->x[i];
+            real dy = src->y[j] - targets->y[i];
+            real dz = src->z[j] - targets->z[i];
+            real drSq = dx * dx + dy * dy + dz * dz + EPS2;
+            real mor3 = src->m[j] / (mw_sqrt(drSq) * drSq);
+
+            ax += dx * mor3;
+            ay += dy * mor3;
+            az += dz * mor3;
+        }
+
+        targets->ax[i] = ax;
+        targets->ay[i] = ay;
+        targets->az[i] = az;
+    }
+}
+
+static real relativeDifference(real a, real b)
+{
+    real scale = mw_fmax(mw_abs(a), mw_abs(b));
+
+    return scale > 0.0 ? mw_abs(a - b) / scale : 0.0;
+}
+
+/* Run every available path on the same problem. Odd sizes exercise the
+   leftover lanes and partial target blocks. */
+static int testDirectSum(int nSource, int nTarget)
+{
+    int i;
+    int fails = 0;
+    NBodyDirectSumLevel level;
+    DirectSumTestData src, plain, generic, test;
+    real maxDiff = 0.0;
+
+    allocTestData(&src, nSource, TRUE);
+    allocTestData(&plain, nTarget, FALSE);
+
+    memcpy(&generic, &plain, sizeof(plain));
+    generic.ax = (real*) mwMalloc(nTarget * sizeof(real));
+    generic.ay = (real*) mwMalloc(nTarget * sizeof(real));
+    generic.az = (real*) mwMalloc(nTarget * sizeof(real));
+
+    memcpy(&test, &plain, sizeof(plain));
+    test.ax = (real*) mwMalloc(nTarget * sizeof(real));
+    test.ay = (real*) mwMalloc(nTarget * sizeof(real));
+    test.az = (real*) mwMalloc(nTarget * sizeof(real));
+
+    plainDirectSum(&src, nSource, &plain, nTarget);
+
+    nbDirectSum_Generic(src.x, src.y, src.z, src.m, nSource,
+                        generic.x, generic.y, generic.z, nTarget, EPS2,
+                        generic.ax, generic.ay, generic.az);
+
+    for (i = 0; i < nTarget; ++i)
+    {
+        maxDiff = mw_fmax(maxDiff, relativeDifference(generic.ax[i], plain.ax[i]));
+        maxDiff = mw_fmax(maxDiff, relativeDifference(generic.ay[i], plain.ay[i]));
+        maxDiff = mw_fmax(maxDiff, relativeDifference(generic.az[i], plain.az[i]));
+    }
+
+    if (maxDiff > SUM_TOLERANCE)
+    {
+        mw_printf("%d sources, %d targets: generic direct sum differs from the plain sum by %g\n",
+                  nSource, nTarget, maxDiff);
+        ++fails;
+    }
+
+    for (level = NBODY_DIRECT_SUM_SSE2; level <= NBODY_DIRECT_SUM_AVX512F; ++level)
+    {
+        if (nbDirectSumDispatch(level, FALSE))
+        {
+            continue;  /* Not available here */
+        }
+
+        nbDirectSum(src.x, src.y, src.z, src.m, nSource,
+                    test.x, test.y, test.z, nTarget, EPS2,
+                    test.ax, test.ay, test.az);
+
+        for (i = 0; i < nTarget; ++i)
+        {
+            if (   test.ax[i] != generic.ax[i]
+                || test.ay[i] != generic.ay[i]
+                || test.az[i] != generic.az[i])
+            {
+                mw_printf("%d sources, %d targets: direct sum level %d differs from generic for target %d\n",
+                          nSource, nTarget, (int) level, i);
+                ++fails;
+                break;
+            }
+        }
+    }
+
+    free(generic.ax);
+    free(generic.ay);
+    free(generic.az);
+    free(test.ax);
+    free(test.ay);
+    free(test.az);
+    freeTestData(&plain);
+    freeTestData(&src);
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails = 0;
+
+    dsfmt_init_gen_rand(&_prng, 1234567);
+
+    fails += testDirectSum(1, 1);
+    fails += testDirectSum(7, 3);
+    fails += testDirectSum(100, 33);
+    fails += testDirectSum(1027, 65);
+    fails += testDirectSum(3001, 129);
+
+    if (fails != 0)
+    {
+        mw_printf("%d direct sum tests failed\n", fails);
+    }
+
+    return fails;
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare the forces from the group walk against the normal tree walk
+ * and the direct sum. The group walk opens at least the cells each
+ * body would open on its own, so it shouldn't be any less accurate. */
+
+#include "milkyway_util.h"
+#include "nbody_types.h"
+#include "nbody_grav.h"
+#include "nbody_defaults.h"
+#include "nbody_show.h"
+#include "dSFMT.h"
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+#define N_BODY 4000
+#define N_TEST_PARTICLE 16
+
+/* Allowed slack on the errors of the group walk relative to the normal walk */
+#define ERROR_TOLERANCE 1.01
+
+static dsfmt_t _prng;
+
+/* Plummer sphere with unit scale radius and mass, followed by some
+   massless test particles */
+static Body* plummerBodies(int nbody, int nTest)
+{
+    int i;
+    Body* bodies = (Body*) mwCallocA(nbody + nTest, sizeof(Body));
+
+    for (i = 0; i < nbody + nTest; ++i)
+    {
+        Body* b = &bodies[i];
+        real u, r, cost, sint, phi;
+
+        do
+        {
+            u = mwXrandom(&_prng, 0.0, 1.0);
+            r = 1.0 / mw_sqrt(mw_pow(u, -2.0 / 3.0) - 1.0);
+        }
+        while (r > 20.0);
+
+        cost = mwXrandom(&_prng, -1.0, 1.0);
+        sint = mw_sqrt(1.0 - cost * cost);
+        phi = mwXrandom(&_prng, 0.0, 2.0 * M_PI);
+
+        SET_VECTOR(Pos(b), r * sint * mw_cos(phi), r * sint * mw_sin(phi), r * cost);
+        Mass(b) = i < nbody ? 1.0 / nbody : 0.0;
+        Type(b) = BODY(FALSE);
+        idBody(b) = i;
+    }
+
+    return bodies;
+}
+
+static int sameVector(mwvector a, mwvector b)
+{
+    return X(a) == X(b) && Y(a) == Y(b) && Z(a) == Z(b);
+}
+
+static void setupState(NBodyState* st, const NBodyCtx* ctx, const Body* bodies, int nbody, mwbool soa)
+{
+    Body* copy = (Body*) mwMallocA(nbody * sizeof(Body));
+
+    memcpy(copy, bodies, nbody * sizeof(Body));
+    setInitialNBodyState(st, ctx, copy, nbody);
+
+    if (soa)
+    {
+        nbCreateSoA(st);
+        nbMarshalBodiesSoA(st, TRUE);
+    }
+}
+
+/* Find the accelerations of the bodies with the given context */
+static mwvector* accelerations(const NBodyCtx* ctx, const Body* bodies, int nbody, mwbool soa, mwbool* incest)
+{
+    int i;
+    NBodyState st = EMPTY_NBODYSTATE;
+    mwvector* acc = (mwvector*) mwMallocA(nbody * sizeof(mwvector));
+
+    setupState(&st, ctx, bodies, nbody, soa);
+
+    if (nbStatusIsFatal(nbGravMap(ctx, &st)))
+    {
+        mw_printf("Force calculation failed\n");
+        destroyNBodyState(&st);
+        mwFreeA(acc);
+        return NULL;
+    }
+
+    *incest = st.treeIncest;
+
+    for (i = 0; i < nbody; ++i)
+    {
+        if (soa)
+        {
+            SET_VECTOR(acc[i], st.soa->acc[0][i], st.soa->acc[1][i], st.soa->acc[2][i]);
+        }
+        else
+        {
+            acc[i] = st.acctab[i];
+        }
+    }
+
+    destroyNBodyState(&st);
+
+    return acc;
+}
+
+static void forceErrors(const mwvector* acc, const mwvector* exact, int nbody, real* rmsOut, real* maxOut)
+{
+    int i;
+    real sum = 0.0;
+    real maxErr = 0.0;
+
+    for (i = 0; i < nbody; ++i)
+    {
+        real err = mw_absv(mw_subv(acc[i], exact[i])) / mw_absv(exact[i]);
+
+        sum += err * err;
+        maxErr = mw_fmax(maxErr, err);
+    }
+
+    *rmsOut = mw_sqrt(sum / nbody);
+    *maxOut = maxErr;
+}
+
+static int testGroupWalk(const Body* bodies, int nbody, criterion_t crit, real theta, mwbool useQuad)
+{
+    int i;
+    int fails = 0;
+    NBodyCtx ctx = defaultNBodyCtx;
+    NBodyCtx exactCtx;
+    mwvector* exact;
+    mwvector* tree;
+    mwvector* group;
+    mwvector* groupSoA;
+    real treeRMS, treeMax, groupRMS, groupMax;
+    mwbool exactIncest, treeIncest, groupIncest, groupSoAIncest;
+
+    ctx.eps2 = 1.0e-4;
+    ctx.theta = theta;
+    ctx.criterion = crit;
+    ctx.useQuad = useQuad;
+    ctx.allowIncest = TRUE;
+    ctx.quietErrors = TRUE;
+    ctx.potentialType = EXTERNAL_POTENTIAL_NONE;
+
+    exactCtx = ctx;
+    exactCtx.criterion = Exact;
+    exactCtx.useQuad = FALSE;
+
+    exact = accelerations(&exactCtx, bodies, nbody, FALSE, &exactIncest);
+    tree = accelerations(&ctx, bodies, nbody, FALSE, &treeIncest);
+
+    ctx.useGroupWalk = TRUE;
+    group = accelerations(&ctx, bodies, nbody, FALSE, &groupIncest);
+    groupSoA = accelerations(&ctx, bodies, nbody, TRUE, &groupSoAIncest);
+
+    if (!exact || !tree || !group || !groupSoA)
+    {
+        mwFreeA(exact);
+        mwFreeA(tree);
+        mwFreeA(group);
+        mwFreeA(groupSoA);
+        return 1;
+    }
+
+    /* Only the bodies in the tree are grouped */
+    forceErrors(tree, exact, N_BODY, &treeRMS, &treeMax);
+    forceErrors(group, exact, N_BODY, &groupRMS, &groupMax);
+
+    mw_printf("%s, theta = %.2f, quad = %s: tree walk RMS error %g (max %g), group walk %g (max %g)%s\n",
+              showCriterionT(crit), theta, showBool(useQuad), treeRMS, treeMax, groupRMS, groupMax,
+              treeIncest ? ", tree incest" : "");
+
+    /* A group inside an accepted cell is walked body by body instead */
+    if (groupIncest != treeIncest || groupSoAIncest != treeIncest)
+    {
+        mw_printf("  Tree incest %s in the tree walk, but %s in the group walk\n",
+                  treeIncest ? "found" : "not found", groupIncest ? "found" : "not found");
+        ++fails;
+    }
+
+    if (groupRMS > ERROR_TOLERANCE * treeRMS || groupMax > ERROR_TOLERANCE * treeMax)
+    {
+        mw_printf("  Group walk is less accurate than the tree walk\n");
+        ++fails;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        /* Test particles get a regular walk */
+        if (i >= N_BODY && !sameVector(group[i], tree[i]))
+        {
+            mw_printf("  Test particle %d differs from the tree walk\n", i);
+            ++fails;
+            break;
+        }
+
+        if (!sameVector(group[i], groupSoA[i]))
+        {
+            mw_printf("  Body %d differs between AoS and SoA group walks\n", i);
+            ++fails;
+            break;
+        }
+    }
+
+    mwFreeA(exact);
+    mwFreeA(tree);
+    mwFreeA(group);
+    mwFreeA(groupSoA);
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails = 0;
+    const int nbody = N_BODY + N_TEST_PARTICLE;
+    Body* bodies;
+
+    dsfmt_init_gen_rand(&_prng, 8675309);
+    bodies = plummerBodies(N_BODY, N_TEST_PARTICLE);
+
+    fails += testGroupWalk(bodies, nbody, TreeCode, 0.5, TRUE);
+    fails += testGroupWalk(bodies, nbody, TreeCode, 1.0, TRUE);
+    fails += testGroupWalk(bodies, nbody, TreeCode, 1.0, FALSE);
+    fails += testGroupWalk(bodies, nbody, SW93, 0.7, TRUE);
+    fails += testGroupWalk(bodies, nbody, BH86, 0.5, TRUE);
+
+    /* Test particles are always reported as incest, so leave them out to
+       see the group walk find real tree incest */
+    fails += testGroupWalk(bodies, N_BODY, BH86, 0.5, TRUE);
+    fails += testGroupWalk(bodies, N_BODY, BH86, 1.0, TRUE);
+
+    mwFreeA(bodies);
+
+    if (fails != 0)
+    {
+        mw_printf("%d group walk tests failed\n", fails);
+    }
+
+    return fails;
+}
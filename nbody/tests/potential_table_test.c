@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare the tabulated caustic halo against the direct evaluation,
+ * and check that only the expensive components get tables. Also check
+ * the batched evaluation gives exactly the same results as evaluating
+ * each point on its own, with and without a table. */
+
+#include "milkyway_util.h"
+#include "nbody_types.h"
+#include "nbody_potential.h"
+#include "nbody_potential_table.h"
+#include "dSFMT.h"
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+#define N_POINT 20000
+
+/* Not a multiple of NBODY_EXT_BATCH, to get a partial batch */
+#define N_BATCH_POINT (2 * NBODY_EXT_BATCH + 37)
+
+#define TABLE_ERROR 1.0e-6
+
+/* The cells are only checked in the middle, so allow some slack
+   elsewhere in them */
+#define TABLE_TOLERANCE (10.0 * TABLE_ERROR)
+
+static dsfmt_t _prng;
+
+static Potential testPotential(disk_t diskType, halo_t haloType)
+{
+    Potential p = EMPTY_POTENTIAL;
+
+    p.sphere[0].type = HernquistSpherical;
+    p.sphere[0].mass = 67479.9;
+    p.sphere[0].scale = 0.6;
+
+    p.disk.type = diskType;
+    p.disk.mass = 4.45865888e5;
+    p.disk.scaleLength = 6.5;
+    p.disk.scaleHeight = 0.26;
+
+    p.disk2.type = NoDisk;
+
+    p.halo.type = haloType;
+    p.halo.vhalo = 74.61;
+    p.halo.scaleLength = 12.0;
+    p.halo.flattenZ = 1.0;
+
+    return p;
+}
+
+static real relativeError(mwvector a, mwvector b)
+{
+    real mag = mw_absv(a);
+    mwvector d = mw_subv(a, b);
+
+    return mag > 0.0 ? mw_absv(d) / mag : mw_absv(d);
+}
+
+static int testNoTable(void)
+{
+    int fails = 0;
+    Potential p = testPotential(MiyamotoNagaiDisk, LogarithmicHalo);
+    NBodyPotentialTable* t;
+
+    t = nbMakePotentialTable(&p, TABLE_ERROR);
+    if (t)
+    {
+        mw_printf("Made a potential table with nothing expensive to tabulate\n");
+        nbDestroyPotentialTable(t);
+        ++fails;
+    }
+
+    p = testPotential(MiyamotoNagaiDisk, CausticHalo);
+    t = nbMakePotentialTable(&p, 0.0);
+    if (t)
+    {
+        mw_printf("Made a potential table with potentialTableError = 0\n");
+        nbDestroyPotentialTable(t);
+        ++fails;
+    }
+
+    return fails;
+}
+
+static int testCausticTable(void)
+{
+    int i;
+    int fails = 0;
+    int nInterpolated = 0;
+    real maxErr = 0.0;
+    mwvector pos, mirror, a, b, exact;
+    Potential p = testPotential(MiyamotoNagaiDisk, CausticHalo);
+    NBodyPotentialTable* t = nbMakePotentialTable(&p, TABLE_ERROR);
+
+    if (!t)
+    {
+        mw_printf("No potential table made for the caustic halo\n");
+        return 1;
+    }
+
+    if (t->disk.a || t->disk2.a || !t->halo.a)
+    {
+        mw_printf("Wrong components tabulated\n");
+        nbDestroyPotentialTable(t);
+        return 1;
+    }
+
+    for (i = 0; i < N_POINT; ++i)
+    {
+        real r = mw_pow(10.0, mwXrandom(&_prng, -1.0, 2.0));
+
+        SET_VECTOR(pos,
+                   r * mwXrandom(&_prng, -1.0, 1.0),
+                   r * mwXrandom(&_prng, -1.0, 1.0),
+                   r * mwXrandom(&_prng, -1.0, 1.0));
+
+        if (!nbPotentialGridAcceleration(&t->halo, pos, &a))
+        {
+            continue;
+        }
+
+        ++nInterpolated;
+        exact = nbHaloAcceleration(&p.halo, pos);
+        maxErr = mw_fmax(maxErr, relativeError(exact, a));
+
+        /* The halo is symmetric about the plane */
+        SET_VECTOR(mirror, X(pos), Y(pos), -Z(pos));
+        if (   !nbPotentialGridAcceleration(&t->halo, mirror, &b)
+            || X(b) != X(a) || Y(b) != Y(a) || Z(b) != -Z(a))
+        {
+            mw_printf("Tabulated halo not symmetric at (%f, %f, %f)\n", X(pos), Y(pos), Z(pos));
+            ++fails;
+            break;
+        }
+    }
+
+    if (maxErr > TABLE_TOLERANCE)
+    {
+        mw_printf("Tabulated caustic halo differs from the direct evaluation by %g\n", maxErr);
+        ++fails;
+    }
+
+    if (nInterpolated < N_POINT / 2)
+    {
+        mw_printf("Only %d of %d points interpolated\n", nInterpolated, N_POINT);
+        ++fails;
+    }
+
+    /* Past the end of the grid the direct evaluation is used */
+    SET_VECTOR(pos, 2.0 * NBODY_POTENTIAL_TABLE_MAX_RADIUS, 0.0, 1.0);
+    if (nbPotentialGridAcceleration(&t->halo, pos, &a))
+    {
+        mw_printf("Tabulated halo used outside of the grid\n");
+        ++fails;
+    }
+
+    a = nbTableExtAcceleration(t, &p, pos);
+    b = nbExtAcceleration(&p, pos);
+    if (X(a) != X(b) || Y(a) != Y(b) || Z(a) != Z(b))
+    {
+        mw_printf("Acceleration outside of the grid differs from the direct evaluation\n");
+        ++fails;
+    }
+
+    nbDestroyPotentialTable(t);
+
+    return fails;
+}
+
+static int checkBatch(const Potential* p, const NBodyPotentialTable* t)
+{
+    int i;
+    int fails = 0;
+    real x[N_BATCH_POINT], y[N_BATCH_POINT], z[N_BATCH_POINT];
+    real ax[N_BATCH_POINT], ay[N_BATCH_POINT], az[N_BATCH_POINT];
+
+    for (i = 0; i < N_BATCH_POINT; ++i)
+    {
+        real r = mw_pow(10.0, mwXrandom(&_prng, -3.0, 2.5));
+
+        x[i] = r * mwXrandom(&_prng, -1.0, 1.0);
+        y[i] = r * mwXrandom(&_prng, -1.0, 1.0);
+        z[i] = r * mwXrandom(&_prng, -1.0, 1.0);
+    }
+
+    nbExtAccelerationBatch(p, t, N_BATCH_POINT, x, y, z, ax, ay, az);
+
+    for (i = 0; i < N_BATCH_POINT; ++i)
+    {
+        mwvector pos, a;
+
+        SET_VECTOR(pos, x[i], y[i], z[i]);
+        a = nbTableExtAcceleration(t, p, pos);
+
+        if (X(a) != ax[i] || Y(a) != ay[i] || Z(a) != az[i])
+        {
+            mw_printf("Batched acceleration differs for disk %d, halo %d%s at (%f, %f, %f)\n",
+                      (int) p->disk.type, (int) p->halo.type, t ? " with a table" : "",
+                      x[i], y[i], z[i]);
+            ++fails;
+            break;
+        }
+    }
+
+    return fails;
+}
+
+static int testBatch(void)
+{
+    int d, h;
+    int fails = 0;
+    NBodyPotentialTable* t;
+    Potential p;
+
+    static const disk_t disks[] = { NoDisk, MiyamotoNagaiDisk, FreemanDisk };
+    static const halo_t halos[] =
+        {
+            NoHalo, LogarithmicHalo, NFWHalo, TriaxialHalo, CausticHalo, AllenSantillanHalo,
+            WilkinsonEvansHalo, NFWMassHalo, PlummerHalo, HernquistHalo, NinkovicHalo
+        };
+
+    for (d = 0; d < (int) (sizeof(disks) / sizeof(disks[0])); ++d)
+    {
+        for (h = 0; h < (int) (sizeof(halos) / sizeof(halos[0])); ++h)
+        {
+            p = testPotential(disks[d], halos[h]);
+            p.sphere[0].type = (d % 2 == 0) ? HernquistSpherical : PlummerSpherical;
+            p.halo.mass = 1.0e5;
+            p.halo.gamma = 2.0;
+            p.halo.lambda = 200.0;
+            p.halo.rho0 = 1.0;
+            p.halo.c1 = 1.0;
+            p.halo.c2 = 0.9;
+            p.halo.c3 = 0.1;
+
+            fails += checkBatch(&p, NULL);
+        }
+    }
+
+    p = testPotential(MiyamotoNagaiDisk, CausticHalo);
+    t = nbMakePotentialTable(&p, TABLE_ERROR);
+    fails += checkBatch(&p, t);
+    nbDestroyPotentialTable(t);
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails = 0;
+
+    dsfmt_init_gen_rand(&_prng, 1234567);
+
+    fails += testNoTable();
+    fails += testCausticTable();
+    fails += testBatch();
+
+    if (fails != 0)
+    {
+        mw_printf("%d potential table tests failed\n", fails);
+    }
+
+    return fails;
+}
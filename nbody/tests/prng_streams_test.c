@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check jumping the generator ahead against drawing the numbers in
+ * between, and how the bodies are split into blocks. */
+
+#include "milkyway_util.h"
+#include "nbody_prng_streams.h"
+#include "dSFMT-jump.h"
+
+#define N_COMPARE 1000
+
+/* Exactly the same number */
+static int sameDraw(dsfmt_t* a, dsfmt_t* b)
+{
+    double x = dsfmt_genrand_close_open(a);
+    double y = dsfmt_genrand_close_open(b);
+
+    return memcmp(&x, &y, sizeof(double)) == 0;
+}
+
+/* x^50000 mod the minimal polynomial of the generator, worked out
+   offline like dsfmt_jump_2_64. That's more steps than the degree of
+   the minimal polynomial (19993), so unlike the monomials below it
+   checks jumping with a reduced polynomial. */
+#define JUMP_50000_STEPS 50000
+static const char jump50000[] =
+    "773e90e1176daeab2e6b8bb0f7976a13bbf1fdca02e664a0546c6569dc6dd39d"
+    "f6b74d4cb767465bddbea149a4c1f652882bba22e9ce20176a9e53cb877f5af2"
+    "cf5bfca44083a0a3ae82e96cc147eb1087ee348775f41e9924359c8c1d6d71d3"
+    "c51055e9717fc67b905f17d7e9b28b89e071b967eaa177ce8240a571368b8e4e"
+    "9c2cc9590c4ebf8010dec8e435070e53b1ff6ca2692069c3ca976962709035d8"
+    "5a5c6fe7bb12a426c9a9b9f50c852b238c4659f930b8abdd7d2ed9a6e7d2f927"
+    "e3410e53cf0b7596b6f6d095a5b0ce96f8fd4239b0f529adbb0393e883fdf1ff"
+    "d50abf3a7d54066a9a6e3a944bf7b7f9e5e4c607ea32e8e3005d4d2890732336"
+    "bac49c2a27aff577a3a1dd28322521fe41ee8fc81307bb2aecb3c8d7a5d66ce1"
+    "9e57078009a27bfcba573c92ab05d67918555365349a46160771a99fdc39ee3d"
+    "ed7392a2fc69e7e5bc57152cc273e58521b091c774dd478167550612367e31ec"
+    "00a682fb4535e0b62c5215e2712d04616ab82b6e3b66f8793cb7d0c1505c6171"
+    "055234d476d23b1e78d5fb865eaf1d92980615202f1723f031ef482fdece1164"
+    "820d03f0a942914ffcfeaa58a939cff991578c942a22f39dafef34487db33b38"
+    "0927902238bf3c722ee67cdbf1f7eff06d87a2237d2f973ee6410a43809b4024"
+    "587a3432e58771f214e33a4d9d1559370a66a323dae858e10d7da5e534727695"
+    "9386420649189d8206aec7d205fdf4c959c85e78b52475e28d8df3d36884f628"
+    "01097676001de5d9cc61dce828a3cddb0aa5a549099f55fb43edcdc1fae64ae1"
+    "0e779a0f8ed0fe0e77c86c4d93165770f82ea22b4ba2af4905fbf0bdf26795e2"
+    "abffa09dd1272b8da19f6311fdd249b43c6c16b575c4d920e3e5ec7dbedaff53"
+    "73085db8b63fb9bd88dab7d330686695af9de88a288e1a081c78d63a55883d1d"
+    "c8812e028247c90fd9ebed4e19e41ac3b5daf1f5435025e34fda2306d9132b9e"
+    "9b0b2b1ae5781f9c0ec6308ca2c2973b5247826c53bd8383dcf9a1ce16a655de"
+    "6743aac6ed551f4a57562b00b09abd5b93c106da4c35da2d42e7c0f4649c99b0"
+    "ee54dd61c1f9218a518f24ec6a807fb99dc17a867f9f6fd35545f588ee0cd467"
+    "a0ace85eb2d0b62d36a9b0e4d21b0653bc89010cbdfa1d109d498eda5b62790b"
+    "21811af625ed3fefe29102a67a5a18e5a11152bfae0686c00c890c9471258685"
+    "64ee36bc0b6016edeb8acdb4a535d99586d6d8fda48de8d8ed5348f9408a2017"
+    "1ad1452dbaaea6dfcc63813690aea38a4a7f81027c39c4a96a8cb26be2eb742a"
+    "31c1471034da93972b88a354d1f52eb8de6d864fddbeb1eb26d2255a138c281c"
+    "9e7f5a41b4d574144701f810fad9752c92ac01801a97932c74d7d4c7fc6ab5d9"
+    "3a4a36506b3fd36d005c1990add3ee10f2ad0f1ba8e07b7c8ea51ee5cf119b2a"
+    "6cd4e6d34ff30e3f9b2a0dc1c65adf7abf9b0e41de74243919c22a1113b7a239"
+    "699fffc5a923fa6b3a8d165cc368afc52b7fed28fafc87c0014d6789beb4da00"
+    "68f18f6a76c5c686f9135a90e2c617c5725ba20e54040ba49ac425f0f3a300b5"
+    "3fe4da53333b6d3eef9fe7faed4cb609f0ec492379aa9f93cd7bcb1ff8d82af7"
+    "40249011f79ea49dcac8ef19c25f7019451b721576c262e1fcb278193e031ddf"
+    "17ed54b340d20d03638170bb47286c3e5f7b0aabfeb1577fbf83c1532ee2ffaf"
+    "99fcff2d6b44527f33dcab6d86d17cc096ec0d3d38bdf29f03bf8d5d843a1ba3"
+    "f43800874177b7463eeb06d621dc5caae3c2a9a26bc5a77e1e22c3e041f60627"
+    "eb7ce3aa9f700ea74fec40c747bf794706d73c4ac890891ce13bbc1238ca76cf"
+    "117a5bd5b0065a6d531b42ad4bf2644acfe4cf3323ca5f6c551111514c3e8299"
+    "fc4626dfa1e8a57e4bb3b49880e76fe85f830a74c72282f2226b6312fe4e8141"
+    "068f16744363c2e0c623c88bf771edc78b138c72108699a0f082a82c13a61c3a"
+    "d7ce41c9cf9899c02a0b82bb4e455355e9993d19beca7a929772fbcd1889ee9e"
+    "fbd4401392d69c62f5704ebbffe317d0d7bcbddf153ca2a9f6db0d3212811a2e"
+    "f08b9cbc7c2c1ac9910c3aedeb4496524a90f48406f9e9cbdf68232da6ace1da"
+    "01ad2257fb65d418ecda14577702c017aa995a0c4064a862364642b6c3ff98d3"
+    "66f4af0adca6019a793520342af98c16f000fcfadc6c963d376e76d344584a34"
+    "37e60f6b3246c772ac23f70920181454d91c2e9235fb50a414e8b7391e1a06dc"
+    "d744ce75d4bb31a2c2630a11f26435e9e750d4bfde8d3b728519186ab3b3396e"
+    "2e9b1b3765112137e59c525108001a84e953da67b9e9c0dcaf750552cc06bea0"
+    "1996562430bfcc34a7ce84697f35b08bf8322814b43db5204793e00f9129533a"
+    "497530756f6b7aad56b30b99c5bff35391f4dba18dc0db1b6bca767563b417c3"
+    "724bbbc3c7307a273241697d1e6d988ea7202698ef462a6fbe82ae4b0fc9f9e8"
+    "28d51b5bffefd73cc202d1d7e5d97b3a90d133c91d589de0dc9fceeaf49c43e2"
+    "209bcab20b79d41fa1053aeac43f7157103d3205391868db8f7deceb7651cfde"
+    "b34d09292c0a8b90df861703ee737d1c5e95a21fdb209c473142c1d5658d973c"
+    "d7ca71a7b5a3f5c4c77aed851a75bc0dbbb4a8954e6c80618b4aeee1d5c7165f"
+    "3b93cd9301a3f2577aba0e7676fe7fd8a8ce5374299fb68ad004d5664af09abc"
+    "00c8b5004a36cea6b6b24fe3a35dcea6ce2e76c3a7b8a6573d11ed8bf34253f9"
+    "6f897ffb090b858466c239877c9089aba8feb01bb26259ac5dd79e89a8bdbdbf"
+    "0f1f25039910c84f395c8fce69935db392dbf85ac7a3252e3f892cf01b034f5f"
+    "67c85ec38135a146209ce482049410a7acfb514da3eda3604f9937c017458fe7"
+    "876d4550821c5329b81b15176ed972415d41e315fa66e29e994aa472c7f65039"
+    "52846c9f89ce9e6e14be5f5129a77df780debe60971eb1a0479ad8ae0a760993"
+    "296c98d8ab7b7c64502006c8da741629b83b788d126ac13746540b6f7a9f2c3f"
+    "11fd85314e49bced63631f69a30f5fa526d31f21b1bfea5408531a6fb809fe93"
+    "26bb49bbf871bf7af3dc6a89c8697e7bd06b5b554631894a67cbb5831565d7dc"
+    "43c47ea5549f81ec6b7cb4f02213a32cddc1d90f0103b89db65d4287e3f6aa66"
+    "62fc3ec1739ce9b87783ef88a522c11aa0c6b221908f249da7167a45e3f7854f"
+    "d14abbe8ce95c16ef555afa66160900ce0b3c5aa06713a1612eba17811d6ad40"
+    "8d7d5b04575cc4c8c8a8c7aff1a1930972686c7c6fbe5632a77b5c9a664287b8"
+    "c531eb3d007c57959dc1d37e690a9238d75a74c0ae01b2b04989d245ddbfad95"
+    "5cfc08f45d211ca3d6601a4088843e18321fba05d5ab117427c6c1b50b59c71b"
+    "c3fc5b76f5594139d41f699e1395fd81ecf419171be5fbae8bdd57c8ac36e0c2"
+    "3753f482971c754948b6ea6f14da4365955512794ef3b176d72ddbe373f566f1"
+    "e7521cbb58f6805fcb858a3bea7b502f75b391ba49b50e2d5720d7fea5653f81"
+    "da8d72";
+
+/* The jump polynomial for fewer steps than its degree is just x^steps */
+static char* monomialJumpString(unsigned int steps)
+{
+    unsigned int i, n = steps / 4 + 1;
+    char* str = (char*) mwCalloc(n + 1, sizeof(char));
+
+    for (i = 0; i < n; ++i)
+        str[i] = '0';
+    str[steps / 4] = "1248"[steps % 4];
+
+    return str;
+}
+
+static int checkJumpPoly(unsigned int steps, const char* jumpStr, unsigned int drawn)
+{
+    dsfmt_t stepped, jumped;
+    unsigned int i;
+    int failed = 0;
+
+    dsfmt_init_gen_rand(&stepped, 31337);
+    for (i = 0; i < drawn; ++i)
+        dsfmt_genrand_close_open(&stepped);
+    jumped = stepped;
+
+    /* Each step is 2 numbers */
+    for (i = 0; i < 2 * steps; ++i)
+        dsfmt_genrand_close_open(&stepped);
+    dSFMT_jump(&jumped, jumpStr);
+
+    for (i = 0; i < N_COMPARE; ++i)
+    {
+        if (!sameDraw(&stepped, &jumped))
+        {
+            mw_printf("Jump of %u steps after %u numbers differs at %u\n", steps, drawn, i);
+            failed = 1;
+            break;
+        }
+    }
+
+    return failed;
+}
+
+static int checkJump(unsigned int steps, unsigned int drawn)
+{
+    char* str = monomialJumpString(steps);
+    int failed = checkJumpPoly(steps, str, drawn);
+
+    free(str);
+    return failed;
+}
+
+static int checkBlocks(unsigned int nbody, unsigned int minBlock, unsigned int expectedBlocks)
+{
+    NBodyPRNGStreams s;
+    dsfmt_t prng, jumped, block, lastBlock;
+    unsigned int k, first, last, next = 0;
+    int failed = 0;
+
+    dsfmt_init_gen_rand(&prng, 42);
+    dsfmt_genrand_close_open(&prng);
+
+    nbInitPRNGStreams(&s, &prng, nbody, minBlock);
+
+    if (s.nBlocks != expectedBlocks)
+    {
+        mw_printf("%u bodies: %u blocks, expected %u\n", nbody, s.nBlocks, expectedBlocks);
+        failed = 1;
+    }
+
+    for (k = 0; k < s.nBlocks; ++k)
+    {
+        nbPRNGStreamBlock(&s, k, &first, &last);
+        if (first != next || last <= first)
+        {
+            mw_printf("%u bodies: block %u is [%u, %u)\n", nbody, k, first, last);
+            failed = 1;
+        }
+        next = last;
+
+        if (k > 0)
+        {
+            jumped = s.states[k - 1];
+            block = s.states[k];
+            dSFMT_jump(&jumped, dsfmt_jump_2_64);
+            if (!sameDraw(&jumped, &block))
+            {
+                mw_printf("%u bodies: block %u isn't 2^64 steps after the last\n", nbody, k);
+                failed = 1;
+            }
+        }
+    }
+
+    if (next != nbody)
+    {
+        mw_printf("%u bodies: blocks end at %u\n", nbody, next);
+        failed = 1;
+    }
+
+    /* The first block continues from the generator it was given */
+    jumped = prng;
+    if (!sameDraw(&jumped, &s.states[0]))
+    {
+        mw_printf("%u bodies: first block isn't the generator passed in\n", nbody);
+        failed = 1;
+    }
+
+    /* The first block was drawn from once above */
+    lastBlock = s.states[s.nBlocks - 1];
+    nbFinishPRNGStreams(&s, &prng);
+
+    if (!sameDraw(&prng, &lastBlock))
+    {
+        mw_printf("%u bodies: generator not left at the end of the last block\n", nbody);
+        failed = 1;
+    }
+
+    return failed;
+}
+
+static int compareDraws(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Draw n[k] numbers from each block k of a model of nbody bodies */
+static void drawModel(dsfmt_t* prng, unsigned int nbody, const unsigned int* n, double* draws)
+{
+    NBodyPRNGStreams s;
+    unsigned int k, i;
+
+    nbInitPRNGStreams(&s, prng, nbody, NBODY_PRNG_DWARF_BLOCK);
+    for (k = 0; k < s.nBlocks; ++k)
+    {
+        for (i = 0; i < n[k]; ++i)
+            *draws++ = dsfmt_genrand_close_open(&s.states[k]);
+    }
+    nbFinishPRNGStreams(&s, prng);
+}
+
+/* Two models drawn one after another from the same generator don't share
+ * numbers, even when a later block draws more than the first one. */
+static int checkSuccessive(void)
+{
+    static const unsigned int n[2] = { 100, 150 };
+    double first[250], second[250];
+    dsfmt_t prng;
+    unsigned int i;
+    int failed = 0;
+
+    dsfmt_init_gen_rand(&prng, 2718);
+    drawModel(&prng, NBODY_PRNG_DWARF_BLOCK + 1, n, first);
+    drawModel(&prng, NBODY_PRNG_DWARF_BLOCK + 1, n, second);
+
+    qsort(first, 250, sizeof(double), compareDraws);
+    for (i = 0; i < 250; ++i)
+    {
+        if (bsearch(&second[i], first, 250, sizeof(double), compareDraws))
+        {
+            mw_printf("Second model repeats a number of the first at %u\n", i);
+            failed = 1;
+            break;
+        }
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    failed |= checkJump(1, 0);
+    failed |= checkJump(1, 17);
+    failed |= checkJump(190, 3);
+    failed |= checkJump(1000, 381);
+    failed |= checkJump(12345, 382);
+    failed |= checkJumpPoly(JUMP_50000_STEPS, jump50000, 0);
+    failed |= checkJumpPoly(JUMP_50000_STEPS, jump50000, 383);
+
+    failed |= checkBlocks(1, NBODY_PRNG_DWARF_BLOCK, 1);
+    failed |= checkBlocks(NBODY_PRNG_DWARF_BLOCK, NBODY_PRNG_DWARF_BLOCK, 1);
+    failed |= checkBlocks(NBODY_PRNG_DWARF_BLOCK + 1, NBODY_PRNG_DWARF_BLOCK, 2);
+    failed |= checkBlocks(10 * NBODY_PRNG_DWARF_BLOCK - 5, NBODY_PRNG_DWARF_BLOCK, 10);
+    failed |= checkBlocks(1000 * NBODY_PRNG_DWARF_BLOCK, NBODY_PRNG_DWARF_BLOCK, NBODY_PRNG_MAX_BLOCKS);
+    failed |= checkBlocks(NBODY_PRNG_PLUMMER_BLOCK, NBODY_PRNG_PLUMMER_BLOCK, 1);
+    failed |= checkBlocks(NBODY_PRNG_PLUMMER_BLOCK + 1, NBODY_PRNG_PLUMMER_BLOCK, 2);
+
+    failed |= checkSuccessive();
+
+    return failed;
+}
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check the errors of the packed math functions in milkyway_simd_math.h
+ * against the C library, and the special values. This is built once
+ * for each width, and passes without doing anything on a CPU that
+ * can't run it. */
+
+#include "milkyway_util.h"
+#include "milkyway_cpuid.h"
+#include "milkyway_simd_math.h"
+#include "dSFMT.h"
+
+#include <float.h>
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+#define N_SAMPLE (1 << 16)
+
+static dsfmt_t _prng;
+
+typedef mwvd (*VecFunc1)(mwvd);
+
+/* Distance from b in units of the last place of b */
+static double ulpError(double a, double b)
+{
+    double ulp;
+
+    if (a == b || (isnan(a) && isnan(b)))
+        return 0.0;
+
+    if (!isfinite(a) || !isfinite(b))
+        return INFINITY;
+
+    ulp = nextafter(fabs(b), INFINITY) - fabs(b);
+    return fabs(a - b) / ulp;
+}
+
+static double vecExp(double x)
+{
+    MW_ALIGN_V(64) double out[MW_VEC_WIDTH];
+
+    mwv_store(out, mwv_exp(mwv_set1(x)));
+    return out[0];
+}
+
+/* Apply f to all of in, the last partial vector only to what's there */
+static void applyVec(VecFunc1 f, const double* in, double* out, int n)
+{
+    int i, j;
+    MW_ALIGN_V(64) double tmp[MW_VEC_WIDTH];
+
+    for (i = 0; i < n; i += MW_VEC_WIDTH)
+    {
+        if (n - i >= MW_VEC_WIDTH)
+        {
+            mwv_storeu(&out[i], f(mwv_loadu(&in[i])));
+        }
+        else
+        {
+            mwv_store(tmp, f(mwv_load_n(&in[i], n - i)));
+            for (j = 0; j < n - i; ++j)
+                out[i + j] = tmp[j];
+        }
+    }
+}
+
+static int checkFunc(const char* name, VecFunc1 f, double (*ref)(double),
+                     const double* in, int n, double maxUlp)
+{
+    int i, worst = 0;
+    double err, maxErr = 0.0;
+    double* out = (double*) mwMalloc(n * sizeof(double));
+
+    applyVec(f, in, out, n);
+
+    for (i = 0; i < n; ++i)
+    {
+        err = ulpError(out[i], ref(in[i]));
+        if (err > maxErr)
+        {
+            maxErr = err;
+            worst = i;
+        }
+    }
+
+    if (maxErr > maxUlp)
+    {
+        mw_printf("%s(%.17g) = %.17g, expected %.17g: %g ulp, more than %g\n",
+                  name, in[worst], out[worst], ref(in[worst]), maxErr, maxUlp);
+    }
+
+    free(out);
+    return maxErr > maxUlp;
+}
+
+static double refRsqrt(double x)
+{
+    return (double) (1.0L / sqrtl((long double) x));
+}
+
+static mwvd vecLog10(mwvd x)
+{
+    return mwv_log10(x);
+}
+
+static mwvd vecRsqrt(mwvd x)
+{
+    return mwv_rsqrt(x);
+}
+
+static mwvd vecSqrt(mwvd x)
+{
+    return mwv_sqrt(x);
+}
+
+static mwvd vecSin(mwvd x)
+{
+    mwvd s, c;
+
+    mwv_sincos(x, &s, &c);
+    return s;
+}
+
+static mwvd vecCos(mwvd x)
+{
+    mwvd s, c;
+
+    mwv_sincos(x, &s, &c);
+    return c;
+}
+
+static void fillUniform(double* in, int n, double lo, double hi)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        in[i] = mwXrandom(&_prng, lo, hi);
+}
+
+/* Spread evenly over the exponents */
+static void fillLogUniform(double* in, int n, double lo, double hi)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        in[i] = exp(mwXrandom(&_prng, log(lo), log(hi)));
+}
+
+static int testExpLog(double* in)
+{
+    int fails = 0;
+
+    fillUniform(in, N_SAMPLE, -1.0, 1.0);
+    fails += checkFunc("exp", mwv_exp, exp, in, N_SAMPLE, 1.0);
+
+    fillUniform(in, N_SAMPLE, -708.0, 709.78);
+    fails += checkFunc("exp", mwv_exp, exp, in, N_SAMPLE, 1.0);
+
+    fillLogUniform(in, N_SAMPLE, 0.5, 2.0);
+    fails += checkFunc("log", mwv_log, log, in, N_SAMPLE, 1.0);
+
+    fillLogUniform(in, N_SAMPLE, 1.0e-300, 1.0e300);
+    fails += checkFunc("log", mwv_log, log, in, N_SAMPLE, 1.0);
+
+    fillLogUniform(in, N_SAMPLE, 4.9e-324, 2.2e-308);
+    fails += checkFunc("log", mwv_log, log, in, N_SAMPLE, 1.0);
+
+    fillLogUniform(in, N_SAMPLE, 1.0e-300, 1.0e300);
+    fails += checkFunc("log10", vecLog10, log10, in, N_SAMPLE, 2.0);
+
+    return fails;
+}
+
+static int testSqrt(double* in)
+{
+    int fails = 0;
+
+    fillLogUniform(in, N_SAMPLE, 1.0e-300, 1.0e300);
+    fails += checkFunc("sqrt", vecSqrt, sqrt, in, N_SAMPLE, 0.0);
+    fails += checkFunc("rsqrt", vecRsqrt, refRsqrt, in, N_SAMPLE, 1.0);
+
+    return fails;
+}
+
+static int testSinCos(double* in)
+{
+    int fails = 0;
+
+    fillUniform(in, N_SAMPLE, -M_PI, M_PI);
+    fails += checkFunc("sin", vecSin, sin, in, N_SAMPLE, 1.0);
+    fails += checkFunc("cos", vecCos, cos, in, N_SAMPLE, 1.0);
+
+    fillUniform(in, N_SAMPLE, -1.0e6, 1.0e6);
+    fails += checkFunc("sin", vecSin, sin, in, N_SAMPLE, 1.0);
+    fails += checkFunc("cos", vecCos, cos, in, N_SAMPLE, 1.0);
+
+    /* Some of these go through the C library */
+    fillUniform(in, N_SAMPLE, -1.0e7, 1.0e7);
+    fails += checkFunc("sin", vecSin, sin, in, N_SAMPLE, 1.0);
+    fails += checkFunc("cos", vecCos, cos, in, N_SAMPLE, 1.0);
+
+    return fails;
+}
+
+static int testPow(void)
+{
+    int i, worst = 0, worstBig = 0;
+    double b, y, err, maxErr = 0.0, maxBigRatio = 0.0;
+    MW_ALIGN_V(64) double out[MW_VEC_WIDTH];
+    int fails = 0;
+
+    for (i = 0; i < N_SAMPLE; ++i)
+    {
+        b = exp(mwXrandom(&_prng, -5.0, 5.0));
+        y = mwXrandom(&_prng, -1.0, 1.0) / fabs(log(b));
+
+        mwv_store(out, mwv_pow(mwv_set1(b), mwv_set1(y)));
+        err = ulpError(out[0], pow(b, y));
+        if (err > maxErr)
+        {
+            maxErr = err;
+            worst = i;
+        }
+
+        /* The error is relative to the exponent past that */
+        y = mwXrandom(&_prng, -700.0, 700.0) / fabs(log(b));
+        mwv_store(out, mwv_pow(mwv_set1(b), mwv_set1(y)));
+        err = ulpError(out[0], pow(b, y)) / fmax(1.0, fabs(y * log(b)));
+        if (err > maxBigRatio)
+        {
+            maxBigRatio = err;
+            worstBig = i;
+        }
+    }
+
+    if (maxErr > 2.0)
+    {
+        mw_printf("pow error %g ulp (sample %d) with |y log(b)| < 1\n", maxErr, worst);
+        ++fails;
+    }
+
+    if (maxBigRatio > 2.0)
+    {
+        mw_printf("pow error %g |y log(b)| ulp (sample %d)\n", maxBigRatio, worstBig);
+        ++fails;
+    }
+
+    return fails;
+}
+
+static int testSpecialValues(void)
+{
+    int fails = 0;
+    MW_ALIGN_V(64) double out[MW_VEC_WIDTH];
+
+    if (vecExp(-745.0) != 0.0 || vecExp(710.0) != INFINITY || vecExp(-INFINITY) != 0.0
+        || vecExp(INFINITY) != INFINITY || !isnan(vecExp(NAN)) || vecExp(0.0) != 1.0)
+    {
+        mw_printf("Wrong exp special value\n");
+        ++fails;
+    }
+
+    mwv_store(out, mwv_log(mwv_set1(0.0)));
+    fails += (out[0] != -INFINITY);
+    mwv_store(out, mwv_log(mwv_set1(-1.0)));
+    fails += !isnan(out[0]);
+    mwv_store(out, mwv_log(mwv_set1(INFINITY)));
+    fails += (out[0] != INFINITY);
+    mwv_store(out, mwv_log(mwv_set1(NAN)));
+    fails += !isnan(out[0]);
+    mwv_store(out, mwv_log(mwv_set1(1.0)));
+    fails += (out[0] != 0.0);
+    mwv_store(out, mwv_log(mwv_set1(DBL_MAX)));
+    fails += (ulpError(out[0], log(DBL_MAX)) > 1.0);
+
+    if (fails != 0)
+    {
+        mw_printf("Wrong log special value\n");
+    }
+
+    return fails;
+}
+
+static int cpuCanRun(void)
+{
+    int abcd[4];
+    int maxLeaf;
+
+    mw_cpuid(abcd, 0, 0);
+    maxLeaf = abcd[0];
+    mw_cpuid(abcd, 1, 0);
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    if (!mwHasAVX(abcd) || !mwOSHasAVXSupport() || maxLeaf < 7)
+        return FALSE;
+  #if defined(__AVX512F__)
+    mw_cpuid(abcd, 7, 0);
+    return mwHasAVX512F(abcd) && mwOSHasAVX512Support();
+  #else
+    if (!mwHasFMA(abcd))
+        return FALSE;
+    mw_cpuid(abcd, 7, 0);
+    return mwHasAVX2(abcd);
+  #endif
+#else
+    (void) maxLeaf;
+    return mwHasSSE2(abcd);
+#endif
+}
+
+int main(void)
+{
+    int fails = 0;
+    double* in;
+
+    if (!cpuCanRun())
+    {
+        mw_printf("Skipping %d wide SIMD math test, not supported by this CPU\n", MW_VEC_WIDTH);
+        return 0;
+    }
+
+    dsfmt_init_gen_rand(&_prng, 1234567);
+    in = (double*) mwMalloc((N_SAMPLE + 1) * sizeof(double));
+
+    fails += testExpLog(in);
+    fails += testSqrt(in);
+    fails += testSinCos(in);
+    fails += testPow();
+    fails += testSpecialValues();
+
+    /* Odd length for a partial vector at the end */
+    fillUniform(in, 7, -10.0, 10.0);
+    fails += checkFunc("exp", mwv_exp, exp, in, 7, 1.0);
+
+    free(in);
+
+    if (fails != 0)
+    {
+        mw_printf("%d SIMD math tests failed with width %d\n", fails, MW_VEC_WIDTH);
+    }
+
+    return fails;
+}
+
@@ -37,13 +37,22 @@ int evaluate(SeparationResults* results,
              const IntegralArea* ias,
              const Streams* streams,
              const StreamConstants* sc,
+             const StreamGauss sg,
+             const StarPoints* sp,
              int likelihoodToText,
-             const char* star_points_file,
              const CLRequest* clr,
              int do_separation,
              int *ignoreCheckpoint,
              const char* separation_outfile);
 
+int evaluateCutIntegrals(const AstronomyParameters* ap,
+                         const IntegralArea* ias,
+                         const StreamConstants* sc,
+                         const StreamGauss sg,
+                         const CLRequest* clr,
+                         real* bgIntegrals,
+                         real* streamIntegrals);
+
 #ifdef __cplusplus
 }
 #endif
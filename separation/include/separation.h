@@ -80,6 +80,8 @@ typedef struct
     int modfit;         /* Modified fitting function from Newby 2011 */
     int background;		/* Broken Power Law Option */
     int LikelihoodToText;   /* Create text file containing likelihood for use in local MLE*/
+    int numThreads;         /* Threads for the CPU integrals and likelihood. No effect without OpenMP */
+    double adaptiveTolerance; /* Refine the integration grid only where needed, to this relative error */
 
     MWPriority processPriority;
 
@@ -93,6 +95,8 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512F;
 
     int verbose;
 } SeparationFlags;
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SEPARATION_API_H_
+#define _SEPARATION_API_H_
+
+#include "separation_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Evaluates the likelihood of many parameter sets in one process, for
+   use by optimisers. The parameter file, the stars, the probability
+   function dispatch and everything else that doesn't depend on the
+   fit parameters are set up once when it is created. Integrals always
+   run on the CPU, and checkpoints are not used. */
+typedef struct SeparationEvaluator SeparationEvaluator;
+
+SeparationEvaluator* separationEvaluatorCreate(const char* parametersFile,
+                                               const char* starPointsFile,
+                                               int modfit,
+                                               int brokenPowerLaw);
+void separationEvaluatorDestroy(SeparationEvaluator* se);
+
+/* Parameters are in the same order as given on the command line:
+   background epsilon and q, then epsilon, mu, r, theta, phi and sigma
+   for each stream. */
+unsigned int separationEvaluatorNumberParameters(const SeparationEvaluator* se);
+
+/* The parameters from the parameter file */
+int separationEvaluatorGetParameters(const SeparationEvaluator* se, real* parameters, unsigned int nParameters);
+
+int separationEvaluate(SeparationEvaluator* se,
+                       const real* parameters,
+                       unsigned int nParameters,
+                       real* likelihoodOut);
+
+/* Full results of the last evaluation */
+const SeparationResults* separationEvaluatorResults(const SeparationEvaluator* se);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SEPARATION_API_H_ */
+
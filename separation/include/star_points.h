@@ -28,6 +28,7 @@
 #include "separation_types.h"
 
 int readStarPoints(StarPoints* sp, const char* file);
+int writeStarPointsBinary(const StarPoints* sp, const char* filename);
 void freeStarPoints(StarPoints* sp);
 
 #endif /* _STAR_POINTS_H_ */
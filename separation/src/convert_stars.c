@@ -0,0 +1,53 @@
+/*
+ *  Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Convert a star points file to the binary format, which separation
+   maps directly instead of parsing. The input may be either format. */
+
+#include "separation_types.h"
+#include "star_points.h"
+#include "milkyway_util.h"
+
+int main(int argc, const char* argv[])
+{
+    int rc;
+    StarPoints sp = EMPTY_STAR_POINTS;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <input star points> <output binary star points>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (readStarPoints(&sp, argv[1]))
+    {
+        fprintf(stderr, "Failed to read star points from '%s'\n", argv[1]);
+        freeStarPoints(&sp);
+        return EXIT_FAILURE;
+    }
+
+    rc = writeStarPointsBinary(&sp, argv[2]);
+    if (rc == 0)
+        printf("Wrote %u stars to '%s'\n", sp.number_stars, argv[2]);
+
+    freeStarPoints(&sp);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
@@ -171,8 +171,9 @@ int evaluate(SeparationResults* results,
              const IntegralArea* ias,
              const Streams* streams,
              const StreamConstants* sc,
+             const StreamGauss sg,
+             const StarPoints* sp,
              int likelihoodToText,
-             const char* starPointsFile,
              const CLRequest* clr,
              int do_separation,
              int *ignoreCheckpoint,
@@ -180,17 +181,14 @@ int evaluate(SeparationResults* results,
 {
     int rc = 0;
     EvaluationState* es;
-    StreamGauss sg;
     CLInfo ci;
     int done = FALSE;
-    StarPoints sp = EMPTY_STAR_POINTS;
     memset(&ci, 0, sizeof(ci));
 
     if (probabilityFunctionDispatch(ap, clr))
         return 1;
 
     es = newEvaluationState(ap);
-    sg  = getStreamGauss(ap->convolve);
 
   #if SEPARATION_GRAPHICS
     if (separationInitSharedEvaluationState(es))
@@ -272,14 +270,7 @@ int evaluate(SeparationResults* results,
 
     getFinalIntegrals(results, es, ap->number_streams, ap->number_integrals);
 
-    rc = readStarPoints(&sp, starPointsFile);
-    if (rc)
-    {
-        goto error;
-    }
-
-
-    rc = likelihood(results, ap, &sp, sc, streams, sg, do_separation, separation_outfile);
+    rc = likelihood(results, ap, sp, sc, streams, sg, do_separation, separation_outfile);
     /* Modifying output;  non-finite results now return a very bad likelihood, but 
      * otherwise finish cleanly */
     if (checkSeparationResults(results, ap->number_streams))
@@ -306,8 +297,6 @@ int evaluate(SeparationResults* results,
 
 error:
     freeEvaluationState(es);
-    freeStarPoints(&sp);
-    freeStreamGauss(sg);
 
   #if SEPARATION_OPENCL
     if (!clr->forceNoOpenCL && !done)
@@ -319,3 +308,37 @@ error:
     return rc;
 }
 
+/* Integrals of every cut, for evaluating many parameter sets in one
+   process. Nothing is read from or written to the checkpoint. */
+int evaluateCutIntegrals(const AstronomyParameters* ap,
+                         const IntegralArea* ias,
+                         const StreamConstants* sc,
+                         const StreamGauss sg,
+                         const CLRequest* clr,
+                         real* bgIntegrals,      /* One for each cut */
+                         real* streamIntegrals)  /* number_streams for each cut */
+{
+    int i, j, rc;
+    EvaluationState* es;
+    CLInfo ci;
+
+    memset(&ci, 0, sizeof(ci));
+
+    es = newEvaluationState(ap);
+
+    rc = calculateIntegrals(ap, ias, sc, sg, es, clr, &ci);
+    if (rc == 0)
+    {
+        for (i = 0; i < ap->number_integrals; ++i)
+        {
+            bgIntegrals[i] = es->cuts[i].bgIntegral;
+            for (j = 0; j < ap->number_streams; ++j)
+                streamIntegrals[i * ap->number_streams + j] = es->cuts[i].streamIntegrals[j];
+        }
+    }
+
+    freeEvaluationState(es);
+
+    return rc;
+}
+
@@ -32,6 +32,10 @@
 
 #include <time.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 /* Marshaling into split r_points and qw_r3_N which helps with vectorization */
 static RConsts* initRPoints(const AstronomyParameters* ap,
                             const IntegralArea* ia,
@@ -120,17 +124,6 @@ static inline void doBoincCheckpoint(const AstronomyParameters* ap,
 
 #endif /* BOINC_APPLICATION */
 
-HOT
-static inline void sumProbs(EvaluationState* es)
-{
-    int i;
-
-    KAHAN_ADD(es->bgSum, es->bgTmp);
-    for (i = 0; i < es->numberStreams; ++i)
-        KAHAN_ADD(es->streamSums[i], es->streamTmps[i]);
-}
-
-
 HOT
 static inline void r_sum(const AstronomyParameters* ap,
                          const StreamConstants* sc,
@@ -139,26 +132,31 @@ static inline void r_sum(const AstronomyParameters* ap,
                          const real* RESTRICT qw_r3_N,
                          LBTrig lbt,
                          real id,
-                         EvaluationState* es,
                          const RConsts* rc,
-                         unsigned int r_steps)
+                         unsigned int r_steps,
+                         Kahan* RESTRICT sums,
+                         real* RESTRICT streamTmps)
 {
+    int i;
     unsigned int r_step;
-    real reff_xr_rp3;
+    real reff_xr_rp3, bgTmp;
 
     for (r_step = 0; r_step < r_steps; ++r_step)
     {
         reff_xr_rp3 = id * rc[r_step].irv_reff_xr_rp3;
-        es->bgTmp = probabilityFunc(ap,
-                                    sc,
-                                    sg_dx,
-                                    &rPoints[r_step * ap->convolve],
-                                    &qw_r3_N[r_step * ap->convolve],
-                                    lbt,
-                                    rc[r_step].gPrime,
-                                    reff_xr_rp3,
-                                    es->streamTmps);
-        sumProbs(es);
+        bgTmp = probabilityFunc(ap,
+                                sc,
+                                sg_dx,
+                                &rPoints[r_step * ap->convolve],
+                                &qw_r3_N[r_step * ap->convolve],
+                                lbt,
+                                rc[r_step].gPrime,
+                                reff_xr_rp3,
+                                streamTmps);
+
+        KAHAN_ADD(sums[0], bgTmp);
+        for (i = 0; i < ap->number_streams; ++i)
+            KAHAN_ADD(sums[i + 1], streamTmps[i]);
     }
 }
 
@@ -177,6 +175,8 @@ inline LBTrig lb_trig(LB lb)
     return lbt;
 }
 
+/* Sum one (nu, mu) cell over r. sums[0] is the background and
+   sums[1..number_streams] the streams. */
 HOT
 static inline void mu_sum(const AstronomyParameters* ap,
                           const IntegralArea* ia,
@@ -186,30 +186,33 @@ static inline void mu_sum(const AstronomyParameters* ap,
                           const real* RESTRICT rPoints,
                           const real* RESTRICT qw_r3_N,
                           const NuId nuid,
-                          EvaluationState* es)
+                          unsigned int mu_step,
+                          Kahan* RESTRICT sums,
+                          real* RESTRICT streamTmps)
 {
+    int i;
     real mu;
     LB lb;
     LBTrig lbt;
 
-    const real mu_step_size = ia->mu_step_size;
-    const real mu_min = ia->mu_min;
-
-    for (; es->mu_step < ia->mu_steps; es->mu_step++)
-    {
-        doBoincCheckpoint(ap, es, ia, ap->total_calc_probs);
+    mu = ia->mu_min + (((real) mu_step + 0.5) * ia->mu_step_size);
 
-        mu = mu_min + (((real) es->mu_step + 0.5) * mu_step_size);
+    lb = gc2lb(ap->wedge, mu, nuid.nu); /* integral point */
+    lbt = lb_trig(lb);
 
-        lb = gc2lb(ap->wedge, mu, nuid.nu); /* integral point */
-        lbt = lb_trig(lb);
-
-        r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, es, rc, ia->r_steps);
-    }
+    for (i = 0; i <= ap->number_streams; ++i)
+        CLEAR_KAHAN(sums[i]);
 
-    es->mu_step = 0;
+    r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, rc, ia->r_steps, sums, streamTmps);
 }
 
+/* The mu cells of each nu step are split between threads, each with
+ * its own partial sums. The partial sums are then added in order of
+ * mu, so the result doesn't depend on the number of threads. The
+ * state is only advanced a whole nu step at a time, so checkpoints
+ * are taken between nu steps. A checkpoint taken part way through a
+ * nu step still resumes from its mu step.
+ */
 static void nuSum(const AstronomyParameters* ap,
                   const IntegralArea* ia,
                   const StreamConstants* sc,
@@ -217,20 +220,378 @@ static void nuSum(const AstronomyParameters* ap,
                   const real* RESTRICT sg_dx,
                   const real* RESTRICT rPoints,
                   const real* RESTRICT qw_r3_N,
-                  EvaluationState* es)
+                  EvaluationState* es,
+                  Kahan* RESTRICT cellSums,
+                  real* RESTRICT streamTmps,
+                  int tmpStride)
 {
+    int i, mu_step, mu_start;
     NuId nuid;
+    const int nSums = ap->number_streams + 1;
+    const int mu_steps = (int) ia->mu_steps;
 
     for ( ; es->nu_step < ia->nu_steps; es->nu_step++)
     {
+        doBoincCheckpoint(ap, es, ia, ap->total_calc_probs);
+
         nuid = calcNuStep(ia, es->nu_step);
+        mu_start = (int) es->mu_step;
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(mu_step) schedule(static)
+      #endif
+        for (mu_step = mu_start; mu_step < mu_steps; ++mu_step)
+        {
+          #ifdef _OPENMP
+            real* tmps = &streamTmps[omp_get_thread_num() * tmpStride];
+          #else
+            real* tmps = streamTmps;
+          #endif
+
+            mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, (unsigned int) mu_step,
+                   &cellSums[mu_step * nSums], tmps);
+        }
+
+        for (mu_step = mu_start; mu_step < mu_steps; ++mu_step)
+        {
+            const Kahan* sums = &cellSums[mu_step * nSums];
 
-        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, es);
+            KAHAN_REDUCTION(es->bgSum, sums[0]);
+            for (i = 0; i < es->numberStreams; ++i)
+                KAHAN_REDUCTION(es->streamSums[i], sums[i + 1]);
+        }
+
+        es->mu_step = 0;
     }
 
     es->nu_step = 0;
 }
 
+/* Adaptive integration. The (nu, mu) cells are grouped in
+ * ADAPTIVE_BLOCK x ADAPTIVE_BLOCK blocks, and a coarse pass only does
+ * the middle cell of each, counted for the whole block. The error of
+ * that is estimated from the second differences between neighbouring
+ * blocks. The blocks with the largest errors are then done on the full
+ * grid until the estimated error left in each integral is under the
+ * tolerance. Cells past the last whole block are always done. The r
+ * sum of a cell is the same as on the full grid.
+ *
+ * Like nuSum(), the sums are added in a fixed order so the result
+ * doesn't depend on the number of threads. The cut is done in one go,
+ * so a checkpoint can only be taken between cuts.
+ */
+#define ADAPTIVE_BLOCK 3
+
+typedef struct
+{
+    unsigned int nu_step, mu_step;
+} CellIndex;
+
+typedef struct
+{
+    real key;
+    int block;
+} BlockError;
+
+static int compareBlockErrors(const void* a, const void* b)
+{
+    const BlockError* ea = (const BlockError*) a;
+    const BlockError* eb = (const BlockError*) b;
+
+    /* Largest first, and by position for ties */
+    if (ea->key > eb->key)
+        return -1;
+    if (ea->key < eb->key)
+        return 1;
+    return ea->block - eb->block;
+}
+
+static void evaluateCells(const AstronomyParameters* ap,
+                          const IntegralArea* ia,
+                          const StreamConstants* sc,
+                          const RConsts* rc,
+                          const real* RESTRICT sg_dx,
+                          const real* RESTRICT rPoints,
+                          const real* RESTRICT qw_r3_N,
+                          const NuId* nuids,
+                          const CellIndex* cells,
+                          int nCells,
+                          Kahan* RESTRICT cellSums,
+                          real* RESTRICT streamTmps,
+                          int tmpStride)
+{
+    int c;
+    const int nSums = ap->number_streams + 1;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(c) schedule(static)
+  #endif
+    for (c = 0; c < nCells; ++c)
+    {
+      #ifdef _OPENMP
+        real* tmps = &streamTmps[omp_get_thread_num() * tmpStride];
+      #else
+        real* tmps = streamTmps;
+      #endif
+
+        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuids[cells[c].nu_step], cells[c].mu_step,
+               &cellSums[c * nSums], tmps);
+    }
+}
+
+static void adaptiveSum(const AstronomyParameters* ap,
+                        const IntegralArea* ia,
+                        const StreamConstants* sc,
+                        const RConsts* rc,
+                        const real* RESTRICT sg_dx,
+                        const real* RESTRICT rPoints,
+                        const real* RESTRICT qw_r3_N,
+                        EvaluationState* es,
+                        real tolerance,
+                        real* RESTRICT streamTmps,
+                        int tmpStride)
+{
+    const int B = ADAPTIVE_BLOCK;
+    const int nSums = ap->number_streams + 1;
+    const int nbNu = (int) ia->nu_steps / B;
+    const int nbMu = (int) ia->mu_steps / B;
+    const int nBlocks = nbNu * nbMu;
+    const unsigned int nCellsTotal = ia->nu_steps * ia->mu_steps;
+    const real errFactor = (real) (B * B - 1) / (real) (24 * B * B);
+
+    NuId* nuids;
+    CellIndex* cells;
+    Kahan* cellSums;
+    real* g;            /* Middle cell of each block without its volume */
+    real* weights;      /* Volume of each block */
+    real* errors;       /* Estimated error of each block for each integral */
+    real* budget;
+    real* remaining;
+    BlockError* order;
+    int* refineStart;
+    int nCells, nEdge, nRefined = 0;
+    int i, j, k, b, bi, bj, t, u;
+    unsigned int nu_step, mu_step;
+
+    nuids = (NuId*) mwMalloc(ia->nu_steps * sizeof(NuId));
+    for (nu_step = 0; nu_step < ia->nu_steps; ++nu_step)
+        nuids[nu_step] = calcNuStep(ia, nu_step);
+
+    cells = (CellIndex*) mwMalloc(nCellsTotal * sizeof(CellIndex));
+    cellSums = (Kahan*) mwCallocA(nCellsTotal * nSums, sizeof(Kahan));
+    g = (real*) mwMalloc((nBlocks * nSums + 1) * sizeof(real));
+    weights = (real*) mwMalloc((nBlocks + 1) * sizeof(real));
+    errors = (real*) mwMalloc((nBlocks * nSums + 1) * sizeof(real));
+    budget = (real*) mwMalloc(nSums * sizeof(real));
+    remaining = (real*) mwMalloc(nSums * sizeof(real));
+    order = (BlockError*) mwMalloc((nBlocks + 1) * sizeof(BlockError));
+    refineStart = (int*) mwMalloc((nBlocks + 1) * sizeof(int));
+
+    /* Coarse pass: the middle of each block, then everything past the
+       last whole blocks */
+    nCells = 0;
+    for (bi = 0; bi < nbNu; ++bi)
+    {
+        for (bj = 0; bj < nbMu; ++bj)
+        {
+            cells[nCells].nu_step = bi * B + B / 2;
+            cells[nCells].mu_step = bj * B + B / 2;
+            ++nCells;
+        }
+    }
+
+    for (nu_step = 0; nu_step < ia->nu_steps; ++nu_step)
+    {
+        for (mu_step = 0; mu_step < ia->mu_steps; ++mu_step)
+        {
+            if ((int) nu_step >= nbNu * B || (int) mu_step >= nbMu * B)
+            {
+                cells[nCells].nu_step = nu_step;
+                cells[nCells].mu_step = mu_step;
+                ++nCells;
+            }
+        }
+    }
+    nEdge = nCells - nBlocks;
+
+    evaluateCells(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuids, cells, nCells, cellSums, streamTmps, tmpStride);
+
+    for (b = 0; b < nBlocks; ++b)
+    {
+        bi = b / nbMu;
+        weights[b] = 0.0;
+        for (t = 0; t < B; ++t)
+            weights[b] += nuids[bi * B + t].id;
+        weights[b] *= (real) B;
+
+        for (k = 0; k < nSums; ++k)
+            g[b * nSums + k] = cellSums[b * nSums + k].sum / nuids[bi * B + B / 2].id;
+    }
+
+    /* The midpoint rule over a block is off by about (H^2 / 24) g'' of
+       it, and the full grid in it by 1 / B^2 of that. Near the edges
+       the second difference is taken one block in. */
+    for (k = 0; k < nSums; ++k)
+    {
+        budget[k] = 0.0;
+        remaining[k] = 0.0;
+    }
+
+    for (b = 0; b < nBlocks; ++b)
+    {
+        int ci, cj;
+
+        bi = b / nbMu;
+        bj = b % nbMu;
+        ci = bi < 1 ? 1 : (bi > nbNu - 2 ? nbNu - 2 : bi);
+        cj = bj < 1 ? 1 : (bj > nbMu - 2 ? nbMu - 2 : bj);
+
+        for (k = 0; k < nSums; ++k)
+        {
+            real d2nu = g[((ci - 1) * nbMu + bj) * nSums + k]
+                      - 2.0 * g[(ci * nbMu + bj) * nSums + k]
+                      + g[((ci + 1) * nbMu + bj) * nSums + k];
+            real d2mu = g[(bi * nbMu + cj - 1) * nSums + k]
+                      - 2.0 * g[(bi * nbMu + cj) * nSums + k]
+                      + g[(bi * nbMu + cj + 1) * nSums + k];
+
+            errors[b * nSums + k] = weights[b] * errFactor * (mw_fabs(d2nu) + mw_fabs(d2mu));
+            remaining[k] += errors[b * nSums + k];
+            budget[k] += weights[b] * g[b * nSums + k];
+        }
+    }
+
+    for (i = nBlocks; i < nCells; ++i)
+    {
+        for (k = 0; k < nSums; ++k)
+            budget[k] += cellSums[i * nSums + k].sum;
+    }
+
+    for (k = 0; k < nSums; ++k)
+        budget[k] = tolerance * mw_fabs(budget[k]);
+
+    /* Refine the worst blocks until each integral is within its
+       budget. Streams that will be thrown away don't count. */
+    for (b = 0; b < nBlocks; ++b)
+    {
+        order[b].block = b;
+        order[b].key = 0.0;
+        for (k = 0; k < nSums; ++k)
+        {
+            real e = errors[b * nSums + k];
+
+            if (k > 0 && !sc[k - 1].large_sigma)
+                continue;
+
+            if (budget[k] > 0.0)
+                e /= budget[k];
+            else if (e > 0.0)
+                e = REAL_MAX;
+
+            order[b].key = mw_fmax(order[b].key, e);
+        }
+        refineStart[b] = -1;
+    }
+
+    qsort(order, nBlocks, sizeof(BlockError), compareBlockErrors);
+
+    for (i = 0; i < nBlocks; ++i)
+    {
+        int over = FALSE;
+
+        for (k = 0; k < nSums; ++k)
+        {
+            if (k > 0 && !sc[k - 1].large_sigma)
+                continue;
+            over |= (remaining[k] > budget[k]);
+        }
+
+        if (!over)
+            break;
+
+        b = order[i].block;
+        for (k = 0; k < nSums; ++k)
+            remaining[k] -= errors[b * nSums + k];
+
+        /* The rest of the block, after what's already done */
+        refineStart[b] = nCells;
+        bi = b / nbMu;
+        bj = b % nbMu;
+        for (t = 0; t < B; ++t)
+        {
+            for (u = 0; u < B; ++u)
+            {
+                if (t == B / 2 && u == B / 2)
+                    continue;
+                cells[nCells].nu_step = bi * B + t;
+                cells[nCells].mu_step = bj * B + u;
+                ++nCells;
+            }
+        }
+        ++nRefined;
+    }
+
+    evaluateCells(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuids,
+                  &cells[nBlocks + nEdge], nCells - nBlocks - nEdge,
+                  &cellSums[(nBlocks + nEdge) * nSums], streamTmps, tmpStride);
+
+    for (b = 0; b < nBlocks; ++b)
+    {
+        if (refineStart[b] < 0)
+        {
+            KAHAN_ADD(es->bgSum, weights[b] * g[b * nSums]);
+            for (k = 1; k < nSums; ++k)
+                KAHAN_ADD(es->streamSums[k - 1], weights[b] * g[b * nSums + k]);
+            continue;
+        }
+
+        for (j = 0; j < B * B; ++j)
+        {
+            const Kahan* sums;
+
+            if (j == B * B / 2)
+                sums = &cellSums[b * nSums];
+            else
+                sums = &cellSums[(refineStart[b] + (j < B * B / 2 ? j : j - 1)) * nSums];
+
+            KAHAN_REDUCTION(es->bgSum, sums[0]);
+            for (k = 1; k < nSums; ++k)
+                KAHAN_REDUCTION(es->streamSums[k - 1], sums[k]);
+        }
+    }
+
+    for (i = nBlocks; i < nBlocks + nEdge; ++i)
+    {
+        const Kahan* sums = &cellSums[i * nSums];
+
+        KAHAN_REDUCTION(es->bgSum, sums[0]);
+        for (k = 1; k < nSums; ++k)
+            KAHAN_REDUCTION(es->streamSums[k - 1], sums[k]);
+    }
+
+    mw_printf("Adaptive integral %u: %d of %u cells (%.1f%%), %d of %d blocks refined\n",
+              es->currentCut, nCells, nCellsTotal, 100.0 * (double) nCells / (double) nCellsTotal,
+              nRefined, nBlocks);
+    mw_printf("  Estimated relative error: background = %g", remaining[0] / mw_fabs(es->bgSum.sum));
+    for (k = 1; k < nSums; ++k)
+    {
+        if (sc[k - 1].large_sigma)
+            mw_printf(", stream %d = %g", k - 1, remaining[k] / mw_fabs(es->streamSums[k - 1].sum));
+    }
+    mw_printf("\n");
+
+    free(nuids);
+    free(cells);
+    mwFreeA(cellSums);
+    free(g);
+    free(weights);
+    free(errors);
+    free(budget);
+    free(remaining);
+    free(order);
+    free(refineStart);
+}
+
 void separationIntegralGetSums(EvaluationState* es)
 {
     int i;
@@ -254,8 +615,11 @@ int integrate(const AstronomyParameters* ap,
     RConsts* rc;
     real* RESTRICT rPoints;
     real* RESTRICT qw_r3_N;
+    Kahan* RESTRICT cellSums;
+    real* RESTRICT streamTmps;
+    int tmpStride, nThreads;
 
-    (void) clr, (void) _ci;
+    (void) _ci;
 
     if (ap->q == 0.0)
     {
@@ -270,9 +634,36 @@ int integrate(const AstronomyParameters* ap,
     qw_r3_N = mwMallocA(sizeof(real) * ia->r_steps * ap->convolve);
     rc = initRPoints(ap, ia, sg, rPoints, qw_r3_N);
 
-    nuSum(ap, ia, sc, rc, sg.dx, rPoints, qw_r3_N, es);
+  #ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+  #else
+    nThreads = 1;
+  #endif
+
+    /* Keep each thread's temporaries on their own cache lines */
+    tmpStride = (ap->number_streams + 7) & ~7;
+    if (tmpStride == 0)
+        tmpStride = 8;
+
+    cellSums = (Kahan*) mwCallocA(ia->mu_steps * (ap->number_streams + 1), sizeof(Kahan));
+    streamTmps = (real*) mwCallocA(nThreads * tmpStride, sizeof(real));
+
+    /* Too small to have blocks in the middle, or resuming part way
+       through a cut on the full grid */
+    if (clr->adaptiveTolerance > 0.0
+        && ia->nu_steps >= 3 * ADAPTIVE_BLOCK && ia->mu_steps >= 3 * ADAPTIVE_BLOCK
+        && es->nu_step == 0 && es->mu_step == 0)
+    {
+        adaptiveSum(ap, ia, sc, rc, sg.dx, rPoints, qw_r3_N, es, clr->adaptiveTolerance, streamTmps, tmpStride);
+    }
+    else
+    {
+        nuSum(ap, ia, sc, rc, sg.dx, rPoints, qw_r3_N, es, cellSums, streamTmps, tmpStride);
+    }
     separationIntegralGetSums(es);
 
+    mwFreeA(cellSums);
+    mwFreeA(streamTmps);
     mwFreeA(rc);
     mwFreeA(rPoints);
     mwFreeA(qw_r3_N);
@@ -24,6 +24,10 @@
 #include <stdio.h>
 #include <time.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 #include "separation_types.h"
 #include "likelihood.h"
 #include "probabilities.h"
@@ -140,7 +144,23 @@ static void separation(FILE* f,
     }
 }
 
-static real likelihood_probability(const AstronomyParameters* ap,
+/* Stars are evaluated a block at a time. Each star gets a row of
+   results, laid out as below, which is then added into the sums in
+   order of stars. */
+#define LIKELIHOOD_BLOCK_SIZE 4096
+
+#define STAR_PROB(row) ((row)[0])
+#define STAR_BG_PROB(row) ((row)[1])
+#define STAR_BG_LOG(row) ((row)[2])
+#define STAR_STREAM_LOGS(row) (&(row)[3])
+#define STAR_STREAM_PROBS(row, nStreams) (&(row)[3 + (nStreams)])
+
+static int starRowSize(int nStreams)
+{
+    return 2 * nStreams + 3;
+}
+
+static void likelihood_probability(const AstronomyParameters* ap,
                                    const StreamConstants* sc,
                                    const Streams* streams,
 
@@ -152,42 +172,67 @@ static real likelihood_probability(const AstronomyParameters* ap,
                                    real gPrime,
                                    real reff_xr_rp3,
                                    const SeparationResults* results,
-                                   EvaluationState* es,
 
-                                   real* RESTRICT bgProb) /* Out argument for thing needed by separation */
+                                   real* RESTRICT row)
 {
     int i;
-    real starProb, streamOnly;
+    real bgTmp, starProb, streamOnly;
+    real* streamTmps = STAR_STREAM_PROBS(row, ap->number_streams);
+    real* streamLogs = STAR_STREAM_LOGS(row);
 
     /* if q is 0, there is no probability */
     if (ap->q == 0.0)
     {
-        es->bgTmp = -1.0;
+        bgTmp = -1.0;
     }
     else
     {
-        es->bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, es->streamTmps);
+        bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps);
     }
 
-    if (bgProb)
-        *bgProb = es->bgTmp;
+    STAR_BG_PROB(row) = bgTmp; /* Needed by separation */
 
-    es->bgTmp = es->bgTmp / results->backgroundIntegral;
+    bgTmp = bgTmp / results->backgroundIntegral;
 
-    starProb = es->bgTmp; /* bg only */
+    starProb = bgTmp; /* bg only */
     for (i = 0; i < ap->number_streams; ++i)
     {
-        streamOnly = es->streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
+        streamOnly = streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
         starProb += streamOnly;
-        streamOnly = probability_log(streamOnly, streams->sumExpWeights);
-        KAHAN_ADD(es->streamSums[i], streamOnly);
+        streamLogs[i] = probability_log(streamOnly, streams->sumExpWeights);
     }
     starProb /= streams->sumExpWeights;
 
-    es->bgTmp = probability_log(es->bgTmp, streams->sumExpWeights);
-    KAHAN_ADD(es->bgSum, es->bgTmp);
+    STAR_BG_LOG(row) = probability_log(bgTmp, streams->sumExpWeights);
+    STAR_PROB(row) = starProb;
+}
+
+static void likelihood_star(const AstronomyParameters* ap,
+                            const StreamConstants* sc,
+                            const Streams* streams,
+                            const StreamGauss sg,
+                            const SeparationResults* results,
+                            mwvector point,
+                            real* RESTRICT r_points,
+                            real* RESTRICT qw_r3_N,
+                            real* RESTRICT row)
+{
+    LB lb;
+    LBTrig lbt;
+    real reff_xr_rp3;
+    RConsts rc;
+
+    rc = calcRConstsLik(Z(point), ap);
+    setSplitRPoints(ap, sg, &rc, r_points, qw_r3_N);
+    reff_xr_rp3 = calcReffXrRp3(Z(point), rc.gPrime);
 
-    return starProb;
+    LB_L(lb) = L(point);
+    LB_B(lb) = B(point);
+
+    lbt = lb_trig(lb);
+
+    likelihood_probability(ap, sc, streams, sg.dx, r_points, qw_r3_N, lbt, rc.gPrime,
+                           reff_xr_rp3, results, row);
 }
 
 static real calculateLikelihood(const Kahan* ksum, unsigned int nStars, unsigned int badJacobians)
@@ -266,6 +311,10 @@ static void printSeparationStats(const StreamStats* ss,
         printf("%d stars separated into stream\n", ss[i].q);
 }
 
+/* The stars of each block are split between threads, each with its
+   own r points. The per star results are then added up in order of
+   stars, so the sums are the same as adding them one star at a time
+   regardless of the number of threads. */
 static int likelihood_sum(SeparationResults* results,
                           const AstronomyParameters* ap,
                           const StarPoints* sp,
@@ -277,7 +326,7 @@ static int likelihood_sum(SeparationResults* results,
 
                           real* RESTRICT r_points,
                           real* RESTRICT qw_r3_N,
-
+                          real* RESTRICT starRows,
 
                           const int do_separation,
                           StreamStats* ss,
@@ -285,15 +334,12 @@ static int likelihood_sum(SeparationResults* results,
 {
     Kahan prob = ZERO_KAHAN;
 
-    unsigned int current_star_point;
-    mwvector point;
+    int i, star, blockStart, blockEnd;
+    const int nStars = (int) sp->number_stars;
+    const int rowSize = starRowSize(streams->number_streams);
+    const real* row;
     real star_prob;
-    LB lb;
-    LBTrig lbt;
-    real reff_xr_rp3;
-    RConsts rc = { 0.0, 0.0, 0.0, 0.0, 0.0 };
 
-    real bgProb = 0.0;
     real epsilon_b = 0.0;
     mwmatrix cmatrix;
     unsigned int num_zero = 0;
@@ -305,34 +351,53 @@ static int likelihood_sum(SeparationResults* results,
         epsilon_b = get_stream_bg_weight_consts(ss, streams);
     }
 
-    for (current_star_point = 0; current_star_point < sp->number_stars; ++current_star_point)
+    for (blockStart = 0; blockStart < nStars; blockStart += LIKELIHOOD_BLOCK_SIZE)
     {
-        point = sp->stars[current_star_point];
-        rc = calcRConstsLik(Z(point), ap);
-        setSplitRPoints(ap, sg, &rc, r_points, qw_r3_N);
-        reff_xr_rp3 = calcReffXrRp3(Z(point), rc.gPrime);
+        blockEnd = mwMin(blockStart + LIKELIHOOD_BLOCK_SIZE, nStars);
 
-        LB_L(lb) = L(point);
-        LB_B(lb) = B(point);
-
-        lbt = lb_trig(lb);
-
-        star_prob = likelihood_probability(ap, sc, streams, sg.dx, r_points, qw_r3_N, lbt, rc.gPrime,
-                                           reff_xr_rp3, results, es, &bgProb);
-
-        if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+      #ifdef _OPENMP
+        #pragma omp parallel for private(star) schedule(static)
+      #endif
+        for (star = blockStart; star < blockEnd; ++star)
         {
-            star_prob = mw_log10(star_prob);
-            KAHAN_ADD(prob, star_prob);
+          #ifdef _OPENMP
+            const int offset = omp_get_thread_num() * ap->convolve;
+          #else
+            const int offset = 0;
+          #endif
+
+            likelihood_star(ap, sc, streams, sg, results, sp->stars[star],
+                            &r_points[offset], &qw_r3_N[offset],
+                            &starRows[(star - blockStart) * rowSize]);
         }
-        else
+
+        for (star = blockStart; star < blockEnd; ++star)
         {
-            ++num_zero;
-            prob.sum -= 238.0;
+            row = &starRows[(star - blockStart) * rowSize];
+
+            star_prob = STAR_PROB(row);
+            if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+            {
+                star_prob = mw_log10(star_prob);
+                KAHAN_ADD(prob, star_prob);
+            }
+            else
+            {
+                ++num_zero;
+                prob.sum -= 238.0;
+            }
+
+            for (i = 0; i < streams->number_streams; ++i)
+                KAHAN_ADD(es->streamSums[i], STAR_STREAM_LOGS(row)[i]);
+            KAHAN_ADD(es->bgSum, STAR_BG_LOG(row));
+
+            if (do_separation)
+            {
+                separation(f, ap, results, cmatrix, ss,
+                           STAR_STREAM_PROBS(row, streams->number_streams),
+                           STAR_BG_PROB(row), epsilon_b, sp->stars[star]);
+            }
         }
-
-        if (do_separation)
-            separation(f, ap, results, cmatrix, ss, es->streamTmps, bgProb, epsilon_b, point);
     }
 
     calculateLikelihoods(results, &prob, &es->bgSum, es->streamSums,
@@ -361,7 +426,9 @@ int likelihood(SeparationResults* results,
 {
     real* r_points;
     real* qw_r3_N;
+    real* starRows;
     EvaluationState* es;
+    int nThreads = 1;
     StreamStats* ss = NULL;
     FILE* f = NULL;
 
@@ -385,8 +452,14 @@ int likelihood(SeparationResults* results,
     /* New state for this sum */
     es = newEvaluationState(ap);
 
-    r_points = (real*) mwMallocA(sizeof(real) * ap->convolve);
-    qw_r3_N = (real*) mwMallocA(sizeof(real) * ap->convolve);
+  #ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+  #endif
+
+    /* One set of r points for each thread */
+    r_points = (real*) mwMallocA(sizeof(real) * ap->convolve * nThreads);
+    qw_r3_N = (real*) mwMallocA(sizeof(real) * ap->convolve * nThreads);
+    starRows = (real*) mwMallocA(sizeof(real) * starRowSize(streams->number_streams) * LIKELIHOOD_BLOCK_SIZE);
 
     t1 = mwGetTime();
     rc = likelihood_sum(results,
@@ -395,6 +468,7 @@ int likelihood(SeparationResults* results,
                         es,
                         r_points,
                         qw_r3_N,
+                        starRows,
                         do_separation,
                         ss,
                         f);
@@ -403,6 +477,7 @@ int likelihood(SeparationResults* results,
 
     mwFreeA(r_points);
     mwFreeA(qw_r3_N);
+    mwFreeA(starRows);
     mwFreeA(ss);
     freeEvaluationState(es);
 
@@ -0,0 +1,259 @@
+/*
+ *  Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is built once for AVX2 with FMA and once for AVX-512F. Unlike
+ * the SSE2 ones it handles every background profile, including the
+ * slow Hernquist and the auxiliary quadratic term, using the exp() and
+ * log() from milkyway_simd_math.h. The last vector of a convolution that
+ * isn't a multiple of the width is loaded with zeros, so those lanes
+ * have no weight.
+ */
+
+#include "milkyway_util.h"
+#include "probabilities.h"
+#include "separation_constants.h"
+
+#if !defined(__AVX512F__) && !(defined(__AVX2__) && defined(__FMA__))
+  #error "Probabilities built without AVX2 and FMA or AVX-512F"
+#endif
+
+#include "milkyway_simd_math.h"
+
+
+HOT ALWAYS_INLINE
+static inline real probabilities_avx2_kernel(const AstronomyParameters* ap,
+                                             const StreamConstants* sc,
+                                             const real* RESTRICT sg_dx,
+                                             const real* RESTRICT r_point,
+                                             const real* RESTRICT qw_r3_N,
+                                             LBTrig lbt,
+                                             real gPrime,
+                                             real reff_xr_rp3,
+                                             real* RESTRICT streamTmps,
+                                             const int profile,
+                                             const int aux)
+{
+    int i, j;
+    const int convolve = ap->convolve;
+    const int nStreams = ap->number_streams;
+    MW_ALIGN_V(64) real xs[MAX_CONVOLVE];
+    MW_ALIGN_V(64) real ys[MAX_CONVOLVE];
+    MW_ALIGN_V(64) real zs[MAX_CONVOLVE];
+    MW_ALIGN_V(64) real qws[MAX_CONVOLVE];
+
+    const mwvd COSBL    = mwv_set1(lbt.lCosBCos);
+    const mwvd SINCOSBL = mwv_set1(lbt.lSinBCos);
+    const mwvd SINB     = mwv_set1(lbt.bSin);
+    const mwvd SUNR0    = mwv_set1(ap->sun_r0);
+    const mwvd R0       = mwv_set1(ap->r0);
+    const mwvd Q_INV    = mwv_set1(ap->q_inv);
+    const mwvd INNER    = mwv_set1(ap->innerPower);
+    const mwvd DELTA3   = mwv_set1(ap->alpha_delta3);
+    const mwvd BGW      = mwv_set1(ap->background_weight);
+    const mwvd THICKW   = mwv_set1(ap->thick_disk_weight);
+    const mwvd THICKLS  = mwv_set1(-0.285714286);  /* Scale length and height of the thick disk */
+    const mwvd THICKHS  = mwv_set1(-1.428571429);  /* as in disk_prob_thick() */
+    const mwvd GPRIME   = mwv_set1(gPrime);
+    const mwvd BG_A     = mwv_set1(ap->bg_a);
+    const mwvd BG_B     = mwv_set1(ap->bg_b);
+    const mwvd BG_C     = mwv_set1(ap->bg_c);
+
+    mwvd bg = mwv_zero();
+
+    for (i = 0; i < convolve; i += MW_VEC_WIDTH)
+    {
+        mwvd ri, qw, x, y, z, xy2, rg, h;
+
+        if (convolve - i >= MW_VEC_WIDTH)
+        {
+            ri = mwv_loadu(&r_point[i]);
+            qw = mwv_loadu(&qw_r3_N[i]);
+        }
+        else
+        {
+            ri = mwv_load_n(&r_point[i], convolve - i);
+            qw = mwv_load_n(&qw_r3_N[i], convolve - i);
+        }
+
+        x = mwv_fmsub(ri, COSBL, SUNR0);
+        y = mwv_mul(ri, SINCOSBL);
+        z = mwv_mul(ri, SINB);
+
+        mwv_store(&xs[i], x);
+        mwv_store(&ys[i], y);
+        mwv_store(&zs[i], z);
+        mwv_store(&qws[i], qw);
+
+        xy2 = mwv_fmadd(x, x, mwv_mul(y, y));
+        rg = mwv_mul(z, Q_INV);
+        rg = mwv_sqrt(mwv_fmadd(rg, rg, xy2));
+
+        if (profile == BROKEN_POWER_LAW)
+        {
+            mwvd n = mwv_select(mwv_cmpge(rg, R0), mwv_add(INNER, DELTA3), INNER);
+            bg = mwv_fmadd(qw, mwv_pow(mwv_div(SUNR0, rg), n), bg);
+            continue;
+        }
+
+        if (profile == FAST_HERNQUIST)
+        {
+            mwvd rs = mwv_add(rg, R0);
+            h = mwv_div(BGW, mwv_mul(rg, mwv_mul(rs, mwv_mul(rs, rs))));
+        }
+        else
+        {
+            mwvd rs = mwv_add(rg, R0);
+            mwvd lp = mwv_fmadd(INNER, mwv_log(rg), mwv_mul(DELTA3, mwv_log(rs)));
+            h = mwv_mul(BGW, mwv_exp(mwv_sub(mwv_zero(), lp)));
+        }
+
+        /* Thick disk */
+        h = mwv_fmadd(THICKW, mwv_exp(mwv_fmadd(mwv_sqrt(xy2), THICKLS, mwv_mul(mwv_abs(z), THICKHS))), h);
+
+        if (aux)
+        {
+            mwvd g = convolve - i >= MW_VEC_WIDTH ? mwv_loadu(&sg_dx[i]) : mwv_load_n(&sg_dx[i], convolve - i);
+            g = mwv_add(GPRIME, g);
+            h = mwv_fmadd(BGW, mwv_fmadd(mwv_fmadd(BG_A, g, BG_B), g, BG_C), h);
+        }
+
+        bg = mwv_fmadd(qw, h, bg);
+    }
+
+    for (j = 0; j < nStreams; ++j)
+    {
+        const mwvd CX = mwv_set1(X(sc[j].c));
+        const mwvd CY = mwv_set1(Y(sc[j].c));
+        const mwvd CZ = mwv_set1(Z(sc[j].c));
+        const mwvd AX = mwv_set1(X(sc[j].a));
+        const mwvd AY = mwv_set1(Y(sc[j].a));
+        const mwvd AZ = mwv_set1(Z(sc[j].a));
+        const mwvd SIGMA = mwv_set1(-sc[j].sigma_sq2_inv);
+        mwvd st = mwv_zero();
+
+        for (i = 0; i < convolve; i += MW_VEC_WIDTH)
+        {
+            mwvd dx, dy, dz, dotted, norm;
+
+            dx = mwv_sub(mwv_load(&xs[i]), CX);
+            dy = mwv_sub(mwv_load(&ys[i]), CY);
+            dz = mwv_sub(mwv_load(&zs[i]), CZ);
+
+            dotted = mwv_fmadd(AX, dx, mwv_fmadd(AY, dy, mwv_mul(AZ, dz)));
+
+            dx = mwv_fnmadd(dotted, AX, dx);
+            dy = mwv_fnmadd(dotted, AY, dy);
+            dz = mwv_fnmadd(dotted, AZ, dz);
+
+            norm = mwv_fmadd(dx, dx, mwv_fmadd(dy, dy, mwv_mul(dz, dz)));
+
+            st = mwv_fmadd(mwv_load(&qws[i]), mwv_exp(mwv_mul(norm, SIGMA)), st);
+        }
+
+        streamTmps[j] = mwv_hsum(st) * reff_xr_rp3;
+    }
+
+    return mwv_hsum(bg) * reff_xr_rp3;
+}
+
+static real probabilities_avx2_fast_hprob(const AstronomyParameters* ap,
+                                          const StreamConstants* sc,
+                                          const real* RESTRICT sg_dx,
+                                          const real* RESTRICT r_point,
+                                          const real* RESTRICT qw_r3_N,
+                                          LBTrig lbt,
+                                          real gPrime,
+                                          real reff_xr_rp3,
+                                          real* RESTRICT streamTmps)
+{
+    return probabilities_avx2_kernel(ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps,
+                                     FAST_HERNQUIST, FALSE);
+}
+
+static real probabilities_avx2_fast_hprob_aux(const AstronomyParameters* ap,
+                                              const StreamConstants* sc,
+                                              const real* RESTRICT sg_dx,
+                                              const real* RESTRICT r_point,
+                                              const real* RESTRICT qw_r3_N,
+                                              LBTrig lbt,
+                                              real gPrime,
+                                              real reff_xr_rp3,
+                                              real* RESTRICT streamTmps)
+{
+    return probabilities_avx2_kernel(ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps,
+                                     FAST_HERNQUIST, TRUE);
+}
+
+static real probabilities_avx2_slow_hprob(const AstronomyParameters* ap,
+                                          const StreamConstants* sc,
+                                          const real* RESTRICT sg_dx,
+                                          const real* RESTRICT r_point,
+                                          const real* RESTRICT qw_r3_N,
+                                          LBTrig lbt,
+                                          real gPrime,
+                                          real reff_xr_rp3,
+                                          real* RESTRICT streamTmps)
+{
+    return probabilities_avx2_kernel(ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps,
+                                     SLOW_HERNQUIST, FALSE);
+}
+
+static real probabilities_avx2_slow_hprob_aux(const AstronomyParameters* ap,
+                                              const StreamConstants* sc,
+                                              const real* RESTRICT sg_dx,
+                                              const real* RESTRICT r_point,
+                                              const real* RESTRICT qw_r3_N,
+                                              LBTrig lbt,
+                                              real gPrime,
+                                              real reff_xr_rp3,
+                                              real* RESTRICT streamTmps)
+{
+    return probabilities_avx2_kernel(ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps,
+                                     SLOW_HERNQUIST, TRUE);
+}
+
+/* The auxiliary term isn't used with the broken power law */
+static real probabilities_avx2_broken_power_law(const AstronomyParameters* ap,
+                                                const StreamConstants* sc,
+                                                const real* RESTRICT sg_dx,
+                                                const real* RESTRICT r_point,
+                                                const real* RESTRICT qw_r3_N,
+                                                LBTrig lbt,
+                                                real gPrime,
+                                                real reff_xr_rp3,
+                                                real* RESTRICT streamTmps)
+{
+    return probabilities_avx2_kernel(ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps,
+                                     BROKEN_POWER_LAW, FALSE);
+}
+
+ProbabilityFunc INIT_PROBABILITIES(const AstronomyParameters* ap)
+{
+    switch (ap->background_profile)
+    {
+        case FAST_HERNQUIST:
+            return ap->aux_bg_profile ? probabilities_avx2_fast_hprob_aux : probabilities_avx2_fast_hprob;
+        case SLOW_HERNQUIST:
+            return ap->aux_bg_profile ? probabilities_avx2_slow_hprob_aux : probabilities_avx2_slow_hprob;
+        case BROKEN_POWER_LAW:
+            return probabilities_avx2_broken_power_law;
+        default:
+            return NULL;
+    }
+}
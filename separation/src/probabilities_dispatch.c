@@ -31,6 +31,14 @@ ProbabilityFunc probabilityFunc = NULL;
 
 
 /* MSVC can't do weak imports. Using dlsym()/GetProcAddress() etc. would be better */
+#if !HAVE_AVX512F || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
+  #define initProbabilities_AVX512F NULL
+#endif
+
+#if !HAVE_AVX2 || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
+  #define initProbabilities_AVX2 NULL
+#endif
+
 #if !HAVE_AVX || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
   #define initProbabilities_AVX NULL
 #endif
@@ -48,13 +56,15 @@ ProbabilityFunc probabilityFunc = NULL;
 #endif
 
 /* Can't use the functions themselves if defined to NULL */
+static ProbInitFunc initAVX512F = initProbabilities_AVX512F;
+static ProbInitFunc initAVX2 = initProbabilities_AVX2;
 static ProbInitFunc initAVX = initProbabilities_AVX;
 static ProbInitFunc initSSE41 = initProbabilities_SSE41;
 static ProbInitFunc initSSE3 = initProbabilities_SSE3;
 static ProbInitFunc initSSE2 = initProbabilities_SSE2;
 
 
-static int usingIntrinsicsIsAcceptable(const AstronomyParameters* ap, int forceNoIntrinsics)
+static int usingIntrinsicsIsAcceptable(int forceNoIntrinsics)
 {
     if (!DOUBLEPREC)
     {
@@ -67,15 +77,16 @@ static int usingIntrinsicsIsAcceptable(const AstronomyParameters* ap, int forceN
         return FALSE;
     }
 
-    if (ap->background_profile == SLOW_HERNQUIST || ap->aux_bg_profile)
-    {
-        mw_printf("Intrinsics are not acceptable for workunit\n");
-        return FALSE;
-    }
-
     return TRUE;
 }
 
+/* The SSE* ones only do the fast Hernquist and broken power law
+   backgrounds. The AVX2 and AVX-512F ones do all of them. */
+static int oldIntrinsicsAreAcceptable(const AstronomyParameters* ap)
+{
+    return ap->background_profile != SLOW_HERNQUIST && !ap->aux_bg_profile;
+}
+
 static ProbabilityFunc selectStandardFunction(const AstronomyParameters* ap)
 {
 	switch(ap->background_profile)
@@ -101,16 +112,22 @@ static ProbabilityFunc selectStandardFunction(const AstronomyParameters* ap)
 /* Use one of the faster functions if available, or use something forced */
 int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest* clr)
 {
-    int hasSSE2, hasSSE3, hasSSE41, hasAVX;
-    int forcingInstructions = clr->forceAVX || clr->forceSSE41 || clr->forceSSE3 || clr->forceSSE2 || clr->forceX87;
+    int hasSSE2, hasSSE3, hasSSE41, hasAVX, hasAVX2 = FALSE, hasAVX512F = FALSE;
+    int oldOK;
+    int forcingInstructions = clr->forceAVX512F || clr->forceAVX2 || clr->forceAVX
+                           || clr->forceSSE41 || clr->forceSSE3 || clr->forceSSE2 || clr->forceX87;
     int abcd[4];
+    int maxLeaf;
 
-    if (!usingIntrinsicsIsAcceptable(ap, clr->forceNoIntrinsics))
+    if (!usingIntrinsicsIsAcceptable(clr->forceNoIntrinsics))
     {
         probabilityFunc = selectStandardFunction(ap);
         return 0;
     }
 
+    mw_cpuid(abcd, 0, 0);
+    maxLeaf = abcd[0];
+
     mw_cpuid(abcd, 1, 0);
 
     hasAVX = mwHasAVX(abcd) && mwOSHasAVXSupport();
@@ -118,20 +135,49 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
     hasSSE3 = mwHasSSE3(abcd);
     hasSSE2 = mwHasSSE2(abcd);
 
+    if (maxLeaf >= 7)
+    {
+        int fma = mwHasFMA(abcd);
+
+        mw_cpuid(abcd, 7, 0);
+        hasAVX2 = hasAVX && fma && mwHasAVX2(abcd);
+        hasAVX512F = hasAVX && mwHasAVX512F(abcd) && mwOSHasAVX512Support();
+    }
+
+    /* Without the wider ones, these workunits need the plain functions */
+    oldOK = oldIntrinsicsAreAcceptable(ap);
+
     if (clr->verbose)
     {
-        mw_printf("CPU features:        SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n"
-                  "Available functions: SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n"
-                  "Forcing:             SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n",
-                  hasSSE2, hasSSE3, hasSSE41, hasAVX,
+        mw_printf("CPU features:        SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512F = %d\n"
+                  "Available functions: SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512F = %d\n"
+                  "Forcing:             SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512F = %d\n",
+                  hasSSE2, hasSSE3, hasSSE41, hasAVX, hasAVX2, hasAVX512F,
                   initSSE2 != NULL, initSSE3 != NULL, initSSE41 != NULL, initAVX != NULL,
-                  clr->forceSSE2, clr->forceSSE3, clr->forceSSE41, clr->forceAVX);
+                  initAVX2 != NULL, initAVX512F != NULL,
+                  clr->forceSSE2, clr->forceSSE3, clr->forceSSE41, clr->forceAVX,
+                  clr->forceAVX2, clr->forceAVX512F);
     }
 
     /* If multiple instructions are forced, the highest will take precedence */
     if (forcingInstructions)
     {
-        if (clr->forceAVX && hasAVX && initAVX)
+        if (clr->forceAVX512F && hasAVX512F && initAVX512F)
+        {
+            mw_printf("Using AVX-512F path\n");
+            probabilityFunc = initAVX512F(ap);
+        }
+        else if (clr->forceAVX2 && hasAVX2 && initAVX2)
+        {
+            mw_printf("Using AVX2 path\n");
+            probabilityFunc = initAVX2(ap);
+        }
+        else if (!oldOK && (clr->forceAVX || clr->forceSSE41 || clr->forceSSE3 || clr->forceSSE2))
+        {
+            mw_printf("Intrinsics are not acceptable for workunit\n");
+            probabilityFunc = selectStandardFunction(ap);
+        }
+        else if (clr->forceAVX && hasAVX && initAVX)
         {
             mw_printf("Using AVX path\n");
             probabilityFunc = initAVX(ap);
@@ -165,7 +211,22 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
     else
     {
         /* Choose the highest level with available function and instructions */
-        if (hasAVX && initAVX)
+        if (hasAVX512F && initAVX512F)
+        {
+            mw_printf("Using AVX-512F path\n");
+            probabilityFunc = initAVX512F(ap);
+        }
+        else if (hasAVX2 && initAVX2)
+        {
+            mw_printf("Using AVX2 path\n");
+            probabilityFunc = initAVX2(ap);
+        }
+        else if (!oldOK)
+        {
+            mw_printf("Intrinsics are not acceptable for workunit\n");
+            probabilityFunc = selectStandardFunction(ap);
+        }
+        else if (hasAVX && initAVX)
         {
             mw_printf("Using AVX path\n");
             probabilityFunc = initAVX(ap);
@@ -195,10 +256,14 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
     if (!probabilityFunc)
     {
         mw_panic("Probability function not set!:\n"
+                 "  Has AVX-512F         = %d\n"
+                 "  Has AVX2             = %d\n"
                  "  Has AVX              = %d\n"
                  "  Has SSE4.1           = %d\n"
                  "  Has SSE3             = %d\n"
                  "  Has SSE2             = %d\n"
+                 "  Forced AVX-512F      = %d\n"
+                 "  Forced AVX2          = %d\n"
                  "  Forced AVX           = %d\n"
                  "  Forced SSE4.1        = %d\n"
                  "  Forced SSE3          = %d\n"
@@ -206,7 +271,8 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
                  "  Forced x87           = %d\n"
                  "  Forced no intrinsics = %d\n"
                  "  Arch                 = %s\n",
-                 hasSSE41, hasSSE3, hasSSE2, hasAVX,
+                 hasAVX512F, hasAVX2, hasAVX, hasSSE41, hasSSE3, hasSSE2,
+                 clr->forceAVX512F, clr->forceAVX2,
                  clr->forceAVX, clr->forceSSE41, clr->forceSSE3, clr->forceSSE2,
                  clr->forceX87, clr->forceNoIntrinsics,
                  ARCH_STRING);
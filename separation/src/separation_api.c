@@ -0,0 +1,336 @@
+/*
+ *  Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "separation.h"
+#include "separation_lua.h"
+#include "separation_api.h"
+#include "probabilities_dispatch.h"
+
+/* Parameters are compared exactly to tell whether an integral changed */
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+#define NUMBER_BG_PARAMETERS 2
+#define NUMBER_STREAM_PARAMETERS 6
+
+struct SeparationEvaluator
+{
+    AstronomyParameters ap;
+    BackgroundParameters bgp;
+    Streams streams;
+    IntegralArea* ias;
+    StreamGauss sg;
+    StarPoints sp;
+    CLRequest clr;
+
+    /* probabilityFunc is global, so keep the one chosen for this
+       evaluator in case there is more than one */
+    ProbabilityFunc probabilityFunc;
+
+    unsigned int nParameters;
+    real* fileParameters;
+    SeparationResults* results;
+
+    /* Integrals of each cut from the last evaluation. A stream's
+       integral only depends on its own constants and not on its
+       epsilon, so a new set of parameters only needs the parts which
+       changed recalculated. */
+    int haveIntegrals;
+    BackgroundParameters cachedBGP;
+    StreamConstants* cachedSC;
+    real* cutBGIntegrals;      /* number_integrals */
+    real* cutStreamIntegrals;  /* number_integrals * number_streams */
+};
+
+static void getFileParameters(const SeparationEvaluator* se, real* parameters)
+{
+    int i;
+    real* p;
+
+    parameters[0] = se->bgp.epsilon;
+    parameters[1] = se->bgp.q;
+
+    for (i = 0; i < se->streams.number_streams; ++i)
+    {
+        p = &parameters[NUMBER_BG_PARAMETERS + i * NUMBER_STREAM_PARAMETERS];
+
+        p[0] = se->streams.parameters[i].epsilon;
+        p[1] = se->streams.parameters[i].mu;
+        p[2] = se->streams.parameters[i].r;
+        p[3] = se->streams.parameters[i].theta;
+        p[4] = se->streams.parameters[i].phi;
+        p[5] = se->streams.parameters[i].sigma;
+    }
+}
+
+SeparationEvaluator* separationEvaluatorCreate(const char* parametersFile,
+                                               const char* starPointsFile,
+                                               int modfit,
+                                               int brokenPowerLaw)
+{
+    SeparationEvaluator* se;
+    SeparationFlags sf;
+
+    se = (SeparationEvaluator*) mwCalloc(1, sizeof(SeparationEvaluator));
+
+    se->ap.modfit = modfit;
+    se->ap.background_profile = brokenPowerLaw ? BROKEN_POWER_LAW : FAST_HERNQUIST;
+    se->ap.totalWUs = 1;
+    se->clr.forceNoOpenCL = TRUE;
+
+    memset(&sf, 0, sizeof(sf));
+    sf.ap_file = (char*) parametersFile;
+
+    /* Try the new file first. If that doesn't work, try the old one. */
+    se->ias = setupSeparation(&se->ap, &se->bgp, &se->streams, &sf);
+    if (!se->ias)
+    {
+        se->ias = readParameters(parametersFile, &se->ap, &se->bgp, &se->streams);
+    }
+
+    if (!se->ias)
+    {
+        mw_printf("Failed to read parameters file '%s'\n", parametersFile);
+        free(se);
+        return NULL;
+    }
+
+    se->nParameters = NUMBER_BG_PARAMETERS + se->ap.number_streams * NUMBER_STREAM_PARAMETERS;
+    se->fileParameters = (real*) mwMalloc(se->nParameters * sizeof(real));
+    getFileParameters(se, se->fileParameters);
+
+    if (   setAstronomyParameters(&se->ap, &se->bgp)
+        || probabilityFunctionDispatch(&se->ap, &se->clr)
+        || readStarPoints(&se->sp, starPointsFile))
+    {
+        separationEvaluatorDestroy(se);
+        return NULL;
+    }
+
+    se->probabilityFunc = probabilityFunc;
+    se->sg = getStreamGauss(se->ap.convolve);
+    se->results = newSeparationResults(se->ap.number_streams);
+
+    se->cachedSC = (StreamConstants*) mwCallocA(se->ap.number_streams, sizeof(StreamConstants));
+    se->cutBGIntegrals = (real*) mwCalloc(se->ap.number_integrals, sizeof(real));
+    se->cutStreamIntegrals = (real*) mwCalloc(se->ap.number_integrals * se->ap.number_streams, sizeof(real));
+
+    return se;
+}
+
+void separationEvaluatorDestroy(SeparationEvaluator* se)
+{
+    if (!se)
+        return;
+
+    if (se->results)
+        freeSeparationResults(se->results);
+
+    mwFreeA(se->cachedSC);
+    free(se->cutBGIntegrals);
+    free(se->cutStreamIntegrals);
+
+    freeStreamGauss(se->sg);
+    freeStarPoints(&se->sp);
+    freeStreams(&se->streams);
+    mwFreeA(se->ias);
+    free(se->fileParameters);
+    free(se);
+}
+
+unsigned int separationEvaluatorNumberParameters(const SeparationEvaluator* se)
+{
+    return se->nParameters;
+}
+
+int separationEvaluatorGetParameters(const SeparationEvaluator* se, real* parameters, unsigned int nParameters)
+{
+    if (nParameters != se->nParameters)
+    {
+        mw_printf("Expected %u parameters, got %u\n", se->nParameters, nParameters);
+        return 1;
+    }
+
+    memcpy(parameters, se->fileParameters, nParameters * sizeof(real));
+    return 0;
+}
+
+/* The background epsilon also goes into the background integral, as
+   the weight between the halo and the thick disk */
+static int backgroundIntegralChanged(const BackgroundParameters* a, const BackgroundParameters* b)
+{
+    return a->innerPower != b->innerPower
+        || a->r0 != b->r0
+        || a->q != b->q
+        || a->outerPower != b->outerPower
+        || a->epsilon != b->epsilon
+        || a->a != b->a
+        || a->b != b->b
+        || a->c != b->c;
+}
+
+static int streamIntegralChanged(const StreamConstants* a, const StreamConstants* b)
+{
+    return X(a->a) != X(b->a) || Y(a->a) != Y(b->a) || Z(a->a) != Z(b->a)
+        || X(a->c) != X(b->c) || Y(a->c) != Y(b->c) || Z(a->c) != Z(b->c)
+        || a->sigma_sq2_inv != b->sigma_sq2_inv
+        || a->large_sigma != b->large_sigma;
+}
+
+/* Recalculate the integrals of the streams whose constants changed
+   since the last evaluation. The background is always calculated along
+   with them, but if nothing at all changed the integration is skipped. */
+static int updateIntegrals(SeparationEvaluator* se, const StreamConstants* sc)
+{
+    int i, j, rc;
+    int nStreams = se->ap.number_streams;
+    int nCuts = se->ap.number_integrals;
+    int nChanged = 0;
+    int bgChanged;
+    int* changed;
+    StreamConstants* changedSC;
+    real* bgIntegrals;
+    real* streamIntegrals;
+    AstronomyParameters ap;
+
+    bgChanged = !se->haveIntegrals || backgroundIntegralChanged(&se->bgp, &se->cachedBGP);
+
+    changed = (int*) mwMalloc((nStreams + 1) * sizeof(int));
+    for (i = 0; i < nStreams; ++i)
+    {
+        if (!se->haveIntegrals || streamIntegralChanged(&sc[i], &se->cachedSC[i]))
+            changed[nChanged++] = i;
+    }
+
+    if (!bgChanged && nChanged == 0)
+    {
+        free(changed);
+        return 0;
+    }
+
+    changedSC = (StreamConstants*) mwMallocA((nChanged + 1) * sizeof(StreamConstants));
+    for (i = 0; i < nChanged; ++i)
+        changedSC[i] = sc[changed[i]];
+
+    bgIntegrals = (real*) mwMalloc(nCuts * sizeof(real));
+    streamIntegrals = (real*) mwMalloc((nCuts * nChanged + 1) * sizeof(real));
+
+    ap = se->ap;
+    ap.number_streams = nChanged;
+
+    rc = evaluateCutIntegrals(&ap, se->ias, changedSC, se->sg, &se->clr, bgIntegrals, streamIntegrals);
+    if (rc == 0)
+    {
+        for (i = 0; i < nCuts; ++i)
+        {
+            se->cutBGIntegrals[i] = bgIntegrals[i];
+            for (j = 0; j < nChanged; ++j)
+            {
+                se->cutStreamIntegrals[i * nStreams + changed[j]] = streamIntegrals[i * nChanged + j];
+                se->cachedSC[changed[j]] = changedSC[j];
+            }
+        }
+
+        se->cachedBGP = se->bgp;
+        se->haveIntegrals = TRUE;
+    }
+    else
+    {
+        se->haveIntegrals = FALSE;
+    }
+
+    free(changed);
+    mwFreeA(changedSC);
+    free(bgIntegrals);
+    free(streamIntegrals);
+
+    return rc;
+}
+
+/* Same as getFinalIntegrals(), from the cached cuts */
+static void getCachedFinalIntegrals(SeparationEvaluator* se)
+{
+    int i, j;
+    int nStreams = se->ap.number_streams;
+    SeparationResults* results = se->results;
+
+    results->backgroundIntegral = se->cutBGIntegrals[0];
+    for (j = 0; j < nStreams; ++j)
+        results->streamIntegrals[j] = se->cutStreamIntegrals[j];
+
+    for (i = 1; i < se->ap.number_integrals; ++i)
+    {
+        results->backgroundIntegral -= se->cutBGIntegrals[i];
+        for (j = 0; j < nStreams; ++j)
+            results->streamIntegrals[j] -= se->cutStreamIntegrals[i * nStreams + j];
+    }
+}
+
+int separationEvaluate(SeparationEvaluator* se,
+                       const real* parameters,
+                       unsigned int nParameters,
+                       real* likelihoodOut)
+{
+    int rc;
+    StreamConstants* sc;
+
+    if (   setParameters(&se->ap, &se->bgp, &se->streams, parameters, nParameters)
+        || setAstronomyParameters(&se->ap, &se->bgp))
+    {
+        se->haveIntegrals = FALSE;
+        return 1;
+    }
+
+    setExpStreamWeights(&se->ap, &se->streams);
+    sc = getStreamConstants(&se->ap, &se->streams);
+    if (!sc)
+    {
+        mw_printf("Failed to get stream constants\n");
+        se->haveIntegrals = FALSE;
+        return 1;
+    }
+
+    probabilityFunc = se->probabilityFunc;
+
+    rc = updateIntegrals(se, sc);
+    if (rc == 0)
+    {
+        getCachedFinalIntegrals(se);
+
+        rc = likelihood(se->results, &se->ap, &se->sp, sc, &se->streams, se->sg, FALSE, NULL);
+        if (checkSeparationResults(se->results, se->ap.number_streams))
+        {
+            se->results->likelihood = -999.0;
+        }
+    }
+
+    mwFreeA(sc);
+
+    if (rc == 0 && likelihoodOut)
+        *likelihoodOut = se->results->likelihood;
+
+    return rc;
+}
+
+const SeparationResults* separationEvaluatorResults(const SeparationEvaluator* se)
+{
+    return se->results;
+}
+
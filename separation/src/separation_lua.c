@@ -505,6 +505,9 @@ IntegralArea* setupSeparation(AstronomyParameters* ap,
         return NULL;
     }
 
+    /* Forwarded arguments are in the same order as setParameters() takes */
+    ap->params_per_workunit = 2 + 6 * streams->number_streams;
+
     setAPConstants(ap);
     return _ias;
 }
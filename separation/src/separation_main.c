@@ -37,6 +37,10 @@
 #include "io_util.h"
 #include <popt.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 
 #define DEFAULT_ASTRONOMY_PARAMETERS "astronomy_parameters.txt"
 #define DEFAULT_STAR_POINTS "stars.txt"
@@ -173,6 +177,8 @@ static void setCLReqFlags(CLRequest* clr, const SeparationFlags* sf)
     clr->forceSSE3 = sf->forceSSE3;
     clr->forceSSE41 = sf->forceSSE41;
     clr->forceAVX = sf->forceAVX;
+    clr->forceAVX2 = sf->forceAVX2;
+    clr->forceAVX512F = sf->forceAVX512F;
     clr->verbose = sf->verbose;
     clr->nonResponsive = sf->nonResponsive;
     clr->enableCheckpointing = !sf->disableGPUCheckpointing;
@@ -189,6 +195,8 @@ static void setCLReqFlags(CLRequest* clr, const SeparationFlags* sf)
     clr->forceNoOpenCL = sf->forceNoOpenCL;
 
     clr->enableProfiling = FALSE;
+
+    clr->adaptiveTolerance = sf->adaptiveTolerance;
 }
 
 typedef struct
@@ -503,6 +511,30 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Force to use AVX path", NULL
             },
 
+            {
+                "force-avx2", '\0',
+                POPT_ARG_NONE, &sf.forceAVX2,
+                0, "Force to use AVX2 path", NULL
+            },
+
+            {
+                "force-avx512f", '\0',
+                POPT_ARG_NONE, &sf.forceAVX512F,
+                0, "Force to use AVX-512F path", NULL
+            },
+
+            {
+                "adaptive-tolerance", '\0',
+                POPT_ARG_DOUBLE, &sf.adaptiveTolerance,
+                0, "Integrate on a coarse grid refined only where needed, to this relative error of each integral (CPU only)", NULL
+            },
+
+            {
+                "nthreads", 'n',
+                POPT_ARG_INT, &sf.numThreads,
+                0, "BOINC argument for number of threads. No effect if built without OpenMP", NULL
+            },
+
             {
                 "p", 'p',
                 POPT_ARG_NONE, &serverParams,
@@ -611,7 +643,9 @@ static IntegralArea* prepareParameters(const SeparationFlags* sf,
 
     return ias;
 }
-//Needs to loop to account for number of WUs being crunched
+/* Needs to loop to account for number of WUs being crunched. The
+   stars and the convolution points are the same for every WU, so they
+   are only set up once. */
 static int worker(const SeparationFlags* sf)
 {
     AstronomyParameters ap;
@@ -620,7 +654,10 @@ static int worker(const SeparationFlags* sf)
     IntegralArea* ias = NULL;
     StreamConstants* sc = NULL;
     SeparationResults* results = NULL;
+    StarPoints sp = EMPTY_STAR_POINTS;
+    StreamGauss sg;
     int rc;
+    int ignoreCheckpoint;
     CLRequest clr;
 
     memset(&ap, 0, sizeof(ap));
@@ -654,23 +691,32 @@ static int worker(const SeparationFlags* sf)
     }
     mw_printf("<number_WUs> %d </number_WUs>\n", ap.totalWUs);
     mw_printf("<number_params_per_WU> %d </number_params_per_WU>\n", ap.params_per_workunit);
-    int ignoreCheckpoint = sf->ignoreCheckpoint;
+
+    if (readStarPoints(&sp, sf->star_points_file))
+    {
+        mwFreeA(ias);
+        freeStreams(&streams);
+        return 1;
+    }
+
+    sg = getStreamGauss(ap.convolve);
+    results = newSeparationResults(ap.number_streams);
+
+    rc = 0;
+    ignoreCheckpoint = sf->ignoreCheckpoint;
     for(ap.currentWU = 0; ap.currentWU < ap.totalWUs; ap.currentWU++)
     {
 
         if (sf->numArgs && setParameters(&ap, &bgp, &streams, &(sf->numArgs[ap.params_per_workunit * ap.currentWU]), ap.params_per_workunit))
         {
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
+            rc = 1;
+            break;
         }
 
         rc = setAstronomyParameters(&ap, &bgp);
         if (rc)
         {
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
+            break;
         }
 
         setExpStreamWeights(&ap, &streams);
@@ -678,23 +724,24 @@ static int worker(const SeparationFlags* sf)
         if (!sc)
         {
             mw_printf("Failed to get stream constants\n");
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
+            rc = 1;
+            break;
         }
 
-        results = newSeparationResults(ap.number_streams);
-        int currentWU = ap.currentWU;
-        rc = evaluate(results, &ap, ias, &streams, sc, sf->LikelihoodToText, sf->star_points_file,
-                  &clr, sf->do_separation, &ignoreCheckpoint, sf->separation_outfile);
+        rc = evaluate(results, &ap, ias, &streams, sc, sg, &sp, sf->LikelihoodToText,
+                      &clr, sf->do_separation, &ignoreCheckpoint, sf->separation_outfile);
         if (rc)
             mw_printf("Failed to calculate likelihood\n");
+
+        mwFreeA(sc);
+        sc = NULL;
     }
-    
+
     mwFreeA(ias);
-    mwFreeA(sc);
     freeStreams(&streams);
-    if(results) freeSeparationResults(results);
+    freeStarPoints(&sp);
+    freeStreamGauss(sg);
+    freeSeparationResults(results);
 
     return rc;
 }
@@ -739,6 +786,38 @@ static int separationInit(int debugBOINC)
   #define main _iphone_main
 #endif
 
+static int separationSetNumThreads(int numThreads)
+{
+  #ifdef _OPENMP
+    int nProc = omp_get_num_procs();
+    int nBoinc = mwGetBoincNumCPU();
+
+    if (nProc <= 0)
+    {
+        mw_printf("Number of processors %d is crazy\n", nProc);
+        return 1;
+    }
+
+    /* If command line argument not given, and BOINC gives us a value use that */
+    if (numThreads <= 0 && nBoinc > 0)
+    {
+        numThreads = nBoinc;
+    }
+
+    if (numThreads != 0)
+    {
+        omp_set_num_threads(numThreads);
+        mw_printf("Using OpenMP %d max threads on a system with %d processors\n",
+                  omp_get_max_threads(),
+                  nProc);
+    }
+  #else
+    (void) numThreads;
+  #endif
+
+    return 0;
+}
+
 int main(int argc, const char* argv[])
 {
     int rc;
@@ -781,6 +860,12 @@ int main(int argc, const char* argv[])
         mwSetProcessPriority(sf.processPriority);
     }
 
+    if (separationSetNumThreads(sf.numThreads))
+    {
+        freeSeparationFlags(&sf);
+        mw_finish(EXIT_FAILURE);
+    }
+
     rc = worker(&sf);
 
     freeSeparationFlags(&sf);
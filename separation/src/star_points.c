@@ -24,6 +24,84 @@
 #include "star_points.h"
 #include "milkyway_util.h"
 
+#if HAVE_FCNTL_H
+  #include <fcntl.h>
+#endif
+
+#if HAVE_WINDOWS_H
+  #include <windows.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+  #include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_TYPES_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+  #include <sys/stat.h>
+#endif
+
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+/* Binary star points file
+   Name        Type         Values     Notes
+-------------------------------------------------------
+   StarPointsHeader
+   stars       mwvector[]   anything   number_stars vectors in the
+                                       precision and byte order of the
+                                       writer. Starts 64 bytes into
+                                       the file so it can be used
+                                       directly from a mapping.
+ */
+
+static const char starPointsMagic[8] = "mwstars";
+
+#define STAR_POINTS_BINARY_VERSION 1
+
+typedef struct
+{
+    char magic[8];          /* "mwstars" */
+    uint32_t version;
+    uint32_t realSize;      /* Are the stars float or double */
+    uint32_t vectorSize;    /* sizeof(mwvector) of the writer */
+    uint32_t number_stars;
+    char pad[40];
+} StarPointsHeader;
+
+static int starPointsHeaderIsBinary(const StarPointsHeader* hdr)
+{
+    return memcmp(hdr->magic, starPointsMagic, sizeof(starPointsMagic)) == 0;
+}
+
+static int verifyStarPointsHeader(const StarPointsHeader* hdr, size_t fileSize, const char* filename)
+{
+    if (hdr->version != STAR_POINTS_BINARY_VERSION)
+    {
+        mw_printf("Star points file '%s' has unknown version %u\n", filename, hdr->version);
+        return 1;
+    }
+
+    if (hdr->realSize != sizeof(real) || hdr->vectorSize != sizeof(mwvector))
+    {
+        mw_printf("Star points file '%s' was written with real size %u, expected %u\n",
+                  filename, hdr->realSize, (unsigned int) sizeof(real));
+        return 1;
+    }
+
+    if (fileSize != sizeof(StarPointsHeader) + (size_t) hdr->number_stars * sizeof(mwvector))
+    {
+        mw_printf("Star points file '%s' is the wrong size for %u stars\n", filename, hdr->number_stars);
+        return 1;
+    }
+
+    return 0;
+}
+
 static int freadStarPoints(FILE* data_file, StarPoints* sp)
 {
     double x, y, z;
@@ -50,26 +128,276 @@ static int freadStarPoints(FILE* data_file, StarPoints* sp)
     return 0;
 }
 
+#if HAVE_SYS_MMAN_H
+
+static int mapStarPoints(StarPoints* sp, const char* filename)
+{
+    int fd;
+    struct stat sb;
+    char path[4096];
+    const StarPointsHeader* hdr;
+
+    if (mw_resolve_filename(filename, path, sizeof(path)))
+    {
+        mw_printf("Error resolving star points file '%s'\n", filename);
+        return 1;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        mwPerror("Error opening star points file '%s'", filename);
+        return 1;
+    }
+
+    if (fstat(fd, &sb) == -1)
+    {
+        mwPerror("Error on fstat() of star points file '%s'", filename);
+        close(fd);
+        return 1;
+    }
+
+    if ((size_t) sb.st_size < sizeof(StarPointsHeader))
+    {
+        mw_printf("Star points file '%s' is too small\n", filename);
+        close(fd);
+        return 1;
+    }
+
+    sp->mapSize = (size_t) sb.st_size;
+    sp->map = mmap(NULL, sp->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping holds its own reference */
+    if (sp->map == MAP_FAILED)
+    {
+        mwPerror("Error mmap()ing star points file '%s'", filename);
+        sp->map = NULL;
+        return 1;
+    }
+
+    hdr = (const StarPointsHeader*) sp->map;
+    if (verifyStarPointsHeader(hdr, sp->mapSize, filename))
+    {
+        munmap(sp->map, sp->mapSize);
+        sp->map = NULL;
+        return 1;
+    }
+
+    sp->number_stars = hdr->number_stars;
+    sp->stars = (mwvector*) ((char*) sp->map + sizeof(StarPointsHeader));
+
+    return 0;
+}
+
+static void unmapStarPoints(StarPoints* sp)
+{
+    if (munmap(sp->map, sp->mapSize) == -1)
+        mwPerror("munmap() star points");
+}
+
+#elif defined(_WIN32)
+
+static int mapStarPoints(StarPoints* sp, const char* filename)
+{
+    HANDLE file, mapFile;
+    DWORD fileSize;
+    char path[4096];
+    const StarPointsHeader* hdr;
+
+    if (mw_resolve_filename(filename, path, sizeof(path)))
+    {
+        mw_printf("Error resolving star points file '%s'\n", filename);
+        return 1;
+    }
+
+    file = CreateFile(path,
+                      GENERIC_READ,
+                      FILE_SHARE_READ,
+                      NULL,
+                      OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN,
+                      NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        mwPerrorW32("Failed to open star points file '%s'", filename);
+        return 1;
+    }
+
+    fileSize = GetFileSize(file, NULL);
+    if (fileSize == INVALID_FILE_SIZE || fileSize < sizeof(StarPointsHeader))
+    {
+        mwPerrorW32("Invalid star points file size (%ld) for file '%s'", fileSize, filename);
+        CloseHandle(file);
+        return 1;
+    }
+
+    mapFile = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapFile == NULL)
+    {
+        mwPerrorW32("Failed to create mapping for star points file '%s'", filename);
+        CloseHandle(file);
+        return 1;
+    }
+
+    /* The view keeps the file open after the handles are closed */
+    sp->map = MapViewOfFile(mapFile, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapFile);
+    CloseHandle(file);
+    if (sp->map == NULL)
+    {
+        mwPerrorW32("Failed to open view of star points file '%s'", filename);
+        return 1;
+    }
+
+    sp->mapSize = fileSize;
+    hdr = (const StarPointsHeader*) sp->map;
+    if (verifyStarPointsHeader(hdr, sp->mapSize, filename))
+    {
+        UnmapViewOfFile(sp->map);
+        sp->map = NULL;
+        return 1;
+    }
+
+    sp->number_stars = hdr->number_stars;
+    sp->stars = (mwvector*) ((char*) sp->map + sizeof(StarPointsHeader));
+
+    return 0;
+}
+
+static void unmapStarPoints(StarPoints* sp)
+{
+    if (!UnmapViewOfFile(sp->map))
+        mwPerrorW32("Error unmapping star points");
+}
+
+#else
+
+/* No mapping available, so just read the stars in */
+static int mapStarPoints(StarPoints* sp, const char* filename)
+{
+    FILE* f;
+    StarPointsHeader hdr;
+    size_t fileSize;
+
+    f = mwOpenResolved(filename, "rb");
+    if (!f)
+    {
+        mwPerror("Opening star points file '%s'", filename);
+        return 1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || fseek(f, 0, SEEK_END))
+    {
+        mwPerror("Reading star points file '%s'", filename);
+        fclose(f);
+        return 1;
+    }
+
+    fileSize = (size_t) ftell(f);
+    if (verifyStarPointsHeader(&hdr, fileSize, filename) || fseek(f, sizeof(hdr), SEEK_SET))
+    {
+        fclose(f);
+        return 1;
+    }
+
+    sp->number_stars = hdr.number_stars;
+    sp->stars = (mwvector*) mwMallocA(sizeof(mwvector) * sp->number_stars);
+    if (fread(sp->stars, sizeof(mwvector), sp->number_stars, f) != sp->number_stars)
+    {
+        mwPerror("Reading star points from '%s'", filename);
+        mwFreeA(sp->stars);
+        sp->stars = NULL;
+        fclose(f);
+        return 1;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void unmapStarPoints(StarPoints* sp)
+{
+    (void) sp;
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Reads either a text star file or a binary one written by
+   writeStarPointsBinary(), which is mapped rather than parsed */
 int readStarPoints(StarPoints* sp, const char* filename)
 {
     int rc;
     FILE* f;
+    StarPointsHeader hdr;
 
-    f = mwOpenResolved(filename, "r");
+    f = mwOpenResolved(filename, "rb");
     if (!f)
     {
         mwPerror("Opening star points file '%s'", filename);
         return 1;
     }
 
+    memset(&hdr, 0, sizeof(hdr));
+    if (fread(&hdr, 1, sizeof(hdr), f) >= sizeof(starPointsMagic) && starPointsHeaderIsBinary(&hdr))
+    {
+        fclose(f);
+        return mapStarPoints(sp, filename);
+    }
+
+    rewind(f);
     rc = freadStarPoints(f, sp);
     fclose(f);
 
     return rc;
 }
 
+int writeStarPointsBinary(const StarPoints* sp, const char* filename)
+{
+    FILE* f;
+    StarPointsHeader hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, starPointsMagic, sizeof(starPointsMagic));
+    hdr.version = STAR_POINTS_BINARY_VERSION;
+    hdr.realSize = sizeof(real);
+    hdr.vectorSize = sizeof(mwvector);
+    hdr.number_stars = sp->number_stars;
+
+    f = mw_fopen(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Opening star points output file '%s'", filename);
+        return 1;
+    }
+
+    if (   fwrite(&hdr, sizeof(hdr), 1, f) != 1
+        || fwrite(sp->stars, sizeof(mwvector), sp->number_stars, f) != sp->number_stars)
+    {
+        mwPerror("Writing star points to '%s'", filename);
+        fclose(f);
+        return 1;
+    }
+
+    if (fclose(f))
+    {
+        mwPerror("Closing star points output file '%s'", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
 void freeStarPoints(StarPoints* sp)
 {
-    mwFreeA(sp->stars);
+    if (sp->map)
+    {
+        unmapStarPoints(sp);
+        sp->map = NULL;
+    }
+    else
+    {
+        mwFreeA(sp->stars);
+    }
+
+    sp->stars = NULL;
 }
 
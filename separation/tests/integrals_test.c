@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check the integrals are the same to the bit on one thread and on
+ * several, and that they match a plain sum over the grid. The adaptive
+ * integrals are checked the same way, and against the full grid to
+ * their tolerance. */
+
+#include "milkyway_util.h"
+#include "separation_types.h"
+#include "calculated_constants.h"
+#include "coordinates.h"
+#include "evaluation_state.h"
+#include "integrals.h"
+#include "probabilities_dispatch.h"
+#include "r_points.h"
+
+#include <string.h>
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#define N_STREAMS 3
+#define CONVOLVE 120
+#define N_MU 80
+#define N_NU 30
+#define R_STEPS 24
+
+#define N_THREADS 4
+
+#define SUM_TOLERANCE 1.0e-12
+
+static const real adaptiveTolerances[] = { 1.0e-2, 1.0e-3, 1.0e-4 };
+
+#define N_ADAPTIVE_TOLERANCES ((int) (sizeof(adaptiveTolerances) / sizeof(adaptiveTolerances[0])))
+
+/* Stripe 11, with a stream that is wide enough to take the large
+   sigma path */
+static StreamParameters testStreams[N_STREAMS] =
+{
+    { -1.6399520342497356, 205.21803284471036, 42.03344837017558, -1.527611739959411, -0.05433086018778808, 5.082524347800713, 0.0 },
+    { -1.2888377006006837, 190.39957431376956, 17.437880809296555, -3.7252490157919604, 6.283185307179586, 4.653141218739342, 0.0 },
+    { -2.1555258514050437, 192.14250325583725, 55.32343429965131, -0.940602342819544, 6.283185307179586, 19.400317106842817, 0.0 }
+};
+
+typedef struct
+{
+    AstronomyParameters ap;
+    IntegralArea ia;
+    StreamConstants* sc;
+    StreamGauss sg;
+} IntegralTestState;
+
+typedef struct
+{
+    real bg;
+    real streams[N_STREAMS];
+} IntegralSums;
+
+static void freeIntegralTestState(IntegralTestState* ts)
+{
+    mwFreeA(ts->sc);
+    freeStreamGauss(ts->sg);
+}
+
+static int setupIntegralTestState(IntegralTestState* ts)
+{
+    BackgroundParameters bgp;
+    Streams streams;
+    CLRequest clr;
+
+    memset(ts, 0, sizeof(*ts));
+    memset(&bgp, 0, sizeof(bgp));
+    memset(&clr, 0, sizeof(clr));
+
+    ts->ap.wedge = 11;
+    ts->ap.convolve = CONVOLVE;
+    ts->ap.number_streams = N_STREAMS;
+    ts->ap.number_integrals = 1;
+    ts->ap.totalWUs = 1;
+    ts->ap.background_profile = FAST_HERNQUIST;
+
+    bgp.q = 0.5028896997252196;
+    bgp.r0 = 15.434002371668935;
+    bgp.epsilon = 0.9;
+    bgp.innerPower = 1.0;
+    bgp.outerPower = 1.0;
+
+    if (setAstronomyParameters(&ts->ap, &bgp))
+        return 1;
+
+    streams.parameters = testStreams;
+    streams.number_streams = N_STREAMS;
+    setExpStreamWeights(&ts->ap, &streams);
+
+    ts->sc = getStreamConstants(&ts->ap, &streams);
+    if (!ts->sc)
+        return 1;
+
+    ts->sg = getStreamGauss(CONVOLVE);
+
+    ts->ia.r_min = 16.0;
+    ts->ia.r_max = 23.0;
+    ts->ia.r_steps = R_STEPS;
+    ts->ia.r_step_size = (ts->ia.r_max - ts->ia.r_min) / (real) ts->ia.r_steps;
+    ts->ia.mu_min = 150.0;
+    ts->ia.mu_max = 229.0;
+    ts->ia.mu_steps = N_MU;
+    ts->ia.mu_step_size = (ts->ia.mu_max - ts->ia.mu_min) / (real) ts->ia.mu_steps;
+    ts->ia.nu_min = -1.25;
+    ts->ia.nu_max = 1.25;
+    ts->ia.nu_steps = N_NU;
+    ts->ia.nu_step_size = (ts->ia.nu_max - ts->ia.nu_min) / (real) ts->ia.nu_steps;
+
+    ts->ap.total_calc_probs = (real) N_MU * N_NU * R_STEPS;
+
+    return probabilityFunctionDispatch(&ts->ap, &clr);
+}
+
+static int runIntegral(const IntegralTestState* ts, int nThreads, real tolerance, IntegralSums* sums)
+{
+    EvaluationState* es;
+    CLRequest clr;
+    int i, rc;
+
+  #ifdef _OPENMP
+    omp_set_num_threads(nThreads);
+  #else
+    (void) nThreads;
+  #endif
+
+    memset(&clr, 0, sizeof(clr));
+    clr.adaptiveTolerance = tolerance;
+
+    es = newEvaluationState(&ts->ap);
+    es->cut = &es->cuts[0];
+
+    rc = integrate(&ts->ap, &ts->ia, ts->sc, ts->sg, es, &clr, NULL);
+
+    sums->bg = es->cut->bgIntegral;
+    for (i = 0; i < N_STREAMS; ++i)
+        sums->streams[i] = es->cut->streamIntegrals[i];
+
+    freeEvaluationState(es);
+
+    return rc;
+}
+
+/* The same sum without the Kahan sums, in a wider type instead */
+static void plainIntegral(const IntegralTestState* ts, IntegralSums* sums)
+{
+    const AstronomyParameters* ap = &ts->ap;
+    unsigned int mu_step, nu_step, r_step;
+    long double bg = 0.0;
+    long double streams[N_STREAMS] = { 0.0 };
+    real streamTmps[N_STREAMS];
+    real* r_points;
+    real* qw_r3_N;
+    RPoints* r_pts;
+    RConsts* rc;
+    int i;
+
+    r_pts = precalculateRPts(ap, &ts->ia, ts->sg, &rc, FALSE);
+    r_points = (real*) mwMallocA(R_STEPS * CONVOLVE * sizeof(real));
+    qw_r3_N = (real*) mwMallocA(R_STEPS * CONVOLVE * sizeof(real));
+    for (i = 0; i < R_STEPS * CONVOLVE; ++i)
+    {
+        r_points[i] = r_pts[i].r_point;
+        qw_r3_N[i] = r_pts[i].qw_r3_N;
+    }
+
+    for (nu_step = 0; nu_step < ts->ia.nu_steps; ++nu_step)
+    {
+        NuId nuid = calcNuStep(&ts->ia, nu_step);
+
+        for (mu_step = 0; mu_step < ts->ia.mu_steps; ++mu_step)
+        {
+            real mu = ts->ia.mu_min + (((real) mu_step + 0.5) * ts->ia.mu_step_size);
+            LBTrig lbt = lb_trig(gc2lb(ap->wedge, mu, nuid.nu));
+
+            for (r_step = 0; r_step < ts->ia.r_steps; ++r_step)
+            {
+                bg += probabilityFunc(ap,
+                                      ts->sc,
+                                      ts->sg.dx,
+                                      &r_points[r_step * CONVOLVE],
+                                      &qw_r3_N[r_step * CONVOLVE],
+                                      lbt,
+                                      rc[r_step].gPrime,
+                                      nuid.id * rc[r_step].irv_reff_xr_rp3,
+                                      streamTmps);
+                for (i = 0; i < N_STREAMS; ++i)
+                    streams[i] += streamTmps[i];
+            }
+        }
+    }
+
+    sums->bg = (real) bg;
+    for (i = 0; i < N_STREAMS; ++i)
+        sums->streams[i] = (real) streams[i];
+
+    mwFreeA(r_pts);
+    mwFreeA(rc);
+    mwFreeA(r_points);
+    mwFreeA(qw_r3_N);
+}
+
+static real relativeError(real a, real b)
+{
+    real mag = mw_fabs(a);
+    real d = mw_fabs(a - b);
+
+    return mag > 0.0 ? d / mag : d;
+}
+
+static int checkSame(const char* name, const IntegralSums* serial, const IntegralSums* parallel)
+{
+    int i;
+    int failed = 0;
+
+    if (memcmp(&serial->bg, &parallel->bg, sizeof(real)))
+    {
+        mw_printf("%s background integral %.17g on 1 thread, %.17g on %d\n",
+                  name, serial->bg, parallel->bg, N_THREADS);
+        failed = 1;
+    }
+
+    for (i = 0; i < N_STREAMS; ++i)
+    {
+        if (memcmp(&serial->streams[i], &parallel->streams[i], sizeof(real)))
+        {
+            mw_printf("%s stream %d integral %.17g on 1 thread, %.17g on %d\n",
+                      name, i, serial->streams[i], parallel->streams[i], N_THREADS);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+/* With sc, streams that are thrown away aren't held to the tolerance */
+static int checkClose(const char* name,
+                      const StreamConstants* sc,
+                      const IntegralSums* expected,
+                      const IntegralSums* actual,
+                      real tolerance)
+{
+    real err;
+    int i;
+    int failed = 0;
+
+    err = relativeError(expected->bg, actual->bg);
+    if (err > tolerance)
+    {
+        mw_printf("%s background integral %.17g, expected %.17g (error %g)\n", name, actual->bg, expected->bg, err);
+        failed = 1;
+    }
+
+    for (i = 0; i < N_STREAMS; ++i)
+    {
+        if (sc && !sc[i].large_sigma)
+            continue;
+
+        err = relativeError(expected->streams[i], actual->streams[i]);
+        if (err > tolerance)
+        {
+            mw_printf("%s stream %d integral %.17g, expected %.17g (error %g)\n",
+                      name, i, actual->streams[i], expected->streams[i], err);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+static int checkAdaptive(const IntegralTestState* ts, const IntegralSums* full, real tolerance)
+{
+    IntegralSums serial, parallel;
+    char name[64];
+    int failed = 0;
+
+    if (runIntegral(ts, 1, tolerance, &serial) || runIntegral(ts, N_THREADS, tolerance, &parallel))
+    {
+        mw_printf("Failed to calculate adaptive integral\n");
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), "Adaptive %g", tolerance);
+    failed |= checkSame(name, &serial, &parallel);
+    failed |= checkClose(name, ts->sc, full, &serial, tolerance);
+
+    return failed;
+}
+
+int main(void)
+{
+    IntegralTestState ts;
+    IntegralSums serial, parallel, plain;
+    int i;
+    int failed = 0;
+
+    if (setupIntegralTestState(&ts))
+    {
+        mw_printf("Failed to set up integral test\n");
+        return 1;
+    }
+
+    if (runIntegral(&ts, 1, 0.0, &serial) || runIntegral(&ts, N_THREADS, 0.0, &parallel))
+    {
+        mw_printf("Failed to calculate integral\n");
+        return 1;
+    }
+
+    plainIntegral(&ts, &plain);
+
+    failed |= checkSame("Full grid", &serial, &parallel);
+    failed |= checkClose("Full grid", NULL, &plain, &serial, SUM_TOLERANCE);
+
+    for (i = 0; i < N_ADAPTIVE_TOLERANCES; ++i)
+        failed |= checkAdaptive(&ts, &serial, adaptiveTolerances[i]);
+
+    freeIntegralTestState(&ts);
+
+    return failed;
+}
+
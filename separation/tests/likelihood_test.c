@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Check the likelihood of a set of stars is the same to the bit on one
+ * thread and on several. */
+
+#include "milkyway_util.h"
+#include "separation_types.h"
+#include "separation_utils.h"
+#include "calculated_constants.h"
+#include "coordinates.h"
+#include "likelihood.h"
+#include "probabilities_dispatch.h"
+
+#include <string.h>
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#define N_STREAMS 3
+#define CONVOLVE 120
+
+/* More than two blocks of stars, the last not full */
+#define N_STARS 9000
+
+#define N_THREADS 4
+
+static StreamParameters testStreams[N_STREAMS] =
+{
+    { -1.6399520342497356, 205.21803284471036, 42.03344837017558, -1.527611739959411, -0.05433086018778808, 5.082524347800713, 0.0 },
+    { -1.2888377006006837, 190.39957431376956, 17.437880809296555, -3.7252490157919604, 6.283185307179586, 4.653141218739342, 0.0 },
+    { -2.1555258514050437, 192.14250325583725, 55.32343429965131, -0.940602342819544, 6.283185307179586, 19.400317106842817, 0.0 }
+};
+
+/* Roughly what the integrals of stripe 11 come to */
+static const real testBackgroundIntegral = 0.000469;
+static const real testStreamIntegrals[N_STREAMS] = { 18.6, 4.39, 93.1 };
+
+typedef struct
+{
+    AstronomyParameters ap;
+    Streams streams;
+    StreamConstants* sc;
+    StreamGauss sg;
+    StarPoints sp;
+} LikelihoodTestState;
+
+static void freeLikelihoodTestState(LikelihoodTestState* ts)
+{
+    mwFreeA(ts->sc);
+    freeStreamGauss(ts->sg);
+    mwFreeA(ts->sp.stars);
+}
+
+/* Stars scattered over the stripe, near and far */
+static void makeStars(StarPoints* sp)
+{
+    unsigned int i;
+
+    sp->number_stars = N_STARS;
+    sp->stars = (mwvector*) mwMallocA(N_STARS * sizeof(mwvector));
+
+    for (i = 0; i < N_STARS; ++i)
+    {
+        real mu = 150.0 + 79.0 * (0.5 + 0.5 * mw_sin(0.37 * i));
+        real nu = 1.25 * mw_cos(1.3 * i);
+        real r = 3.0 + 45.0 * (0.5 + 0.5 * mw_sin(0.011 * i + 0.7));
+        LB lb = gc2lb(11, mu, nu);
+
+        SET_VECTOR(sp->stars[i], LB_L(lb), LB_B(lb), r);
+    }
+}
+
+static int setupLikelihoodTestState(LikelihoodTestState* ts)
+{
+    BackgroundParameters bgp;
+    CLRequest clr;
+
+    memset(ts, 0, sizeof(*ts));
+    memset(&bgp, 0, sizeof(bgp));
+    memset(&clr, 0, sizeof(clr));
+
+    ts->ap.wedge = 11;
+    ts->ap.convolve = CONVOLVE;
+    ts->ap.number_streams = N_STREAMS;
+    ts->ap.background_profile = FAST_HERNQUIST;
+
+    bgp.q = 0.5028896997252196;
+    bgp.r0 = 15.434002371668935;
+    bgp.epsilon = 0.9;
+    bgp.innerPower = 1.0;
+    bgp.outerPower = 1.0;
+
+    if (setAstronomyParameters(&ts->ap, &bgp))
+        return 1;
+
+    ts->streams.parameters = testStreams;
+    ts->streams.number_streams = N_STREAMS;
+    setExpStreamWeights(&ts->ap, &ts->streams);
+
+    ts->sc = getStreamConstants(&ts->ap, &ts->streams);
+    if (!ts->sc)
+        return 1;
+
+    ts->sg = getStreamGauss(CONVOLVE);
+
+    if (probabilityFunctionDispatch(&ts->ap, &clr))
+        return 1;
+
+    makeStars(&ts->sp);
+
+    return 0;
+}
+
+static SeparationResults* runLikelihood(const LikelihoodTestState* ts, int nThreads)
+{
+    SeparationResults* results;
+    int i;
+
+  #ifdef _OPENMP
+    omp_set_num_threads(nThreads);
+  #else
+    (void) nThreads;
+  #endif
+
+    results = newSeparationResults(N_STREAMS);
+    results->backgroundIntegral = testBackgroundIntegral;
+    for (i = 0; i < N_STREAMS; ++i)
+        results->streamIntegrals[i] = testStreamIntegrals[i];
+
+    if (likelihood(results, &ts->ap, &ts->sp, ts->sc, &ts->streams, ts->sg, FALSE, NULL))
+    {
+        freeSeparationResults(results);
+        return NULL;
+    }
+
+    return results;
+}
+
+static int compareResults(const SeparationResults* serial, const SeparationResults* parallel)
+{
+    int i;
+    int failed = 0;
+
+    if (memcmp(&serial->likelihood, &parallel->likelihood, sizeof(real)))
+    {
+        mw_printf("Likelihood %.17g on 1 thread, %.17g on %d\n",
+                  serial->likelihood, parallel->likelihood, N_THREADS);
+        failed = 1;
+    }
+
+    if (memcmp(&serial->backgroundLikelihood, &parallel->backgroundLikelihood, sizeof(real)))
+    {
+        mw_printf("Background likelihood %.17g on 1 thread, %.17g on %d\n",
+                  serial->backgroundLikelihood, parallel->backgroundLikelihood, N_THREADS);
+        failed = 1;
+    }
+
+    for (i = 0; i < N_STREAMS; ++i)
+    {
+        if (memcmp(&serial->streamLikelihoods[i], &parallel->streamLikelihoods[i], sizeof(real)))
+        {
+            mw_printf("Stream %d likelihood %.17g on 1 thread, %.17g on %d\n",
+                      i, serial->streamLikelihoods[i], parallel->streamLikelihoods[i], N_THREADS);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    LikelihoodTestState ts;
+    SeparationResults* serial;
+    SeparationResults* parallel;
+    int failed;
+
+    if (setupLikelihoodTestState(&ts))
+    {
+        mw_printf("Failed to set up likelihood test\n");
+        return 1;
+    }
+
+    serial = runLikelihood(&ts, 1);
+    parallel = runLikelihood(&ts, N_THREADS);
+    if (!serial || !parallel)
+    {
+        mw_printf("Failed to calculate likelihood\n");
+        return 1;
+    }
+
+    if (checkSeparationResults(serial, N_STREAMS))
+    {
+        mw_printf("Likelihood isn't finite\n");
+        failed = 1;
+    }
+    else
+    {
+        failed = compareResults(serial, parallel);
+    }
+
+    freeSeparationResults(serial);
+    freeSeparationResults(parallel);
+    freeLikelihoodTestState(&ts);
+
+    return failed;
+}
+
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare each of the probability functions this CPU can run against
+ * the plain one for every background profile. With --bench, also time
+ * each of them. */
+
+#include "milkyway_util.h"
+#include "separation_types.h"
+#include "calculated_constants.h"
+#include "coordinates.h"
+#include "integrals.h"
+#include "probabilities_dispatch.h"
+#include "r_points.h"
+
+#include <string.h>
+
+#define N_STREAMS 3
+#define N_MU 9
+#define N_NU 7
+#define R_STEPS 24
+
+#define PROB_TOLERANCE 1.0e-12
+
+#define N_BENCH_ITER 20
+
+typedef enum
+{
+    PATH_NONE,
+    PATH_X87,
+    PATH_SSE2,
+    PATH_SSE3,
+    PATH_SSE41,
+    PATH_AVX,
+    PATH_AVX2,
+    PATH_AVX512F
+} ProbPath;
+
+static const char* pathNames[] = { "Plain", "Other", "SSE2", "SSE3", "SSE4.1", "AVX", "AVX2", "AVX-512F" };
+
+#define N_PATHS ((int) (sizeof(pathNames) / sizeof(pathNames[0])))
+
+typedef struct
+{
+    const char* name;
+    int brokenPowerLaw;
+    real innerPower, outerPower;
+    real a, b, c;
+} ProfileCase;
+
+static const ProfileCase profileCases[] =
+{
+    { "fast Hernquist",        FALSE, 1.0, 1.0,   0.0,   0.0,  0.0 },
+    { "fast Hernquist + aux",  FALSE, 1.0, 1.0, 100.0,  50.0, 25.0 },
+    { "slow Hernquist",        FALSE, 0.8, 2.4,   0.0,   0.0,  0.0 },
+    { "slow Hernquist + aux",  FALSE, 0.8, 2.4, 100.0,  50.0, 25.0 },
+    { "broken power law",      TRUE,  1.2, 3.5,   0.0,   0.0,  0.0 }
+};
+
+#define N_PROFILES ((int) (sizeof(profileCases) / sizeof(profileCases[0])))
+
+/* Stripe 11, with a stream that is wide enough to take the large
+   sigma path */
+static StreamParameters testStreams[N_STREAMS] =
+{
+    { -1.6399520342497356, 205.21803284471036, 42.03344837017558, -1.527611739959411, -0.05433086018778808, 5.082524347800713, 0.0 },
+    { -1.2888377006006837, 190.39957431376956, 17.437880809296555, -3.7252490157919604, 6.283185307179586, 4.653141218739342, 0.0 },
+    { -2.1555258514050437, 192.14250325583725, 55.32343429965131, -0.940602342819544, 6.283185307179586, 19.400317106842817, 0.0 }
+};
+
+typedef struct
+{
+    AstronomyParameters ap;
+    IntegralArea ia;
+    StreamConstants* sc;
+    StreamGauss sg;
+    RConsts* rc;
+    real* r_points;
+    real* qw_r3_N;
+} ProbTestState;
+
+static void freeProbTestState(ProbTestState* ts)
+{
+    mwFreeA(ts->sc);
+    mwFreeA(ts->rc);
+    mwFreeA(ts->r_points);
+    mwFreeA(ts->qw_r3_N);
+    freeStreamGauss(ts->sg);
+}
+
+static int setupProbTestState(ProbTestState* ts, const ProfileCase* pc, int convolve)
+{
+    BackgroundParameters bgp;
+    Streams streams;
+    RPoints* r_pts;
+    unsigned int i;
+
+    memset(ts, 0, sizeof(*ts));
+    memset(&bgp, 0, sizeof(bgp));
+
+    ts->ap.wedge = 11;
+    ts->ap.convolve = convolve;
+    ts->ap.number_streams = N_STREAMS;
+    ts->ap.background_profile = pc->brokenPowerLaw ? BROKEN_POWER_LAW : FAST_HERNQUIST;
+
+    bgp.q = 0.5028896997252196;
+    bgp.r0 = 15.434002371668935;
+    bgp.epsilon = 0.9;
+    bgp.innerPower = pc->innerPower;
+    bgp.outerPower = pc->outerPower;
+    bgp.a = pc->a;
+    bgp.b = pc->b;
+    bgp.c = pc->c;
+
+    if (setAstronomyParameters(&ts->ap, &bgp))
+        return 1;
+
+    streams.parameters = testStreams;
+    streams.number_streams = N_STREAMS;
+    setExpStreamWeights(&ts->ap, &streams);
+
+    ts->sc = getStreamConstants(&ts->ap, &streams);
+    if (!ts->sc)
+        return 1;
+
+    ts->sg = getStreamGauss(convolve);
+
+    ts->ia.r_min = 16.0;
+    ts->ia.r_max = 23.0;
+    ts->ia.r_steps = R_STEPS;
+    ts->ia.r_step_size = (ts->ia.r_max - ts->ia.r_min) / (real) ts->ia.r_steps;
+    ts->ia.mu_min = 150.0;
+    ts->ia.mu_max = 229.0;
+    ts->ia.mu_steps = N_MU;
+    ts->ia.mu_step_size = (ts->ia.mu_max - ts->ia.mu_min) / (real) ts->ia.mu_steps;
+    ts->ia.nu_min = -1.25;
+    ts->ia.nu_max = 1.25;
+    ts->ia.nu_steps = N_NU;
+    ts->ia.nu_step_size = (ts->ia.nu_max - ts->ia.nu_min) / (real) ts->ia.nu_steps;
+
+    /* The functions take the points split apart like the integration does */
+    r_pts = precalculateRPts(&ts->ap, &ts->ia, ts->sg, &ts->rc, FALSE);
+    ts->r_points = (real*) mwMallocA(R_STEPS * convolve * sizeof(real));
+    ts->qw_r3_N = (real*) mwMallocA(R_STEPS * convolve * sizeof(real));
+    for (i = 0; i < R_STEPS * (unsigned int) convolve; ++i)
+    {
+        ts->r_points[i] = r_pts[i].r_point;
+        ts->qw_r3_N[i] = r_pts[i].qw_r3_N;
+    }
+
+    mwFreeA(r_pts);
+
+    return 0;
+}
+
+static void setPathFlags(CLRequest* clr, ProbPath path)
+{
+    memset(clr, 0, sizeof(*clr));
+
+    switch (path)
+    {
+        case PATH_NONE:
+            clr->forceNoIntrinsics = TRUE;
+            break;
+        case PATH_X87:
+            clr->forceX87 = TRUE;
+            break;
+        case PATH_SSE2:
+            clr->forceSSE2 = TRUE;
+            break;
+        case PATH_SSE3:
+            clr->forceSSE3 = TRUE;
+            break;
+        case PATH_SSE41:
+            clr->forceSSE41 = TRUE;
+            break;
+        case PATH_AVX:
+            clr->forceAVX = TRUE;
+            break;
+        case PATH_AVX2:
+            clr->forceAVX2 = TRUE;
+            break;
+        case PATH_AVX512F:
+            clr->forceAVX512F = TRUE;
+            break;
+        default:
+            mw_panic("Invalid path %d\n", (int) path);
+    }
+}
+
+/* Fill out with the background and stream probabilities for every
+   point of the test area. Returns the time it took. */
+static double evaluateArea(const ProbTestState* ts, real* out, int iterations)
+{
+    unsigned int mu_step, nu_step, r_step;
+    int i, j, k;
+    unsigned int n = N_STREAMS + 1;
+    real streamTmps[N_STREAMS];
+    double t1, t2;
+    const AstronomyParameters* ap = &ts->ap;
+
+    t1 = mwGetTime();
+    for (k = 0; k < iterations; ++k)
+    {
+        j = 0;
+        for (nu_step = 0; nu_step < ts->ia.nu_steps; ++nu_step)
+        {
+            NuId nuid = calcNuStep(&ts->ia, nu_step);
+
+            for (mu_step = 0; mu_step < ts->ia.mu_steps; ++mu_step)
+            {
+                real mu = ts->ia.mu_min + (((real) mu_step + 0.5) * ts->ia.mu_step_size);
+                LBTrig lbt = lb_trig(gc2lb(ap->wedge, mu, nuid.nu));
+
+                for (r_step = 0; r_step < ts->ia.r_steps; ++r_step)
+                {
+                    out[j * n] = probabilityFunc(ap,
+                                                 ts->sc,
+                                                 ts->sg.dx,
+                                                 &ts->r_points[r_step * ap->convolve],
+                                                 &ts->qw_r3_N[r_step * ap->convolve],
+                                                 lbt,
+                                                 ts->rc[r_step].gPrime,
+                                                 nuid.id * ts->rc[r_step].irv_reff_xr_rp3,
+                                                 streamTmps);
+                    for (i = 0; i < N_STREAMS; ++i)
+                        out[j * n + i + 1] = streamTmps[i];
+                    ++j;
+                }
+            }
+        }
+    }
+    t2 = mwGetTime();
+
+    return t2 - t1;
+}
+
+static real relativeError(real a, real b)
+{
+    real mag = mw_fabs(a);
+    real d = mw_fabs(a - b);
+
+    return mag > 0.0 ? d / mag : d;
+}
+
+static int checkPath(const char* name, const real* expected, const real* actual, unsigned int n)
+{
+    unsigned int i;
+    real err, maxErr = 0.0;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (!isfinite(actual[i]))
+        {
+            mw_printf("  %s: got %.15g instead of %.15g at %u\n", name, actual[i], expected[i], i);
+            return 1;
+        }
+
+        err = relativeError(expected[i], actual[i]);
+        if (err > maxErr)
+            maxErr = err;
+    }
+
+    if (maxErr > PROB_TOLERANCE)
+    {
+        mw_printf("  %s: maximum relative error %g is over %g\n", name, maxErr, PROB_TOLERANCE);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int testProfile(const ProfileCase* pc, int convolve, int bench)
+{
+    ProbTestState ts;
+    CLRequest clr;
+    int path;
+    int failed = 0;
+    unsigned int n = N_MU * N_NU * R_STEPS * (N_STREAMS + 1);
+    real* expected;
+    real* actual;
+    double tPlain = 0.0, t;
+
+    if (setupProbTestState(&ts, pc, convolve))
+    {
+        mw_printf("Failed to set up test for %s\n", pc->name);
+        return 1;
+    }
+
+    expected = (real*) mwMalloc(n * sizeof(real));
+    actual = (real*) mwMalloc(n * sizeof(real));
+
+    for (path = 0; path < N_PATHS; ++path)
+    {
+        setPathFlags(&clr, (ProbPath) path);
+
+        /* Not available on this CPU, or not built */
+        if (probabilityFunctionDispatch(&ts.ap, &clr))
+            continue;
+
+        if (path == PATH_NONE)
+        {
+            evaluateArea(&ts, expected, 1);
+        }
+        else
+        {
+            evaluateArea(&ts, actual, 1);
+            if (checkPath(pathNames[path], expected, actual, n))
+            {
+                mw_printf("Failed %s path for %s with convolve = %d\n",
+                          pathNames[path], pc->name, convolve);
+                failed = 1;
+            }
+        }
+
+        if (bench)
+        {
+            t = evaluateArea(&ts, actual, N_BENCH_ITER);
+            if (path == PATH_NONE)
+                tPlain = t;
+
+            mw_printf("  %-22s %-9s %10.1f ns/call  %5.2fx\n",
+                      pc->name,
+                      pathNames[path],
+                      1.0e9 * t / ((double) N_BENCH_ITER * N_MU * N_NU * R_STEPS),
+                      tPlain / t);
+        }
+    }
+
+    free(expected);
+    free(actual);
+    freeProbTestState(&ts);
+
+    return failed;
+}
+
+int main(int argc, const char* argv[])
+{
+    /* The widest vectors don't evenly divide the smaller one */
+    static const int convolves[] = { 120, 30 };
+    int bench = (argc > 1 && !strcmp(argv[1], "--bench"));
+    unsigned int i, j;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(convolves) / sizeof(convolves[0]); ++i)
+    {
+        if (bench && i > 0)
+            break;
+
+        for (j = 0; j < N_PROFILES; ++j)
+        {
+            failed |= testProfile(&profileCases[j], convolves[i], bench);
+        }
+    }
+
+    return failed;
+}
+
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Write stars in the binary format and check they read back the same
+ * as the text file they came from, that binary files of the wrong
+ * precision or size are rejected and that text files are still read as
+ * text. */
+
+#include "milkyway_util.h"
+#include "separation_types.h"
+#include "star_points.h"
+
+#include <string.h>
+
+#define N_STARS 1000
+
+#define TEXT_FILE "star_points_test.txt"
+#define BINARY_FILE "star_points_test.bin"
+#define BAD_FILE "star_points_test_bad.bin"
+
+/* The real size follows the 8 byte magic and the version */
+#define REAL_SIZE_OFFSET 12
+
+static int writeTextStars(void)
+{
+    FILE* f;
+    unsigned int i;
+
+    f = fopen(TEXT_FILE, "w");
+    if (!f)
+    {
+        mwPerror("Opening '%s'", TEXT_FILE);
+        return 1;
+    }
+
+    fprintf(f, "%u\n", N_STARS);
+    for (i = 0; i < N_STARS; ++i)
+    {
+        double x = 160.0 + 50.0 * sin(0.37 * i);
+        double y = -30.0 + 10.0 * cos(1.3 * i);
+        double z = 2.0 + 0.041 * i;
+
+        fprintf(f, "%.17g %.17g %.17g\n", x, y, z);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static unsigned char* readWhole(const char* filename, size_t* size)
+{
+    FILE* f = fopen(filename, "rb");
+    unsigned char* buf;
+
+    if (!f)
+    {
+        mwPerror("Opening '%s'", filename);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = (size_t) ftell(f);
+    rewind(f);
+
+    buf = (unsigned char*) mwMalloc(*size);
+    if (fread(buf, 1, *size, f) != *size)
+    {
+        mwPerror("Reading '%s'", filename);
+        free(buf);
+        buf = NULL;
+    }
+
+    fclose(f);
+    return buf;
+}
+
+static int writeWhole(const char* filename, const unsigned char* buf, size_t size)
+{
+    FILE* f = fopen(filename, "wb");
+    int failed;
+
+    if (!f)
+    {
+        mwPerror("Opening '%s'", filename);
+        return 1;
+    }
+
+    failed = fwrite(buf, 1, size, f) != size;
+    fclose(f);
+    return failed;
+}
+
+/* The binary file has exactly the stars of the text parse */
+static int checkRoundTrip(void)
+{
+    StarPoints text = EMPTY_STAR_POINTS;
+    StarPoints binary = EMPTY_STAR_POINTS;
+    int failed = 0;
+
+    if (readStarPoints(&text, TEXT_FILE))
+    {
+        mw_printf("Failed to read text stars\n");
+        freeStarPoints(&text);
+        return 1;
+    }
+
+    if (text.map || text.number_stars != N_STARS)
+    {
+        mw_printf("Text file read as %u stars, %s\n", text.number_stars, text.map ? "mapped" : "parsed");
+        failed = 1;
+    }
+
+    if (writeStarPointsBinary(&text, BINARY_FILE) || readStarPoints(&binary, BINARY_FILE))
+    {
+        mw_printf("Failed to write and read back binary stars\n");
+        freeStarPoints(&text);
+        freeStarPoints(&binary);
+        return 1;
+    }
+
+    if (   binary.number_stars != text.number_stars
+        || memcmp(binary.stars, text.stars, text.number_stars * sizeof(mwvector)))
+    {
+        mw_printf("Binary stars differ from the text ones\n");
+        failed = 1;
+    }
+
+    freeStarPoints(&text);
+    freeStarPoints(&binary);
+    return failed;
+}
+
+/* A copy of the binary file changed by f must not be read */
+static int checkRejected(const char* what, void (*change)(unsigned char*, size_t*))
+{
+    StarPoints sp = EMPTY_STAR_POINTS;
+    unsigned char* buf;
+    size_t size;
+    int failed = 0;
+
+    buf = readWhole(BINARY_FILE, &size);
+    if (!buf)
+        return 1;
+
+    change(buf, &size);
+    if (writeWhole(BAD_FILE, buf, size))
+    {
+        free(buf);
+        return 1;
+    }
+
+    if (readStarPoints(&sp, BAD_FILE) == 0)
+    {
+        mw_printf("Star points file with %s was accepted\n", what);
+        freeStarPoints(&sp);
+        failed = 1;
+    }
+
+    free(buf);
+    remove(BAD_FILE);
+    return failed;
+}
+
+static void otherRealSize(unsigned char* buf, size_t* size)
+{
+    uint32_t realSize = sizeof(real) == sizeof(double) ? sizeof(float) : sizeof(double);
+
+    (void) size;
+    memcpy(&buf[REAL_SIZE_OFFSET], &realSize, sizeof(realSize));
+}
+
+static void lastStarCut(unsigned char* buf, size_t* size)
+{
+    (void) buf;
+    *size -= sizeof(real);
+}
+
+static void headerCut(unsigned char* buf, size_t* size)
+{
+    (void) buf;
+    *size = 20;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    if (writeTextStars())
+        return 1;
+
+    failed |= checkRoundTrip();
+    failed |= checkRejected("the wrong real size", otherRealSize);
+    failed |= checkRejected("the last star cut short", lastStarCut);
+    failed |= checkRejected("the header cut short", headerCut);
+
+    remove(TEXT_FILE);
+    remove(BINARY_FILE);
+
+    return failed;
+}